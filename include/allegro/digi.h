@@ -28,13 +28,13 @@
 struct PACKFILE;       
 
 
-#define DIGI_VOICES           64       /* Theoretical maximums: */
+#define DIGI_VOICES           1024     /* Theoretical maximums: */
                                        /* actual drivers may not be */
                                        /* able to handle this many */
 
 typedef struct SAMPLE                  /* a sample */
 {
-   int bits;                           /* 8 or 16 */
+   int bits;                           /* 8 or 16, 4 for IMA ADPCM */
    int stereo;                         /* sample type flag */
    int freq;                           /* sample frequency */
    int priority;                       /* 0-255 */
@@ -144,6 +144,7 @@ AL_FUNC(SAMPLE *, load_wav, (AL_CONST char *filename));
 AL_FUNC(SAMPLE *, load_wav_pf, (struct PACKFILE *f));
 AL_FUNC(SAMPLE *, load_voc, (AL_CONST char *filename));
 AL_FUNC(SAMPLE *, load_voc_pf, (struct PACKFILE *f));
+AL_FUNC(SAMPLE *, load_streamed_sample, (AL_CONST char *filename));
 AL_FUNC(int, save_sample, (AL_CONST char *filename, SAMPLE *spl));
 AL_FUNC(SAMPLE *, create_sample, (int bits, int stereo, int freq, int len));
 AL_FUNC(void, destroy_sample, (SAMPLE *spl));
@@ -394,6 +394,8 @@ AL_FUNC(void, set_color_depth, (int depth));
 AL_FUNC(int, get_color_depth, (void));
 AL_FUNC(void, set_color_conversion, (int mode));
 AL_FUNC(int, get_color_conversion, (void));
+AL_FUNC(void, set_bitmap_alignment, (int align));
+AL_FUNC(int, get_bitmap_alignment, (void));
 AL_FUNC(void, request_refresh_rate, (int rate));
 AL_FUNC(int, get_refresh_rate, (void));
 AL_FUNC(int, set_gfx_mode, (int card, int w, int h, int v_w, int v_h));
@@ -414,6 +416,13 @@ AL_FUNC(void, add_clip_rect, (BITMAP *bitmap, int x1, int y_1, int x2, int y2));
 AL_FUNC(void, clear_bitmap, (BITMAP *bitmap));
 AL_FUNC(void, vsync, (void));
 
+AL_FUNC(int, enable_dirty_tracking, (BITMAP *bmp));
+AL_FUNC(void, disable_dirty_tracking, (BITMAP *bmp));
+AL_FUNC(void, mark_dirty_rect, (BITMAP *bmp, int x, int y, int w, int h));
+AL_FUNC(void, clear_dirty_rects, (BITMAP *bmp));
+AL_FUNC(int, get_dirty_rects, (BITMAP *bmp, int *rects, int max));
+AL_FUNC(int, blit_dirty_rects, (BITMAP *src, BITMAP *dest, int dest_x, int dest_y));
+
 
 
 #define SWITCH_NONE           0
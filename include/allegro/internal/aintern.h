@@ -98,6 +98,11 @@ AL_FUNC(void, _add_exit_func, (AL_METHOD(void, func, (void)), AL_CONST char *des
 AL_FUNC(void, _remove_exit_func, (AL_METHOD(void, func, (void))));
 
 
+/* pool of threads for splitting up CPU heavy work */
+AL_FUNC(int, _get_worker_count, (void));
+AL_FUNC(void, _run_worker_jobs, (AL_METHOD(void, proc, (void *arg, int job, int worker)), void *arg, int count));
+
+
 /* helper structure for talking to Unicode strings */
 typedef struct UTYPE_INFO
 {
@@ -173,9 +178,14 @@ typedef struct TIMER_QUEUE
    void *param;                        /* param for param_proc if used */
    long speed;                         /* timer speed */
    long counter;                       /* counts down to zero=blastoff */
+   unsigned long due;                  /* deadline on the timer clock */
+   int heap_pos;                       /* index in the deadline heap or -1 */
 } TIMER_QUEUE;
 
-AL_ARRAY(TIMER_QUEUE, _timer_queue);
+/* _timer_queue holds MAX_TIMERS entries, and grows on demand in
+ * multithreaded builds */
+AL_VAR(TIMER_QUEUE *, _timer_queue);
+AL_VAR(int, _timer_queue_size);
 
 AL_VAR(int, _timer_installed);
 
@@ -328,6 +338,13 @@ AL_FUNC(uintptr_t, _stub_bank_switch, (BITMAP *bmp, int lyne));
 AL_FUNC(void, _stub_unbank_switch, (BITMAP *bmp));
 AL_FUNC(void, _stub_bank_switch_end, (void));
 
+/* bank switcher of bitmaps with dirty rectangle tracking */
+AL_FUNC(uintptr_t, _dirty_write_bank, (BITMAP *bmp, int lyne));
+AL_FUNC(uintptr_t, _dirty_write_bank_asm, (BITMAP *bmp, int lyne));
+AL_FUNC(void, _dirty_mark_area, (BITMAP *bmp, int x1, int y1, int x2, int y2));
+AL_FUNC(void *, _dirty_suspend, (BITMAP *bmp));
+AL_FUNC(void, _dirty_resume, (BITMAP *bmp, void *tracker));
+
 #ifdef ALLEGRO_GFX_HAS_VGA
 
 AL_FUNC(uintptr_t, _x_bank_switch, (BITMAP *bmp, int lyne));
@@ -392,6 +409,16 @@ AL_VAR(int, _safe_gfx_mode_change);
    #endif
 #endif
 
+
+/* distance in bytes between the lines of a memory bitmap */
+AL_INLINE(int, _bitmap_pitch, (BITMAP *bmp),
+{
+   if (bmp->h > 1)
+      return bmp->line[1] - bmp->line[0];
+
+   return bmp->w * BYTES_PER_PIXEL(bitmap_color_depth(bmp));
+})
+
 AL_FUNC(int, _color_load_depth, (int depth, int hasalpha));
 
 AL_VAR(int, _color_conv);
@@ -467,6 +494,17 @@ AL_VAR(int, _blender_col_32);
 
 AL_VAR(int, _blender_alpha);
 
+/* span versions of the blenders, NULL when there is none (see cblend.c) */
+typedef struct BLENDER_SPAN
+{
+   AL_METHOD(void, blend, (void *dst, AL_CONST void *x, AL_CONST void *y, int w, int n, int masked));
+   AL_METHOD(void, lit, (void *dst, AL_CONST void *y, int w, int color, int n));
+} BLENDER_SPAN;
+
+AL_VAR(AL_CONST BLENDER_SPAN *, _blender_span15);
+AL_VAR(AL_CONST BLENDER_SPAN *, _blender_span16);
+AL_VAR(AL_CONST BLENDER_SPAN *, _blender_span32);
+
 AL_FUNC(unsigned long, _blender_black, (unsigned long x, unsigned long y, unsigned long n));
 
 #ifdef ALLEGRO_COLOR16
@@ -646,6 +684,69 @@ AL_FUNC(void, _linear_clear_to_color32, (BITMAP *bitmap, int color));
 
 #endif
 
+/* SSE2/AVX2 versions of the C drawing code. The kernels are compiled in
+ * whenever the compiler targets SSE2, and picked at runtime by checking
+ * cpu_capabilities, just like the MMX paths of the i386 asm code.
+ */
+#if (defined __GNUC__) && (defined __SSE2__) && !(defined ALLEGRO_DOS) && !(defined ALLEGRO_NO_SIMD) \
+    && ((defined ALLEGRO_NO_ASM) || !(defined ALLEGRO_I386))
+   #define ALLEGRO_SIMD_SSE2
+   #if (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9))
+      #define ALLEGRO_SIMD_AVX2
+      #define AL_AVX2_FUNC    __attribute__ ((target ("avx2")))
+   #endif
+#endif
+
+#ifdef ALLEGRO_SIMD_SSE2
+
+AL_FUNC(void, _simd_clear_line8, (void *dst, int w, int color));
+AL_FUNC(void, _simd_clear_line16, (void *dst, int w, int color));
+AL_FUNC(void, _simd_clear_line24, (void *dst, int w, int color));
+AL_FUNC(void, _simd_clear_line32, (void *dst, int w, int color));
+AL_FUNC(void, _simd_masked_line8, (void *dst, AL_CONST void *src, int w, unsigned long mask));
+AL_FUNC(void, _simd_masked_line16, (void *dst, AL_CONST void *src, int w, unsigned long mask));
+AL_FUNC(void, _simd_masked_line24, (void *dst, AL_CONST void *src, int w, unsigned long mask));
+AL_FUNC(void, _simd_masked_line32, (void *dst, AL_CONST void *src, int w, unsigned long mask));
+AL_FUNC(void, _simd_masked_flip_line8, (void *dst, AL_CONST void *src, int w, unsigned long mask));
+AL_FUNC(void, _simd_masked_flip_line16, (void *dst, AL_CONST void *src, int w, unsigned long mask));
+AL_FUNC(void, _simd_masked_flip_line24, (void *dst, AL_CONST void *src, int w, unsigned long mask));
+AL_FUNC(void, _simd_masked_flip_line32, (void *dst, AL_CONST void *src, int w, unsigned long mask));
+AL_FUNC(void, _simd_colorconv_line_16_to_32, (void *dst, AL_CONST void *src, int w));
+AL_FUNC(void, _simd_colorconv_line_8_to_32, (void *dst, AL_CONST void *src, int w, AL_CONST int *palette));
+
+/* sample formats for the mixing kernels */
+#define SIMD_MIX_16BIT              1     /* 16 bit source, else 8 bit */
+#define SIMD_MIX_STEREO             2     /* stereo source, else mono */
+#define SIMD_MIX_MONO_OUT           4     /* mono mixing buffer, else stereo */
+#define SIMD_MIX_HQ                 8     /* full precision 16 bit source */
+
+AL_FUNC(void, _simd_mix_samples, (int *buf, AL_CONST void *data, int format, long pos, long diff, int n, int lvol, int rvol));
+AL_FUNC(void, _simd_mix_samples_interp, (int *buf, AL_CONST void *data, int format, long pos, long diff, int n, int lvol, int rvol));
+AL_FUNC(void, _simd_mix_to_16bit, (void *dst, AL_CONST int *src, int n, int issigned));
+AL_FUNC(void, _simd_mix_to_8bit, (void *dst, AL_CONST int *src, int n, int issigned));
+AL_FUNC(void, _simd_mix_samples_sinc, (float *buf, AL_CONST void *data, int format, long pos, long diff, int n, AL_CONST float *bank, float lvol, float rvol));
+AL_FUNC(void, _simd_mix_from_float, (int *dst, AL_CONST float *src, int n));
+
+AL_FUNC(void, _seed_blender_span, (void));
+
+#ifdef ALLEGRO_COLOR16
+AL_VAR(AL_CONST BLENDER_SPAN, _blender_span_trans15);
+AL_VAR(AL_CONST BLENDER_SPAN, _blender_span_trans16);
+AL_VAR(AL_CONST BLENDER_SPAN, _blender_span_dissolve15);
+AL_VAR(AL_CONST BLENDER_SPAN, _blender_span_dissolve16);
+#endif
+
+#ifdef ALLEGRO_COLOR32
+AL_VAR(AL_CONST BLENDER_SPAN, _blender_span_trans32);
+AL_VAR(AL_CONST BLENDER_SPAN, _blender_span_add32);
+AL_VAR(AL_CONST BLENDER_SPAN, _blender_span_multiply32);
+AL_VAR(AL_CONST BLENDER_SPAN, _blender_span_screen32);
+AL_VAR(AL_CONST BLENDER_SPAN, _blender_span_dissolve32);
+AL_VAR(AL_CONST BLENDER_SPAN, _blender_span_alpha32);
+#endif
+
+#endif
+
 #ifdef ALLEGRO_GFX_HAS_VGA
 
 AL_FUNC(int,  _x_getpixel, (BITMAP *bmp, int x, int y));
@@ -1074,6 +1175,9 @@ AL_VAR(int, _digi_volume);
 AL_VAR(int, _midi_volume);
 AL_VAR(int, _sound_flip_pan); 
 AL_VAR(int, _sound_hq);
+AL_VAR(int, _sound_lod_volume);
+AL_VAR(int, _sound_lod_priority);
+AL_VAR(int, _sound_budget);
 AL_VAR(int, _sound_stereo);
 AL_VAR(int, _sound_bits);
 AL_VAR(int, _sound_freq);
@@ -1085,12 +1189,42 @@ AL_VAR(int, _sound_installed);
 AL_VAR(int, _sound_input_installed);
 
 AL_FUNC(int, _midi_allocate_voice, (int min, int max));
+AL_FUNC(int, _voice_set_fill, (int voice, AL_METHOD(int, fill, (void *buf, int len, void *param)), void *param, int len));
+
+/* streamed samples are marked by their param field */
+#define SAMPLE_STREAM_ID   AL_ID('S','S','T','R')
+
+AL_FUNC(int, _sample_stream_voice, (AL_CONST SAMPLE *spl));
+AL_FUNC(void, _sample_stream_init_voice, (AL_CONST SAMPLE *spl, int voice, int phys));
+AL_FUNC(void, _sample_stream_start_voice, (AL_CONST SAMPLE *spl, int phys));
+AL_FUNC(int, _sample_stream_get_position, (AL_CONST SAMPLE *spl, int pos));
+AL_FUNC(void, _sample_stream_set_position, (AL_CONST SAMPLE *spl, int phys, int pos));
+AL_FUNC(void, _sample_stream_set_playmode, (AL_CONST SAMPLE *spl, int phys, int playmode));
+AL_FUNC(void, _sample_stream_destroy, (SAMPLE *spl));
+
+/* samples with 4 bits hold IMA ADPCM data, in blocks of ADPCM_BLOCK_FRAMES
+ * frames. For each channel a block has a four byte header, with the
+ * starting predictor (little endian) and step index, followed by the codes
+ * of its frames, two to a byte with the low nibble first.
+ */
+#define ADPCM_BLOCK_SHIFT  8
+#define ADPCM_BLOCK_FRAMES (1<<ADPCM_BLOCK_SHIFT)
+#define ADPCM_CHANNEL_SIZE (4 + ADPCM_BLOCK_FRAMES/2)
+
+AL_FUNC(long, _sample_data_size, (int bits, int stereo, long len));
+AL_FUNC(void, _adpcm_decode_block, (signed short *dst, AL_CONST unsigned char *src, int channels));
+AL_FUNC(void, _adpcm_encode, (unsigned char *dst, AL_CONST signed short *src, int channels, long len));
+AL_FUNC(long, _adpcm_decode_wav, (signed short *dst, AL_CONST unsigned char *src, long size, int channels, int align, int spb, long len));
+AL_FUNC(void, _adpcm_lock_mem, (void));
 
 AL_VAR(volatile long, _midi_tick);
+AL_VAR(int, _midi_clocked);
+AL_FUNC(void, _midi_set_clock, (int clocked));
+AL_FUNC(int, _midi_clock, (long ticks));
 
 AL_FUNC(int, _digmid_find_patches, (char *dir, int dir_size, char *file, int size_of_file));
 
-#define VIRTUAL_VOICES  256
+#define VIRTUAL_VOICES  2048
 
 
 typedef struct          /* a virtual (as seen by the user) soundcard voice */
@@ -1116,17 +1250,32 @@ typedef struct          /* a physical (as used by hardware) soundcard voice */
    int freq;            /* current frequency (fixed point .12) */
    int dfreq;           /* frequency delta, for sweeps */
    int target_freq;     /* target frequency, for sweeps */
+   int priority;        /* priority of the virtual voice, for the mixer */
 } PHYS_VOICE;
 
 AL_ARRAY(PHYS_VOICE, _phys_voice);
 
 
 #define MIXER_DEF_SFX               8
-#define MIXER_MAX_SFX               64
+#define MIXER_MAX_SFX               1024
+
+/* fixed point precision of the mixer sample positions,
+ * must be <= (sizeof(int)*8)-24 */
+#define MIX_FIX_SHIFT               8
+
+/* size of the windowed sinc filter used by mixer quality 3: each output
+ * frame reads MIX_SINC_TAPS/2-1 source frames before its position and
+ * MIX_SINC_TAPS/2 after it, with one row of coefficients per phase */
+#define MIX_SINC_TAPS               16
+#define MIX_SINC_PHASE_BITS         8
+#define MIX_SINC_PHASES             (1<<MIX_SINC_PHASE_BITS)
 
 AL_FUNC(int,  _mixer_init, (int bufsize, int freq, int stereo, int is16bit, int *voices));
 AL_FUNC(void, _mixer_exit, (void));
 AL_FUNC(void, _mix_some_samples, (uintptr_t buf, unsigned short seg, int issigned));
+AL_FUNC(int,  _mixer_voices_active, (void));
+AL_FUNC(void, _mixer_set_idle, (int idle));
+AL_FUNC(void, _mixer_stats_underrun, (int recovered));
 AL_FUNC(void, _mixer_init_voice, (int voice, AL_CONST SAMPLE *sample));
 AL_FUNC(void, _mixer_release_voice, (int voice));
 AL_FUNC(void, _mixer_start_voice, (int voice));
@@ -1149,6 +1298,7 @@ AL_FUNC(void, _mixer_stop_pan_sweep, (int voice));
 AL_FUNC(void, _mixer_set_echo, (int voice, int strength, int delay));
 AL_FUNC(void, _mixer_set_tremolo, (int voice, int rate, int depth));
 AL_FUNC(void, _mixer_set_vibrato, (int voice, int rate, int depth));
+AL_FUNC(void, _mixer_set_fill, (int voice, AL_METHOD(int, fill, (void *buf, int len, void *param)), void *param, int len));
 
 AL_FUNC(void, _dummy_noop1, (int p));
 AL_FUNC(void, _dummy_noop2, (int p1, int p2));
@@ -1221,6 +1371,8 @@ struct _AL_LINKER_MIDI
 {
    AL_METHOD(int, init, (void));
    AL_METHOD(void, exit, (void));
+   AL_METHOD(void, compile, (MIDI *midi));
+   AL_METHOD(void, forget, (MIDI *midi));
 };
 
 AL_VAR(struct _AL_LINKER_MIDI *, _al_linker_midi);
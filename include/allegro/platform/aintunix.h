@@ -59,6 +59,11 @@ extern "C" {
    AL_FUNC(void, _unix_rest, (unsigned int, AL_METHOD(void, callback, (void))));
 
 
+   /* Microsecond clock and sleep for the timer drivers */
+   AL_FUNC(unsigned long, _unix_read_usec, (void));
+   AL_FUNC(void, _unix_rest_usec, (unsigned long usecs));
+
+
    /* Module support */
    AL_FUNC(void, _unix_load_modules, (int system_driver_id));
    AL_FUNC(void, _unix_unload_modules, (void));
@@ -167,8 +172,18 @@ extern "C" {
  */
 typedef void (*bg_func) (int threaded);
 
+/* Period, in microseconds, of functions installed with register_func(). */
+#define BG_DEFAULT_PERIOD  10000
+
+/* Conditions on the file descriptor passed to register_func_ex(). */
+#define BG_FUNC_READ       1
+#define BG_FUNC_WRITE      2
+
 /* Background function manager -- responsible for calling background 
- * functions.  `int' methods return -1 on failure, 0 on success. */
+ * functions.  `int' methods return -1 on failure, 0 on success.
+ * register_func_ex() calls `f' every `period' microseconds (never if 0),
+ * and also as soon as `fd' (ignored if -1) is ready for `fd_events'.
+ * Managers that can't wait on descriptors treat it like register_func(). */
 struct bg_manager
 {
    int multi_threaded;
@@ -179,6 +194,7 @@ struct bg_manager
    void (*enable_interrupts) (void);
    void (*disable_interrupts) (void);
    int (*interrupts_disabled) (void);
+   int (*register_func_ex) (bg_func f, int period, int fd, int fd_events);
 };	
 
 extern struct bg_manager _bg_man_pthreads;
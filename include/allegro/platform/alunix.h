@@ -69,6 +69,7 @@ AL_VAR(TIMER_DRIVER, timerdrv_unix_sigalrm);
 #define DIGI_ALSA             AL_ID('A','L','S','A')
 #define MIDI_ALSA             AL_ID('A','M','I','D')
 #define DIGI_JACK             AL_ID('J','A','C','K')
+#define DIGI_WAV              AL_ID('W','A','V','F')
 
 
 #ifdef ALLEGRO_WITH_OSSDIGI
@@ -123,6 +124,12 @@ AL_VAR(DIGI_DRIVER, digi_jack);
       {  DIGI_JACK,       &digi_jack,           TRUE  },
 #endif /* ALLEGRO_WITH_JACKDIGI */
 
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+AL_VAR(DIGI_DRIVER, digi_wav);
+#define DIGI_DRIVER_WAV                                          \
+      {  DIGI_WAV,        &digi_wav,            FALSE },
+#endif
+
 #endif
 
 
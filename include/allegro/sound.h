@@ -28,6 +28,21 @@
    extern "C" {
 #endif
 
+typedef struct MIXER_STATS
+{
+   int buffers;               /* buffers mixed */
+   int usec;                  /* time taken by the last buffer */
+   int max_usec;              /* longest time since the last call */
+   int avg_usec;              /* average time over all the buffers */
+   int voices;                /* voices mixed into the last buffer */
+   int silent_voices;         /* voices playing but left out of it */
+   int underruns;             /* times the device ran out of data */
+   int recoveries;            /* underruns the driver recovered from */
+   int clipped;               /* output values which had to be clipped */
+   int peak_left;             /* loudest values since the last call, */
+   int peak_right;            /* where 32768 is full scale */
+} MIXER_STATS;
+
 AL_FUNC(void, reserve_voices, (int digi_voices, int midi_voices));
 AL_FUNC(void, set_volume_per_voice, (int scale));
 
@@ -45,6 +60,10 @@ AL_FUNC(void, get_hardware_volume, (int *digi_volume, int *midi_volume));
 
 AL_FUNC(void, set_mixer_quality, (int quality));
 AL_FUNC(int, get_mixer_quality, (void));
+AL_FUNC(void, set_mixer_lod, (int volume, int priority));
+AL_FUNC(void, set_mixer_budget, (int percent));
+AL_FUNC(void, set_mixer_stats, (int enable));
+AL_FUNC(int, get_mixer_stats, (MIXER_STATS *stats));
 AL_FUNC(int, get_mixer_frequency, (void));
 AL_FUNC(int, get_mixer_bits, (void));
 AL_FUNC(int, get_mixer_channels, (void));
@@ -36,9 +36,12 @@ typedef struct AUDIOSTREAM
    int bufnum;                         /* current refill buffer */
    int active;                         /* which half is currently playing */
    void *locked;                       /* the locked buffer */
+   AL_METHOD(void, callback, (void *buf, int len, void *param));
+   void *param;                        /* user data for the callback */
 } AUDIOSTREAM;
 
 AL_FUNC(AUDIOSTREAM *, play_audio_stream, (int len, int bits, int stereo, int freq, int vol, int pan));
+AL_FUNC(AUDIOSTREAM *, play_audio_stream_callback, (int len, int bits, int stereo, int freq, int vol, int pan, AL_METHOD(void, callback, (void *buf, int len, void *param)), void *param));
 AL_FUNC(void, stop_audio_stream, (AUDIOSTREAM *stream));
 AL_FUNC(void *, get_audio_stream_buffer, (AUDIOSTREAM *stream));
 AL_FUNC(void, free_audio_stream_buffer, (AUDIOSTREAM *stream));
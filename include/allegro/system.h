@@ -110,6 +110,7 @@ AL_FUNC(void, check_cpu, (void));
 #define CPU_AMD64    0x0200
 #define CPU_IA64     0x0400
 #define CPU_SSE3     0x0800
+#define CPU_AVX2     0x1000
 
 /* CPU families - PC */
 #define CPU_FAMILY_UNKNOWN  0
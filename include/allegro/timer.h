@@ -46,9 +46,22 @@ typedef struct TIMER_DRIVER
    AL_METHOD(int,  can_simulate_retrace, (void));
    AL_METHOD(void, simulate_retrace, (int enable));
    AL_METHOD(void, rest, (unsigned int tyme, AL_METHOD(void, callback, (void))));
+   AL_METHOD(unsigned long, read_usec, (void));
+   AL_METHOD(void, rest_usec, (unsigned long usecs));
 } TIMER_DRIVER;
 
 
+typedef struct FRAME_STATS
+{
+   int frames;                      /* calls to wait_for_next_frame() */
+   int late;                        /* frames that started past their time */
+   int missed;                      /* frame periods skipped entirely */
+   long overshoot_avg;              /* usecs past the frame time, average */
+   long overshoot_max;              /* usecs past the frame time, worst */
+   long spin_avg;                   /* usecs spent spinning, average */
+} FRAME_STATS;
+
+
 AL_VAR(TIMER_DRIVER *, timer_driver);
 AL_ARRAY(_DRIVER_INFO, _timer_driver_list);
 
@@ -68,6 +81,11 @@ AL_VAR(volatile int, retrace_count);
 AL_FUNC(void, rest, (unsigned int tyme));
 AL_FUNC(void, rest_callback, (unsigned int tyme, AL_METHOD(void, callback, (void))));
 
+AL_FUNC(int, set_frame_period, (long speed));
+AL_FUNC(int, wait_for_next_frame, (void));
+AL_FUNC(void, get_frame_stats, (FRAME_STATS *stats));
+AL_FUNC(void, reset_frame_stats, (void));
+
 #ifdef __cplusplus
    }
 #endif
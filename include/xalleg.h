@@ -165,6 +165,7 @@ AL_FUNCPTR (void, _xwin_input_handler, (void));
 AL_FUNCPTR (void, _xwin_keyboard_callback, (int, int));
 
 AL_FUNC(void, xwin_set_window_name, (AL_CONST char *name, AL_CONST char *group));
+AL_FUNC(int, xwin_get_frames_in_flight, (void));
 
 
 
@@ -0,0 +1,249 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      IMA ADPCM sample compression.
+ *
+ *      Samples with 4 bits hold IMA ADPCM codes in blocks of
+ *      ADPCM_BLOCK_FRAMES frames, see aintern.h. Every block starts from
+ *      the predictor state stored in its header, so the mixer can decode
+ *      any block on its own when a voice loops or seeks.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+
+#include "allegro.h"
+#include "allegro/internal/aintern.h"
+
+
+
+/* step index changes for each code */
+static AL_CONST signed char adpcm_index_table[16] =
+{
+   -1, -1, -1, -1, 2, 4, 6, 8,
+   -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+
+/* quantizer step sizes */
+static AL_CONST short adpcm_step_table[89] =
+{
+   7,     8,     9,     10,    11,    12,    13,    14,    16,    17,
+   19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+   50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+   130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+   337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+   876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+   2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+   5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
+   15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+
+
+/* adpcm_decode_code:
+ *  Applies one code to the predictor state, and returns the new value.
+ */
+static INLINE int adpcm_decode_code(int *pred, int *index, int code)
+{
+   int step = adpcm_step_table[*index];
+   int diff = step >> 3;
+
+   if (code & 1)
+      diff += step >> 2;
+   if (code & 2)
+      diff += step >> 1;
+   if (code & 4)
+      diff += step;
+
+   if (code & 8)
+      *pred = MAX(*pred - diff, -0x8000);
+   else
+      *pred = MIN(*pred + diff, 0x7FFF);
+
+   *index = MID(0, *index + adpcm_index_table[code], 88);
+
+   return *pred;
+}
+
+
+
+/* adpcm_read_header:
+ *  Reads the predictor state from a block header. The step index is
+ *  clamped, so that uninitialised data can't make the decoder read past
+ *  the step table.
+ */
+static INLINE void adpcm_read_header(AL_CONST unsigned char *p, int *pred, int *index)
+{
+   *pred = (signed short)(p[0] | (p[1] << 8));
+   *index = MID(0, p[2], 88);
+}
+
+
+
+/* _adpcm_decode_block:
+ *  Decodes the block at src into ADPCM_BLOCK_FRAMES frames of interleaved
+ *  signed 16 bit values. Called by the mixer.
+ */
+void _adpcm_decode_block(signed short *dst, AL_CONST unsigned char *src, int channels)
+{
+   AL_CONST unsigned char *p;
+   int pred, index;
+   int ch, i;
+
+   for (ch=0; ch<channels; ch++) {
+      p = src + ch*ADPCM_CHANNEL_SIZE;
+      adpcm_read_header(p, &pred, &index);
+      p += 4;
+
+      for (i=0; i<ADPCM_BLOCK_FRAMES; i+=2, p++) {
+	 dst[i*channels+ch] = adpcm_decode_code(&pred, &index, *p & 15);
+	 dst[(i+1)*channels+ch] = adpcm_decode_code(&pred, &index, *p >> 4);
+      }
+   }
+}
+
+END_OF_FUNCTION(_adpcm_decode_block);
+
+
+
+/* adpcm_encode_value:
+ *  Picks the code which brings the predictor closest to v, and applies it.
+ */
+static int adpcm_encode_value(int *pred, int *index, int v)
+{
+   int step = adpcm_step_table[*index];
+   int diff = v - *pred;
+   int code = 0;
+
+   if (diff < 0) {
+      code = 8;
+      diff = -diff;
+   }
+
+   if (diff >= step) {
+      code |= 4;
+      diff -= step;
+   }
+   step >>= 1;
+
+   if (diff >= step) {
+      code |= 2;
+      diff -= step;
+   }
+   step >>= 1;
+
+   if (diff >= step)
+      code |= 1;
+
+   adpcm_decode_code(pred, index, code);
+
+   return code;
+}
+
+
+
+/* _adpcm_encode:
+ *  Compresses len frames of interleaved signed 16 bit values into the
+ *  blocks at dst, which must have room for _sample_data_size() bytes. The
+ *  predictor state carries on from one block to the next, and the end of
+ *  the last block is padded with silence.
+ */
+void _adpcm_encode(unsigned char *dst, AL_CONST signed short *src, int channels, long len)
+{
+   int pred[2] = { 0, 0 };
+   int index[2] = { 0, 0 };
+   unsigned char *p;
+   long pos, i;
+   int ch, lo, hi;
+
+   for (pos=0; pos<len; pos+=ADPCM_BLOCK_FRAMES) {
+      for (ch=0; ch<channels; ch++) {
+	 p = dst + ch*ADPCM_CHANNEL_SIZE;
+
+	 p[0] = pred[ch] & 0xFF;
+	 p[1] = (pred[ch] >> 8) & 0xFF;
+	 p[2] = index[ch];
+	 p[3] = 0;
+	 p += 4;
+
+	 for (i=pos; i<pos+ADPCM_BLOCK_FRAMES; i+=2) {
+	    lo = adpcm_encode_value(&pred[ch], &index[ch], (i < len) ? src[i*channels+ch] : 0);
+	    hi = adpcm_encode_value(&pred[ch], &index[ch], (i+1 < len) ? src[(i+1)*channels+ch] : 0);
+	    *(p++) = lo | (hi << 4);
+	 }
+      }
+
+      dst += ADPCM_CHANNEL_SIZE * channels;
+   }
+}
+
+
+
+/* _adpcm_decode_wav:
+ *  Decodes the data chunk of an IMA ADPCM WAV file, which holds blocks of
+ *  align bytes with up to spb frames each, into at most len frames of
+ *  interleaved signed 16 bit values. In these blocks the header value is
+ *  the first frame, and the codes of the channels take turns in groups of
+ *  eight. Returns the number of frames decoded.
+ */
+long _adpcm_decode_wav(signed short *dst, AL_CONST unsigned char *src, long size, int channels, int align, int spb, long len)
+{
+   AL_CONST unsigned char *p;
+   int pred[2], index[2];
+   long done = 0;
+   int block, n, ch, i, j;
+
+   while ((done < len) && (size > 4*channels)) {
+      block = MIN(size, align);
+
+      /* only whole groups of codes count */
+      n = 1 + (block - 4*channels) / (4*channels) * 8;
+      n = MIN(n, spb);
+      n = MIN(n, len - done);
+
+      for (ch=0; ch<channels; ch++) {
+	 adpcm_read_header(src + ch*4, &pred[ch], &index[ch]);
+	 dst[ch] = pred[ch];
+      }
+
+      p = src + 4*channels;
+
+      for (i=1; i<n; i+=8) {
+	 for (ch=0; ch<channels; ch++) {
+	    for (j=0; j<8; j++) {
+	       int v = adpcm_decode_code(&pred[ch], &index[ch], (p[j>>1] >> ((j&1)*4)) & 15);
+	       if (i+j < n)
+		  dst[(i+j)*channels+ch] = v;
+	    }
+	    p += 4;
+	 }
+      }
+
+      dst += n * channels;
+      done += n;
+      src += block;
+      size -= block;
+   }
+
+   return done;
+}
+
+
+
+/* _adpcm_lock_mem:
+ *  Locks the decoder, which runs inside the mixer.
+ */
+void _adpcm_lock_mem(void)
+{
+   LOCK_VARIABLE(adpcm_index_table);
+   LOCK_VARIABLE(adpcm_step_table);
+   LOCK_FUNCTION(_adpcm_decode_block);
+}
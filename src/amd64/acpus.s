@@ -113,6 +113,7 @@ FUNC(_i_get_cpuid_info)
 
    /* rdi contains the first argument */
    movl %edi, %eax               /* eax = cpuid_levels */
+   xorl %ecx, %ecx               /* ecx = sub-level 0 */
 
    .byte 0x0F, 0xA2              /* cpuid instruction */
 
@@ -128,3 +129,17 @@ FUNC(_i_get_cpuid_info)
    popq %rbp
    ret
 
+
+
+
+/* uint32_t _i_get_xcr0();
+ *  Reads the low half of XCR0, which tells us what register state the OS
+ *  saves on context switches. Only valid if cpuid reports OSXSAVE.
+ */
+FUNC(_i_get_xcr0)
+   xorl %ecx, %ecx               /* ecx = XCR0 */
+
+   .byte 0x0F, 0x01, 0xD0        /* xgetbv instruction */
+
+   ret
+
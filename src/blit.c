@@ -733,8 +733,10 @@ void blit(BITMAP *src, BITMAP *dest, int s_x, int s_y, int d_x, int d_y, int w,
    }
    else {
       /* drawing onto memory bitmaps */
-      if ((is_video_bitmap(src)) || (is_system_bitmap(src)))
+      if ((is_video_bitmap(src)) || (is_system_bitmap(src))) {
          src->vtable->blit_to_memory(src, dest, s_x, s_y, d_x, d_y, w, h);
+         mark_dirty_rect(dest, d_x, d_y, w, h);
+      }
       else
          dest->vtable->blit_to_self(src, dest, s_x, s_y, d_x, d_y, w, h);
    }
@@ -0,0 +1,362 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      SSE2 span versions of the truecolor blender functions.
+ *
+ *      These blend a whole run of pixels at a time for the C sprite and
+ *      scanline drawers. The trans, add, multiply, screen and alpha spans
+ *      give exactly the same results as the per pixel functions in
+ *      colblend.c, which also finish the odd pixels at the end of a run.
+ *      set_*_blender() decides which of these tables are usable.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+
+#include "allegro.h"
+#include "allegro/internal/aintern.h"
+
+#ifdef ALLEGRO_SIMD_SSE2
+
+#include <emmintrin.h>
+
+
+
+/* The scalar blenders all boil down to y + floor((x - y) * n / 2^k) for
+ * each channel. That is the same as (x * n + y * (2^k - n)) >> k, which
+ * never overflows an unsigned 16 bit lane, so the channels are blended
+ * in 16 bit lanes with no loss of precision.
+ */
+static INLINE __m128i lerp(__m128i x, __m128i y, __m128i n, __m128i one, int k)
+{
+   __m128i m = _mm_sub_epi16(_mm_slli_epi16(one, k), n);
+
+   return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(x, n), _mm_mullo_epi16(y, m)), k);
+}
+
+
+
+/* trans_alpha:
+ *  Converts blender alphas to the n+1 form used by _blender_trans24().
+ */
+static INLINE __m128i trans_alpha(__m128i n, __m128i one)
+{
+   return _mm_add_epi16(_mm_add_epi16(n, one), _mm_cmpeq_epi16(n, _mm_setzero_si128()));
+}
+
+
+
+/* Applies a channel operation to both halves of a vector of 32 bit
+ * pixels, with the channels widened to 16 bits. The top byte of the
+ * result is cleared, like the 24 bit blenders do.
+ */
+#define CHANNELS32(x, y, n, op)                                              \
+   _mm_and_si128(_mm_packus_epi16(                                           \
+	 op(_mm_unpacklo_epi8((x), _mm_setzero_si128()),                     \
+	    _mm_unpacklo_epi8((y), _mm_setzero_si128()), (n)),               \
+	 op(_mm_unpackhi_epi8((x), _mm_setzero_si128()),                     \
+	    _mm_unpackhi_epi8((y), _mm_setzero_si128()), (n))),              \
+      _mm_set1_epi32(0xFFFFFF))
+
+
+
+/* trans_lerp:
+ *  The 8 bit version of lerp(), as done by _blender_trans24(). That adds
+ *  the whole destination pixel to the packed red and blue products, so
+ *  the low byte of the red product can carry in the destination green.
+ *  This quirk is reproduced to keep the results identical.
+ */
+static INLINE __m128i trans_lerp(__m128i x, __m128i y, __m128i n)
+{
+   __m128i m = _mm_sub_epi16(_mm_set1_epi16(256), n);
+   __m128i s = _mm_add_epi16(_mm_mullo_epi16(x, n), _mm_mullo_epi16(y, m));
+   __m128i c = _mm_add_epi16(_mm_and_si128(s, _mm_set1_epi16(0xFF)), _mm_slli_epi64(y, 16));
+
+   c = _mm_and_si128(_mm_srli_epi16(c, 8), _mm_set_epi16(0, 1, 0, 0, 0, 1, 0, 0));
+
+   return _mm_add_epi16(_mm_srli_epi16(s, 8), c);
+}
+
+
+
+static INLINE __m128i trans_channel(__m128i x, __m128i y, __m128i n)
+{
+   return trans_lerp(x, y, trans_alpha(n, _mm_set1_epi16(1)));
+}
+
+
+
+static INLINE __m128i add_channel(__m128i x, __m128i y, __m128i n)
+{
+   return _mm_add_epi16(y, _mm_srli_epi16(_mm_mullo_epi16(x, n), 8));
+}
+
+
+
+static INLINE __m128i multiply_channel(__m128i x, __m128i y, __m128i n)
+{
+   return trans_channel(_mm_srli_epi16(_mm_mullo_epi16(x, y), 8), y, n);
+}
+
+
+
+static INLINE __m128i screen_channel(__m128i x, __m128i y, __m128i n)
+{
+   __m128i c = _mm_set1_epi16(255);
+
+   x = _mm_mullo_epi16(_mm_sub_epi16(c, x), _mm_sub_epi16(c, y));
+
+   return trans_channel(_mm_sub_epi16(c, _mm_srli_epi16(x, 8)), y, n);
+}
+
+
+
+/* alpha_channel:
+ *  Like trans_channel(), but takes the alpha of each pixel from the top
+ *  byte of the source rather than from the blender.
+ */
+static INLINE __m128i alpha_channel(__m128i x, __m128i y, __m128i n)
+{
+   __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xFF), 0xFF);
+
+   return trans_lerp(x, y, trans_alpha(a, _mm_set1_epi16(1)));
+}
+
+
+
+static INLINE __m128i trans32(__m128i x, __m128i y, __m128i n, __m128i *state)
+{
+   return CHANNELS32(x, y, n, trans_channel);
+}
+
+static INLINE __m128i add32(__m128i x, __m128i y, __m128i n, __m128i *state)
+{
+   return CHANNELS32(x, y, n, add_channel);
+}
+
+static INLINE __m128i multiply32(__m128i x, __m128i y, __m128i n, __m128i *state)
+{
+   return CHANNELS32(x, y, n, multiply_channel);
+}
+
+static INLINE __m128i screen32(__m128i x, __m128i y, __m128i n, __m128i *state)
+{
+   return CHANNELS32(x, y, n, screen_channel);
+}
+
+static INLINE __m128i alpha32(__m128i x, __m128i y, __m128i n, __m128i *state)
+{
+   return CHANNELS32(x, y, n, alpha_channel);
+}
+
+
+
+/* trans_fields:
+ *  Blends 15 or 16 bit pixels field by field, at the 5 bit precision of
+ *  _blender_trans15() and _blender_trans16(). The middle field is blended
+ *  in place, the top one is shifted down first so it can't overflow.
+ */
+static INLINE __m128i trans_fields(__m128i x, __m128i y, __m128i n, int gmask, int rshift)
+{
+   __m128i one = _mm_set1_epi16(1);
+   __m128i bm = _mm_set1_epi16(0x1F);
+   __m128i gm = _mm_set1_epi16(gmask);
+   __m128i b, g, r;
+
+   n = _mm_srli_epi16(_mm_add_epi16(n, one), 3);
+
+   b = lerp(_mm_and_si128(x, bm), _mm_and_si128(y, bm), n, one, 5);
+   g = lerp(_mm_and_si128(x, gm), _mm_and_si128(y, gm), n, one, 5);
+   r = lerp(_mm_and_si128(_mm_srli_epi16(x, rshift), bm),
+	    _mm_and_si128(_mm_srli_epi16(y, rshift), bm), n, one, 5);
+
+   return _mm_or_si128(_mm_or_si128(b, _mm_and_si128(g, gm)), _mm_slli_epi16(r, rshift));
+}
+
+static INLINE __m128i trans15(__m128i x, __m128i y, __m128i n, __m128i *state)
+{
+   return trans_fields(x, y, n, 0x3E0, 10);
+}
+
+static INLINE __m128i trans16(__m128i x, __m128i y, __m128i n, __m128i *state)
+{
+   return trans_fields(x, y, n, 0x7E0, 11);
+}
+
+
+
+/* The dissolve blender only has to look random, so it uses a vector of
+ * xorshift generators instead of _al_rand(). Each 16 bit lane gives one
+ * random byte, which is enough for eight 16 bit or four 32 bit pixels.
+ * The generators start from the address of the span, so threads drawing
+ * different spans never share any state, and the same span always gets
+ * the same pattern until the blender is seeded again.
+ */
+static __m128i dissolve_key;
+
+static INLINE __m128i dissolve_seed(AL_CONST void *p)
+{
+   unsigned int a = (unsigned int)(uintptr_t)p;
+   __m128i s = _mm_set_epi32(a * 0x9E3779B1u, a * 0x85EBCA77u,
+			     a * 0xC2B2AE3Du, a * 0x27D4EB2Fu);
+
+   return _mm_or_si128(_mm_xor_si128(s, dissolve_key), _mm_set1_epi32(1));
+}
+
+static INLINE __m128i dissolve_mask(__m128i n, __m128i *state)
+{
+   __m128i t = _mm_sub_epi16(n, _mm_cmpeq_epi16(n, _mm_set1_epi16(255)));
+   __m128i s = *state;
+
+   s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+   s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+   s = _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+   *state = s;
+
+   return _mm_cmplt_epi16(_mm_srli_epi16(s, 8), t);
+}
+
+static INLINE __m128i dissolve16(__m128i x, __m128i y, __m128i n, __m128i *state)
+{
+   __m128i t = dissolve_mask(n, state);
+
+   return _mm_or_si128(_mm_and_si128(t, x), _mm_andnot_si128(t, y));
+}
+
+static INLINE __m128i dissolve32(__m128i x, __m128i y, __m128i n, __m128i *state)
+{
+   __m128i t = dissolve_mask(n, state);
+
+   t = _mm_shufflehi_epi16(_mm_shufflelo_epi16(t, 0xA0), 0xA0);
+
+   return _mm_or_si128(_mm_and_si128(t, x), _mm_andnot_si128(t, y));
+}
+
+
+
+/* _seed_blender_span:
+ *  Reseeds the dissolve generators from _al_rand(). This is only called
+ *  when the blender is selected, never while spans are being drawn.
+ */
+void _seed_blender_span(void)
+{
+   dissolve_key = _mm_set_epi32(_al_rand(), _al_rand(),
+				_al_rand(), _al_rand());
+}
+
+
+
+/* Generates the two entry points of a span blender:
+ *
+ *  blend: d[i] = blend(x[i], y[i], n), leaving d[i] alone where x[i] is
+ *         the mask color if masked is set.
+ *  lit:   d[i] = blend(color, y[i], n), leaving d[i] alone where y[i] is
+ *         the mask color.
+ *
+ * op blends a vector of pixels, with state holding the dissolve
+ * generators for the span, func is the scalar blender used for the last
+ * few pixels, rep replicates a color across a 32 bit lane.
+ */
+#define BLENDER_SPAN_SSE2(name, type, step, mask, rep, cmpeq, op, func)      \
+static void name##_blend(void *dst, AL_CONST void *xp, AL_CONST void *yp,    \
+			 int w, int n, int masked)                           \
+{                                                                            \
+   type *d = dst;                                                            \
+   AL_CONST type *x = xp;                                                    \
+   AL_CONST type *y = yp;                                                    \
+   __m128i vn = _mm_set1_epi16(n);                                           \
+   __m128i m = _mm_set1_epi32(rep(mask));                                    \
+   __m128i state = dissolve_seed(d);                                         \
+                                                                             \
+   for (; w >= step; w -= step, x += step, y += step, d += step) {           \
+      __m128i xv = _mm_loadu_si128((AL_CONST __m128i *)x);                   \
+      __m128i yv = _mm_loadu_si128((AL_CONST __m128i *)y);                   \
+      __m128i c = op(xv, yv, vn, &state);                                    \
+                                                                             \
+      if (masked) {                                                          \
+	 __m128i t = cmpeq(xv, m);                                           \
+	 int bits = _mm_movemask_epi8(t);                                    \
+									     \
+	 if (bits == 0xFFFF)                                                 \
+	    continue;                                                        \
+									     \
+	 if (bits) {                                                         \
+	    __m128i dv = _mm_loadu_si128((__m128i *)d);                      \
+	    c = _mm_or_si128(_mm_and_si128(t, dv), _mm_andnot_si128(t, c));  \
+	 }                                                                   \
+      }                                                                      \
+                                                                             \
+      _mm_storeu_si128((__m128i *)d, c);                                     \
+   }                                                                         \
+                                                                             \
+   for (; w > 0; w--, x++, y++, d++) {                                       \
+      if ((!masked) || (*x != (type)(mask)))                                 \
+	 *d = func(*x, *y, n);                                               \
+   }                                                                         \
+}                                                                            \
+                                                                             \
+static void name##_lit(void *dst, AL_CONST void *yp, int w, int color, int n)\
+{                                                                            \
+   type *d = dst;                                                            \
+   AL_CONST type *y = yp;                                                    \
+   __m128i vn = _mm_set1_epi16(n);                                           \
+   __m128i m = _mm_set1_epi32(rep(mask));                                    \
+   __m128i xv = _mm_set1_epi32(rep(color));                                  \
+   __m128i state = dissolve_seed(d);                                         \
+                                                                             \
+   for (; w >= step; w -= step, y += step, d += step) {                      \
+      __m128i yv = _mm_loadu_si128((AL_CONST __m128i *)y);                   \
+      __m128i t = cmpeq(yv, m);                                              \
+      __m128i c;                                                             \
+      int bits = _mm_movemask_epi8(t);                                       \
+                                                                             \
+      if (bits == 0xFFFF)                                                    \
+	 continue;                                                           \
+                                                                             \
+      c = op(xv, yv, vn, &state);                                            \
+                                                                             \
+      if (bits) {                                                            \
+	 __m128i dv = _mm_loadu_si128((__m128i *)d);                         \
+	 c = _mm_or_si128(_mm_and_si128(t, dv), _mm_andnot_si128(t, c));     \
+      }                                                                      \
+                                                                             \
+      _mm_storeu_si128((__m128i *)d, c);                                     \
+   }                                                                         \
+                                                                             \
+   for (; w > 0; w--, y++, d++) {                                            \
+      if (*y != (type)(mask))                                                \
+	 *d = func(color, *y, n);                                            \
+   }                                                                         \
+}                                                                            \
+                                                                             \
+AL_CONST BLENDER_SPAN name = { name##_blend, name##_lit }
+
+
+#define REP16(c)     (int)(((unsigned int)(c) & 0xFFFF) * 0x10001)
+#define REP32(c)     (int)(c)
+
+
+#ifdef ALLEGRO_COLOR16
+BLENDER_SPAN_SSE2(_blender_span_trans15, uint16_t, 8, MASK_COLOR_15, REP16, _mm_cmpeq_epi16, trans15, _blender_trans15);
+BLENDER_SPAN_SSE2(_blender_span_trans16, uint16_t, 8, MASK_COLOR_16, REP16, _mm_cmpeq_epi16, trans16, _blender_trans16);
+BLENDER_SPAN_SSE2(_blender_span_dissolve15, uint16_t, 8, MASK_COLOR_15, REP16, _mm_cmpeq_epi16, dissolve16, _blender_dissolve15);
+BLENDER_SPAN_SSE2(_blender_span_dissolve16, uint16_t, 8, MASK_COLOR_16, REP16, _mm_cmpeq_epi16, dissolve16, _blender_dissolve16);
+#endif
+
+#ifdef ALLEGRO_COLOR32
+BLENDER_SPAN_SSE2(_blender_span_trans32, uint32_t, 4, MASK_COLOR_32, REP32, _mm_cmpeq_epi32, trans32, _blender_trans24);
+BLENDER_SPAN_SSE2(_blender_span_add32, uint32_t, 4, MASK_COLOR_32, REP32, _mm_cmpeq_epi32, add32, _blender_add24);
+BLENDER_SPAN_SSE2(_blender_span_multiply32, uint32_t, 4, MASK_COLOR_32, REP32, _mm_cmpeq_epi32, multiply32, _blender_multiply24);
+BLENDER_SPAN_SSE2(_blender_span_screen32, uint32_t, 4, MASK_COLOR_32, REP32, _mm_cmpeq_epi32, screen32, _blender_screen24);
+BLENDER_SPAN_SSE2(_blender_span_dissolve32, uint32_t, 4, MASK_COLOR_32, REP32, _mm_cmpeq_epi32, dissolve32, _blender_dissolve24);
+BLENDER_SPAN_SSE2(_blender_span_alpha32, uint32_t, 4, MASK_COLOR_32, REP32, _mm_cmpeq_epi32, alpha32, _blender_alpha32);
+#endif
+
+#endif
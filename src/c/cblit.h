@@ -23,7 +23,9 @@
 /* Define USE_MEMMOVE to use libc's memmove command for doing blits.
  * This helps some machines, while it doesn't seem to do much for others.
  * Left as a define so the older blit version can be easily reactivated for
- * testing.
+ * testing. Modern libcs already pick an SSE2/AVX2 memmove at runtime, so
+ * plain blits have no separate SIMD path: only the masked blit and the
+ * clear do (see csimd.c).
  */
 #define USE_MEMMOVE
 
@@ -49,6 +51,18 @@ void FUNC_LINEAR_CLEAR_TO_COLOR(BITMAP *dst, int color)
 
    bmp_select(dst);
 
+#ifdef ALLEGRO_SIMD_SSE2
+   if (cpu_capabilities & CPU_SSE2) {
+      for (y = dst->ct; y < dst->cb; y++) {
+	 PIXEL_PTR d = OFFSET_PIXEL_PTR(bmp_write_line(dst, y), dst->cl);
+	 FUNC_SIMD_CLEAR_LINE(d, w, color);
+      }
+
+      bmp_unwrite_line(dst);
+      return;
+   }
+#endif
+
    for (y = dst->ct; y < dst->cb; y++) {
       PIXEL_PTR d = OFFSET_PIXEL_PTR(bmp_write_line(dst, y), dst->cl);
 
@@ -159,6 +173,20 @@ void FUNC_LINEAR_MASKED_BLIT(BITMAP *src, BITMAP *dst, int sx, int sy,
 
    mask_color = bitmap_mask_color(dst);
 
+#ifdef ALLEGRO_SIMD_SSE2
+   if (cpu_capabilities & CPU_SSE2) {
+      for (y = 0; y < h; y++) {
+	 PIXEL_PTR s = OFFSET_PIXEL_PTR(bmp_read_line(src, sy + y), sx);
+	 PIXEL_PTR d = OFFSET_PIXEL_PTR(bmp_write_line(dst, dy + y), dx);
+	 FUNC_SIMD_MASKED_LINE(d, s, w, mask_color);
+      }
+
+      bmp_unwrite_line(src);
+      bmp_unwrite_line(dst);
+      return;
+   }
+#endif
+
    for (y = 0; y < h; y++) {
       PIXEL_PTR s = OFFSET_PIXEL_PTR(bmp_read_line(src, sy + y), sx);
       PIXEL_PTR d = OFFSET_PIXEL_PTR(bmp_write_line(dst, dy + y), dx);
@@ -20,6 +20,7 @@
 
 #ifdef ALLEGRO_COLOR16
 
+#include "allegro/internal/aintern.h"
 #include "cdefs16.h"
 #include "cblit.h"
 
@@ -20,6 +20,7 @@
 
 #ifdef ALLEGRO_COLOR24
 
+#include "allegro/internal/aintern.h"
 #include "cdefs24.h"
 #include "cblit.h"
 
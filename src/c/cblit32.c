@@ -20,6 +20,7 @@
 
 #ifdef ALLEGRO_COLOR32
 
+#include "allegro/internal/aintern.h"
 #include "cdefs32.h"
 #include "cblit.h"
 
@@ -20,6 +20,7 @@
 
 #ifdef ALLEGRO_COLOR8
 
+#include "allegro/internal/aintern.h"
 #include "cdefs8.h"
 #include "cblit.h"
 
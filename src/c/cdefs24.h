@@ -73,6 +73,10 @@
 #define FUNC_LINEAR_BLIT_BACKWARD           _linear_blit_backward24
 #define FUNC_LINEAR_MASKED_BLIT             _linear_masked_blit24
 
+#define FUNC_SIMD_CLEAR_LINE                _simd_clear_line24
+#define FUNC_SIMD_MASKED_LINE               _simd_masked_line24
+#define FUNC_SIMD_MASKED_FLIP_LINE          _simd_masked_flip_line24
+
 #define FUNC_LINEAR_PUTPIXEL                _linear_putpixel24
 #define FUNC_LINEAR_GETPIXEL                _linear_getpixel24
 #define FUNC_LINEAR_HLINE                   _linear_hline24
@@ -56,6 +56,11 @@
 #define PS_BLEND(b,o,c)        ((*(b))((c), _blender_col_32, (o)))
 #define PS_ALPHA_BLEND(b,o,c)  ((*(b))((o), (c), _blender_alpha))
 
+/* SIMD span versions of the above blenders.  */
+#define MAKE_SPAN_BLENDER()    _blender_span32
+#define SPAN_BLENDER_COL       _blender_col_32
+#define SPAN_PIXEL             uint32_t
+
 #define PATTERN_LINE(y)        (PIXEL_PTR) (_drawing_pattern->line[((y) - _drawing_y_anchor) \
 								   & _drawing_y_mask])
 #define GET_PATTERN_PIXEL(x,y) GET_MEMORY_PIXEL(OFFSET_PIXEL_PTR(PATTERN_LINE(y), \
@@ -69,6 +74,10 @@
 #define FUNC_LINEAR_BLIT_BACKWARD           _linear_blit_backward32
 #define FUNC_LINEAR_MASKED_BLIT             _linear_masked_blit32
 
+#define FUNC_SIMD_CLEAR_LINE                _simd_clear_line32
+#define FUNC_SIMD_MASKED_LINE               _simd_masked_line32
+#define FUNC_SIMD_MASKED_FLIP_LINE          _simd_masked_flip_line32
+
 #define FUNC_LINEAR_PUTPIXEL                _linear_putpixel32
 #define FUNC_LINEAR_GETPIXEL                _linear_getpixel32
 #define FUNC_LINEAR_HLINE                   _linear_hline32
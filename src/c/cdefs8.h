@@ -68,6 +68,10 @@
 #define FUNC_LINEAR_BLIT_BACKWARD           _linear_blit_backward8
 #define FUNC_LINEAR_MASKED_BLIT             _linear_masked_blit8
 
+#define FUNC_SIMD_CLEAR_LINE                _simd_clear_line8
+#define FUNC_SIMD_MASKED_LINE               _simd_masked_line8
+#define FUNC_SIMD_MASKED_FLIP_LINE          _simd_masked_flip_line8
+
 #define FUNC_LINEAR_PUTPIXEL                _linear_putpixel8
 #define FUNC_LINEAR_GETPIXEL                _linear_getpixel8
 #define FUNC_LINEAR_HLINE                   _linear_hline8
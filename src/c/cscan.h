@@ -21,6 +21,9 @@
 #ifndef __bma_cscan_h
 #define __bma_cscan_h
 
+/* how many texels the trans fillers gather before blending them */
+#define SCAN_SPAN_SIZE     64
+
 #ifdef _bma_scan_gcol
 
 /* _poly_scanline_gcol:
@@ -538,6 +541,33 @@ void FUNC_POLY_SCANLINE_ATEX_TRANS(uintptr_t addr, int w, POLYGON_SEGMENT *info)
    d = (PIXEL_PTR) addr;
    r = (PIXEL_PTR) info->read_addr;
 
+#if (defined ALLEGRO_SIMD_SSE2) && (defined MAKE_SPAN_BLENDER)
+   if ((MAKE_SPAN_BLENDER()) && (cpu_capabilities & CPU_SSE2) &&
+       ((unsigned int)_blender_alpha < 256)) {
+      AL_CONST BLENDER_SPAN *span = MAKE_SPAN_BLENDER();
+      SPAN_PIXEL buf[SCAN_SPAN_SIZE];
+
+      while (w > 0) {
+	 int n = MIN(w, SCAN_SPAN_SIZE);
+	 PIXEL_PTR t = buf;
+
+	 for (x = n - 1; x >= 0; INC_PIXEL_PTR(t), x--) {
+	    PIXEL_PTR s = OFFSET_PIXEL_PTR(texture, ((v >> vshift) & vmask) + ((u >> 16) & umask));
+	    PUT_MEMORY_PIXEL(t, GET_MEMORY_PIXEL(s));
+	    u += du;
+	    v += dv;
+	 }
+
+	 span->blend(d, buf, r, n, _blender_alpha, FALSE);
+	 d = OFFSET_PIXEL_PTR(d, n);
+	 r = OFFSET_PIXEL_PTR(r, n);
+	 w -= n;
+      }
+
+      return;
+   }
+#endif
+
    for (x = w - 1; x >= 0; INC_PIXEL_PTR(d), INC_PIXEL_PTR(r), x--) {
       PIXEL_PTR s = OFFSET_PIXEL_PTR(texture, ((v >> vshift) & vmask) + ((u >> 16) & umask));
       unsigned long color = GET_MEMORY_PIXEL(s);
@@ -579,6 +609,33 @@ void FUNC_POLY_SCANLINE_ATEX_MASK_TRANS(uintptr_t addr, int w, POLYGON_SEGMENT *
    d = (PIXEL_PTR) addr;
    r = (PIXEL_PTR) info->read_addr;
 
+#if (defined ALLEGRO_SIMD_SSE2) && (defined MAKE_SPAN_BLENDER)
+   if ((MAKE_SPAN_BLENDER()) && (cpu_capabilities & CPU_SSE2) &&
+       ((unsigned int)_blender_alpha < 256)) {
+      AL_CONST BLENDER_SPAN *span = MAKE_SPAN_BLENDER();
+      SPAN_PIXEL buf[SCAN_SPAN_SIZE];
+
+      while (w > 0) {
+	 int n = MIN(w, SCAN_SPAN_SIZE);
+	 PIXEL_PTR t = buf;
+
+	 for (x = n - 1; x >= 0; INC_PIXEL_PTR(t), x--) {
+	    PIXEL_PTR s = OFFSET_PIXEL_PTR(texture, ((v >> vshift) & vmask) + ((u >> 16) & umask));
+	    PUT_MEMORY_PIXEL(t, GET_MEMORY_PIXEL(s));
+	    u += du;
+	    v += dv;
+	 }
+
+	 span->blend(d, buf, r, n, _blender_alpha, TRUE);
+	 d = OFFSET_PIXEL_PTR(d, n);
+	 r = OFFSET_PIXEL_PTR(r, n);
+	 w -= n;
+      }
+
+      return;
+   }
+#endif
+
    for (x = w - 1; x >= 0; INC_PIXEL_PTR(d), INC_PIXEL_PTR(r), x--) {
       PIXEL_PTR s = OFFSET_PIXEL_PTR(texture, ((v >> vshift) & vmask) + ((u >> 16) & umask));
       unsigned long color = GET_MEMORY_PIXEL(s);
@@ -632,6 +689,51 @@ void FUNC_POLY_SCANLINE_PTEX_TRANS(uintptr_t addr, int w, POLYGON_SEGMENT *info)
    fz += dfz;
    z1 = 1. / fz;
 
+#if (defined ALLEGRO_SIMD_SSE2) && (defined MAKE_SPAN_BLENDER)
+   if ((MAKE_SPAN_BLENDER()) && (cpu_capabilities & CPU_SSE2) &&
+       ((unsigned int)_blender_alpha < 256)) {
+      AL_CONST BLENDER_SPAN *span = MAKE_SPAN_BLENDER();
+      SPAN_PIXEL buf[SCAN_SPAN_SIZE];
+      PIXEL_PTR t = buf;
+      int n = 0;
+
+      for (x = w - 1; x >= 0; x-= 4) {
+	 long nextu, nextv, du, dv;
+
+	 fu += dfu;
+	 fv += dfv;
+	 fz += dfz;
+	 nextu = fu * z1;
+	 nextv = fv * z1;
+	 z1 = 1. / fz;
+	 du = (nextu - u) >> 2;
+	 dv = (nextv - v) >> 2;
+
+	 /* scanline subdivision */
+	 if (x < 3)
+	    imax = x;
+	 for (i = imax; i >= 0; i--, INC_PIXEL_PTR(t)) {
+	    PIXEL_PTR s = OFFSET_PIXEL_PTR(texture, ((v >> vshift) & vmask) + ((u >> 16) & umask));
+	    PUT_MEMORY_PIXEL(t, GET_MEMORY_PIXEL(s));
+	    u += du;
+	    v += dv;
+	 }
+
+	 /* blend whenever the buffer can't take another four texels */
+	 n += imax + 1;
+	 if ((n > SCAN_SPAN_SIZE - 4) || (x < 4)) {
+	    span->blend(d, buf, r, n, _blender_alpha, FALSE);
+	    d = OFFSET_PIXEL_PTR(d, n);
+	    r = OFFSET_PIXEL_PTR(r, n);
+	    t = buf;
+	    n = 0;
+	 }
+      }
+
+      return;
+   }
+#endif
+
    for (x = w - 1; x >= 0; x-= 4) {
       long nextu, nextv, du, dv;
 
@@ -699,6 +801,51 @@ void FUNC_POLY_SCANLINE_PTEX_MASK_TRANS(uintptr_t addr, int w, POLYGON_SEGMENT *
    fz += dfz;
    z1 = 1. / fz;
 
+#if (defined ALLEGRO_SIMD_SSE2) && (defined MAKE_SPAN_BLENDER)
+   if ((MAKE_SPAN_BLENDER()) && (cpu_capabilities & CPU_SSE2) &&
+       ((unsigned int)_blender_alpha < 256)) {
+      AL_CONST BLENDER_SPAN *span = MAKE_SPAN_BLENDER();
+      SPAN_PIXEL buf[SCAN_SPAN_SIZE];
+      PIXEL_PTR t = buf;
+      int n = 0;
+
+      for (x = w - 1; x >= 0; x-= 4) {
+	 long nextu, nextv, du, dv;
+
+	 fu += dfu;
+	 fv += dfv;
+	 fz += dfz;
+	 nextu = fu * z1;
+	 nextv = fv * z1;
+	 z1 = 1. / fz;
+	 du = (nextu - u) >> 2;
+	 dv = (nextv - v) >> 2;
+
+	 /* scanline subdivision */
+	 if (x < 3)
+	    imax = x;
+	 for (i = imax; i >= 0; i--, INC_PIXEL_PTR(t)) {
+	    PIXEL_PTR s = OFFSET_PIXEL_PTR(texture, ((v >> vshift) & vmask) + ((u >> 16) & umask));
+	    PUT_MEMORY_PIXEL(t, GET_MEMORY_PIXEL(s));
+	    u += du;
+	    v += dv;
+	 }
+
+	 /* blend whenever the buffer can't take another four texels */
+	 n += imax + 1;
+	 if ((n > SCAN_SPAN_SIZE - 4) || (x < 4)) {
+	    span->blend(d, buf, r, n, _blender_alpha, TRUE);
+	    d = OFFSET_PIXEL_PTR(d, n);
+	    r = OFFSET_PIXEL_PTR(r, n);
+	    t = buf;
+	    n = 0;
+	 }
+      }
+
+      return;
+   }
+#endif
+
    for (x = w - 1; x >= 0; x-= 4) {
       long nextu, nextv, du, dv;
 
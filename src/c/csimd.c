@@ -0,0 +1,1456 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      SSE2 and AVX2 scanline kernels used by the C blitters, sprite
+ *      drawing routines and color conversion blitters, and the sample
+ *      mixing kernels of the digital sound mixer.
+ *
+ *      Each kernel handles a whole line: it picks the widest instruction
+ *      set that cpu_capabilities allows, and finishes the odd pixels at
+ *      the end of the line in plain C.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+
+#include <string.h>
+
+#include "allegro.h"
+#include "allegro/internal/aintern.h"
+
+#ifdef ALLEGRO_SIMD_SSE2
+
+#include <emmintrin.h>
+
+#ifdef ALLEGRO_SIMD_AVX2
+   #include <immintrin.h>
+#endif
+
+
+
+/* Generates the SSE2 and AVX2 masked line copiers for the depths where a
+ * pixel fits in one vector lane. A lane equal to the mask color keeps the
+ * destination pixel, any other lane takes the source pixel. Vectors that
+ * are entirely transparent are not written back at all.
+ */
+#define MASKED_LINE_SSE2(name, type, n, set1, cmpeq)                         \
+static void name(type *d, AL_CONST type *s, int w, unsigned long mask)       \
+{                                                                            \
+   __m128i m = set1(mask);                                                   \
+                                                                             \
+   for (; w >= n; w -= n, s += n, d += n) {                                  \
+      __m128i sv = _mm_loadu_si128((AL_CONST __m128i *)s);                   \
+      __m128i t = cmpeq(sv, m);                                              \
+                                                                             \
+      if (_mm_movemask_epi8(t) != 0xFFFF) {                                  \
+	 __m128i dv = _mm_loadu_si128((__m128i *)d);                         \
+	 dv = _mm_or_si128(_mm_and_si128(t, dv), _mm_andnot_si128(t, sv));  \
+	 _mm_storeu_si128((__m128i *)d, dv);                                 \
+      }                                                                      \
+   }                                                                         \
+                                                                             \
+   for (; w > 0; w--, s++, d++) {                                            \
+      if (*s != (type)mask)                                                  \
+	 *d = *s;                                                            \
+   }                                                                         \
+}
+
+#define MASKED_LINE_AVX2(name, type, n, set1, cmpeq)                         \
+AL_AVX2_FUNC static void name(type *d, AL_CONST type *s, int w,              \
+			      unsigned long mask)                            \
+{                                                                            \
+   __m256i m = set1(mask);                                                   \
+                                                                             \
+   for (; w >= n; w -= n, s += n, d += n) {                                  \
+      __m256i sv = _mm256_loadu_si256((AL_CONST __m256i *)s);                \
+      __m256i t = cmpeq(sv, m);                                              \
+                                                                             \
+      if (_mm256_movemask_epi8(t) != -1) {                                   \
+	 __m256i dv = _mm256_loadu_si256((__m256i *)d);                      \
+	 _mm256_storeu_si256((__m256i *)d, _mm256_blendv_epi8(sv, dv, t));   \
+      }                                                                      \
+   }                                                                         \
+                                                                             \
+   for (; w > 0; w--, s++, d++) {                                            \
+      if (*s != (type)mask)                                                  \
+	 *d = *s;                                                            \
+   }                                                                         \
+}
+
+MASKED_LINE_SSE2(sse2_masked_line8, unsigned char, 16, _mm_set1_epi8, _mm_cmpeq_epi8)
+MASKED_LINE_SSE2(sse2_masked_line16, unsigned short, 8, _mm_set1_epi16, _mm_cmpeq_epi16)
+MASKED_LINE_SSE2(sse2_masked_line32, uint32_t, 4, _mm_set1_epi32, _mm_cmpeq_epi32)
+
+#ifdef ALLEGRO_SIMD_AVX2
+MASKED_LINE_AVX2(avx2_masked_line8, unsigned char, 32, _mm256_set1_epi8, _mm256_cmpeq_epi8)
+MASKED_LINE_AVX2(avx2_masked_line16, unsigned short, 16, _mm256_set1_epi16, _mm256_cmpeq_epi16)
+MASKED_LINE_AVX2(avx2_masked_line32, uint32_t, 8, _mm256_set1_epi32, _mm256_cmpeq_epi32)
+#endif
+
+
+
+/* Reverses the order of the pixels held in a vector. */
+static INLINE __m128i sse2_reverse16(__m128i v)
+{
+   v = _mm_shufflelo_epi16(v, 0x1B);
+   v = _mm_shufflehi_epi16(v, 0x1B);
+   return _mm_shuffle_epi32(v, 0x4E);
+}
+
+static INLINE __m128i sse2_reverse8(__m128i v)
+{
+   v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+   return sse2_reverse16(v);
+}
+
+static INLINE __m128i sse2_reverse32(__m128i v)
+{
+   return _mm_shuffle_epi32(v, 0x1B);
+}
+
+#ifdef ALLEGRO_SIMD_AVX2
+
+AL_AVX2_FUNC static INLINE __m256i avx2_reverse8(__m256i v)
+{
+   __m256i r = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+				15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+   v = _mm256_shuffle_epi8(v, r);
+   return _mm256_permute2x128_si256(v, v, 1);
+}
+
+AL_AVX2_FUNC static INLINE __m256i avx2_reverse16(__m256i v)
+{
+   __m256i r = _mm256_setr_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+				14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+   v = _mm256_shuffle_epi8(v, r);
+   return _mm256_permute2x128_si256(v, v, 1);
+}
+
+AL_AVX2_FUNC static INLINE __m256i avx2_reverse32(__m256i v)
+{
+   return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+#endif
+
+
+
+/* Horizontally flipped versions of the masked line copiers: d points to
+ * the last pixel of the destination span and moves backwards, so each
+ * source vector is reversed in registers before it is blended in.
+ */
+#define MASKED_FLIP_LINE_SSE2(name, type, n, set1, cmpeq, reverse)           \
+static void name(type *d, AL_CONST type *s, int w, unsigned long mask)       \
+{                                                                            \
+   __m128i m = set1(mask);                                                   \
+                                                                             \
+   for (; w >= n; w -= n, s += n, d -= n) {                                  \
+      __m128i sv = reverse(_mm_loadu_si128((AL_CONST __m128i *)s));          \
+      __m128i t = cmpeq(sv, m);                                              \
+                                                                             \
+      if (_mm_movemask_epi8(t) != 0xFFFF) {                                  \
+	 __m128i dv = _mm_loadu_si128((__m128i *)(d - n + 1));               \
+	 dv = _mm_or_si128(_mm_and_si128(t, dv), _mm_andnot_si128(t, sv));  \
+	 _mm_storeu_si128((__m128i *)(d - n + 1), dv);                       \
+      }                                                                      \
+   }                                                                         \
+                                                                             \
+   for (; w > 0; w--, s++, d--) {                                            \
+      if (*s != (type)mask)                                                  \
+	 *d = *s;                                                            \
+   }                                                                         \
+}
+
+#define MASKED_FLIP_LINE_AVX2(name, type, n, set1, cmpeq, reverse)           \
+AL_AVX2_FUNC static void name(type *d, AL_CONST type *s, int w,              \
+			      unsigned long mask)                            \
+{                                                                            \
+   __m256i m = set1(mask);                                                   \
+                                                                             \
+   for (; w >= n; w -= n, s += n, d -= n) {                                  \
+      __m256i sv = reverse(_mm256_loadu_si256((AL_CONST __m256i *)s));       \
+      __m256i t = cmpeq(sv, m);                                              \
+                                                                             \
+      if (_mm256_movemask_epi8(t) != -1) {                                   \
+	 __m256i dv = _mm256_loadu_si256((__m256i *)(d - n + 1));            \
+	 _mm256_storeu_si256((__m256i *)(d - n + 1),                         \
+			     _mm256_blendv_epi8(sv, dv, t));                 \
+      }                                                                      \
+   }                                                                         \
+                                                                             \
+   for (; w > 0; w--, s++, d--) {                                            \
+      if (*s != (type)mask)                                                  \
+	 *d = *s;                                                            \
+   }                                                                         \
+}
+
+MASKED_FLIP_LINE_SSE2(sse2_masked_flip_line8, unsigned char, 16, _mm_set1_epi8, _mm_cmpeq_epi8, sse2_reverse8)
+MASKED_FLIP_LINE_SSE2(sse2_masked_flip_line16, unsigned short, 8, _mm_set1_epi16, _mm_cmpeq_epi16, sse2_reverse16)
+MASKED_FLIP_LINE_SSE2(sse2_masked_flip_line32, uint32_t, 4, _mm_set1_epi32, _mm_cmpeq_epi32, sse2_reverse32)
+
+#ifdef ALLEGRO_SIMD_AVX2
+MASKED_FLIP_LINE_AVX2(avx2_masked_flip_line8, unsigned char, 32, _mm256_set1_epi8, _mm256_cmpeq_epi8, avx2_reverse8)
+MASKED_FLIP_LINE_AVX2(avx2_masked_flip_line16, unsigned short, 16, _mm256_set1_epi16, _mm256_cmpeq_epi16, avx2_reverse16)
+MASKED_FLIP_LINE_AVX2(avx2_masked_flip_line32, uint32_t, 8, _mm256_set1_epi32, _mm256_cmpeq_epi32, avx2_reverse32)
+#endif
+
+
+
+/* Same for filling a line with a solid color. The first few pixels are
+ * written one by one until the destination is aligned, so that lines of
+ * bitmaps made with set_bitmap_alignment() go straight to aligned stores.
+ */
+#define CLEAR_LINE_SSE2(name, type, n, set1)                                 \
+static void name(type *d, int w, int color)                                  \
+{                                                                            \
+   __m128i c = set1(color);                                                  \
+                                                                             \
+   for (; (w > 0) && ((uintptr_t)d & 15); w--, d++)                          \
+      *d = color;                                                            \
+                                                                             \
+   for (; w >= n; w -= n, d += n)                                            \
+      _mm_store_si128((__m128i *)d, c);                                      \
+                                                                             \
+   for (; w > 0; w--, d++)                                                   \
+      *d = color;                                                            \
+}
+
+#define CLEAR_LINE_AVX2(name, type, n, set1)                                 \
+AL_AVX2_FUNC static void name(type *d, int w, int color)                     \
+{                                                                            \
+   __m256i c = set1(color);                                                  \
+                                                                             \
+   for (; (w > 0) && ((uintptr_t)d & 31); w--, d++)                          \
+      *d = color;                                                            \
+                                                                             \
+   for (; w >= n; w -= n, d += n)                                            \
+      _mm256_store_si256((__m256i *)d, c);                                   \
+                                                                             \
+   for (; w > 0; w--, d++)                                                   \
+      *d = color;                                                            \
+}
+
+CLEAR_LINE_SSE2(sse2_clear_line16, unsigned short, 8, _mm_set1_epi16)
+CLEAR_LINE_SSE2(sse2_clear_line32, uint32_t, 4, _mm_set1_epi32)
+
+#ifdef ALLEGRO_SIMD_AVX2
+CLEAR_LINE_AVX2(avx2_clear_line16, unsigned short, 16, _mm256_set1_epi16)
+CLEAR_LINE_AVX2(avx2_clear_line32, uint32_t, 8, _mm256_set1_epi32)
+#endif
+
+
+
+/* _simd_clear_line8:
+ *  Fills a line of an 8 bit bitmap. libc already does the best job here.
+ */
+void _simd_clear_line8(void *dst, int w, int color)
+{
+   if (w > 0)
+      memset(dst, color, w);
+}
+
+
+
+/* _simd_clear_line16:
+ *  Fills a line of a 15 or 16 bit bitmap.
+ */
+void _simd_clear_line16(void *dst, int w, int color)
+{
+#ifdef ALLEGRO_SIMD_AVX2
+   if (cpu_capabilities & CPU_AVX2) {
+      avx2_clear_line16(dst, w, color);
+      return;
+   }
+#endif
+
+   sse2_clear_line16(dst, w, color);
+}
+
+
+
+/* _simd_clear_line24:
+ *  Fills a line of a 24 bit bitmap. Sixteen pixels fill exactly three
+ *  vectors, so we store the color as a 48 byte repeating pattern.
+ */
+void _simd_clear_line24(void *dst, int w, int color)
+{
+   unsigned char pattern[48];
+   unsigned char *d = dst;
+   __m128i c0, c1, c2;
+   int i;
+
+   for (i = 0; i < 48; i += 3)
+      WRITE3BYTES(pattern + i, color);
+
+   c0 = _mm_loadu_si128((__m128i *)pattern);
+   c1 = _mm_loadu_si128((__m128i *)(pattern + 16));
+   c2 = _mm_loadu_si128((__m128i *)(pattern + 32));
+
+   for (; w >= 16; w -= 16, d += 48) {
+      _mm_storeu_si128((__m128i *)d, c0);
+      _mm_storeu_si128((__m128i *)(d + 16), c1);
+      _mm_storeu_si128((__m128i *)(d + 32), c2);
+   }
+
+   for (; w > 0; w--, d += 3)
+      WRITE3BYTES(d, color);
+}
+
+
+
+/* _simd_clear_line32:
+ *  Fills a line of a 32 bit bitmap.
+ */
+void _simd_clear_line32(void *dst, int w, int color)
+{
+#ifdef ALLEGRO_SIMD_AVX2
+   if (cpu_capabilities & CPU_AVX2) {
+      avx2_clear_line32(dst, w, color);
+      return;
+   }
+#endif
+
+   sse2_clear_line32(dst, w, color);
+}
+
+
+
+/* _simd_masked_line8:
+ *  Masked copy of a line of an 8 bit bitmap.
+ */
+void _simd_masked_line8(void *dst, AL_CONST void *src, int w, unsigned long mask)
+{
+#ifdef ALLEGRO_SIMD_AVX2
+   if (cpu_capabilities & CPU_AVX2) {
+      avx2_masked_line8(dst, src, w, mask);
+      return;
+   }
+#endif
+
+   sse2_masked_line8(dst, src, w, mask);
+}
+
+
+
+/* _simd_masked_line16:
+ *  Masked copy of a line of a 15 or 16 bit bitmap.
+ */
+void _simd_masked_line16(void *dst, AL_CONST void *src, int w, unsigned long mask)
+{
+#ifdef ALLEGRO_SIMD_AVX2
+   if (cpu_capabilities & CPU_AVX2) {
+      avx2_masked_line16(dst, src, w, mask);
+      return;
+   }
+#endif
+
+   sse2_masked_line16(dst, src, w, mask);
+}
+
+
+
+/* one flag bit per 24 bit pixel in a 48 byte compare mask */
+#define ALL_PIXELS24    ((((uint64_t)0x249249) << 24) | 0x249249)
+
+
+
+/* transparent24:
+ *  Compares sixteen 24 bit pixels (three vectors) with the mask color and
+ *  returns one flag per pixel, at bit 3*i for pixel i. Pixels straddle the
+ *  vector lanes at this depth, so we compare bytewise and fold each group
+ *  of three compare bits together.
+ */
+static INLINE uint64_t transparent24(AL_CONST unsigned char *s, __m128i m0, __m128i m1, __m128i m2)
+{
+   uint64_t eq;
+
+   eq = (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((AL_CONST __m128i *)s), m0)) |
+	((uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((AL_CONST __m128i *)(s + 16)), m1)) << 16) |
+	((uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((AL_CONST __m128i *)(s + 32)), m2)) << 32);
+
+   return eq & (eq >> 1) & (eq >> 2) & ALL_PIXELS24;
+}
+
+
+
+/* _simd_masked_line24:
+ *  Masked copy of a line of a 24 bit bitmap. Runs that are fully solid or
+ *  fully transparent are the common case inside a sprite, the rest fall
+ *  back to copying pixel by pixel.
+ */
+void _simd_masked_line24(void *dst, AL_CONST void *src, int w, unsigned long mask)
+{
+   unsigned char *d = dst;
+   AL_CONST unsigned char *s = src;
+   unsigned char pattern[48];
+   __m128i m0, m1, m2;
+   int i;
+
+   for (i = 0; i < 48; i += 3)
+      WRITE3BYTES(pattern + i, mask);
+
+   m0 = _mm_loadu_si128((__m128i *)pattern);
+   m1 = _mm_loadu_si128((__m128i *)(pattern + 16));
+   m2 = _mm_loadu_si128((__m128i *)(pattern + 32));
+
+   for (; w >= 16; w -= 16, s += 48, d += 48) {
+      uint64_t t = transparent24(s, m0, m1, m2);
+
+      if (t == 0) {
+	 memcpy(d, s, 48);
+      }
+      else if (t != ALL_PIXELS24) {
+	 for (i = 0; i < 48; i += 3) {
+	    if (!((t >> i) & 1))
+	       WRITE3BYTES(d + i, READ3BYTES(s + i));
+	 }
+      }
+   }
+
+   for (; w > 0; w--, s += 3, d += 3) {
+      unsigned long c = READ3BYTES(s);
+
+      if (c != mask)
+	 WRITE3BYTES(d, c);
+   }
+}
+
+
+
+/* _simd_masked_flip_line24:
+ *  Horizontally flipped masked copy of a line of a 24 bit bitmap, where
+ *  dst points to the last pixel of the span. Reversing 3 byte pixels in
+ *  registers is not worth it with SSE2, so only the transparency test is
+ *  vectorised: fully transparent runs are skipped outright.
+ */
+void _simd_masked_flip_line24(void *dst, AL_CONST void *src, int w, unsigned long mask)
+{
+   unsigned char *d = dst;
+   AL_CONST unsigned char *s = src;
+   unsigned char pattern[48];
+   __m128i m0, m1, m2;
+   int i;
+
+   for (i = 0; i < 48; i += 3)
+      WRITE3BYTES(pattern + i, mask);
+
+   m0 = _mm_loadu_si128((__m128i *)pattern);
+   m1 = _mm_loadu_si128((__m128i *)(pattern + 16));
+   m2 = _mm_loadu_si128((__m128i *)(pattern + 32));
+
+   for (; w >= 16; w -= 16, s += 48, d -= 48) {
+      uint64_t t = transparent24(s, m0, m1, m2);
+
+      if (t != ALL_PIXELS24) {
+	 for (i = 0; i < 48; i += 3) {
+	    if (!((t >> i) & 1))
+	       WRITE3BYTES(d - i, READ3BYTES(s + i));
+	 }
+      }
+   }
+
+   for (; w > 0; w--, s += 3, d -= 3) {
+      unsigned long c = READ3BYTES(s);
+
+      if (c != mask)
+	 WRITE3BYTES(d, c);
+   }
+}
+
+
+
+/* _simd_masked_line32:
+ *  Masked copy of a line of a 32 bit bitmap.
+ */
+void _simd_masked_line32(void *dst, AL_CONST void *src, int w, unsigned long mask)
+{
+#ifdef ALLEGRO_SIMD_AVX2
+   if (cpu_capabilities & CPU_AVX2) {
+      avx2_masked_line32(dst, src, w, mask);
+      return;
+   }
+#endif
+
+   sse2_masked_line32(dst, src, w, mask);
+}
+
+/* _simd_masked_flip_line8:
+ *  Horizontally flipped masked copy of a line of an 8 bit bitmap, where dst
+ *  points to the last pixel of the span.
+ */
+void _simd_masked_flip_line8(void *dst, AL_CONST void *src, int w, unsigned long mask)
+{
+#ifdef ALLEGRO_SIMD_AVX2
+   if (cpu_capabilities & CPU_AVX2) {
+      avx2_masked_flip_line8(dst, src, w, mask);
+      return;
+   }
+#endif
+
+   sse2_masked_flip_line8(dst, src, w, mask);
+}
+
+
+
+/* _simd_masked_flip_line16:
+ *  Horizontally flipped masked copy of a line of a 15 or 16 bit bitmap, where dst
+ *  points to the last pixel of the span.
+ */
+void _simd_masked_flip_line16(void *dst, AL_CONST void *src, int w, unsigned long mask)
+{
+#ifdef ALLEGRO_SIMD_AVX2
+   if (cpu_capabilities & CPU_AVX2) {
+      avx2_masked_flip_line16(dst, src, w, mask);
+      return;
+   }
+#endif
+
+   sse2_masked_flip_line16(dst, src, w, mask);
+}
+
+
+
+/* _simd_masked_flip_line32:
+ *  Horizontally flipped masked copy of a line of a 32 bit bitmap, where dst
+ *  points to the last pixel of the span.
+ */
+void _simd_masked_flip_line32(void *dst, AL_CONST void *src, int w, unsigned long mask)
+{
+#ifdef ALLEGRO_SIMD_AVX2
+   if (cpu_capabilities & CPU_AVX2) {
+      avx2_masked_flip_line32(dst, src, w, mask);
+      return;
+   }
+#endif
+
+   sse2_masked_flip_line32(dst, src, w, mask);
+}
+
+
+/* sse2_expand5:
+ *  Widens 5 bit components in 16 bit lanes to 8 bits, repeating the top
+ *  bits at the bottom like the _rgb_scale_5[] table does.
+ */
+static INLINE __m128i sse2_expand5(__m128i c)
+{
+   return _mm_or_si128(_mm_slli_epi16(c, 3), _mm_srli_epi16(c, 2));
+}
+
+
+
+/* sse2_colorconv_16_to_32:
+ *  Converts eight 16 bit pixels to 32 bits. The green component follows
+ *  the two tables built by build_rgb_scale_5335_table() in colconv.c, so
+ *  that the result is the same as the one of the plain C blitter.
+ */
+static INLINE void sse2_colorconv_16_to_32(uint32_t *d, __m128i p)
+{
+   __m128i m5 = _mm_set1_epi16(0x1F);
+   __m128i m3 = _mm_set1_epi16(0x07);
+   __m128i r, g, b, ghi, glo, rg;
+
+   r = sse2_expand5(_mm_srli_epi16(p, 11));
+   b = sse2_expand5(_mm_and_si128(p, m5));
+
+   ghi = _mm_and_si128(_mm_srli_epi16(p, 8), m3);
+   glo = _mm_and_si128(_mm_srli_epi16(p, 5), m3);
+
+   g = _mm_add_epi16(_mm_slli_epi16(ghi, 5), _mm_slli_epi16(glo, 2));
+   g = _mm_sub_epi16(g, _mm_cmpgt_epi16(ghi, _mm_set1_epi16(2)));
+   g = _mm_sub_epi16(g, _mm_cmpgt_epi16(ghi, _mm_set1_epi16(4)));
+   g = _mm_sub_epi16(g, _mm_cmpeq_epi16(glo, m3));
+
+   rg = _mm_or_si128(_mm_slli_epi16(g, 8), b);
+
+   _mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi16(rg, r));
+   _mm_storeu_si128((__m128i *)(d + 4), _mm_unpackhi_epi16(rg, r));
+}
+
+
+
+#ifdef ALLEGRO_SIMD_AVX2
+
+/* avx2_colorconv_line_16_to_32:
+ *  AVX2 version of sse2_colorconv_16_to_32(), for a whole line.
+ */
+AL_AVX2_FUNC static void avx2_colorconv_line_16_to_32(uint32_t *d, AL_CONST unsigned short *s, int w)
+{
+   __m256i m5 = _mm256_set1_epi16(0x1F);
+   __m256i m3 = _mm256_set1_epi16(0x07);
+   __m256i p, r, g, b, ghi, glo, rg;
+
+   for (; w >= 16; w -= 16, s += 16, d += 16) {
+      /* order the quadwords so the in-lane unpacks come out in sequence */
+      p = _mm256_permute4x64_epi64(_mm256_loadu_si256((AL_CONST __m256i *)s), 0xD8);
+
+      r = _mm256_srli_epi16(p, 11);
+      r = _mm256_or_si256(_mm256_slli_epi16(r, 3), _mm256_srli_epi16(r, 2));
+      b = _mm256_and_si256(p, m5);
+      b = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 2));
+
+      ghi = _mm256_and_si256(_mm256_srli_epi16(p, 8), m3);
+      glo = _mm256_and_si256(_mm256_srli_epi16(p, 5), m3);
+
+      g = _mm256_add_epi16(_mm256_slli_epi16(ghi, 5), _mm256_slli_epi16(glo, 2));
+      g = _mm256_sub_epi16(g, _mm256_cmpgt_epi16(ghi, _mm256_set1_epi16(2)));
+      g = _mm256_sub_epi16(g, _mm256_cmpgt_epi16(ghi, _mm256_set1_epi16(4)));
+      g = _mm256_sub_epi16(g, _mm256_cmpeq_epi16(glo, m3));
+
+      rg = _mm256_or_si256(_mm256_slli_epi16(g, 8), b);
+
+      _mm256_storeu_si256((__m256i *)d, _mm256_unpacklo_epi16(rg, r));
+      _mm256_storeu_si256((__m256i *)(d + 8), _mm256_unpackhi_epi16(rg, r));
+   }
+
+   if (w >= 8) {
+      sse2_colorconv_16_to_32(d, _mm_loadu_si128((AL_CONST __m128i *)s));
+      s += 8;
+      d += 8;
+      w -= 8;
+   }
+
+   if (w > 0) {
+      unsigned short tmp[8];
+      uint32_t out[8];
+
+      memcpy(tmp, s, w * sizeof(unsigned short));
+      sse2_colorconv_16_to_32(out, _mm_loadu_si128((__m128i *)tmp));
+      memcpy(d, out, w * sizeof(uint32_t));
+   }
+}
+
+
+
+/* avx2_colorconv_line_8_to_32:
+ *  Looks up eight palette entries at a time with a gather.
+ */
+AL_AVX2_FUNC static void avx2_colorconv_line_8_to_32(uint32_t *d, AL_CONST unsigned char *s, int w, AL_CONST int *palette)
+{
+   __m256i idx;
+
+   for (; w >= 8; w -= 8, s += 8, d += 8) {
+      idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((AL_CONST __m128i *)s));
+      _mm256_storeu_si256((__m256i *)d, _mm256_i32gather_epi32(palette, idx, 4));
+   }
+
+   for (; w > 0; w--)
+      *d++ = palette[*s++];
+}
+
+#endif
+
+
+
+/* _simd_colorconv_line_16_to_32:
+ *  Converts a line of 16 bit pixels to 32 bits.
+ */
+void _simd_colorconv_line_16_to_32(void *dst, AL_CONST void *src, int w)
+{
+   AL_CONST unsigned short *s = src;
+   uint32_t *d = dst;
+
+#ifdef ALLEGRO_SIMD_AVX2
+   if (cpu_capabilities & CPU_AVX2) {
+      avx2_colorconv_line_16_to_32(d, s, w);
+      return;
+   }
+#endif
+
+   for (; w >= 8; w -= 8, s += 8, d += 8)
+      sse2_colorconv_16_to_32(d, _mm_loadu_si128((AL_CONST __m128i *)s));
+
+   if (w > 0) {
+      unsigned short tmp[8];
+      uint32_t out[8];
+
+      memcpy(tmp, s, w * sizeof(unsigned short));
+      sse2_colorconv_16_to_32(out, _mm_loadu_si128((__m128i *)tmp));
+      memcpy(d, out, w * sizeof(uint32_t));
+   }
+}
+
+
+
+/* _simd_colorconv_line_8_to_32:
+ *  Converts a line of 8 bit pixels to 32 bits through a palette of 256
+ *  ints. SSE2 has no gather instruction, so without AVX2 this is a plain
+ *  table lookup.
+ */
+void _simd_colorconv_line_8_to_32(void *dst, AL_CONST void *src, int w, AL_CONST int *palette)
+{
+   AL_CONST unsigned char *s = src;
+   uint32_t *d = dst;
+
+#ifdef ALLEGRO_SIMD_AVX2
+   if (cpu_capabilities & CPU_AVX2) {
+      avx2_colorconv_line_8_to_32(d, s, w, palette);
+      return;
+   }
+#endif
+
+   for (; w >= 4; w -= 4, s += 4, d += 4) {
+      d[0] = palette[s[0]];
+      d[1] = palette[s[1]];
+      d[2] = palette[s[2]];
+      d[3] = palette[s[3]];
+   }
+
+   for (; w > 0; w--)
+      *d++ = palette[*s++];
+}
+
+
+
+/* Sample mixer kernels. The fetch and arithmetic helpers below take the
+ * SIMD_MIX_* format as a constant, so every kernel generated from them only
+ * keeps the code for its own sample format.
+ */
+#define MIX_FETCH_INDEX(format, pos)                                         \
+   ((int)((pos) >> MIX_FIX_SHIFT) * (((format) & SIMD_MIX_STEREO) ? 2 : 1))
+
+
+
+/* mix_value:
+ *  Reads one source sample, centered on zero. 16 bit samples keep their
+ *  low byte only in high quality mode, like in the mixer's C code.
+ */
+static INLINE int mix_value(AL_CONST void *data, int format, int i)
+{
+   if (format & SIMD_MIX_16BIT) {
+      if (format & SIMD_MIX_HQ)
+	 return ((AL_CONST unsigned short *)data)[i] - 0x8000;
+      else
+	 return (((AL_CONST unsigned short *)data)[i] >> 8) - 0x80;
+   }
+   else
+      return ((AL_CONST unsigned char *)data)[i] - 0x80;
+}
+
+
+
+/* mix_value24:
+ *  Reads one source sample, as a 24 bit value centered on zero.
+ */
+static INLINE int mix_value24(AL_CONST void *data, int format, int i)
+{
+   if (format & SIMD_MIX_16BIT)
+      return (((AL_CONST unsigned short *)data)[i] << 8) - 0x800000;
+   else
+      return (((AL_CONST unsigned char *)data)[i] << 16) - 0x800000;
+}
+
+
+
+/* mix_frame:
+ *  Plain C version of the mixing kernels, for a single frame.
+ */
+static INLINE int *mix_frame(int *buf, AL_CONST void *data, int format, long pos, int lvol, int rvol)
+{
+   int i = MIX_FETCH_INDEX(format, pos);
+   int l = mix_value(data, format, i) * lvol;
+   int r = mix_value(data, format, i + ((format & SIMD_MIX_STEREO) ? 1 : 0)) * rvol;
+
+   if ((format & SIMD_MIX_16BIT) && (format & SIMD_MIX_HQ)) {
+      l >>= 8;
+      r >>= 8;
+   }
+
+   if (format & SIMD_MIX_MONO_OUT) {
+      *(buf++) += l + r;
+   }
+   else {
+      *(buf++) += l;
+      *(buf++) += r;
+   }
+
+   return buf;
+}
+
+
+
+/* mix_frame_interp:
+ *  Plain C version of the interpolating kernels, for a single frame.
+ */
+static INLINE int *mix_frame_interp(int *buf, AL_CONST void *data, int format, long pos, int lvol, int rvol)
+{
+   int ch = ((format & SIMD_MIX_STEREO) ? 1 : 0);
+   int i = MIX_FETCH_INDEX(format, pos);
+   int f = pos & ((1 << MIX_FIX_SHIFT) - 1);
+   int v1, v2, l, r;
+
+   v1 = mix_value24(data, format, i);
+   v2 = mix_value24(data, format, i + 1 + ch);
+   l = ((v2 * f) + (v1 * ((1 << MIX_FIX_SHIFT) - f))) >> MIX_FIX_SHIFT;
+
+   v1 = mix_value24(data, format, i + ch);
+   v2 = mix_value24(data, format, i + 1 + ch + ch);
+   r = ((v2 * f) + (v1 * ((1 << MIX_FIX_SHIFT) - f))) >> MIX_FIX_SHIFT;
+
+   *(buf++) += (int)(((int64_t)l * lvol) >> 16);
+   *(buf++) += (int)(((int64_t)r * rvol) >> 16);
+
+   return buf;
+}
+
+
+
+/* sse2_mullo32:
+ *  Multiplies 32 bit lanes, keeping the low halves of the products. SSE2
+ *  only has the widening unsigned multiply, which has the same low half.
+ */
+static INLINE __m128i sse2_mullo32(__m128i a, __m128i b)
+{
+   __m128i even = _mm_mul_epu32(a, b);
+   __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+   return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			     _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+
+
+/* sse2_mix_fetch:
+ *  Reads the samples at offset ofs of four frames starting at pos.
+ */
+static INLINE __m128i sse2_mix_fetch(AL_CONST void *data, int format, long pos, long diff, int ofs)
+{
+   int i0 = MIX_FETCH_INDEX(format, pos) + ofs;
+   int i1 = MIX_FETCH_INDEX(format, pos + diff) + ofs;
+   int i2 = MIX_FETCH_INDEX(format, pos + diff * 2) + ofs;
+   int i3 = MIX_FETCH_INDEX(format, pos + diff * 3) + ofs;
+
+   if (format & SIMD_MIX_16BIT) {
+      AL_CONST unsigned short *s = data;
+      return _mm_setr_epi32(s[i0], s[i1], s[i2], s[i3]);
+   }
+   else {
+      AL_CONST unsigned char *s = data;
+      return _mm_setr_epi32(s[i0], s[i1], s[i2], s[i3]);
+   }
+}
+
+
+
+/* sse2_mix_store:
+ *  Adds four frames of left and right values to the mixing buffer.
+ */
+static INLINE int *sse2_mix_store(int *buf, int format, __m128i l, __m128i r)
+{
+   __m128i *b = (__m128i *)buf;
+
+   if (format & SIMD_MIX_MONO_OUT) {
+      _mm_storeu_si128(b, _mm_add_epi32(_mm_loadu_si128(b), _mm_add_epi32(l, r)));
+      return buf + 4;
+   }
+
+   _mm_storeu_si128(b, _mm_add_epi32(_mm_loadu_si128(b), _mm_unpacklo_epi32(l, r)));
+   _mm_storeu_si128(b + 1, _mm_add_epi32(_mm_loadu_si128(b + 1), _mm_unpackhi_epi32(l, r)));
+   return buf + 8;
+}
+
+
+
+/* sse2_mix_scale:
+ *  Centers four raw samples on zero and applies the volume.
+ */
+static INLINE __m128i sse2_mix_scale(__m128i v, int format, __m128i vol)
+{
+   if (format & SIMD_MIX_16BIT) {
+      if (format & SIMD_MIX_HQ)
+	 return _mm_srai_epi32(sse2_mullo32(_mm_sub_epi32(v, _mm_set1_epi32(0x8000)), vol), 8);
+      v = _mm_srli_epi32(v, 8);
+   }
+
+   return sse2_mullo32(_mm_sub_epi32(v, _mm_set1_epi32(0x80)), vol);
+}
+
+
+
+/* sse2_mix_interp:
+ *  Interpolates four frames of one channel at 24 bits, and applies the
+ *  volume the way MULSC() does in the mixer.
+ */
+static INLINE __m128i sse2_mix_interp(AL_CONST void *data, int format, long pos, long diff, int ofs, __m128i f, __m128i vol)
+{
+   int next = ((format & SIMD_MIX_STEREO) ? 2 : 1);
+   int shift = ((format & SIMD_MIX_16BIT) ? 8 : 16);
+   __m128i bias = _mm_set1_epi32(0x800000);
+   __m128i v1, v2, hi, lo;
+
+   v1 = _mm_sub_epi32(_mm_slli_epi32(sse2_mix_fetch(data, format, pos, diff, ofs), shift), bias);
+   v2 = _mm_sub_epi32(_mm_slli_epi32(sse2_mix_fetch(data, format, pos, diff, ofs + next), shift), bias);
+   /* same rounding as the C mixer: (v2*f + v1*(256-f)) >> 8 never overflows */
+   v1 = _mm_add_epi32(sse2_mullo32(v2, f), sse2_mullo32(v1, _mm_sub_epi32(_mm_set1_epi32(1 << MIX_FIX_SHIFT), f)));
+   v1 = _mm_srai_epi32(v1, MIX_FIX_SHIFT);
+
+   /* (v * vol) >> 16 without overflowing 32 bits */
+   hi = sse2_mullo32(_mm_srai_epi32(v1, 8), vol);
+   lo = sse2_mullo32(_mm_and_si128(v1, _mm_set1_epi32(0xFF)), vol);
+   return _mm_srai_epi32(_mm_add_epi32(hi, _mm_srli_epi32(lo, 8)), 8);
+}
+
+
+
+/* sse2_mix_frac:
+ *  Fractional parts of four frame positions.
+ */
+static INLINE __m128i sse2_mix_frac(long pos, long diff)
+{
+   __m128i f = _mm_setr_epi32(pos, pos + diff, pos + diff * 2, pos + diff * 3);
+   return _mm_and_si128(f, _mm_set1_epi32((1 << MIX_FIX_SHIFT) - 1));
+}
+
+
+
+#ifdef ALLEGRO_SIMD_AVX2
+
+/* avx2_mix_fetch:
+ *  Reads the samples at offset ofs of eight frames starting at pos.
+ */
+AL_AVX2_FUNC static INLINE __m256i avx2_mix_fetch(AL_CONST void *data, int format, long pos, long diff, int ofs)
+{
+   int i[8], j;
+
+   for (j=0; j<8; j++)
+      i[j] = MIX_FETCH_INDEX(format, pos + diff * j) + ofs;
+
+   if (format & SIMD_MIX_16BIT) {
+      AL_CONST unsigned short *s = data;
+      return _mm256_setr_epi32(s[i[0]], s[i[1]], s[i[2]], s[i[3]], s[i[4]], s[i[5]], s[i[6]], s[i[7]]);
+   }
+   else {
+      AL_CONST unsigned char *s = data;
+      return _mm256_setr_epi32(s[i[0]], s[i[1]], s[i[2]], s[i[3]], s[i[4]], s[i[5]], s[i[6]], s[i[7]]);
+   }
+}
+
+
+
+/* avx2_mix_store:
+ *  Adds eight frames of left and right values to the mixing buffer.
+ */
+AL_AVX2_FUNC static INLINE int *avx2_mix_store(int *buf, int format, __m256i l, __m256i r)
+{
+   __m256i *b = (__m256i *)buf;
+   __m256i lo, hi;
+
+   if (format & SIMD_MIX_MONO_OUT) {
+      _mm256_storeu_si256(b, _mm256_add_epi32(_mm256_loadu_si256(b), _mm256_add_epi32(l, r)));
+      return buf + 8;
+   }
+
+   /* the unpacks work inside 128 bit lanes, put the halves back in order */
+   lo = _mm256_unpacklo_epi32(l, r);
+   hi = _mm256_unpackhi_epi32(l, r);
+   _mm256_storeu_si256(b, _mm256_add_epi32(_mm256_loadu_si256(b), _mm256_permute2x128_si256(lo, hi, 0x20)));
+   _mm256_storeu_si256(b + 1, _mm256_add_epi32(_mm256_loadu_si256(b + 1), _mm256_permute2x128_si256(lo, hi, 0x31)));
+   return buf + 16;
+}
+
+
+
+/* avx2_mix_scale:
+ *  AVX2 version of sse2_mix_scale().
+ */
+AL_AVX2_FUNC static INLINE __m256i avx2_mix_scale(__m256i v, int format, __m256i vol)
+{
+   if (format & SIMD_MIX_16BIT) {
+      if (format & SIMD_MIX_HQ)
+	 return _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(v, _mm256_set1_epi32(0x8000)), vol), 8);
+      v = _mm256_srli_epi32(v, 8);
+   }
+
+   return _mm256_mullo_epi32(_mm256_sub_epi32(v, _mm256_set1_epi32(0x80)), vol);
+}
+
+
+
+/* avx2_mix_interp:
+ *  AVX2 version of sse2_mix_interp().
+ */
+AL_AVX2_FUNC static INLINE __m256i avx2_mix_interp(AL_CONST void *data, int format, long pos, long diff, int ofs, __m256i f, __m256i vol)
+{
+   int next = ((format & SIMD_MIX_STEREO) ? 2 : 1);
+   int shift = ((format & SIMD_MIX_16BIT) ? 8 : 16);
+   __m256i bias = _mm256_set1_epi32(0x800000);
+   __m256i v1, v2, hi, lo;
+
+   v1 = _mm256_sub_epi32(_mm256_slli_epi32(avx2_mix_fetch(data, format, pos, diff, ofs), shift), bias);
+   v2 = _mm256_sub_epi32(_mm256_slli_epi32(avx2_mix_fetch(data, format, pos, diff, ofs + next), shift), bias);
+   v1 = _mm256_add_epi32(_mm256_mullo_epi32(v2, f), _mm256_mullo_epi32(v1, _mm256_sub_epi32(_mm256_set1_epi32(1 << MIX_FIX_SHIFT), f)));
+   v1 = _mm256_srai_epi32(v1, MIX_FIX_SHIFT);
+
+   hi = _mm256_mullo_epi32(_mm256_srai_epi32(v1, 8), vol);
+   lo = _mm256_mullo_epi32(_mm256_and_si256(v1, _mm256_set1_epi32(0xFF)), vol);
+   return _mm256_srai_epi32(_mm256_add_epi32(hi, _mm256_srli_epi32(lo, 8)), 8);
+}
+
+#endif
+
+
+
+/* Generates the mixing kernels for one sample format: eight frames at a
+ * time with AVX2, four with SSE2, and the rest in plain C.
+ */
+#ifdef ALLEGRO_SIMD_AVX2
+
+#define MIX_KERNEL_AVX2(name, format)                                        \
+AL_AVX2_FUNC static int *avx2_##name(int *buf, AL_CONST void *data, long *pos, long diff, int *n, int lvol, int rvol) \
+{                                                                            \
+   __m256i vl = _mm256_set1_epi32(lvol);                                     \
+   __m256i vr = _mm256_set1_epi32(rvol);                                     \
+   __m256i l, r;                                                             \
+                                                                             \
+   for (; *n >= 8; *n -= 8, *pos += diff * 8) {                              \
+      l = avx2_mix_fetch(data, format, *pos, diff, 0);                       \
+      if (format & SIMD_MIX_STEREO)                                          \
+	 r = avx2_mix_fetch(data, format, *pos, diff, 1);                    \
+      else                                                                   \
+	 r = l;                                                              \
+      buf = avx2_mix_store(buf, format, avx2_mix_scale(l, format, vl),      \
+			   avx2_mix_scale(r, format, vr));                  \
+   }                                                                         \
+                                                                             \
+   return buf;                                                               \
+}
+
+#define MIX_INTERP_KERNEL_AVX2(name, format)                                 \
+AL_AVX2_FUNC static int *avx2_##name(int *buf, AL_CONST void *data, long *pos, long diff, int *n, int lvol, int rvol) \
+{                                                                            \
+   __m256i vl = _mm256_set1_epi32(lvol);                                     \
+   __m256i vr = _mm256_set1_epi32(rvol);                                     \
+   __m256i f, mask = _mm256_set1_epi32((1 << MIX_FIX_SHIFT) - 1);            \
+   long p;                                                                   \
+                                                                             \
+   for (; *n >= 8; *n -= 8, *pos += diff * 8) {                              \
+      p = *pos;                                                              \
+      f = _mm256_setr_epi32(p, p + diff, p + diff * 2, p + diff * 3,         \
+			    p + diff * 4, p + diff * 5, p + diff * 6,        \
+			    p + diff * 7);                                   \
+      f = _mm256_and_si256(f, mask);                                         \
+      buf = avx2_mix_store(buf, format,                                      \
+			   avx2_mix_interp(data, format, p, diff, 0, f, vl), \
+			   avx2_mix_interp(data, format, p, diff,            \
+					   ((format & SIMD_MIX_STEREO) ? 1 : 0), f, vr)); \
+   }                                                                         \
+                                                                             \
+   return buf;                                                               \
+}
+
+#else
+
+#define MIX_KERNEL_AVX2(name, format)
+#define MIX_INTERP_KERNEL_AVX2(name, format)
+
+#endif
+
+#ifdef ALLEGRO_SIMD_AVX2
+   #define MIX_KERNEL_CALL_AVX2(name)                                        \
+      if (cpu_capabilities & CPU_AVX2)                                       \
+	 buf = avx2_##name(buf, data, &pos, diff, &n, lvol, rvol);
+#else
+   #define MIX_KERNEL_CALL_AVX2(name)
+#endif
+
+#define MIX_KERNEL(name, format)                                             \
+MIX_KERNEL_AVX2(name, format)                                                \
+                                                                             \
+static void name(int *buf, AL_CONST void *data, long pos, long diff, int n, int lvol, int rvol) \
+{                                                                            \
+   __m128i vl = _mm_set1_epi32(lvol);                                        \
+   __m128i vr = _mm_set1_epi32(rvol);                                        \
+   __m128i l, r;                                                             \
+                                                                             \
+   MIX_KERNEL_CALL_AVX2(name)                                                \
+                                                                             \
+   for (; n >= 4; n -= 4, pos += diff * 4) {                                 \
+      l = sse2_mix_fetch(data, format, pos, diff, 0);                        \
+      if (format & SIMD_MIX_STEREO)                                          \
+	 r = sse2_mix_fetch(data, format, pos, diff, 1);                     \
+      else                                                                   \
+	 r = l;                                                              \
+      buf = sse2_mix_store(buf, format, sse2_mix_scale(l, format, vl),      \
+			   sse2_mix_scale(r, format, vr));                  \
+   }                                                                         \
+                                                                             \
+   for (; n > 0; n--, pos += diff)                                           \
+      buf = mix_frame(buf, data, format, pos, lvol, rvol);                   \
+}
+
+#define MIX_INTERP_KERNEL(name, format)                                      \
+MIX_INTERP_KERNEL_AVX2(name, format)                                         \
+                                                                             \
+static void name(int *buf, AL_CONST void *data, long pos, long diff, int n, int lvol, int rvol) \
+{                                                                            \
+   __m128i vl = _mm_set1_epi32(lvol);                                        \
+   __m128i vr = _mm_set1_epi32(rvol);                                        \
+   __m128i f;                                                                \
+                                                                             \
+   MIX_KERNEL_CALL_AVX2(name)                                                \
+                                                                             \
+   for (; n >= 4; n -= 4, pos += diff * 4) {                                 \
+      f = sse2_mix_frac(pos, diff);                                          \
+      buf = sse2_mix_store(buf, format,                                      \
+			   sse2_mix_interp(data, format, pos, diff, 0, f, vl), \
+			   sse2_mix_interp(data, format, pos, diff,          \
+					   ((format & SIMD_MIX_STEREO) ? 1 : 0), f, vr)); \
+   }                                                                         \
+                                                                             \
+   for (; n > 0; n--, pos += diff)                                           \
+      buf = mix_frame_interp(buf, data, format, pos, lvol, rvol);            \
+}
+
+MIX_KERNEL(mix_mono_8x1, SIMD_MIX_MONO_OUT)
+MIX_KERNEL(mix_mono_8x2, (SIMD_MIX_MONO_OUT | SIMD_MIX_STEREO))
+MIX_KERNEL(mix_mono_16x1, (SIMD_MIX_MONO_OUT | SIMD_MIX_16BIT))
+MIX_KERNEL(mix_mono_16x2, (SIMD_MIX_MONO_OUT | SIMD_MIX_16BIT | SIMD_MIX_STEREO))
+MIX_KERNEL(mix_stereo_8x1, 0)
+MIX_KERNEL(mix_stereo_8x2, SIMD_MIX_STEREO)
+MIX_KERNEL(mix_stereo_16x1, SIMD_MIX_16BIT)
+MIX_KERNEL(mix_stereo_16x2, (SIMD_MIX_16BIT | SIMD_MIX_STEREO))
+MIX_KERNEL(mix_hq_16x1, (SIMD_MIX_16BIT | SIMD_MIX_HQ))
+MIX_KERNEL(mix_hq_16x2, (SIMD_MIX_16BIT | SIMD_MIX_HQ | SIMD_MIX_STEREO))
+MIX_INTERP_KERNEL(mix_interp_8x1, 0)
+MIX_INTERP_KERNEL(mix_interp_8x2, SIMD_MIX_STEREO)
+MIX_INTERP_KERNEL(mix_interp_16x1, SIMD_MIX_16BIT)
+MIX_INTERP_KERNEL(mix_interp_16x2, (SIMD_MIX_16BIT | SIMD_MIX_STEREO))
+
+
+
+/* _simd_mix_samples:
+ *  Mixes n frames of a sample into the mixing buffer, reading them at the
+ *  fixed point positions pos, pos+diff, ... which must all be inside the
+ *  sample. format is a combination of the SIMD_MIX_* flags. Each sample
+ *  centered on zero is multiplied by lvol or rvol; in high quality mode 16
+ *  bit samples keep their full precision and the product is divided by
+ *  256, otherwise they are cut down to 8 bits first.
+ */
+void _simd_mix_samples(int *buf, AL_CONST void *data, int format, long pos, long diff, int n, int lvol, int rvol)
+{
+   /* 8 bit samples are the same in both modes */
+   if (!(format & SIMD_MIX_16BIT))
+      format &= ~SIMD_MIX_HQ;
+
+   switch (format) {
+      case SIMD_MIX_MONO_OUT:
+      case SIMD_MIX_MONO_OUT | SIMD_MIX_HQ:
+	 mix_mono_8x1(buf, data, pos, diff, n, lvol, rvol);
+	 break;
+      case SIMD_MIX_MONO_OUT | SIMD_MIX_STEREO:
+	 mix_mono_8x2(buf, data, pos, diff, n, lvol, rvol);
+	 break;
+      case SIMD_MIX_MONO_OUT | SIMD_MIX_16BIT:
+	 mix_mono_16x1(buf, data, pos, diff, n, lvol, rvol);
+	 break;
+      case SIMD_MIX_MONO_OUT | SIMD_MIX_16BIT | SIMD_MIX_STEREO:
+	 mix_mono_16x2(buf, data, pos, diff, n, lvol, rvol);
+	 break;
+      case 0:
+	 mix_stereo_8x1(buf, data, pos, diff, n, lvol, rvol);
+	 break;
+      case SIMD_MIX_STEREO:
+	 mix_stereo_8x2(buf, data, pos, diff, n, lvol, rvol);
+	 break;
+      case SIMD_MIX_16BIT:
+	 mix_stereo_16x1(buf, data, pos, diff, n, lvol, rvol);
+	 break;
+      case SIMD_MIX_16BIT | SIMD_MIX_STEREO:
+	 mix_stereo_16x2(buf, data, pos, diff, n, lvol, rvol);
+	 break;
+      case SIMD_MIX_16BIT | SIMD_MIX_HQ:
+	 mix_hq_16x1(buf, data, pos, diff, n, lvol, rvol);
+	 break;
+      case SIMD_MIX_16BIT | SIMD_MIX_HQ | SIMD_MIX_STEREO:
+	 mix_hq_16x2(buf, data, pos, diff, n, lvol, rvol);
+	 break;
+      default:
+	 ASSERT(FALSE);
+	 break;
+   }
+}
+
+
+
+/* _simd_mix_samples_interp:
+ *  Like _simd_mix_samples(), but interpolates linearly between each sample
+ *  and the next one, which must also be inside the sample, and applies a
+ *  16 bit volume to the 24 bit result. The output is always stereo.
+ */
+void _simd_mix_samples_interp(int *buf, AL_CONST void *data, int format, long pos, long diff, int n, int lvol, int rvol)
+{
+   switch (format & (SIMD_MIX_16BIT | SIMD_MIX_STEREO)) {
+      case 0:
+	 mix_interp_8x1(buf, data, pos, diff, n, lvol, rvol);
+	 break;
+      case SIMD_MIX_STEREO:
+	 mix_interp_8x2(buf, data, pos, diff, n, lvol, rvol);
+	 break;
+      case SIMD_MIX_16BIT:
+	 mix_interp_16x1(buf, data, pos, diff, n, lvol, rvol);
+	 break;
+      case SIMD_MIX_16BIT | SIMD_MIX_STEREO:
+	 mix_interp_16x2(buf, data, pos, diff, n, lvol, rvol);
+	 break;
+   }
+}
+
+
+
+#if MIX_SINC_TAPS != 16
+   #error the sinc kernels below assume 16 filter taps
+#endif
+
+/* sse2_sinc_fetch:
+ *  Reads the MIX_SINC_TAPS source frames under the filter for the position
+ *  pos as signed 16 bit values: two vectors for a mono sample, or four of
+ *  interleaved left and right values for a stereo one.
+ */
+static INLINE void sse2_sinc_fetch(__m128i *v, AL_CONST void *data, int format, long pos)
+{
+   int i = MIX_FETCH_INDEX(format, pos - ((MIX_SINC_TAPS/2 - 1) << MIX_FIX_SHIFT));
+   AL_CONST __m128i *s;
+   __m128i a, bias;
+
+   if (format & SIMD_MIX_16BIT) {
+      s = (AL_CONST __m128i *)((AL_CONST unsigned short *)data + i);
+      bias = _mm_set1_epi16(-0x8000);
+      v[0] = _mm_xor_si128(_mm_loadu_si128(s), bias);
+      v[1] = _mm_xor_si128(_mm_loadu_si128(s + 1), bias);
+      if (format & SIMD_MIX_STEREO) {
+	 v[2] = _mm_xor_si128(_mm_loadu_si128(s + 2), bias);
+	 v[3] = _mm_xor_si128(_mm_loadu_si128(s + 3), bias);
+      }
+   }
+   else {
+      s = (AL_CONST __m128i *)((AL_CONST unsigned char *)data + i);
+      bias = _mm_set1_epi16(0x80);
+      a = _mm_loadu_si128(s);
+      v[0] = _mm_sub_epi16(_mm_unpacklo_epi8(a, _mm_setzero_si128()), bias);
+      v[1] = _mm_sub_epi16(_mm_unpackhi_epi8(a, _mm_setzero_si128()), bias);
+      if (format & SIMD_MIX_STEREO) {
+	 a = _mm_loadu_si128(s + 1);
+	 v[2] = _mm_sub_epi16(_mm_unpacklo_epi8(a, _mm_setzero_si128()), bias);
+	 v[3] = _mm_sub_epi16(_mm_unpackhi_epi8(a, _mm_setzero_si128()), bias);
+      }
+   }
+}
+
+
+
+/* Converts the low or high four 16 bit values of a vector to floats, or
+ * the left or right values of four interleaved stereo frames.
+ */
+#define SINC_LO(v)      _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16))
+#define SINC_HI(v)      _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16))
+#define SINC_LEFT(v)    _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v, 16), 16))
+#define SINC_RIGHT(v)   _mm_cvtepi32_ps(_mm_srai_epi32(v, 16))
+
+
+
+/* sse2_sinc_dot:
+ *  Multiplies sixteen source values by a row of filter coefficients and
+ *  adds up the products.
+ */
+static INLINE float sse2_sinc_dot(AL_CONST float *c, __m128 a, __m128 b, __m128 d, __m128 e)
+{
+   __m128 s;
+
+   s = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(c)),
+			     _mm_mul_ps(b, _mm_loadu_ps(c + 4))),
+		  _mm_add_ps(_mm_mul_ps(d, _mm_loadu_ps(c + 8)),
+			     _mm_mul_ps(e, _mm_loadu_ps(c + 12))));
+
+   s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+   s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+
+   return _mm_cvtss_f32(s);
+}
+
+
+
+/* Generates the windowed sinc kernels for one sample format. */
+#define MIX_SINC_KERNEL(name, format)                                        \
+static void name(float *buf, AL_CONST void *data, long pos, long diff, int n, AL_CONST float *bank, float lvol, float rvol) \
+{                                                                            \
+   AL_CONST float *c;                                                        \
+   __m128i v[4];                                                             \
+   float l, r;                                                               \
+                                                                             \
+   for (; n > 0; n--, pos += diff, buf += 2) {                               \
+      c = bank + ((pos & ((1 << MIX_FIX_SHIFT) - 1))                         \
+		  >> (MIX_FIX_SHIFT - MIX_SINC_PHASE_BITS)) * MIX_SINC_TAPS;     \
+      sse2_sinc_fetch(v, data, format, pos);                                 \
+                                                                             \
+      if ((format) & SIMD_MIX_STEREO) {                                      \
+	 l = sse2_sinc_dot(c, SINC_LEFT(v[0]), SINC_LEFT(v[1]),                 \
+			   SINC_LEFT(v[2]), SINC_LEFT(v[3]));                   \
+	 r = sse2_sinc_dot(c, SINC_RIGHT(v[0]), SINC_RIGHT(v[1]),               \
+			   SINC_RIGHT(v[2]), SINC_RIGHT(v[3]));                 \
+      }                                                                      \
+      else {                                                                 \
+	 l = r = sse2_sinc_dot(c, SINC_LO(v[0]), SINC_HI(v[0]),                 \
+			       SINC_LO(v[1]), SINC_HI(v[1]));                   \
+      }                                                                      \
+                                                                             \
+      buf[0] += l * lvol;                                                    \
+      buf[1] += r * rvol;                                                    \
+   }                                                                         \
+}
+
+MIX_SINC_KERNEL(mix_sinc_8x1, 0)
+MIX_SINC_KERNEL(mix_sinc_8x2, SIMD_MIX_STEREO)
+MIX_SINC_KERNEL(mix_sinc_16x1, SIMD_MIX_16BIT)
+MIX_SINC_KERNEL(mix_sinc_16x2, (SIMD_MIX_16BIT | SIMD_MIX_STEREO))
+
+
+
+/* _simd_mix_samples_sinc:
+ *  Mixes n frames of a sample into the float mixing buffer of quality 3,
+ *  filtering them through the bank of windowed sinc coefficients, which has
+ *  MIX_SINC_PHASES rows of MIX_SINC_TAPS values. All the frames under the
+ *  filter must be inside the sample. The source values are centered on zero
+ *  but not scaled, so lvol and rvol also have to normalize them. The output
+ *  is always stereo.
+ */
+void _simd_mix_samples_sinc(float *buf, AL_CONST void *data, int format, long pos, long diff, int n, AL_CONST float *bank, float lvol, float rvol)
+{
+   switch (format & (SIMD_MIX_16BIT | SIMD_MIX_STEREO)) {
+      case 0:
+	 mix_sinc_8x1(buf, data, pos, diff, n, bank, lvol, rvol);
+	 break;
+      case SIMD_MIX_STEREO:
+	 mix_sinc_8x2(buf, data, pos, diff, n, bank, lvol, rvol);
+	 break;
+      case SIMD_MIX_16BIT:
+	 mix_sinc_16x1(buf, data, pos, diff, n, bank, lvol, rvol);
+	 break;
+      case SIMD_MIX_16BIT | SIMD_MIX_STEREO:
+	 mix_sinc_16x2(buf, data, pos, diff, n, bank, lvol, rvol);
+	 break;
+   }
+}
+
+
+
+#ifdef ALLEGRO_SIMD_AVX2
+
+/* avx2_mix_to_16bit:
+ *  AVX2 version of _simd_mix_to_16bit(), which leaves the last n % 16
+ *  values alone.
+ */
+AL_AVX2_FUNC static void avx2_mix_to_16bit(unsigned short *d, AL_CONST int *src, int n, int flip)
+{
+   __m256i vflip = _mm256_set1_epi16(flip);
+   __m256i a, b;
+
+   for (; n >= 16; n -= 16, src += 16, d += 16) {
+      a = _mm256_srai_epi32(_mm256_loadu_si256((AL_CONST __m256i *)src), 8);
+      b = _mm256_srai_epi32(_mm256_loadu_si256((AL_CONST __m256i *)(src + 8)), 8);
+      /* the pack works inside 128 bit lanes, put the quadwords back in order */
+      a = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+      _mm256_storeu_si256((__m256i *)d, _mm256_xor_si256(a, vflip));
+   }
+}
+
+#endif
+
+
+
+/* _simd_mix_to_16bit:
+ *  Clamps n values of the 24 bit mixing buffer and stores them as 16 bit
+ *  samples. Shifting down first lets the saturating pack do the clamping.
+ */
+void _simd_mix_to_16bit(void *dst, AL_CONST int *src, int n, int issigned)
+{
+   unsigned short *d = dst;
+   int flip = (issigned ? 0 : 0x8000);
+   __m128i vflip = _mm_set1_epi16(flip);
+   __m128i a, b;
+   int v;
+
+#ifdef ALLEGRO_SIMD_AVX2
+   if (cpu_capabilities & CPU_AVX2) {
+      avx2_mix_to_16bit(d, src, n, flip);
+      d += n & ~15;
+      src += n & ~15;
+      n &= 15;
+   }
+#endif
+
+   for (; n >= 8; n -= 8, src += 8, d += 8) {
+      a = _mm_srai_epi32(_mm_loadu_si128((AL_CONST __m128i *)src), 8);
+      b = _mm_srai_epi32(_mm_loadu_si128((AL_CONST __m128i *)(src + 4)), 8);
+      _mm_storeu_si128((__m128i *)d, _mm_xor_si128(_mm_packs_epi32(a, b), vflip));
+   }
+
+   for (; n > 0; n--) {
+      v = *(src++) >> 8;
+      v = MID(-0x8000, v, 0x7FFF);
+      *(d++) = (v ^ flip) & 0xFFFF;
+   }
+}
+
+
+
+/* _simd_mix_to_8bit:
+ *  Clamps n values of the 24 bit mixing buffer and stores them as 8 bit
+ *  samples.
+ */
+void _simd_mix_to_8bit(void *dst, AL_CONST int *src, int n, int issigned)
+{
+   unsigned char *d = dst;
+   int flip = (issigned ? 0 : 0x80);
+   __m128i vflip = _mm_set1_epi8(flip);
+   __m128i a, b, c, e;
+   int v;
+
+   for (; n >= 16; n -= 16, src += 16, d += 16) {
+      a = _mm_srai_epi32(_mm_loadu_si128((AL_CONST __m128i *)src), 16);
+      b = _mm_srai_epi32(_mm_loadu_si128((AL_CONST __m128i *)(src + 4)), 16);
+      c = _mm_srai_epi32(_mm_loadu_si128((AL_CONST __m128i *)(src + 8)), 16);
+      e = _mm_srai_epi32(_mm_loadu_si128((AL_CONST __m128i *)(src + 12)), 16);
+      a = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, e));
+      _mm_storeu_si128((__m128i *)d, _mm_xor_si128(a, vflip));
+   }
+
+   for (; n > 0; n--) {
+      v = *(src++) >> 16;
+      v = MID(-0x80, v, 0x7F);
+      *(d++) = (v ^ flip) & 0xFF;
+   }
+}
+
+
+
+/* _simd_mix_from_float:
+ *  Converts n values of the float mixing buffer, where the full scale is
+ *  -1.0 to 1.0, to the 24 bit one. This is where quality 3 clips.
+ */
+void _simd_mix_from_float(int *dst, AL_CONST float *src, int n)
+{
+   __m128 scale = _mm_set1_ps(0x800000);
+   __m128 lo = _mm_set1_ps(-0x800000);
+   __m128 hi = _mm_set1_ps(0x7FFFFF);
+   __m128 v;
+
+   for (; n >= 4; n -= 4, src += 4, dst += 4) {
+      v = _mm_mul_ps(_mm_loadu_ps(src), scale);
+      v = _mm_min_ps(_mm_max_ps(v, lo), hi);
+      _mm_storeu_si128((__m128i *)dst, _mm_cvtps_epi32(v));
+   }
+
+   for (; n > 0; n--) {
+      v = _mm_mul_ss(_mm_load_ss(src++), scale);
+      v = _mm_min_ss(_mm_max_ss(v, lo), hi);
+      *(dst++) = _mm_cvtss_si32(v);
+   }
+}
+
+#endif
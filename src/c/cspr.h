@@ -61,6 +61,23 @@ void FUNC_LINEAR_DRAW_SPRITE(BITMAP *dst, BITMAP *src, int dx, int dy)
       dybeg = dy;
    }
 
+#ifdef ALLEGRO_SIMD_SSE2
+   if (cpu_capabilities & CPU_SSE2) {
+      unsigned long mask = bitmap_mask_color(src);
+
+      bmp_select(dst);
+
+      for (y = 0; y < h; y++) {
+	 PIXEL_PTR s = OFFSET_PIXEL_PTR(src->line[sybeg + y], sxbeg);
+	 PIXEL_PTR d = OFFSET_PIXEL_PTR(bmp_write_line(dst, dybeg + y), dxbeg);
+	 FUNC_SIMD_MASKED_LINE(d, s, w, mask);
+      }
+
+      bmp_unwrite_line(dst);
+      return;
+   }
+#endif
+
    if (dst->id & (BMP_ID_VIDEO | BMP_ID_SYSTEM)) {
       bmp_select(dst);
 
@@ -226,6 +243,23 @@ void FUNC_LINEAR_DRAW_SPRITE_V_FLIP(BITMAP *dst, BITMAP *src, int dx, int dy)
       dybeg = dy + h - 1;
    }
 
+#ifdef ALLEGRO_SIMD_SSE2
+   if (cpu_capabilities & CPU_SSE2) {
+      unsigned long mask = bitmap_mask_color(src);
+
+      bmp_select(dst);
+
+      for (y = 0; y < h; y++) {
+	 PIXEL_PTR s = OFFSET_PIXEL_PTR(src->line[sybeg + y], sxbeg);
+	 PIXEL_PTR d = OFFSET_PIXEL_PTR(bmp_write_line(dst, dybeg - y), dxbeg);
+	 FUNC_SIMD_MASKED_LINE(d, s, w, mask);
+      }
+
+      bmp_unwrite_line(dst);
+      return;
+   }
+#endif
+
    if (dst->id & (BMP_ID_VIDEO | BMP_ID_SYSTEM)) {
       bmp_select(dst);
 
@@ -306,6 +340,23 @@ void FUNC_LINEAR_DRAW_SPRITE_H_FLIP(BITMAP *dst, BITMAP *src, int dx, int dy)
       dybeg = dy;
    }
 
+#ifdef ALLEGRO_SIMD_SSE2
+   if (cpu_capabilities & CPU_SSE2) {
+      unsigned long mask = bitmap_mask_color(src);
+
+      bmp_select(dst);
+
+      for (y = 0; y < h; y++) {
+	 PIXEL_PTR s = OFFSET_PIXEL_PTR(src->line[sybeg + y], sxbeg);
+	 PIXEL_PTR d = OFFSET_PIXEL_PTR(bmp_write_line(dst, dybeg + y), dxbeg);
+	 FUNC_SIMD_MASKED_FLIP_LINE(d, s, w, mask);
+      }
+
+      bmp_unwrite_line(dst);
+      return;
+   }
+#endif
+
    if (dst->id & (BMP_ID_VIDEO | BMP_ID_SYSTEM)) {
       bmp_select(dst);
 
@@ -390,6 +441,23 @@ void FUNC_LINEAR_DRAW_SPRITE_VH_FLIP(BITMAP *dst, BITMAP *src, int dx, int dy)
       dybeg = dy + h - 1;
    }
 
+#ifdef ALLEGRO_SIMD_SSE2
+   if (cpu_capabilities & CPU_SSE2) {
+      unsigned long mask = bitmap_mask_color(src);
+
+      bmp_select(dst);
+
+      for (y = 0; y < h; y++) {
+	 PIXEL_PTR s = OFFSET_PIXEL_PTR(src->line[sybeg + y], sxbeg);
+	 PIXEL_PTR d = OFFSET_PIXEL_PTR(bmp_write_line(dst, dybeg - y), dxbeg);
+	 FUNC_SIMD_MASKED_FLIP_LINE(d, s, w, mask);
+      }
+
+      bmp_unwrite_line(dst);
+      return;
+   }
+#endif
+
    if (dst->id & (BMP_ID_VIDEO | BMP_ID_SYSTEM)) {
       bmp_select(dst);
 
@@ -469,6 +537,26 @@ void FUNC_LINEAR_DRAW_TRANS_SPRITE(BITMAP *dst, BITMAP *src, int dx, int dy)
 
    blender = MAKE_DTS_BLENDER();
 
+#if (defined ALLEGRO_SIMD_SSE2) && (defined MAKE_SPAN_BLENDER)
+   if ((MAKE_SPAN_BLENDER()) && (cpu_capabilities & CPU_SSE2) &&
+       (src->vtable->color_depth == dst->vtable->color_depth) &&
+       ((unsigned int)_blender_alpha < 256)) {
+      AL_CONST BLENDER_SPAN *span = MAKE_SPAN_BLENDER();
+
+      bmp_select(dst);
+
+      for (y = 0; y < h; y++) {
+	 PIXEL_PTR s = OFFSET_PIXEL_PTR(src->line[sybeg + y], sxbeg);
+	 PIXEL_PTR ds = OFFSET_PIXEL_PTR(bmp_read_line(dst, dybeg + y), dxbeg);
+	 PIXEL_PTR dd = OFFSET_PIXEL_PTR(bmp_write_line(dst, dybeg + y), dxbeg);
+	 span->blend(dd, s, ds, w, _blender_alpha, TRUE);
+      }
+
+      bmp_unwrite_line(dst);
+      return;
+   }
+#endif
+
    if ((src->vtable->color_depth == 8) && (dst->vtable->color_depth != 8)) {
       bmp_select(dst);
 
@@ -656,6 +744,24 @@ void FUNC_LINEAR_DRAW_LIT_SPRITE(BITMAP *dst, BITMAP *src, int dx, int dy, int c
 
    blender = MAKE_DLS_BLENDER(color);
 
+#if (defined ALLEGRO_SIMD_SSE2) && (defined MAKE_SPAN_BLENDER)
+   if ((MAKE_SPAN_BLENDER()) && (cpu_capabilities & CPU_SSE2) &&
+       ((unsigned int)color < 256)) {
+      AL_CONST BLENDER_SPAN *span = MAKE_SPAN_BLENDER();
+
+      bmp_select(dst);
+
+      for (y = 0; y < h; y++) {
+	 PIXEL_PTR s = OFFSET_PIXEL_PTR(src->line[sybeg + y], sxbeg);
+	 PIXEL_PTR d = OFFSET_PIXEL_PTR(bmp_write_line(dst, dybeg + y), dxbeg);
+	 span->lit(d, s, w, SPAN_BLENDER_COL, color);
+      }
+
+      bmp_unwrite_line(dst);
+      return;
+   }
+#endif
+
    if (dst->id & (BMP_ID_VIDEO | BMP_ID_SYSTEM)) {
       bmp_select(dst);
 
@@ -18,6 +18,7 @@
 
 
 #include "allegro.h"
+#include "allegro/internal/aintern.h"
 
 
 
@@ -265,6 +266,9 @@ static void _al_stretch_blit(BITMAP *src, BITMAP *dst,
    if ((sw <= 0) || (sh <= 0) || (dw <= 0) || (dh <= 0))
       return;
 
+   /* the hook above belongs to the source, so tracking is done here */
+   _dirty_mark_area(dst, dx, dy, dx+dw-1, dy+dh-1);
+
    /* Find out which stretcher should be used */
    if (masked) {
       switch (bitmap_color_depth(dst)) {
@@ -924,6 +924,54 @@ unsigned long _blender_screen15(unsigned long x, unsigned long y, unsigned long
 
 
 
+/* set_blender_span:
+ *  Installs the SIMD span versions of the blender that was just selected,
+ *  for the color depths that have one. The 32 bit spans work a byte at a
+ *  time, so they are only usable if the 24 bit color shifts (which the 32
+ *  bit blenders go through) address whole bytes.
+ */
+static void set_blender_span(int mode)
+{
+#ifdef ALLEGRO_SIMD_SSE2
+
+   #ifdef ALLEGRO_COLOR16
+      if (mode == blender_mode_trans) {
+	 _blender_span15 = &_blender_span_trans15;
+	 _blender_span16 = &_blender_span_trans16;
+      }
+      else if (mode == blender_mode_dissolve) {
+	 _blender_span15 = &_blender_span_dissolve15;
+	 _blender_span16 = &_blender_span_dissolve16;
+      }
+   #endif
+
+   #ifdef ALLEGRO_COLOR32
+      if (mode == blender_mode_trans)
+	 _blender_span32 = &_blender_span_trans32;
+      else if (mode == blender_mode_dissolve)
+	 _blender_span32 = &_blender_span_dissolve32;
+      else if (mode == blender_mode_alpha) {
+	 if (_rgb_a_shift_32 == 24)
+	    _blender_span32 = &_blender_span_alpha32;
+      }
+      else if (((1 << _rgb_r_shift_24) | (1 << _rgb_g_shift_24) | (1 << _rgb_b_shift_24)) == 0x10101) {
+	 if (mode == blender_mode_add)
+	    _blender_span32 = &_blender_span_add32;
+	 else if (mode == blender_mode_multiply)
+	    _blender_span32 = &_blender_span_multiply32;
+	 else if (mode == blender_mode_screen)
+	    _blender_span32 = &_blender_span_screen32;
+      }
+   #endif
+
+   if (mode == blender_mode_dissolve)
+      _seed_blender_span();
+
+#endif
+}
+
+
+
 /* these functions are all the same, so we can generate them with a macro */
 #define SET_BLENDER_FUNC(name)                                 \
    void set_##name##_blender(int r, int g, int b, int a)       \
@@ -934,6 +982,7 @@ unsigned long _blender_screen15(unsigned long x, unsigned long y, unsigned long
 		       BF16(_blender_##name##16),              \
 		       BF24(_blender_##name##24),              \
 		       r, g, b, a);                            \
+      set_blender_span(blender_mode_##name);                   \
    }
 
 
@@ -1024,6 +1073,8 @@ void set_alpha_blender(void)
 
    set_blender_mode_ex(_blender_black, _blender_black, _blender_black,
 		       f32, f15, f16, f24, 0, 0, 0, 0);
+
+   set_blender_span(blender_mode_alpha);
 }
 
 
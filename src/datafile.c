@@ -136,12 +136,16 @@ static BITMAP *read_bitmap(PACKFILE *f, int bits, int allowconv)
 
       case 4:
 	 /* old format ST data */
-	 load_st_data(bmp->dat, w*h/2, f);
+	 _grow_scratch_mem(w*h);
+	 load_st_data(_scratch_mem, w*h/2, f);
+	 for (y=0; y<h; y++)
+	    memcpy(bmp->line[y], (unsigned char *)_scratch_mem + y*w, w);
 	 break;
 
       case 8:
 	 /* 256 color bitmap */
-	 pack_fread(bmp->dat, w*h, f);
+	 for (y=0; y<h; y++)
+	    pack_fread(bmp->line[y], w, f);
 
 	 break;
 
@@ -596,6 +600,10 @@ static SAMPLE *read_sample(PACKFILE *f)
    if (s->bits == 8) {
       s->data = read_block(f, s->len * ((s->stereo) ? 2 : 1), 0);
    }
+   else if (s->bits == 4) {
+      /* IMA ADPCM blocks are stored as they are */
+      s->data = read_block(f, _sample_data_size(4, s->stereo, s->len), 0);
+   }
    else {
       s->data = _AL_MALLOC_ATOMIC(s->len * sizeof(short) * ((s->stereo) ? 2 : 1));
       if (s->data) {
@@ -617,7 +625,7 @@ static SAMPLE *read_sample(PACKFILE *f)
    }
 
    LOCK_DATA(s, sizeof(SAMPLE));
-   LOCK_DATA(s->data, s->len * ((s->bits==8) ? 1 : sizeof(short)) * ((s->stereo) ? 2 : 1));
+   LOCK_DATA(s->data, _sample_data_size(s->bits, s->stereo, s->len));
 
    return s;
 }
@@ -665,6 +673,10 @@ static MIDI *read_midi(PACKFILE *f)
       }
    }
 
+   /* merge the tracks ready for playing, if the MIDI player is linked in */
+   if (_al_linker_midi)
+      _al_linker_midi->compile(m);
+
    return m;
 }
 
@@ -1115,7 +1127,7 @@ static void unload_sample(SAMPLE *s)
 {
    if (s) {
       if (s->data) {
-	 UNLOCK_DATA(s->data, s->len * ((s->bits==8) ? 1 : sizeof(short)) * ((s->stereo) ? 2 : 1));
+	 UNLOCK_DATA(s->data, _sample_data_size(s->bits, s->stereo, s->len));
 	 _AL_FREE(s->data);
       }
 
@@ -1134,6 +1146,9 @@ static void unload_midi(MIDI *m)
    int c;
 
    if (m) {
+      if (_al_linker_midi)
+	 _al_linker_midi->forget(m);
+
       for (c=0; c<MIDI_TRACKS; c++) {
 	 if (m->track[c].data) {
 	    UNLOCK_DATA(m->track[c].data, m->track[c].len);
@@ -2183,7 +2198,7 @@ static void initialise_datafile(DATAFILE *data)
 	 case DAT_SAMPLE:
 	    s = data[c].dat;
 	    LOCK_DATA(s, sizeof(SAMPLE));
-	    LOCK_DATA(s->data, s->len * ((s->bits==8) ? 1 : sizeof(short)) * ((s->stereo) ? 2 : 1));
+	    LOCK_DATA(s->data, _sample_data_size(s->bits, s->stereo, s->len));
 	    break;
 
 	 case DAT_MIDI:
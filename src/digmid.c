@@ -13,6 +13,11 @@
  *      By Shawn Hargreaves, based on code by Tom Novelli.
  *      Chris Robinson added some optimizations and the digmid_set_pan method.
  *
+ *      Patches stay loaded from one song to the next, up to a memory
+ *      budget. Where pthreads are available, they can also be loaded by a
+ *      background thread while the song plays, or when a note first needs
+ *      them.
+ *
  *      See readme.txt for copyright information.
  */
 
@@ -24,6 +29,10 @@
 #include "allegro.h"
 #include "allegro/internal/aintern.h"
 
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+   #include <pthread.h>
+#endif
+
 
 /* external interface to the Digmid driver */
 static int digmid_detect(int input);
@@ -85,6 +94,8 @@ typedef struct PATCH                /* Gravis PATCH structure */
    SAMPLE *sample[MAX_LAYERS];      /* the waveform data */
    PATCH_EXTRA *extra[MAX_LAYERS];  /* additional waveform information */
    int master_vol;                  /* overall volume level */
+   long size;                       /* memory used, in bytes */
+   int used;                        /* last song which wanted it */
 } PATCH;
 
 
@@ -92,6 +103,37 @@ typedef struct PATCH                /* Gravis PATCH structure */
 static PATCH *patch[256];
 
 
+/* the patch set, as listed by its index file (read by read_patch_index) */
+static char *patch_name[256];
+static int patch_drum[256];
+static char patch_dir[1024];
+static int patch_index = FALSE;
+
+
+/* bookkeeping for the memory budget */
+static long patch_total = 0;        /* bytes of loaded patches */
+static long patch_budget = 0;       /* digmid_cache setting, 0 = no limit */
+static int patch_song = 0;          /* counts calls to load_patches */
+static char patch_tried[256];       /* loaded, or failed to, this song */
+
+
+/* loading patches while the song plays */
+static int digmid_lazy = FALSE;
+
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+static pthread_mutex_t patch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t prefetch_thread;
+static char prefetch_todo[256];     /* patches to load in the background */
+static char prefetch_first[256];    /* patches notes are waiting for */
+static int prefetch_pending = FALSE;
+static int prefetch_quit = FALSE;
+#endif
+
+static volatile int prefetch_gen = 0;  /* changes with each new song */
+static volatile int prefetch_hurry = FALSE;  /* prefetch_first is set */
+
+
 /* frequency table (generated by digmid_init) */
 static long ftbl[130]; 
 
@@ -99,6 +141,7 @@ static long ftbl[130];
 /* stored information about active voices */
 typedef struct DIGMID_VOICE
 {
+   PATCH *p;
    SAMPLE *s;
    PATCH_EXTRA *e;
    int inst;
@@ -437,9 +480,14 @@ static PATCH *load_patch(PACKFILE *f, int drum)
    if (p) {
       LOCK_DATA(p, sizeof(PATCH));
 
+      p->size = sizeof(PATCH);
+
       for (i=0; i<p->samples; i++) {
 	 lock_sample(p->sample[i]);
 	 LOCK_DATA(p->extra[i], sizeof(PATCH_EXTRA));
+
+	 p->size += sizeof(SAMPLE) + sizeof(PATCH_EXTRA);
+	 p->size += p->sample[i]->len * ((p->sample[i]->bits == 8) ? 1 : sizeof(short));
       }
    }
 
@@ -513,31 +561,55 @@ static int parse_string(char *buf, char *argv[])
 
 
 
-/* digmid_load_patches:
- *  Reads the patches that are required by a particular song.
+/* lock_patches, unlock_patches:
+ *  Guard the patch table against the prefetch thread, when there is one.
  */
-static int digmid_load_patches(AL_CONST char *patches, AL_CONST char *drums)
+static void lock_patches(void)
+{
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+   if (digmid_lazy)
+      pthread_mutex_lock(&patch_mutex);
+#endif
+}
+
+END_OF_STATIC_FUNCTION(lock_patches);
+
+static void unlock_patches(void)
+{
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+   if (digmid_lazy)
+      pthread_mutex_unlock(&patch_mutex);
+#endif
+}
+
+END_OF_STATIC_FUNCTION(unlock_patches);
+
+
+
+/* read_patch_index:
+ *  Reads the index file of the patch set, noting which file each patch 
+ *  comes from. This is only done once, rather than for each song.
+ */
+static int read_patch_index(void)
 {
    PACKFILE *f;
-   char dir[1024], file[1024], buf[1024], filename[1024];
-   char todo[256][1024];
+   char file[1024], buf[1024];
    char *argv[16], *p;
    char tmp[128];
    int argc;
-   int patchnum, flag_num;
+   int patchnum, slot, flag_num;
    int drum_mode = FALSE;
    int override_mode = FALSE;
    int drum_start = 0;
-   int type, size;
-   int i, j, c;
+   int c;
 
-   if (!_digmid_find_patches(dir, sizeof(dir), file, sizeof(file)))
-      return -1;
+   if (patch_index)
+      return 0;
 
-   for (i=0; i<256; i++)
-      usetc(todo[i], 0);
+   if (!_digmid_find_patches(patch_dir, sizeof(patch_dir), file, sizeof(file)))
+      return -1;
 
-   ustrzcpy(buf, sizeof(buf), dir);
+   ustrzcpy(buf, sizeof(buf), patch_dir);
    ustrzcat(buf, sizeof(buf), file);
 
    f = pack_fopen(buf, F_READ);
@@ -575,17 +647,12 @@ static int digmid_load_patches(AL_CONST char *patches, AL_CONST char *drums)
 	       if (!drum_mode)
 		  patchnum--;
 
-	       if ((patchnum >= 0) && (patchnum < 128) &&
-		   (((drum_mode) && (drums[patchnum])) ||
-		    ((!drum_mode) && (patches[patchnum])))) {
-
-		  if (drum_mode)
-		     patchnum += drum_start;
+	       slot = (drum_mode) ? patchnum + drum_start : patchnum;
 
-		  if (!patch[patchnum]) {
-		     /* need to load this sample */
-		     ustrzcpy(todo[patchnum], sizeof(todo[patchnum]), argv[1]);
-		  }
+	       if ((patchnum >= 0) && (patchnum < 128) && 
+		   (slot >= 0) && (slot < 256) && (!patch_name[slot])) {
+		  patch_name[slot] = _ustrdup(argv[1], _al_malloc);
+		  patch_drum[slot] = (drum_mode) ? patchnum : -1;
 	       }
 	    }
 	 }
@@ -601,6 +668,74 @@ static int digmid_load_patches(AL_CONST char *patches, AL_CONST char *drums)
 
    pack_fclose(f);
 
+   patch_index = TRUE;
+   return 0;
+}
+
+
+
+/* got_patch:
+ *  Stores a patch which was loaded for the first slot of the list which
+ *  uses its file, sharing it with the other slots that use the same file.
+ *  The patch is thrown away if the slots were filled in the meantime.
+ */
+static void got_patch(AL_CONST char *todo, int first, PATCH *p)
+{
+   int used = FALSE;
+   int i;
+
+   lock_patches();
+
+   for (i=first; i<256; i++) {
+      if ((todo[i]) && (ustricmp(patch_name[i], patch_name[first]) == 0)) {
+	 patch_tried[i] = TRUE;
+
+	 if ((p) && (!patch[i])) {
+	    patch[i] = p;
+	    used = TRUE;
+	 }
+      }
+   }
+
+   if (used) {
+      p->used = patch_song;
+      patch_total += p->size;
+   }
+
+   unlock_patches();
+
+   if ((p) && (!used))
+      destroy_patch(p);
+}
+
+
+
+/* load_cancelled:
+ *  Tells the prefetch thread to stop loading the patches of generation
+ *  gen, because a new song was started or a note is waiting for another
+ *  patch. Loads with a negative gen always run to the end.
+ */
+static int load_cancelled(int gen)
+{
+   return ((gen >= 0) && ((gen != prefetch_gen) || (prefetch_hurry)));
+}
+
+
+
+/* load_patch_files:
+ *  Loads the patches for the slots flagged in todo. If gen isn't negative,
+ *  it gives up as soon as load_cancelled() says so.
+ */
+static int load_patch_files(AL_CONST char *todo, int gen)
+{
+   PACKFILE *f;
+   char dir[1024], buf[1024], filename[1024];
+   char tmp[128];
+   int type, size;
+   int i;
+
+   ustrzcpy(dir, sizeof(dir), patch_dir);
+
    if (ustrchr(dir, '#')) {
       /* read from a datafile */
       if ((ustrlen(dir) > 1) && (ugetat(dir, -1) == '#'))
@@ -623,7 +758,7 @@ static int digmid_load_patches(AL_CONST char *patches, AL_CONST char *drums)
       usetc(filename, 0);
 
       /* scan through the file */
-      while (!pack_feof(f)) {
+      while ((!pack_feof(f)) && (!load_cancelled(gen))) {
 	 type = pack_mgetl(f);
 
 	 if (type == DAT_PROPERTY) {
@@ -644,24 +779,14 @@ static int digmid_load_patches(AL_CONST char *patches, AL_CONST char *drums)
 	 else if (type == DAT_PATCH) {
 	    /* do we want this patch? */
 	    for (i=0; i<256; i++)
-	       if (ugetc(todo[i]) && (ustricmp(filename, todo[i]) == 0))
+	       if ((todo[i]) && (!patch[i]) && (ustricmp(filename, patch_name[i]) == 0))
 		  break;
 
 	    if (i < 256) {
 	       /* load this patch */
 	       f = pack_fopen_chunk(f, FALSE);
-	       patch[i] = load_patch(f, ((i > 127) ? (i - 127) : 0));
+	       got_patch(todo, i, load_patch(f, ((i > 127) ? (i - 127) : 0)));
 	       f = pack_fclose_chunk(f);
-
-	       for (j=i+1; j<256; j++) {
-		  /* share multiple copies of the instrument */
-		  if (ustricmp(todo[i], todo[j]) == 0) {
-		     patch[j] = patch[i];
-		     usetc(todo[j], 0);
-		  }
-	       }
-
-	       usetc(todo[i], 0);
 	    }
 	    else {
 	       /* skip unwanted patch */
@@ -675,33 +800,42 @@ static int digmid_load_patches(AL_CONST char *patches, AL_CONST char *drums)
 	    pack_fseek(f, size+4);
 	 }
       }
+
+      pack_fclose(f);
+
+      if (load_cancelled(gen))
+	 return 0;
+
+      /* don't look for the missing ones again */
+      lock_patches();
+      for (i=0; i<256; i++)
+	 if (todo[i])
+	    patch_tried[i] = TRUE;
+      unlock_patches();
    }
    else {
       /* read from regular disk files */
       for (i=0; i<256; i++) {
-	 if (ugetc(todo[i])) {
-	    if (is_relative_filename(todo[i])) {
+	 if (load_cancelled(gen))
+	    break;
+
+	 if ((todo[i]) && (!patch[i]) && (!patch_tried[i])) {
+	    if (is_relative_filename(patch_name[i])) {
 	       ustrzcpy(filename, sizeof(filename), dir);
-	       ustrzcat(filename, sizeof(filename), todo[i]);
+	       ustrzcat(filename, sizeof(filename), patch_name[i]);
             } else
-	       ustrzcpy(filename, sizeof(filename), todo[i]);
+	       ustrzcpy(filename, sizeof(filename), patch_name[i]);
 
 	    if (ugetc(get_extension(filename)) == 0)
 	       ustrzcat(filename, sizeof(filename), uconvert_ascii(".pat", tmp));
 
 	    f = pack_fopen(filename, F_READ);
 	    if (f) {
-	       patch[i] = load_patch(f, ((i > 127) ? (i - 127) : 0));
+	       got_patch(todo, i, load_patch(f, ((i > 127) ? (i - 127) : 0)));
 	       pack_fclose(f);
 	    }
-
-	    for (j=i+1; j<256; j++) {
-	       /* share multiple copies of the instrument */
-	       if (ustricmp(todo[i], todo[j]) == 0) {
-		  patch[j] = patch[i];
-		  usetc(todo[j], 0);
-	       }
-	    }
+	    else
+	       got_patch(todo, i, NULL);
 	 }
       }
    }
@@ -711,6 +845,175 @@ static int digmid_load_patches(AL_CONST char *patches, AL_CONST char *drums)
 
 
 
+/* patch_playing:
+ *  Checks whether any voice is still reading the samples of a patch.
+ */
+static int patch_playing(PATCH *p)
+{
+   int i, voice;
+
+   for (i=0; i<midi_digmid.voices; i++) {
+      if (digmid_voice[i].p == p) {
+	 voice = midi_digmid.basevoice + i;
+	 if ((voice_check(voice) == digmid_voice[i].s) && (voice_get_position(voice) >= 0))
+	    return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+
+
+/* trim_patches:
+ *  Frees the least recently used patches until they fit in the budget
+ *  again, sparing the ones the current song wants and any still playing.
+ */
+static void trim_patches(void)
+{
+   PATCH *p;
+   int i, j;
+
+   while ((patch_budget > 0) && (patch_total > patch_budget)) {
+      p = NULL;
+
+      for (i=0; i<256; i++) {
+	 if ((patch[i]) && (patch[i]->used != patch_song) &&
+	     ((!p) || (patch[i]->used < p->used)) && (!patch_playing(patch[i])))
+	    p = patch[i];
+      }
+
+      if (!p)
+	 break;
+
+      for (j=0; j<256; j++)
+	 if (patch[j] == p)
+	    patch[j] = NULL;
+
+      for (j=0; j<midi_digmid.voices; j++)
+	 if (digmid_voice[j].p == p)
+	    digmid_voice[j].p = NULL;
+
+      patch_total -= p->size;
+      destroy_patch(p);
+   }
+}
+
+
+
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+
+/* prefetch_proc:
+ *  Background thread which loads the patches of the current song, so they
+ *  are ready (mostly) before the first note which uses them. Patches that
+ *  a note is already waiting for go first, interrupting the song's list,
+ *  which is then picked up again where it left off.
+ */
+static void *prefetch_proc(void *arg)
+{
+   char todo[256];
+   int gen;
+
+   pthread_mutex_lock(&patch_mutex);
+
+   for (;;) {
+      while ((!prefetch_hurry) && (!prefetch_pending) && (!prefetch_quit))
+	 pthread_cond_wait(&prefetch_cond, &patch_mutex);
+
+      if (prefetch_quit)
+	 break;
+
+      if (prefetch_hurry) {
+	 memcpy(todo, prefetch_first, sizeof(todo));
+	 memset(prefetch_first, 0, sizeof(prefetch_first));
+	 prefetch_hurry = FALSE;
+	 gen = -1;
+      }
+      else {
+	 memcpy(todo, prefetch_todo, sizeof(todo));
+	 prefetch_pending = FALSE;
+	 gen = prefetch_gen;
+      }
+
+      pthread_mutex_unlock(&patch_mutex);
+      load_patch_files(todo, gen);
+      pthread_mutex_lock(&patch_mutex);
+
+      /* resume the song's list after the patches that cut in */
+      if ((gen >= 0) && (gen == prefetch_gen) && (prefetch_hurry))
+	 prefetch_pending = TRUE;
+   }
+
+   pthread_mutex_unlock(&patch_mutex);
+
+   return NULL;
+}
+
+#endif
+
+
+
+/* digmid_load_patches:
+ *  Reads the patches that are required by a particular song. With lazy 
+ *  loading, this just hands them over to the prefetch thread.
+ */
+static int digmid_load_patches(AL_CONST char *patches, AL_CONST char *drums)
+{
+   char todo[256];
+   int wanted, pending;
+   int i;
+
+   lock_patches();
+
+   if (read_patch_index() != 0) {
+      unlock_patches();
+      return -1;
+   }
+
+   patch_song++;
+   pending = FALSE;
+
+   for (i=0; i<256; i++) {
+      if (patch_name[i])
+	 wanted = (patch_drum[i] >= 0) ? drums[patch_drum[i]] : patches[i];
+      else
+	 wanted = FALSE;
+
+      if ((wanted) && (patch[i]))
+	 patch[i]->used = patch_song;
+
+      todo[i] = ((wanted) && (!patch[i]));
+      if (todo[i])
+	 pending = TRUE;
+
+      patch_tried[i] = FALSE;
+   }
+
+   /* make room, before loading anything else */
+   trim_patches();
+
+   prefetch_gen++;
+
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+   if (digmid_lazy) {
+      memcpy(prefetch_todo, todo, sizeof(todo));
+      memset(prefetch_first, 0, sizeof(prefetch_first));
+      prefetch_pending = pending;
+      prefetch_hurry = FALSE;
+      pthread_cond_signal(&prefetch_cond);
+   }
+#endif
+
+   unlock_patches();
+
+   if ((digmid_lazy) || (!pending))
+      return 0;
+
+   return load_patch_files(todo, -1);
+}
+
+
+
 /* digmid_freq:
  *  Helper for converting note numbers to sample frequencies.
  */ 
@@ -777,6 +1080,7 @@ static void digmid_trigger(int inst, int snum, int note, int bend, int vol, int
 
    /* store note information for later use */
    info = &digmid_voice[voice - midi_digmid.basevoice];
+   info->p = patch[inst];
    info->s = s;
    info->e = e;
    info->inst = inst;
@@ -799,6 +1103,26 @@ END_OF_STATIC_FUNCTION(digmid_trigger);
 
 
 
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+
+/* load_patch_now:
+ *  Loads a patch which is needed straight away, without waiting for the
+ *  prefetch thread to get around to it.
+ */
+static void load_patch_now(int inst)
+{
+   char todo[256];
+
+   memset(todo, 0, sizeof(todo));
+   todo[inst] = TRUE;
+
+   load_patch_files(todo, -1);
+}
+
+#endif
+
+
+
 /* digmid_key_on:
  *  Triggers the specified voice. The instrument is specified as a GM
  *  patch number, pitch as a midi note number, and volume from 0-127.
@@ -815,46 +1139,70 @@ static void digmid_key_on(int inst, int note, int bend, int vol, int pan)
    int diff;
    int i, c;
 
-   /* quit if instrument is not available */
-   if ((!patch[inst]) || (patch[inst]->samples < 1))
-      return;
-
-   /* adjust volume and pan ranges */
-   vol *= 2;
-   pan *= 2;
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+   /* when a driver renders the song by clocking the player itself, the
+    * note can wait for its instrument without anyone hearing the delay,
+    * and must do so for the output to come out the same every time
+    */
+   if ((digmid_lazy) && (_midi_clocked) && (!patch[inst]) && (patch_name[inst]) && (!patch_tried[inst]))
+      load_patch_now(inst);
+#endif
 
-   if (patch[inst]->samples == 1) {
-      /* only one sample to choose from */
-      digmid_trigger(inst, 0, note, bend, vol, pan);
+   lock_patches();
+
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+   /* otherwise this runs in the timer thread, so rather than loading a
+    * missing instrument here, move it to the front of the prefetch
+    * thread's list and drop the note
+    */
+   if ((digmid_lazy) && (!patch[inst]) && (patch_name[inst]) && (!patch_tried[inst])) {
+      prefetch_first[inst] = TRUE;
+      prefetch_hurry = TRUE;
+      pthread_cond_signal(&prefetch_cond);
    }
-   else {
-      /* find the sample(s) with best frequency range */
-      best = -1;
-      best_diff = INT_MAX;
-      c = 0;
-
-      for (i=0; i<patch[inst]->samples; i++) {
-	 freq = ftbl[note];
-	 e = patch[inst]->extra[i];
-
-	 if ((freq >= e->low_note) && (freq <= e->high_note)) {
-	    digmid_trigger(inst, i, note, bend, vol, pan);
-	    c++;
-	    if (c > 4)
-	       break;
-	 }
-	 else {
-	    diff = MIN(ABS(freq - e->low_note), ABS(freq - e->high_note));
-	    if (diff < best_diff) {
-	       best_diff = diff;
-	       best = i;
+#endif
+
+   /* skip it if the instrument is not available */
+   if ((patch[inst]) && (patch[inst]->samples >= 1)) {
+      /* adjust volume and pan ranges */
+      vol *= 2;
+      pan *= 2;
+
+      if (patch[inst]->samples == 1) {
+	 /* only one sample to choose from */
+	 digmid_trigger(inst, 0, note, bend, vol, pan);
+      }
+      else {
+	 /* find the sample(s) with best frequency range */
+	 best = -1;
+	 best_diff = INT_MAX;
+	 c = 0;
+
+	 for (i=0; i<patch[inst]->samples; i++) {
+	    freq = ftbl[note];
+	    e = patch[inst]->extra[i];
+
+	    if ((freq >= e->low_note) && (freq <= e->high_note)) {
+	       digmid_trigger(inst, i, note, bend, vol, pan);
+	       c++;
+	       if (c > 4)
+		  break;
+	    }
+	    else {
+	       diff = MIN(ABS(freq - e->low_note), ABS(freq - e->high_note));
+	       if (diff < best_diff) {
+		  best_diff = diff;
+		  best = i;
+	       }
 	    }
 	 }
-      }
 
-      if ((c <= 0) && (best >= 0))
-	 digmid_trigger(inst, best, note, bend, vol, pan);
+	 if ((c <= 0) && (best >= 0))
+	    digmid_trigger(inst, best, note, bend, vol, pan);
+      }
    }
+
+   unlock_patches();
 }
 
 END_OF_STATIC_FUNCTION(digmid_key_on);
@@ -990,13 +1338,21 @@ static int digmid_detect(int input)
  */
 static int digmid_init(int input, int voices)
 {
+   char tmp1[64], tmp2[64];
    float f;
    int i;
 
    midi_digmid.desc = get_config_text("Software wavetable synth");
 
-   for (i=0; i<256; i++)
+   for (i=0; i<256; i++) {
       patch[i] = NULL;
+      patch_name[i] = NULL;
+      patch_tried[i] = FALSE;
+   }
+
+   patch_index = FALSE;
+   patch_total = 0;
+   patch_budget = get_config_int(uconvert_ascii("sound", tmp1), uconvert_ascii("digmid_cache", tmp2), 0) * 1024L;
 
    midi_digmid.voices = voices;
 
@@ -1014,6 +1370,9 @@ static int digmid_init(int input, int voices)
    LOCK_VARIABLE(patch);
    LOCK_VARIABLE(ftbl);
    LOCK_VARIABLE(digmid_voice);
+   LOCK_VARIABLE(digmid_lazy);
+   LOCK_FUNCTION(lock_patches);
+   LOCK_FUNCTION(unlock_patches);
    LOCK_FUNCTION(digmid_freq);
    LOCK_FUNCTION(digmid_trigger);
    LOCK_FUNCTION(digmid_key_on);
@@ -1022,6 +1381,19 @@ static int digmid_init(int input, int voices)
    LOCK_FUNCTION(digmid_set_pitch);
    LOCK_FUNCTION(digmid_set_pan);
 
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+   /* load patches in the background, and as notes need them */
+   digmid_lazy = get_config_int(uconvert_ascii("sound", tmp1), uconvert_ascii("digmid_lazy", tmp2), FALSE);
+
+   if (digmid_lazy) {
+      prefetch_pending = FALSE;
+      prefetch_quit = FALSE;
+
+      if (pthread_create(&prefetch_thread, NULL, prefetch_proc, NULL) != 0)
+	 digmid_lazy = FALSE;
+   }
+#endif
+
    return 0;
 }
 
@@ -1034,6 +1406,19 @@ static void digmid_exit(int input)
 {
    int i, j;
 
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+   if (digmid_lazy) {
+      pthread_mutex_lock(&patch_mutex);
+      prefetch_quit = TRUE;
+      prefetch_gen++;
+      pthread_cond_signal(&prefetch_cond);
+      pthread_mutex_unlock(&patch_mutex);
+
+      pthread_join(prefetch_thread, NULL);
+      digmid_lazy = FALSE;
+   }
+#endif
+
    for (i=0; i<256; i++) {
       if (patch[i]) {
 	 for (j=i+1; j<256; j++) {
@@ -1043,7 +1428,18 @@ static void digmid_exit(int input)
 	 destroy_patch(patch[i]);
 	 patch[i] = NULL;
       }
+
+      if (patch_name[i]) {
+	 _AL_FREE(patch_name[i]);
+	 patch_name[i] = NULL;
+      }
    }
+
+   for (i=0; i<MIDI_VOICES; i++)
+      digmid_voice[i].p = NULL;
+
+   patch_index = FALSE;
+   patch_total = 0;
 }
 
 
@@ -0,0 +1,1235 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Dirty rectangle tracking for memory bitmaps.
+ *
+ *      A tracked bitmap gets its own copy of the drawing vtable, with
+ *      wrappers that remember the area touched by each primitive on a
+ *      grid of tiles. Direct line access through bmp_write_line() marks
+ *      the whole line. The marked tiles are later merged into a short list
+ *      of rectangles, so that only the parts of a back buffer which really
+ *      changed need to be copied to the screen.
+ *
+ *      The tracker is not thread safe. Renderers that draw onto a bitmap
+ *      from the worker threads suspend its tracking while they run, and
+ *      mark what the workers drew once they have all finished.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+
+#include <string.h>
+
+#include "allegro.h"
+#include "allegro/internal/aintern.h"
+
+
+#define TILE_SHIFT      4
+#define TILE_SIZE       (1 << TILE_SHIFT)
+
+
+typedef struct DIRTY_RECT
+{
+   int x, y, w, h;                  /* in tiles */
+} DIRTY_RECT;
+
+
+typedef struct DIRTY_TRACKER
+{
+   GFX_VTABLE vtable;               /* must come first: bmp->vtable points here */
+   GFX_VTABLE *orig;                /* the vtable we are wrapping */
+   void *write_bank;                /* original bank switcher of the bitmap */
+   BITMAP *bmp;                     /* the tracked bitmap */
+   int in_call;                     /* inside a wrapped primitive? */
+   int tiles_w, tiles_h;            /* size of the tile grid */
+   int count;                       /* number of marked tiles, roughly */
+   unsigned char *tile;             /* one byte per tile */
+   DIRTY_RECT *rect;                /* rectangles from the last merge */
+   int *open, *next_open;           /* scratch lists for merge_tiles() */
+   int rect_count;
+   int rect_size;
+   int merged;                      /* rect[] matches tile[]? */
+} DIRTY_TRACKER;
+
+
+#define TRACKER(bmp)    ((DIRTY_TRACKER *)(bmp)->vtable)
+
+
+#ifdef ALLEGRO_NO_ASM
+   #define DIRTY_WRITE_BANK      ((void *)_dirty_write_bank)
+#else
+   #define DIRTY_WRITE_BANK      ((void *)_dirty_write_bank_asm)
+#endif
+
+
+
+/* get_tracker:
+ *  Returns the tracker of a bitmap, or one of its sub-bitmaps, or NULL
+ *  if the bitmap is not tracked.
+ */
+static DIRTY_TRACKER *get_tracker(BITMAP *bmp)
+{
+   if (bmp->write_bank != DIRTY_WRITE_BANK)
+      return NULL;
+
+   return TRACKER(bmp);
+}
+
+
+
+/* mark_tiles:
+ *  Marks the tiles covering a rectangle, in coordinates of the tracked
+ *  bitmap. The corners are inclusive, and must already be clipped.
+ */
+static void mark_tiles(DIRTY_TRACKER *t, int x1, int y1, int x2, int y2)
+{
+   unsigned char *p;
+   int w, y;
+
+   x1 >>= TILE_SHIFT;
+   x2 >>= TILE_SHIFT;
+   y1 >>= TILE_SHIFT;
+   y2 >>= TILE_SHIFT;
+
+   w = x2 - x1 + 1;
+   p = t->tile + y1*t->tiles_w + x1;
+
+   for (y=y1; y<=y2; y++) {
+      memset(p, 1, w);
+      p += t->tiles_w;
+   }
+
+   t->count += w * (y2 - y1 + 1);
+   t->merged = FALSE;
+}
+
+
+
+/* mark_area:
+ *  Marks a rectangle given in coordinates of bmp, which is the tracked
+ *  bitmap or a sub-bitmap of it. The rectangle is clipped like the drawing
+ *  would have been, so that corners of shapes lying outside the clipping
+ *  rectangle don't dirty anything.
+ */
+static void mark_area(DIRTY_TRACKER *t, BITMAP *bmp, int x1, int y1, int x2, int y2)
+{
+   int cl, ct, cr, cb;
+
+   if (bmp->clip) {
+      cl = bmp->cl;
+      ct = bmp->ct;
+      cr = bmp->cr - 1;
+      cb = bmp->cb - 1;
+   }
+   else {
+      cl = 0;
+      ct = 0;
+      cr = bmp->w - 1;
+      cb = bmp->h - 1;
+   }
+
+   if (x1 < cl) x1 = cl;
+   if (y1 < ct) y1 = ct;
+   if (x2 > cr) x2 = cr;
+   if (y2 > cb) y2 = cb;
+
+   if ((x1 > x2) || (y1 > y2))
+      return;
+
+   x1 += bmp->x_ofs;
+   x2 += bmp->x_ofs;
+   y1 += bmp->y_ofs;
+   y2 += bmp->y_ofs;
+
+   /* sub-bitmaps may hang over the edges of their parent */
+   if (x1 < 0) x1 = 0;
+   if (y1 < 0) y1 = 0;
+   if (x2 >= t->bmp->w) x2 = t->bmp->w - 1;
+   if (y2 >= t->bmp->h) y2 = t->bmp->h - 1;
+
+   if ((x1 > x2) || (y1 > y2))
+      return;
+
+   mark_tiles(t, x1, y1, x2, y2);
+}
+
+
+
+/* enter_call:
+ *  Called by the wrappers before running the real primitive. Returns
+ *  TRUE for the outermost call, which is the one doing the marking, so
+ *  primitives built out of other vtable calls are only counted once.
+ */
+static INLINE int enter_call(DIRTY_TRACKER *t)
+{
+   if (t->in_call)
+      return FALSE;
+
+   t->in_call = TRUE;
+   return TRUE;
+}
+
+
+
+/* leave_call:
+ *  Called by the wrappers after the real primitive, with the unclipped
+ *  bounding box of what it drew.
+ */
+static INLINE void leave_call(DIRTY_TRACKER *t, BITMAP *bmp, int x1, int y1, int x2, int y2)
+{
+   t->in_call = FALSE;
+
+   if (x1 > x2) {
+      int tmp = x1;
+      x1 = x2;
+      x2 = tmp;
+   }
+
+   if (y1 > y2) {
+      int tmp = y1;
+      y1 = y2;
+      y2 = tmp;
+   }
+
+   mark_area(t, bmp, x1, y1, x2, y2);
+}
+
+
+
+/* leave_call_clip:
+ *  Like leave_call(), for primitives that may touch the whole clipping
+ *  rectangle.
+ */
+static void leave_call_clip(DIRTY_TRACKER *t, BITMAP *bmp)
+{
+   t->in_call = FALSE;
+   mark_area(t, bmp, 0, 0, bmp->w-1, bmp->h-1);
+}
+
+
+
+/* _dirty_write_bank:
+ *  Bank switcher of tracked bitmaps. Lines written directly, outside the
+ *  vtable primitives, are marked over their full width.
+ */
+uintptr_t _dirty_write_bank(BITMAP *bmp, int lyne)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int y;
+
+   if (!t->in_call) {
+      y = lyne + bmp->y_ofs;
+
+      if ((y >= 0) && (y < t->bmp->h))
+	 mark_tiles(t, 0, y, t->bmp->w-1, y);
+   }
+
+   return (uintptr_t)bmp->line[lyne];
+}
+
+
+
+/* Wrappers for the vtable. */
+
+static void dirty_putpixel(BITMAP *bmp, int x, int y, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->putpixel(bmp, x, y, color);
+
+   if (outer)
+      leave_call(t, bmp, x, y, x, y);
+}
+
+
+
+static void dirty_vline(BITMAP *bmp, int x, int y1, int y2, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->vline(bmp, x, y1, y2, color);
+
+   if (outer)
+      leave_call(t, bmp, x, y1, x, y2);
+}
+
+
+
+static void dirty_hline(BITMAP *bmp, int x1, int y, int x2, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->hline(bmp, x1, y, x2, color);
+
+   if (outer)
+      leave_call(t, bmp, x1, y, x2, y);
+}
+
+
+
+static void dirty_hfill(BITMAP *bmp, int x1, int y, int x2, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->hfill(bmp, x1, y, x2, color);
+
+   if (outer)
+      leave_call(t, bmp, x1, y, x2, y);
+}
+
+
+
+static void dirty_line(BITMAP *bmp, int x1, int y1, int x2, int y2, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->line(bmp, x1, y1, x2, y2, color);
+
+   if (outer)
+      leave_call(t, bmp, x1, y1, x2, y2);
+}
+
+
+
+static void dirty_fastline(BITMAP *bmp, int x1, int y1, int x2, int y2, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->fastline(bmp, x1, y1, x2, y2, color);
+
+   if (outer)
+      leave_call(t, bmp, x1, y1, x2, y2);
+}
+
+
+
+static void dirty_rectfill(BITMAP *bmp, int x1, int y1, int x2, int y2, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->rectfill(bmp, x1, y1, x2, y2, color);
+
+   if (outer)
+      leave_call(t, bmp, x1, y1, x2, y2);
+}
+
+
+
+static void dirty_rect(BITMAP *bmp, int x1, int y1, int x2, int y2, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->rect(bmp, x1, y1, x2, y2, color);
+
+   if (outer)
+      leave_call(t, bmp, x1, y1, x2, y2);
+}
+
+
+
+static void dirty_triangle(BITMAP *bmp, int x1, int y1, int x2, int y2, int x3, int y3, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->triangle(bmp, x1, y1, x2, y2, x3, y3, color);
+
+   if (outer)
+      leave_call(t, bmp, MIN(x1, MIN(x2, x3)), MIN(y1, MIN(y2, y3)),
+			 MAX(x1, MAX(x2, x3)), MAX(y1, MAX(y2, y3)));
+}
+
+
+
+static void dirty_polygon(BITMAP *bmp, int vertices, AL_CONST int *points, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+   int x1, y1, x2, y2, i;
+
+   t->orig->polygon(bmp, vertices, points, color);
+
+   if ((outer) && (vertices > 0)) {
+      x1 = x2 = points[0];
+      y1 = y2 = points[1];
+
+      for (i=1; i<vertices; i++) {
+	 x1 = MIN(x1, points[i*2]);
+	 x2 = MAX(x2, points[i*2]);
+	 y1 = MIN(y1, points[i*2+1]);
+	 y2 = MAX(y2, points[i*2+1]);
+      }
+
+      leave_call(t, bmp, x1, y1, x2, y2);
+   }
+   else if (outer)
+      t->in_call = FALSE;
+}
+
+
+
+static void dirty_circle(BITMAP *bmp, int x, int y, int radius, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->circle(bmp, x, y, radius, color);
+
+   if (outer)
+      leave_call(t, bmp, x-radius, y-radius, x+radius, y+radius);
+}
+
+
+
+static void dirty_circlefill(BITMAP *bmp, int x, int y, int radius, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->circlefill(bmp, x, y, radius, color);
+
+   if (outer)
+      leave_call(t, bmp, x-radius, y-radius, x+radius, y+radius);
+}
+
+
+
+static void dirty_ellipse(BITMAP *bmp, int x, int y, int rx, int ry, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->ellipse(bmp, x, y, rx, ry, color);
+
+   if (outer)
+      leave_call(t, bmp, x-rx, y-ry, x+rx, y+ry);
+}
+
+
+
+static void dirty_ellipsefill(BITMAP *bmp, int x, int y, int rx, int ry, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->ellipsefill(bmp, x, y, rx, ry, color);
+
+   if (outer)
+      leave_call(t, bmp, x-rx, y-ry, x+rx, y+ry);
+}
+
+
+
+static void dirty_arc(BITMAP *bmp, int x, int y, fixed ang1, fixed ang2, int r, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->arc(bmp, x, y, ang1, ang2, r, color);
+
+   if (outer)
+      leave_call(t, bmp, x-r, y-r, x+r, y+r);
+}
+
+
+
+static void dirty_spline(BITMAP *bmp, AL_CONST int points[8], int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->spline(bmp, points, color);
+
+   /* a Bezier curve stays inside the hull of its control points */
+   if (outer)
+      leave_call(t, bmp, MIN(MIN(points[0], points[2]), MIN(points[4], points[6])),
+			 MIN(MIN(points[1], points[3]), MIN(points[5], points[7])),
+			 MAX(MAX(points[0], points[2]), MAX(points[4], points[6])),
+			 MAX(MAX(points[1], points[3]), MAX(points[5], points[7])));
+}
+
+
+
+static void dirty_floodfill(BITMAP *bmp, int x, int y, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->floodfill(bmp, x, y, color);
+
+   if (outer)
+      leave_call_clip(t, bmp);
+}
+
+
+
+static void dirty_clear_to_color(BITMAP *bmp, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->clear_to_color(bmp, color);
+
+   if (outer)
+      leave_call_clip(t, bmp);
+}
+
+
+
+#define DIRTY_SPRITE_WRAPPER(name)                                            \
+static void dirty_##name(BITMAP *bmp, BITMAP *sprite, int x, int y)           \
+{                                                                             \
+   DIRTY_TRACKER *t = TRACKER(bmp);                                           \
+   int outer = enter_call(t);                                                 \
+									      \
+   t->orig->name(bmp, sprite, x, y);                                          \
+									      \
+   if (outer)                                                                 \
+      leave_call(t, bmp, x, y, x+sprite->w-1, y+sprite->h-1);                 \
+}
+
+
+DIRTY_SPRITE_WRAPPER(draw_sprite)
+DIRTY_SPRITE_WRAPPER(draw_256_sprite)
+DIRTY_SPRITE_WRAPPER(draw_sprite_v_flip)
+DIRTY_SPRITE_WRAPPER(draw_sprite_h_flip)
+DIRTY_SPRITE_WRAPPER(draw_sprite_vh_flip)
+DIRTY_SPRITE_WRAPPER(draw_trans_sprite)
+DIRTY_SPRITE_WRAPPER(draw_trans_rgba_sprite)
+
+
+
+static void dirty_draw_lit_sprite(BITMAP *bmp, BITMAP *sprite, int x, int y, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->draw_lit_sprite(bmp, sprite, x, y, color);
+
+   if (outer)
+      leave_call(t, bmp, x, y, x+sprite->w-1, y+sprite->h-1);
+}
+
+
+
+static void dirty_draw_character(BITMAP *bmp, BITMAP *sprite, int x, int y, int color, int bg)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->draw_character(bmp, sprite, x, y, color, bg);
+
+   if (outer)
+      leave_call(t, bmp, x, y, x+sprite->w-1, y+sprite->h-1);
+}
+
+
+
+static void dirty_draw_glyph(BITMAP *bmp, AL_CONST FONT_GLYPH *glyph, int x, int y, int color, int bg)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->draw_glyph(bmp, glyph, x, y, color, bg);
+
+   if (outer)
+      leave_call(t, bmp, x, y, x+glyph->w-1, y+glyph->h-1);
+}
+
+
+
+static void dirty_draw_gouraud_sprite(BITMAP *bmp, BITMAP *sprite, int x, int y, int c1, int c2, int c3, int c4)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->draw_gouraud_sprite(bmp, sprite, x, y, c1, c2, c3, c4);
+
+   if (outer)
+      leave_call(t, bmp, x, y, x+sprite->w-1, y+sprite->h-1);
+}
+
+
+
+#define DIRTY_RLE_WRAPPER(name)                                               \
+static void dirty_##name(BITMAP *bmp, AL_CONST RLE_SPRITE *sprite, int x, int y) \
+{                                                                             \
+   DIRTY_TRACKER *t = TRACKER(bmp);                                           \
+   int outer = enter_call(t);                                                 \
+									      \
+   t->orig->name(bmp, sprite, x, y);                                          \
+									      \
+   if (outer)                                                                 \
+      leave_call(t, bmp, x, y, x+sprite->w-1, y+sprite->h-1);                 \
+}
+
+
+DIRTY_RLE_WRAPPER(draw_rle_sprite)
+DIRTY_RLE_WRAPPER(draw_trans_rle_sprite)
+DIRTY_RLE_WRAPPER(draw_trans_rgba_rle_sprite)
+
+
+
+static void dirty_draw_lit_rle_sprite(BITMAP *bmp, AL_CONST RLE_SPRITE *sprite, int x, int y, int color)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->draw_lit_rle_sprite(bmp, sprite, x, y, color);
+
+   if (outer)
+      leave_call(t, bmp, x, y, x+sprite->w-1, y+sprite->h-1);
+}
+
+
+
+/* The blitters are called through the vtable of the destination, except
+ * blit_to_memory and blit_to_system, which belong to the source and so
+ * never draw onto a tracked bitmap.
+ */
+#define DIRTY_BLIT_WRAPPER(name)                                              \
+static void dirty_##name(BITMAP *src, BITMAP *dest, int s_x, int s_y,         \
+			 int d_x, int d_y, int w, int h)                      \
+{                                                                             \
+   DIRTY_TRACKER *t = TRACKER(dest);                                          \
+   int outer = enter_call(t);                                                 \
+									      \
+   t->orig->name(src, dest, s_x, s_y, d_x, d_y, w, h);                        \
+									      \
+   if (outer)                                                                 \
+      leave_call(t, dest, d_x, d_y, d_x+w-1, d_y+h-1);                        \
+}
+
+
+DIRTY_BLIT_WRAPPER(blit_from_memory)
+DIRTY_BLIT_WRAPPER(blit_from_system)
+DIRTY_BLIT_WRAPPER(blit_to_self)
+DIRTY_BLIT_WRAPPER(blit_to_self_forward)
+DIRTY_BLIT_WRAPPER(blit_to_self_backward)
+DIRTY_BLIT_WRAPPER(blit_between_formats)
+DIRTY_BLIT_WRAPPER(masked_blit)
+
+
+
+static void dirty_pivot_scaled_sprite_flip(BITMAP *bmp, BITMAP *sprite, fixed x, fixed y, fixed cx,
+					   fixed cy, fixed angle, fixed scale, int v_flip)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+   fixed xs[4], ys[4];
+   fixed x1, y1, x2, y2;
+   int i;
+
+   t->orig->pivot_scaled_sprite_flip(bmp, sprite, x, y, cx, cy, angle, scale, v_flip);
+
+   if (outer) {
+      _rotate_scale_flip_coordinates(sprite->w << 16, sprite->h << 16,
+				     x, y, cx, cy, angle, scale, scale,
+				     FALSE, v_flip, xs, ys);
+
+      x1 = x2 = xs[0];
+      y1 = y2 = ys[0];
+
+      for (i=1; i<4; i++) {
+	 x1 = MIN(x1, xs[i]);
+	 x2 = MAX(x2, xs[i]);
+	 y1 = MIN(y1, ys[i]);
+	 y2 = MAX(y2, ys[i]);
+      }
+
+      leave_call(t, bmp, (x1 >> 16) - 1, (y1 >> 16) - 1, (x2 >> 16) + 1, (y2 >> 16) + 1);
+   }
+}
+
+
+
+/* float_bound:
+ *  Converts a floating point vertex coordinate to an integer, without
+ *  overflowing on silly values.
+ */
+static int float_bound(float f)
+{
+   if (f < -65536.0)
+      return -65536;
+
+   if (f > 65536.0)
+      return 65536;
+
+   return (int)f;
+}
+
+
+
+/* leave_call_v3d:
+ *  Marks the bounding box of a 3d polygon. The scanline fillers round
+ *  the edges, so the box is grown by a pixel on each side.
+ */
+static void leave_call_v3d(DIRTY_TRACKER *t, BITMAP *bmp, int vc, V3D *vtx[])
+{
+   fixed x1, y1, x2, y2;
+   int i;
+
+   x1 = x2 = vtx[0]->x;
+   y1 = y2 = vtx[0]->y;
+
+   for (i=1; i<vc; i++) {
+      x1 = MIN(x1, vtx[i]->x);
+      x2 = MAX(x2, vtx[i]->x);
+      y1 = MIN(y1, vtx[i]->y);
+      y2 = MAX(y2, vtx[i]->y);
+   }
+
+   leave_call(t, bmp, (x1 >> 16) - 1, (y1 >> 16) - 1, (x2 >> 16) + 1, (y2 >> 16) + 1);
+}
+
+
+
+/* leave_call_v3d_f:
+ *  Floating point version of leave_call_v3d().
+ */
+static void leave_call_v3d_f(DIRTY_TRACKER *t, BITMAP *bmp, int vc, V3D_f *vtx[])
+{
+   float x1, y1, x2, y2;
+   int i;
+
+   x1 = x2 = vtx[0]->x;
+   y1 = y2 = vtx[0]->y;
+
+   for (i=1; i<vc; i++) {
+      x1 = MIN(x1, vtx[i]->x);
+      x2 = MAX(x2, vtx[i]->x);
+      y1 = MIN(y1, vtx[i]->y);
+      y2 = MAX(y2, vtx[i]->y);
+   }
+
+   leave_call(t, bmp, float_bound(x1) - 1, float_bound(y1) - 1, float_bound(x2) + 1, float_bound(y2) + 1);
+}
+
+
+
+static void dirty_polygon3d(BITMAP *bmp, int type, BITMAP *texture, int vc, V3D *vtx[])
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->polygon3d(bmp, type, texture, vc, vtx);
+
+   if ((outer) && (vc > 0))
+      leave_call_v3d(t, bmp, vc, vtx);
+   else if (outer)
+      t->in_call = FALSE;
+}
+
+
+
+static void dirty_polygon3d_f(BITMAP *bmp, int type, BITMAP *texture, int vc, V3D_f *vtx[])
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+
+   t->orig->polygon3d_f(bmp, type, texture, vc, vtx);
+
+   if ((outer) && (vc > 0))
+      leave_call_v3d_f(t, bmp, vc, vtx);
+   else if (outer)
+      t->in_call = FALSE;
+}
+
+
+
+static void dirty_triangle3d(BITMAP *bmp, int type, BITMAP *texture, V3D *v1, V3D *v2, V3D *v3)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+   V3D *vtx[3];
+
+   t->orig->triangle3d(bmp, type, texture, v1, v2, v3);
+
+   if (outer) {
+      vtx[0] = v1;
+      vtx[1] = v2;
+      vtx[2] = v3;
+      leave_call_v3d(t, bmp, 3, vtx);
+   }
+}
+
+
+
+static void dirty_triangle3d_f(BITMAP *bmp, int type, BITMAP *texture, V3D_f *v1, V3D_f *v2, V3D_f *v3)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+   V3D_f *vtx[3];
+
+   t->orig->triangle3d_f(bmp, type, texture, v1, v2, v3);
+
+   if (outer) {
+      vtx[0] = v1;
+      vtx[1] = v2;
+      vtx[2] = v3;
+      leave_call_v3d_f(t, bmp, 3, vtx);
+   }
+}
+
+
+
+static void dirty_quad3d(BITMAP *bmp, int type, BITMAP *texture, V3D *v1, V3D *v2, V3D *v3, V3D *v4)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+   V3D *vtx[4];
+
+   t->orig->quad3d(bmp, type, texture, v1, v2, v3, v4);
+
+   if (outer) {
+      vtx[0] = v1;
+      vtx[1] = v2;
+      vtx[2] = v3;
+      vtx[3] = v4;
+      leave_call_v3d(t, bmp, 4, vtx);
+   }
+}
+
+
+
+static void dirty_quad3d_f(BITMAP *bmp, int type, BITMAP *texture, V3D_f *v1, V3D_f *v2, V3D_f *v3, V3D_f *v4)
+{
+   DIRTY_TRACKER *t = TRACKER(bmp);
+   int outer = enter_call(t);
+   V3D_f *vtx[4];
+
+   t->orig->quad3d_f(bmp, type, texture, v1, v2, v3, v4);
+
+   if (outer) {
+      vtx[0] = v1;
+      vtx[1] = v2;
+      vtx[2] = v3;
+      vtx[3] = v4;
+      leave_call_v3d_f(t, bmp, 4, vtx);
+   }
+}
+
+
+
+/* merge_tiles:
+ *  Turns the marked tiles into rectangles. Each row of tiles is split
+ *  into runs, and a run continues the rectangle above it when both cover
+ *  exactly the same columns, so a dirty area made of whole rectangles
+ *  comes out as those same rectangles.
+ */
+static void merge_tiles(DIRTY_TRACKER *t)
+{
+   unsigned char *row;
+   int open_count, next_count;
+   int x, y, start, i, j;
+   int *tmp;
+
+   t->rect_count = 0;
+   t->merged = TRUE;
+
+   if (!t->count)
+      return;
+
+   open_count = 0;
+
+   for (y=0; y<t->tiles_h; y++) {
+      row = t->tile + y*t->tiles_w;
+      next_count = 0;
+      i = 0;
+      x = 0;
+
+      while (x < t->tiles_w) {
+	 if (!row[x]) {
+	    x++;
+	    continue;
+	 }
+
+	 start = x;
+	 while ((x < t->tiles_w) && (row[x]))
+	    x++;
+
+	 /* the open rectangles are sorted by x, like the runs */
+	 while ((i < open_count) && (t->rect[t->open[i]].x < start))
+	    i++;
+
+	 if ((i < open_count) && (t->rect[t->open[i]].x == start) &&
+	     (t->rect[t->open[i]].w == x - start)) {
+	    j = t->open[i++];
+	    t->rect[j].h++;
+	 }
+	 else {
+	    if (t->rect_count >= t->rect_size) {
+	       DIRTY_RECT *r = _AL_REALLOC(t->rect, sizeof(DIRTY_RECT) * t->rect_size * 2);
+	       if (!r) {
+		  /* out of memory: fall back to one rectangle for everything */
+		  t->rect[0].x = t->rect[0].y = 0;
+		  t->rect[0].w = t->tiles_w;
+		  t->rect[0].h = t->tiles_h;
+		  t->rect_count = 1;
+		  return;
+	       }
+	       t->rect = r;
+	       t->rect_size *= 2;
+	    }
+
+	    j = t->rect_count++;
+	    t->rect[j].x = start;
+	    t->rect[j].y = y;
+	    t->rect[j].w = x - start;
+	    t->rect[j].h = 1;
+	 }
+
+	 t->next_open[next_count++] = j;
+      }
+
+      tmp = t->open;
+      t->open = t->next_open;
+      t->next_open = tmp;
+      open_count = next_count;
+   }
+}
+
+
+
+/* enable_dirty_tracking:
+ *  Starts recording which parts of a memory bitmap are drawn onto.
+ */
+int enable_dirty_tracking(BITMAP *bmp)
+{
+   DIRTY_TRACKER *t;
+   int tiles_w, tiles_h;
+   ASSERT(bmp);
+
+   if ((!is_memory_bitmap(bmp)) || (is_sub_bitmap(bmp)) || (get_tracker(bmp)))
+      return -1;
+
+   tiles_w = (bmp->w + TILE_SIZE - 1) >> TILE_SHIFT;
+   tiles_h = (bmp->h + TILE_SIZE - 1) >> TILE_SHIFT;
+
+   t = _AL_MALLOC(sizeof(DIRTY_TRACKER));
+   if (!t)
+      return -1;
+
+   t->tile = _AL_MALLOC(MAX(tiles_w * tiles_h, 1));
+   t->open = _AL_MALLOC(sizeof(int) * (tiles_w + 1));
+   t->next_open = _AL_MALLOC(sizeof(int) * (tiles_w + 1));
+   t->rect_size = 16;
+   t->rect = _AL_MALLOC(sizeof(DIRTY_RECT) * t->rect_size);
+
+   if ((!t->tile) || (!t->open) || (!t->next_open) || (!t->rect)) {
+      if (t->tile)
+	 _AL_FREE(t->tile);
+      if (t->open)
+	 _AL_FREE(t->open);
+      if (t->next_open)
+	 _AL_FREE(t->next_open);
+      if (t->rect)
+	 _AL_FREE(t->rect);
+      _AL_FREE(t);
+      return -1;
+   }
+
+   memcpy(&t->vtable, bmp->vtable, sizeof(GFX_VTABLE));
+   t->orig = bmp->vtable;
+   t->write_bank = bmp->write_bank;
+   t->bmp = bmp;
+   t->in_call = FALSE;
+   t->tiles_w = tiles_w;
+   t->tiles_h = tiles_h;
+
+   t->vtable.putpixel = dirty_putpixel;
+   t->vtable.vline = dirty_vline;
+   t->vtable.hline = dirty_hline;
+   t->vtable.hfill = dirty_hfill;
+   t->vtable.line = dirty_line;
+   t->vtable.fastline = dirty_fastline;
+   t->vtable.rectfill = dirty_rectfill;
+   t->vtable.triangle = dirty_triangle;
+   t->vtable.draw_sprite = dirty_draw_sprite;
+   t->vtable.draw_256_sprite = dirty_draw_256_sprite;
+   t->vtable.draw_sprite_v_flip = dirty_draw_sprite_v_flip;
+   t->vtable.draw_sprite_h_flip = dirty_draw_sprite_h_flip;
+   t->vtable.draw_sprite_vh_flip = dirty_draw_sprite_vh_flip;
+   t->vtable.draw_trans_sprite = dirty_draw_trans_sprite;
+   t->vtable.draw_trans_rgba_sprite = dirty_draw_trans_rgba_sprite;
+   t->vtable.draw_lit_sprite = dirty_draw_lit_sprite;
+   t->vtable.draw_rle_sprite = dirty_draw_rle_sprite;
+   t->vtable.draw_trans_rle_sprite = dirty_draw_trans_rle_sprite;
+   t->vtable.draw_trans_rgba_rle_sprite = dirty_draw_trans_rgba_rle_sprite;
+   t->vtable.draw_lit_rle_sprite = dirty_draw_lit_rle_sprite;
+   t->vtable.draw_character = dirty_draw_character;
+   t->vtable.draw_glyph = dirty_draw_glyph;
+   t->vtable.blit_from_memory = dirty_blit_from_memory;
+   t->vtable.blit_from_system = dirty_blit_from_system;
+   t->vtable.blit_to_self = dirty_blit_to_self;
+   t->vtable.blit_to_self_forward = dirty_blit_to_self_forward;
+   t->vtable.blit_to_self_backward = dirty_blit_to_self_backward;
+   t->vtable.blit_between_formats = dirty_blit_between_formats;
+   t->vtable.masked_blit = dirty_masked_blit;
+   t->vtable.clear_to_color = dirty_clear_to_color;
+   t->vtable.pivot_scaled_sprite_flip = dirty_pivot_scaled_sprite_flip;
+   t->vtable.draw_gouraud_sprite = dirty_draw_gouraud_sprite;
+   t->vtable.polygon = dirty_polygon;
+   t->vtable.rect = dirty_rect;
+   t->vtable.circle = dirty_circle;
+   t->vtable.circlefill = dirty_circlefill;
+   t->vtable.ellipse = dirty_ellipse;
+   t->vtable.ellipsefill = dirty_ellipsefill;
+   t->vtable.arc = dirty_arc;
+   t->vtable.spline = dirty_spline;
+   t->vtable.floodfill = dirty_floodfill;
+   t->vtable.polygon3d = dirty_polygon3d;
+   t->vtable.polygon3d_f = dirty_polygon3d_f;
+   t->vtable.triangle3d = dirty_triangle3d;
+   t->vtable.triangle3d_f = dirty_triangle3d_f;
+   t->vtable.quad3d = dirty_quad3d;
+   t->vtable.quad3d_f = dirty_quad3d_f;
+
+   bmp->vtable = &t->vtable;
+   bmp->write_bank = DIRTY_WRITE_BANK;
+
+   /* everything counts as changed until the first clear */
+   mark_tiles(t, 0, 0, bmp->w-1, bmp->h-1);
+
+   return 0;
+}
+
+
+
+/* disable_dirty_tracking:
+ *  Stops tracking a bitmap. Sub-bitmaps created while the tracking was
+ *  enabled must have been destroyed before.
+ */
+void disable_dirty_tracking(BITMAP *bmp)
+{
+   DIRTY_TRACKER *t;
+   ASSERT(bmp);
+
+   t = get_tracker(bmp);
+   if ((!t) || (t->bmp != bmp))
+      return;
+
+   bmp->vtable = t->orig;
+   bmp->write_bank = t->write_bank;
+
+   _AL_FREE(t->tile);
+   _AL_FREE(t->open);
+   _AL_FREE(t->next_open);
+   _AL_FREE(t->rect);
+   _AL_FREE(t);
+}
+
+
+
+/* mark_dirty_rect:
+ *  Marks an area of a tracked bitmap as changed, for drawing done behind
+ *  the back of the vtable, like writing to bmp->line[] directly.
+ */
+void mark_dirty_rect(BITMAP *bmp, int x, int y, int w, int h)
+{
+   DIRTY_TRACKER *t;
+   ASSERT(bmp);
+
+   t = get_tracker(bmp);
+   if ((!t) || (w <= 0) || (h <= 0))
+      return;
+
+   x += bmp->x_ofs;
+   y += bmp->y_ofs;
+
+   if (x < 0) {
+      w += x;
+      x = 0;
+   }
+
+   if (y < 0) {
+      h += y;
+      y = 0;
+   }
+
+   if (x + w > t->bmp->w)
+      w = t->bmp->w - x;
+
+   if (y + h > t->bmp->h)
+      h = t->bmp->h - y;
+
+   if ((w > 0) && (h > 0))
+      mark_tiles(t, x, y, x+w-1, y+h-1);
+}
+
+
+
+/* _dirty_mark_area:
+ *  Marks a clipped rectangle of bmp if it is tracked. This is for drawing
+ *  which doesn't go through the vtable of the destination: stretch_blit()
+ *  only has a hook in the vtable of the source bitmap.
+ */
+void _dirty_mark_area(BITMAP *bmp, int x1, int y1, int x2, int y2)
+{
+   DIRTY_TRACKER *t = get_tracker(bmp);
+
+   if (t)
+      mark_area(t, bmp, x1, y1, x2, y2);
+}
+
+
+
+/* _dirty_suspend:
+ *  Points bmp back at its original vtable and bank switcher, so worker
+ *  threads can draw onto it without touching the tracker. Returns the
+ *  tracker, to be passed to _dirty_resume() after the workers are done,
+ *  or NULL if bmp is not tracked. The caller has to mark the areas that
+ *  were drawn with _dirty_mark_area() once tracking is resumed.
+ */
+void *_dirty_suspend(BITMAP *bmp)
+{
+   DIRTY_TRACKER *t = get_tracker(bmp);
+
+   if (t) {
+      bmp->vtable = t->orig;
+      bmp->write_bank = t->write_bank;
+   }
+
+   return t;
+}
+
+
+
+/* _dirty_resume:
+ *  Turns tracking back on after _dirty_suspend().
+ */
+void _dirty_resume(BITMAP *bmp, void *tracker)
+{
+   DIRTY_TRACKER *t = tracker;
+
+   if (t) {
+      bmp->vtable = &t->vtable;
+      bmp->write_bank = DIRTY_WRITE_BANK;
+   }
+}
+
+
+
+/* clear_dirty_rects:
+ *  Forgets everything that has been drawn so far.
+ */
+void clear_dirty_rects(BITMAP *bmp)
+{
+   DIRTY_TRACKER *t;
+   ASSERT(bmp);
+
+   t = get_tracker(bmp);
+   if ((!t) || (!t->count))
+      return;
+
+   memset(t->tile, 0, t->tiles_w * t->tiles_h);
+   t->count = 0;
+   t->rect_count = 0;
+   t->merged = TRUE;
+}
+
+
+
+/* get_dirty_rects:
+ *  Stores up to max rectangles as x, y, w, h quadruples in rects, and
+ *  returns how many there are in total. Coordinates are relative to the
+ *  tracked bitmap, not to the sub-bitmap that may be passed in. An
+ *  untracked bitmap counts as one big dirty rectangle.
+ */
+int get_dirty_rects(BITMAP *bmp, int *rects, int max)
+{
+   DIRTY_TRACKER *t;
+   DIRTY_RECT *r;
+   int i;
+   ASSERT(bmp);
+   ASSERT((rects) || (max <= 0));
+
+   t = get_tracker(bmp);
+
+   if (!t) {
+      if (max > 0) {
+	 rects[0] = 0;
+	 rects[1] = 0;
+	 rects[2] = bmp->w;
+	 rects[3] = bmp->h;
+      }
+      return 1;
+   }
+
+   if (!t->merged)
+      merge_tiles(t);
+
+   for (i=0; (i<t->rect_count) && (i<max); i++) {
+      r = &t->rect[i];
+      rects[i*4+0] = r->x << TILE_SHIFT;
+      rects[i*4+1] = r->y << TILE_SHIFT;
+      rects[i*4+2] = MIN(r->w << TILE_SHIFT, t->bmp->w - rects[i*4+0]);
+      rects[i*4+3] = MIN(r->h << TILE_SHIFT, t->bmp->h - rects[i*4+1]);
+   }
+
+   return t->rect_count;
+}
+
+
+
+/* blit_dirty_rects:
+ *  Copies the changed parts of a tracked bitmap to dest, at dest_x and
+ *  dest_y, and clears the dirty list. Returns the number of rectangles
+ *  copied. This is how a tracked back buffer is meant to be shown: the
+ *  screen blitters of drivers that convert or upload the picture, like
+ *  X11 or fbcon in a different color depth, then only do the work for
+ *  the changed areas.
+ */
+int blit_dirty_rects(BITMAP *src, BITMAP *dest, int dest_x, int dest_y)
+{
+   DIRTY_TRACKER *t;
+   DIRTY_RECT *r;
+   int i, x, y;
+   ASSERT(src);
+   ASSERT(dest);
+
+   t = get_tracker(src);
+
+   if (!t) {
+      blit(src, dest, 0, 0, dest_x, dest_y, src->w, src->h);
+      return 1;
+   }
+
+   if (!t->merged)
+      merge_tiles(t);
+
+   if (t->rect_count) {
+      acquire_bitmap(dest);
+
+      for (i=0; i<t->rect_count; i++) {
+	 r = &t->rect[i];
+	 x = r->x << TILE_SHIFT;
+	 y = r->y << TILE_SHIFT;
+	 blit(t->bmp, dest, x, y, dest_x + x, dest_y + y,
+	      MIN(r->w << TILE_SHIFT, t->bmp->w - x),
+	      MIN(r->h << TILE_SHIFT, t->bmp->h - y));
+      }
+
+      release_bitmap(dest);
+   }
+
+   i = t->rect_count;
+   clear_dirty_rects(t->bmp);
+
+   return i;
+}
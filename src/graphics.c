@@ -56,6 +56,9 @@ int _color_conv = COLORCONV_TOTAL;     /* which formats to auto convert? */
 
 static int color_conv_set = FALSE;     /* has the user set conversion mode? */
 
+static int bitmap_alignment = 0;       /* line alignment of memory bitmaps */
+static int bitmap_stagger = 0;         /* offsets the start of big ones */
+
 int _palette_color8[256];               /* palette -> pixel mapping */
 int _palette_color15[256];
 int _palette_color16[256];
@@ -80,6 +83,10 @@ int _blender_col_32 = 0;
 
 int _blender_alpha = 0;                /* for truecolor translucent drawing */
 
+AL_CONST BLENDER_SPAN *_blender_span15 = NULL;  /* SIMD versions of the above */
+AL_CONST BLENDER_SPAN *_blender_span16 = NULL;
+AL_CONST BLENDER_SPAN *_blender_span32 = NULL;
+
 int _rgb_r_shift_15 = DEFAULT_RGB_R_SHIFT_15;     /* truecolor pixel format */
 int _rgb_g_shift_15 = DEFAULT_RGB_G_SHIFT_15;
 int _rgb_b_shift_15 = DEFAULT_RGB_B_SHIFT_15;
@@ -153,8 +160,9 @@ void lock_bitmap(BITMAP *bmp)
 {
    LOCK_DATA(bmp, sizeof(BITMAP) + sizeof(char *) * bmp->h);
 
-   if (bmp->dat) {
-      LOCK_DATA(bmp->dat, bmp->w * bmp->h * BYTES_PER_PIXEL(bitmap_color_depth(bmp)));
+   if ((bmp->dat) && (bmp->h > 0)) {
+      LOCK_DATA(bmp->dat, bmp->line[bmp->h-1] - (unsigned char *)bmp->dat +
+		bmp->w * BYTES_PER_PIXEL(bitmap_color_depth(bmp)));
    }
 }
 
@@ -325,6 +333,40 @@ int get_color_depth(void)
 
 
 
+/* set_bitmap_alignment:
+ *  Sets the alignment, in bytes, of the lines of the memory bitmaps made
+ *  by subsequent calls to create_bitmap(). Zero gives the default packed
+ *  layout, other values are rounded up to a power of two.
+ */
+void set_bitmap_alignment(int align)
+{
+   int a = 4;
+
+   ASSERT(align >= 0);
+
+   if (align <= 0) {
+      bitmap_alignment = 0;
+      return;
+   }
+
+   while ((a < align) && (a < 4096))
+      a <<= 1;
+
+   bitmap_alignment = a;
+}
+
+
+
+/* get_bitmap_alignment:
+ *  Returns the current memory bitmap line alignment.
+ */
+int get_bitmap_alignment(void)
+{
+   return bitmap_alignment;
+}
+
+
+
 /* set_color_conversion:
  *  Sets a bit mask specifying which types of color format conversions are
  *  valid when loading data from disk.
@@ -1046,6 +1088,8 @@ BITMAP *create_bitmap_ex(int color_depth, int width, int height)
    BITMAP *bitmap;
    int nr_pointers;
    int padding;
+   int pitch, n;
+   int offset = 0;
    int i;
 
    ASSERT(width >= 0);
@@ -1073,7 +1117,30 @@ BITMAP *create_bitmap_ex(int color_depth, int width, int height)
     */
    padding = (color_depth == 24) ? 1 : 0;
 
-   bitmap->dat = _AL_MALLOC_ATOMIC(width * height * BYTES_PER_PIXEL(color_depth) + padding);
+   if (bitmap_alignment) {
+      /* Round the lines up to a multiple of n pixels, the number that
+       * fills the alignment (or the alignment itself for 24 bit, as that
+       * has to be divisible by 3 bytes). n is a power of two, so textures
+       * with a power of two width still find their rows with a shift. Big
+       * bitmaps also start at a varying offset into the page, which stops
+       * blits between two of them from aliasing.
+       */
+      if (color_depth == 24)
+	 n = bitmap_alignment;
+      else
+	 n = MAX(bitmap_alignment / BYTES_PER_PIXEL(color_depth), 1);
+
+      pitch = ((width + n - 1) & ~(n - 1)) * BYTES_PER_PIXEL(color_depth);
+
+      if ((pitch * height >= 65536) && (bitmap_alignment < 4096))
+	 offset = ((bitmap_stagger++ & 15) * bitmap_alignment) & 4095;
+
+      padding += bitmap_alignment - 1 + offset;
+   }
+   else
+      pitch = width * BYTES_PER_PIXEL(color_depth);
+
+   bitmap->dat = _AL_MALLOC_ATOMIC(pitch * height + padding);
    if (!bitmap->dat) {
       _AL_FREE(bitmap);
       return NULL;
@@ -1093,8 +1160,12 @@ BITMAP *create_bitmap_ex(int color_depth, int width, int height)
 
    if (height > 0) {
       bitmap->line[0] = bitmap->dat;
+      if (bitmap_alignment) {
+	 bitmap->line[0] += (bitmap_alignment - ((uintptr_t)bitmap->dat & (bitmap_alignment - 1))) & (bitmap_alignment - 1);
+	 bitmap->line[0] += offset;
+      }
       for (i=1; i<height; i++)
-         bitmap->line[i] = bitmap->line[i-1] + width * BYTES_PER_PIXEL(color_depth);
+         bitmap->line[i] = bitmap->line[i-1] + pitch;
    }
 
    if (system_driver->created_bitmap)
@@ -1493,6 +1564,8 @@ void destroy_bitmap(BITMAP *bitmap)
       }
 
       /* normal memory or sub-bitmap destruction */
+      disable_dirty_tracking(bitmap);
+
       if (system_driver->destroy_bitmap) {
 	 if (system_driver->destroy_bitmap(bitmap))
 	    return;
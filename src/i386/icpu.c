@@ -31,6 +31,7 @@ void _i_cx_w(int index, int value);
 char _i_cx_r(int index);
 int _i_is_cpuid_supported(void);
 void _i_get_cpuid_info(uint32_t cpuid_levels, uint32_t *reg);
+uint32_t _i_get_xcr0(void);
 
 
 
@@ -126,6 +127,15 @@ void check_cpu()
          cpu_capabilities |= (reg[2] & 0x00000001 ? CPU_SSE3 : 0);
 	 cpu_capabilities |= (reg[3] & 0x00008000 ? CPU_CMOV : 0);
          cpu_capabilities |= (reg[3] & 0x40000000 ? CPU_IA64 : 0);
+
+	 /* AVX2 is only usable if the OS saves the YMM registers (OSXSAVE
+	  * plus the SSE and AVX bits of XCR0), so check that first.
+	  */
+	 if ((cpuid_levels >= 7) && ((reg[2] & 0x18000000) == 0x18000000) &&
+	     ((_i_get_xcr0() & 6) == 6)) {
+	    _i_get_cpuid_info(7, reg);
+	    cpu_capabilities |= (reg[1] & 0x00000020 ? CPU_AVX2 : 0);
+	 }
       }
 
       _i_get_cpuid_info(0x80000000, reg);
@@ -197,6 +197,7 @@ FUNC(_i_get_cpuid_info)
    pushl %edi
 
    movl ARG1, %eax               /* eax = cpuid_levels */
+   xorl %ecx, %ecx               /* ecx = sub-level 0 */
 
    .byte 0x0F, 0xA2              /* cpuid instruction */
 
@@ -213,3 +214,17 @@ FUNC(_i_get_cpuid_info)
    popl %ebp
    ret
 
+
+
+
+/* uint32_t _i_get_xcr0();
+ *  Reads the low half of XCR0, which tells us what register state the OS
+ *  saves on context switches. Only valid if cpuid reports OSXSAVE.
+ */
+FUNC(_i_get_xcr0)
+   xorl %ecx, %ecx               /* ecx = XCR0 */
+
+   .byte 0x0F, 0x01, 0xD0        /* xgetbv instruction */
+
+   ret
+
@@ -37,6 +37,21 @@ FUNC(_stub_bank_switch_end)
 
 
 
+/* bank switch routine for bitmaps with dirty rectangle tracking, which
+ * calls the C version in dirty.c.
+ */
+FUNC(_dirty_write_bank_asm)
+   pushl %ecx
+   pushl %eax
+   pushl %edx
+   call GLOBL(_dirty_write_bank)
+   popl %edx
+   popl %ecx                     /* preserve %eax */
+   popl %ecx
+   ret
+
+
+
 
 /* void apply_matrix_f(MATRIX_f *m, float x, float y, float z, 
  *                                  float *xout, float *yout, float *zout);
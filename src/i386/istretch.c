@@ -306,6 +306,9 @@ static void do_stretch_blit(BITMAP *source, BITMAP *dest, int source_x, int sour
        (dest_width <= 0) || (dest_height <= 0))
       return;
 
+   /* the hook above belongs to the source, so tracking is done here */
+   _dirty_mark_area(dest, dest_x, dest_y, dest_x+dest_width-1, dest_y+dest_height-1);
+
    /* make sure all allocated memory is freed atexit */
    if (stretcher_virgin) {
       stretcher_virgin = FALSE;
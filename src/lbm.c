@@ -141,7 +141,7 @@ BITMAP *load_lbm(AL_CONST char *filename, RGB *pal)
 	       return NULL;
 	    }
 
-	    memset(b->line[0], 0, w * h);
+	    clear_bitmap(b);
 
 	    if (pbm_mode)
 	       bpl = w;
@@ -34,13 +34,41 @@
 /* how often the midi callback gets called maximally / second */
 #define MIDI_TIMER_FREQUENCY 40
 
+/* events between the snapshots used for seeking */
+#define MIDI_SNAPSHOT_EVENTS  256
 
-typedef struct MIDI_TRACK                       /* a track in the MIDI file */
+
+typedef struct MIDI_EVENT                       /* an event of the merged tracks */
+{
+   long time;                                   /* position in MIDI ticks */
+   AL_CONST unsigned char *data;                /* the event in the track data */
+   unsigned char status;                        /* status, after running status */
+} MIDI_EVENT;
+
+
+typedef struct MIDI_SNAPSHOT                    /* player state at an event */
+{
+   long time;                                   /* position in MIDI ticks */
+   long timers;                                 /* position in timer ticks */
+   int speed;                                   /* timer ticks per MIDI tick */
+   unsigned char patch[16];                     /* program of each channel */
+   unsigned char volume[16];                    /* volume controller + 1 */
+   unsigned char pan[16];                       /* pan controller */
+   unsigned short pitch_bend[16];               /* pitch bend position */
+} MIDI_SNAPSHOT;
+
+
+typedef struct MIDI_STREAM                      /* a MIDI file, ready to play */
 {
-   unsigned char *pos;                          /* position in track data */
-   long timer;                                  /* time until next event */
-   unsigned char running_status;                /* last MIDI event */
-} MIDI_TRACK;
+   MIDI *midi;                                  /* the file it came from */
+   AL_CONST unsigned char *data[MIDI_TRACKS];   /* its tracks, to tell when */
+   int len[MIDI_TRACKS];                        /* the file has changed */
+   int divisions;
+   int count;                                   /* number of events */
+   MIDI_EVENT *event;                           /* all tracks, sorted by time */
+   MIDI_SNAPSHOT *snapshot;                     /* every MIDI_SNAPSHOT_EVENTS */
+   struct MIDI_STREAM *next;
+} MIDI_STREAM;
 
 
 typedef struct MIDI_CHANNEL                     /* a MIDI channel */
@@ -90,6 +118,8 @@ volatile long _midi_tick = 0;                   /* counter for killing notes */
 
 static void midi_player(void);                  /* core MIDI player routine */
 static void prepare_to_play(MIDI *midi);
+static MIDI_STREAM *get_midi_stream(MIDI *midi);
+static void free_midi_stream(MIDI *midi);
 static void midi_lock_mem(void);
 
 static MIDI *midifile = NULL;                   /* the file that is playing */
@@ -113,15 +143,21 @@ static int midi_alloc_channel;                  /* so _midi_allocate_voice */
 static int midi_alloc_note;                     /* knows which note the */
 static int midi_alloc_vol;                      /* sound is associated with */
 
-static MIDI_TRACK midi_track[MIDI_TRACKS];      /* the active tracks */
+static MIDI_STREAM *midi_streams = NULL;        /* every compiled file */
+static MIDI_STREAM *midi_stream = NULL;         /* the one that is playing */
+static int midi_cursor;                         /* next event to play */
+static long midi_event_timer;                   /* time until it is due */
 static MIDI_VOICE midi_voice[MIDI_VOICES];      /* synth voice status */
 static MIDI_CHANNEL midi_channel[16];           /* MIDI channel info */
 static WAITING_NOTE midi_waiting[MIDI_VOICES];  /* notes still to be played */
 static PATCH_TABLE patch_table[128];            /* GM -> external synth */
 
-static int midi_seeking;                        /* set during seeks */
 static int midi_looping;                        /* set during loops */
 
+int _midi_clocked = FALSE;                      /* driven by _midi_clock()? */
+static long midi_clock_due = -1;                /* ticks until midi_player */
+static void *midi_clock_mutex = NULL;           /* guards midi_clock_due */
+
 /* hook functions */
 void (*midi_msg_callback)(int msg, int byte1, int byte2) = NULL;
 void (*midi_meta_callback)(int type, AL_CONST unsigned char *data, int length) = NULL;
@@ -232,6 +268,10 @@ MIDI *load_midi(AL_CONST char *filename)
 
    pack_fclose(fp);
    lock_midi(midi);
+
+   /* merge the tracks now, rather than when the file is played */
+   get_midi_stream(midi);
+
    return midi;
 
    /* oh dear... */
@@ -254,6 +294,8 @@ void destroy_midi(MIDI *midi)
       stop_midi();
 
    if (midi) {
+      free_midi_stream(midi);
+
       for (c=0; c<MIDI_TRACKS; c++) {
 	 if (midi->track[c].data) {
 	    UNLOCK_DATA(midi->track[c].data, midi->track[c].len);
@@ -619,6 +661,21 @@ END_OF_STATIC_FUNCTION(all_sound_off);
 
 
 
+/* default_pan:
+ *  Returns the pan position a channel starts with, spreading them out
+ *  across the stereo image.
+ */
+static INLINE int default_pan(int channel)
+{
+   switch (channel % 3) {
+      case 0:  return ((channel/3) & 1) ? 60 : 68;
+      case 1:  return 104;
+      default: return 24;
+   }
+}
+
+
+
 /* reset_controllers:
  *  Resets volume, pan, pitch bend, etc, to default positions.
  */
@@ -633,11 +690,7 @@ static void reset_controllers(int channel)
       midi_driver->raw_midi(0);
    }
 
-   switch (channel % 3) {
-      case 0:  midi_channel[channel].pan = ((channel/3) & 1) ? 60 : 68; break;
-      case 1:  midi_channel[channel].pan = 104; break;
-      case 2:  midi_channel[channel].pan = 24; break;
-   }
+   midi_channel[channel].pan = default_pan(channel);
 
    if (midi_driver->raw_midi) {
       midi_driver->raw_midi(0xB0+channel);
@@ -754,6 +807,18 @@ END_OF_STATIC_FUNCTION(process_controller);
 
 
 
+/* tempo_to_speed:
+ *  Converts the data of a tempo meta-event to timer ticks per MIDI tick.
+ */
+static INLINE int tempo_to_speed(AL_CONST unsigned char *data, int divisions)
+{
+   long tempo = data[0] * 0x10000L + data[1] * 0x100 + data[2];
+
+   return (tempo/1000) * (TIMERS_PER_SECOND/1000) / divisions;
+}
+
+
+
 /* process_meta_event:
  *  Processes the next meta-event on the specified track.
  */
@@ -761,7 +826,6 @@ static void process_meta_event(AL_CONST unsigned char **pos, long *timer)
 {
    unsigned char metatype = *((*pos)++);
    long length = parse_var_len(pos);
-   long tempo;
 
    if (midi_meta_callback)
       midi_meta_callback(metatype, *pos, length);
@@ -772,11 +836,8 @@ static void process_meta_event(AL_CONST unsigned char **pos, long *timer)
       return;
    }
 
-   if (metatype == 0x51) {                      /* tempo change */
-      tempo = (*pos)[0] * 0x10000L + (*pos)[1] * 0x100 + (*pos)[2];
-      midi_new_speed = (tempo/1000) * (TIMERS_PER_SECOND/1000);
-      midi_new_speed /= midifile->divisions;
-   }
+   if (metatype == 0x51)                        /* tempo change */
+      midi_new_speed = tempo_to_speed(*pos, midifile->divisions);
 
    (*pos) += length;
 }
@@ -894,21 +955,69 @@ END_OF_STATIC_FUNCTION(process_midi_event);
 
 
 
+/* midi_schedule:
+ *  Arranges for midi_player() to be called after the given number of
+ *  timer ticks, either by the timer module or by _midi_clock().
+ */
+static void midi_schedule(long speed)
+{
+   if (_midi_clocked) {
+      if (midi_clock_mutex)
+	 system_driver->lock_mutex(midi_clock_mutex);
+
+      midi_clock_due = speed;
+
+      if (midi_clock_mutex)
+	 system_driver->unlock_mutex(midi_clock_mutex);
+   }
+   else
+      install_int_ex(midi_player, speed);
+}
+
+END_OF_STATIC_FUNCTION(midi_schedule);
+
+
+
+/* midi_unschedule:
+ *  Stops midi_player() from being called. Like remove_int(), this waits
+ *  for a call that is in progress on another thread to return.
+ */
+static void midi_unschedule(void)
+{
+   if (_midi_clocked) {
+      if (midi_clock_mutex)
+	 system_driver->lock_mutex(midi_clock_mutex);
+
+      midi_clock_due = -1;
+
+      if (midi_clock_mutex)
+	 system_driver->unlock_mutex(midi_clock_mutex);
+   }
+   else
+      remove_int(midi_player);
+}
+
+END_OF_STATIC_FUNCTION(midi_unschedule);
+
+
+
 /* midi_player:
  *  The core MIDI player: to be used as a timer callback.
  */
 static void midi_player(void)
 {
+   AL_CONST MIDI_EVENT *event;
+   AL_CONST unsigned char *pos;
+   unsigned char running_status;
+   long timer;
    int c;
-   long l;
-   int active;
 
    if (!midifile)
       return;
 
    if (midi_semaphore) {
       midi_timer_speed += BPS_TO_TIMER(MIDI_TIMER_FREQUENCY);
-      install_int_ex(midi_player, BPS_TO_TIMER(MIDI_TIMER_FREQUENCY));
+      midi_schedule(BPS_TO_TIMER(MIDI_TIMER_FREQUENCY));
       return;
    }
 
@@ -923,25 +1032,29 @@ static void midi_player(void)
    for (c=0; c<MIDI_VOICES; c++)
       midi_waiting[c].note = -1;
 
-   /* deal with each track in turn... */
-   for (c=0; c<MIDI_TRACKS; c++) { 
-      if (midi_track[c].pos) {
-	 midi_track[c].timer -= midi_timer_speed;
-
-	 /* while events are waiting, process them */
-	 while (midi_track[c].timer <= 0) { 
-	    process_midi_event((AL_CONST unsigned char**) &midi_track[c].pos, 
-			       &midi_track[c].running_status,
-			       &midi_track[c].timer); 
-
-	    /* read next time offset */
-	    if (midi_track[c].pos) { 
-	       l = parse_var_len((AL_CONST unsigned char**) &midi_track[c].pos);
-	       l *= midi_speed;
-	       midi_track[c].timer += l;
-	    }
-	 }
+   /* the tracks are merged in time order, so just play the events which
+      are due, working out the time to the next one as we go */
+   midi_event_timer -= midi_timer_speed;
+
+   while ((midi_cursor < midi_stream->count) && (midi_event_timer <= 0)) {
+      event = midi_stream->event + midi_cursor;
+      pos = event->data;
+      running_status = event->status;
+      process_midi_event(&pos, &running_status, &timer);
+      midi_cursor++;
+
+      /* tempo change? */
+      if (midi_new_speed > 0) {
+	 midi_pos_counter /= midi_speed;
+	 midi_pos_counter *= midi_new_speed;
+
+	 midi_speed = midi_new_speed;
+	 midi_pos_speed = midi_new_speed * midifile->divisions;
+	 midi_new_speed = -1;
       }
+
+      if (midi_cursor < midi_stream->count)
+	 midi_event_timer += (event[1].time - event[0].time) * midi_speed;
    }
 
    /* update global position value */
@@ -951,38 +1064,14 @@ static void midi_player(void)
       midi_pos++;
    }
 
-   /* tempo change? */
-   if (midi_new_speed > 0) {
-      for (c=0; c<MIDI_TRACKS; c++) {
-	 if (midi_track[c].pos) {
-	    midi_track[c].timer /= midi_speed;
-	    midi_track[c].timer *= midi_new_speed;
-	 }
-      }
-      midi_pos_counter /= midi_speed;
-      midi_pos_counter *= midi_new_speed;
-
-      midi_speed = midi_new_speed;
-      midi_pos_speed = midi_new_speed * midifile->divisions;
-      midi_new_speed = -1;
-   }
-
    /* figure out how long until we need to be called again */
-   active = 0;
-   midi_timer_speed = LONG_MAX;
-   for (c=0; c<MIDI_TRACKS; c++) {
-      if (midi_track[c].pos) {
-	 active = 1;
-	 if (midi_track[c].timer < midi_timer_speed)
-	    midi_timer_speed = midi_track[c].timer;
-      }
-   }
+   midi_timer_speed = midi_event_timer;
 
    /* end of the music? */
-   if ((!active) || ((midi_loop_end > 0) && (midi_pos >= midi_loop_end))) {
+   if ((midi_cursor >= midi_stream->count) || ((midi_loop_end > 0) && (midi_pos >= midi_loop_end))) {
       if ((midi_loop) && (!midi_looping)) {
 	 if (midi_loop_start > 0) {
-	    remove_int(midi_player);
+	    midi_unschedule();
 	    midi_semaphore = FALSE;
 	    midi_looping = TRUE;
 	    if (midi_seek(midi_loop_start) != 0) {
@@ -1014,8 +1103,7 @@ static void midi_player(void)
    if (midi_timer_speed < BPS_TO_TIMER(MIDI_TIMER_FREQUENCY))
       midi_timer_speed = BPS_TO_TIMER(MIDI_TIMER_FREQUENCY);
 
-   if (!midi_seeking) 
-      install_int_ex(midi_player, midi_timer_speed);
+   midi_schedule(midi_timer_speed);
 
    /* controller changes are cached and only processed here, so we can 
       condense streams of controller data into just a few voice updates */ 
@@ -1034,6 +1122,63 @@ END_OF_STATIC_FUNCTION(midi_player);
 
 
 
+/* _midi_set_clock:
+ *  Hands the timing of the MIDI player over to _midi_clock(), or back to
+ *  the timer module. Used by drivers which render the output faster than
+ *  realtime, and must only be called while no MIDI file is playing.
+ */
+void _midi_set_clock(int clocked)
+{
+   if (clocked == _midi_clocked)
+      return;
+
+   midi_unschedule();
+   _midi_clocked = clocked;
+   midi_clock_due = -1;
+
+   if (clocked) {
+      if (system_driver->create_mutex)
+	 midi_clock_mutex = system_driver->create_mutex();
+   }
+   else if (midi_clock_mutex) {
+      system_driver->destroy_mutex(midi_clock_mutex);
+      midi_clock_mutex = NULL;
+   }
+}
+
+
+
+/* _midi_clock:
+ *  Advances the MIDI player by the given number of timer ticks, calling
+ *  midi_player() wherever the timer would have done. Returns TRUE while
+ *  the player is waiting to be called again.
+ */
+int _midi_clock(long ticks)
+{
+   int ret;
+
+   if (midi_clock_mutex)
+      system_driver->lock_mutex(midi_clock_mutex);
+
+   while ((midi_clock_due >= 0) && (ticks >= midi_clock_due)) {
+      ticks -= midi_clock_due;
+      midi_clock_due = -1;
+      midi_player();
+   }
+
+   if (midi_clock_due >= 0)
+      midi_clock_due -= ticks;
+
+   ret = (midi_clock_due >= 0);
+
+   if (midi_clock_mutex)
+      system_driver->unlock_mutex(midi_clock_mutex);
+
+   return ret;
+}
+
+
+
 /* midi_init:
  *  Sets up the MIDI player ready for use. Returns non-zero on failure.
  */
@@ -1097,104 +1242,378 @@ static void midi_exit(void)
 
 
 
-/* load_patches:
- *  Scans through a MIDI file and identifies which patches it uses, passing
- *  them to the soundcard driver so it can load whatever samples are
- *  neccessary.
+/* scan_track:
+ *  Works through the data of a track, storing the absolute time, the 
+ *  position and the status of each event in the array if there is one.
+ *  Returns the number of events, which stop at the end of track meta-event
+ *  or wherever the data gets cut short.
  */
-static int load_patches(MIDI *midi)
+static int scan_track(MIDI *midi, int track, MIDI_EVENT *out)
 {
-   char patches[128], drums[128];
-   unsigned char *p, *end;
-   unsigned char running_status, event;
+   AL_CONST unsigned char *p = midi->track[track].data;
+   AL_CONST unsigned char *end = p + midi->track[track].len;
+   AL_CONST unsigned char *start;
+   unsigned char running_status = 0;
+   unsigned char event;
+   long time = 0;
    long l;
-   int c;
-   ASSERT(midi);
+   int n = 0;
 
-   for (c=0; c<128; c++)                        /* initialise to unused */
-      patches[c] = drums[c] = FALSE;
+   if (!p)
+      return 0;
 
-   patches[0] = TRUE;                           /* always load the piano */
+   while (p < end) {                            /* work through data stream */
+      time += parse_var_len(&p);
+      if (p >= end)
+	 break;
 
-   for (c=0; c<MIDI_TRACKS; c++) {              /* for each track... */
-      p = midi->track[c].data;
-      end = p + midi->track[c].len;
-      running_status = 0;
+      start = p;
+      event = *p; 
+      if (event & 0x80) {                       /* regular message */
+	 p++;
+	 if ((event != 0xF0) && (event != 0xF7) && (event != 0xFF))
+	    running_status = event;
+      }
+      else if (running_status)                  /* use running status */
+	 event = running_status; 
+      else                                      /* stray data byte */
+	 break;
 
-      while (p < end) {                         /* work through data stream */
-#ifdef ALLEGRO_BEOS
-         /* Is there a bug in this routine, or in gcc under BeOS/x86? --PW */
-         { int i; for (i=1; i; i--); }
-#endif
-	 event = *p; 
-	 if (event & 0x80) {                    /* regular message */
-	    p++;
-	    if ((event != 0xF0) && (event != 0xF7) && (event != 0xFF))
-	       running_status = event;
-	 }
-	 else                                   /* use running status */
-	    event = running_status; 
+      switch (event>>4) {
 
-	 switch (event>>4) {
+	 case 0x08:                             /* note off */
+	 case 0x09:                             /* note on */
+	 case 0x0A:                             /* note aftertouch */
+	 case 0x0B:                             /* control change */
+	 case 0x0E:                             /* pitch bend */
+	    l = 2;
+	    break;
 
-	    case 0x0C:                          /* program change! */
-	       patches[*p] = TRUE;
-	       p++;
-	       break;
+	 case 0x0C:                             /* program change */
+	 case 0x0D:                             /* channel aftertouch */
+	    l = 1;
+	    break;
 
-	    case 0x09:                          /* note on, is it a drum? */
-	       if ((event & 0x0F) == 9)
-		  drums[*p] = TRUE;
-	       p += 2;
-	       break;
+	 case 0x0F:                             /* special event */
+	    switch (event) {
+	       case 0xF0:                       /* sysex */
+	       case 0xF7: 
+		  l = parse_var_len(&p);
+		  break;
+
+	       case 0xF2:                       /* song position */
+		  l = 2;
+		  break;
+
+	       case 0xF3:                       /* song select */
+		  l = 1;
+		  break;
+
+	       case 0xFF:                       /* meta-event */
+		  p++;
+		  l = (p < end) ? (long)parse_var_len(&p) : 0;
+		  break;
+
+	       default:
+		  /* the other special events don't have any data bytes */
+		  l = 0;
+		  break;
+	    }
+	    break;
 
-	    case 0x08:                          /* note off */
-	    case 0x0A:                          /* note aftertouch */
-	    case 0x0B:                          /* control change */
-	    case 0x0E:                          /* pitch bend */
-	       p += 2;
-	       break;
+	 default:
+	    /* something has gone badly wrong if we ever get to here */
+	    l = 0;
+	    break;
+      }
 
-	    case 0x0D:                          /* channel aftertouch */
-	       p += 1;
+      if ((l < 0) || (p > end) || (l > end - p))
+	 break;
+
+      p += l;
+
+      if (out) {
+	 out[n].time = time;
+	 out[n].data = start;
+	 out[n].status = event;
+      }
+
+      n++;
+
+      if ((event == 0xFF) && (start[1] == 0x2F))  /* end of track */
+	 break;
+   }
+
+   return n;
+}
+
+
+
+/* snapshot_event:
+ *  Moves a snapshot on to the specified event, and applies the changes it 
+ *  makes to the tempo, programs and controllers, without playing anything.
+ */
+static void snapshot_event(MIDI_SNAPSHOT *snap, AL_CONST MIDI_EVENT *event, int divisions)
+{
+   AL_CONST unsigned char *p = event->data;
+   int c = event->status & 0x0F;
+
+   snap->timers += (event->time - snap->time) * snap->speed;
+   snap->time = event->time;
+
+   if (*p & 0x80)
+      p++;
+
+   switch (event->status>>4) {
+
+      case 0x0B:                                /* control change */
+	 switch (p[0]) {
+	    case 7:                             /* main volume */
+	       snap->volume[c] = p[1]+1;
 	       break;
 
-	    case 0x0F:                          /* special event */
-	       switch (event) {
-		  case 0xF0:                    /* sysex */
-		  case 0xF7: 
-		     l = parse_var_len((AL_CONST unsigned char**) &p);
-		     p += l;
-		     break;
-
-		  case 0xF2:                    /* song position */
-		     p += 2;
-		     break;
-
-		  case 0xF3:                    /* song select */
-		     p++;
-		     break;
-
-		  case 0xFF:                    /* meta-event */
-		     p++;
-		     l = parse_var_len((AL_CONST unsigned char**) &p);
-		     p += l;
-		     break;
-
-		  default:
-		     /* the other special events don't have any data bytes,
-			so we don't need to bother skipping past them */
-		     break;
-	       }
+	    case 10:                            /* pan */
+	       snap->pan[c] = p[1];
 	       break;
 
-	    default:
-	       /* something has gone badly wrong if we ever get to here */
+	    case 121:                           /* reset all controllers */
+	       snap->volume[c] = 128;
+	       snap->pitch_bend[c] = 0x2000;
+	       snap->pan[c] = default_pan(c);
 	       break;
 	 }
+	 break;
+
+      case 0x0C:                                /* program change */
+	 snap->patch[c] = p[0];
+	 break;
 
-	 if (p < end)                           /* skip time offset */
-	    parse_var_len((AL_CONST unsigned char**) &p);
+      case 0x0E:                                /* pitch bend */
+	 snap->pitch_bend[c] = p[0] + (p[1] << 7);
+	 break;
+
+      case 0x0F:                                /* tempo change? */
+	 if ((event->status == 0xFF) && (p[0] == 0x51)) {
+	    p++;
+	    parse_var_len(&p);
+	    snap->speed = tempo_to_speed(p, divisions);
+	 }
+	 break;
+   }
+}
+
+END_OF_STATIC_FUNCTION(snapshot_event);
+
+
+
+/* compile_midi:
+ *  Merges the tracks of a MIDI file into a single stream of events sorted
+ *  by time, so the player can simply work through it, and takes snapshots
+ *  of the player state along the way, so midi_seek() doesn't have to go
+ *  through the whole file.
+ */
+static MIDI_STREAM *compile_midi(MIDI *midi)
+{
+   MIDI_STREAM *stream;
+   MIDI_EVENT *tracks;
+   MIDI_SNAPSHOT snap;
+   int first[MIDI_TRACKS+1], next[MIDI_TRACKS];
+   int divisions = MAX(midi->divisions, 1);
+   int c, i, best;
+
+   stream = _AL_MALLOC(sizeof(MIDI_STREAM));
+   if (!stream)
+      return NULL;
+
+   stream->midi = midi;
+   stream->divisions = midi->divisions;
+
+   first[0] = 0;
+   for (c=0; c<MIDI_TRACKS; c++) {
+      stream->data[c] = midi->track[c].data;
+      stream->len[c] = midi->track[c].len;
+      first[c+1] = first[c] + scan_track(midi, c, NULL);
+   }
+
+   stream->count = first[MIDI_TRACKS];
+   stream->event = _AL_MALLOC(MAX(stream->count, 1) * sizeof(MIDI_EVENT));
+   stream->snapshot = _AL_MALLOC((stream->count/MIDI_SNAPSHOT_EVENTS + 1) * sizeof(MIDI_SNAPSHOT));
+   tracks = _AL_MALLOC(MAX(stream->count, 1) * sizeof(MIDI_EVENT));
+
+   if ((!stream->event) || (!stream->snapshot) || (!tracks)) {
+      if (stream->event)
+	 _AL_FREE(stream->event);
+      if (stream->snapshot)
+	 _AL_FREE(stream->snapshot);
+      if (tracks)
+	 _AL_FREE(tracks);
+      _AL_FREE(stream);
+      return NULL;
+   }
+
+   for (c=0; c<MIDI_TRACKS; c++) {
+      scan_track(midi, c, tracks + first[c]);
+      next[c] = first[c];
+   }
+
+   /* merge the tracks, keeping events at the same time in track order */
+   for (i=0; i<stream->count; i++) {
+      best = -1;
+      for (c=0; c<MIDI_TRACKS; c++) {
+	 if ((next[c] < first[c+1]) &&
+	     ((best < 0) || (tracks[next[c]].time < tracks[next[best]].time)))
+	    best = c;
+      }
+      stream->event[i] = tracks[next[best]++];
+   }
+
+   _AL_FREE(tracks);
+
+   /* the state prepare_to_play() starts from */
+   snap.time = 0;
+   snap.timers = 0;
+   snap.speed = TIMERS_PER_SECOND / 2 / divisions;
+
+   for (c=0; c<16; c++) {
+      snap.patch[c] = 0;
+      snap.volume[c] = 128;
+      snap.pan[c] = default_pan(c);
+      snap.pitch_bend[c] = 0x2000;
+   }
+
+   for (i=0; i<=stream->count; i++) {
+      if ((i % MIDI_SNAPSHOT_EVENTS) == 0)
+	 stream->snapshot[i/MIDI_SNAPSHOT_EVENTS] = snap;
+      if (i < stream->count)
+	 snapshot_event(&snap, stream->event+i, divisions);
+   }
+
+   LOCK_DATA(stream, sizeof(MIDI_STREAM));
+   LOCK_DATA(stream->event, MAX(stream->count, 1) * sizeof(MIDI_EVENT));
+   LOCK_DATA(stream->snapshot, (stream->count/MIDI_SNAPSHOT_EVENTS + 1) * sizeof(MIDI_SNAPSHOT));
+
+   return stream;
+}
+
+
+
+/* destroy_stream:
+ *  Frees a stream made by compile_midi().
+ */
+static void destroy_stream(MIDI_STREAM *stream)
+{
+   if (stream == midi_stream) {
+      midifile = NULL;
+      midi_stream = NULL;
+   }
+
+   UNLOCK_DATA(stream->event, MAX(stream->count, 1) * sizeof(MIDI_EVENT));
+   UNLOCK_DATA(stream->snapshot, (stream->count/MIDI_SNAPSHOT_EVENTS + 1) * sizeof(MIDI_SNAPSHOT));
+   UNLOCK_DATA(stream, sizeof(MIDI_STREAM));
+
+   _AL_FREE(stream->event);
+   _AL_FREE(stream->snapshot);
+   _AL_FREE(stream);
+}
+
+
+
+/* get_midi_stream:
+ *  Returns the merged stream of a MIDI file, compiling it the first time.
+ *  Files are remembered by address, so the stream is rebuilt if the track 
+ *  data doesn't match any more (ie. a file was freed without going through
+ *  destroy_midi(), and something else has been put in its place).
+ */
+static MIDI_STREAM *get_midi_stream(MIDI *midi)
+{
+   MIDI_STREAM *stream, **prev;
+   int c;
+
+   for (prev=&midi_streams; *prev; prev=&(*prev)->next) {
+      stream = *prev;
+
+      if (stream->midi == midi) {
+	 if (stream->divisions == midi->divisions) {
+	    for (c=0; c<MIDI_TRACKS; c++) {
+	       if ((stream->data[c] != midi->track[c].data) ||
+		   (stream->len[c] != midi->track[c].len))
+		  break;
+	    }
+	    if (c == MIDI_TRACKS)
+	       return stream;
+	 }
+
+	 *prev = stream->next;
+	 destroy_stream(stream);
+	 break;
+      }
+   }
+
+   stream = compile_midi(midi);
+   if (stream) {
+      stream->next = midi_streams;
+      midi_streams = stream;
+   }
+
+   return stream;
+}
+
+
+
+/* free_midi_stream:
+ *  Forgets about the merged stream of a MIDI file, when it is destroyed.
+ */
+static void free_midi_stream(MIDI *midi)
+{
+   MIDI_STREAM *stream, **prev;
+
+   for (prev=&midi_streams; *prev; prev=&(*prev)->next) {
+      stream = *prev;
+
+      if (stream->midi == midi) {
+	 *prev = stream->next;
+	 destroy_stream(stream);
+	 return;
+      }
+   }
+}
+
+
+
+/* load_patches:
+ *  Scans through a MIDI file and identifies which patches it uses, passing
+ *  them to the soundcard driver so it can load whatever samples are
+ *  neccessary.
+ */
+static int load_patches(MIDI_STREAM *stream)
+{
+   char patches[128], drums[128];
+   AL_CONST unsigned char *p;
+   AL_CONST MIDI_EVENT *event;
+   int c;
+   ASSERT(stream);
+
+   for (c=0; c<128; c++)                        /* initialise to unused */
+      patches[c] = drums[c] = FALSE;
+
+   patches[0] = TRUE;                           /* always load the piano */
+
+   for (c=0; c<stream->count; c++) {            /* for each event... */
+      event = stream->event + c;
+      p = event->data;
+      if (*p & 0x80)
+	 p++;
+
+      switch (event->status>>4) {
+
+	 case 0x0C:                             /* program change! */
+	    patches[*p & 0x7F] = TRUE;
+	    break;
+
+	 case 0x09:                             /* note on, is it a drum? */
+	    if ((event->status & 0x0F) == 9)
+	       drums[*p & 0x7F] = TRUE;
+	    break;
       }
    }
 
@@ -1226,7 +1645,6 @@ static void prepare_to_play(MIDI *midi)
    midi_new_speed = -1;
    midi_pos_speed = midi_speed * midifile->divisions;
    midi_timer_speed = 0;
-   midi_seeking = 0;
    midi_looping = 0;
 
    for (c=0; c<16; c++) {
@@ -1235,18 +1653,11 @@ static void prepare_to_play(MIDI *midi)
 	 raw_program_change(c, 0);
    }
 
-   for (c=0; c<MIDI_TRACKS; c++) {
-      if (midi->track[c].data) {
-	 midi_track[c].pos = midi->track[c].data;
-	 midi_track[c].timer = parse_var_len((AL_CONST unsigned char**) &midi_track[c].pos);
-	 midi_track[c].timer *= midi_speed;
-      }
-      else {
-	 midi_track[c].pos = NULL;
-	 midi_track[c].timer = LONG_MAX;
-      }
-      midi_track[c].running_status = 0;
-   }
+   midi_cursor = 0;
+   if (midi_stream->count > 0)
+      midi_event_timer = midi_stream->event[0].time * midi_speed;
+   else
+      midi_event_timer = 0;
 }
 
 END_OF_STATIC_FUNCTION(prepare_to_play);
@@ -1264,9 +1675,10 @@ END_OF_STATIC_FUNCTION(prepare_to_play);
  */
 int play_midi(MIDI *midi, int loop)
 {
+   MIDI_STREAM *stream;
    int c;
 
-   remove_int(midi_player);
+   midi_unschedule();
 
    for (c=0; c<16; c++) {
       all_notes_off(c);
@@ -1274,18 +1686,23 @@ int play_midi(MIDI *midi, int loop)
    }
 
    if (midi) {
+      stream = get_midi_stream(midi);
+      if (!stream)
+	 return -1;
+
       if (!midi_loaded_patches)
-	 if (load_patches(midi) != 0)
+	 if (load_patches(stream) != 0)
 	    return -1;
 
       midi_loop = loop;
       midi_loop_start = -1;
       midi_loop_end = -1;
 
+      midi_stream = stream;
       prepare_to_play(midi);
 
       /* arbitrary speed, midi_player() will adjust it */
-      install_int(midi_player, 20);
+      midi_schedule(MSEC_TO_TIMER(20));
    }
    else {
       midifile = NULL;
@@ -1343,7 +1760,7 @@ void midi_pause(void)
    if (!midifile)
       return;
 
-   remove_int(midi_player);
+   midi_unschedule();
 
    for (c=0; c<16; c++) {
       all_notes_off(c);
@@ -1363,29 +1780,99 @@ void midi_resume(void)
    if (!midifile)
       return;
 
-   install_int_ex(midi_player, midi_timer_speed);
+   midi_schedule(midi_timer_speed);
 }
 
 END_OF_FUNCTION(midi_resume);
 
 
 
+/* find_event:
+ *  Binary searches the stream for the first event at or after a time.
+ */
+static int find_event(long tick)
+{
+   int lo = 0;
+   int hi = midi_stream->count;
+   int mid;
+
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (midi_stream->event[mid].time < tick)
+	 lo = mid + 1;
+      else
+	 hi = mid;
+   }
+
+   return lo;
+}
+
+END_OF_STATIC_FUNCTION(find_event);
+
+
+
+/* seek_stream:
+ *  Puts the player at the specified time, just before the specified event.
+ *  The state is restored from the last snapshot before the event, and 
+ *  brought up to date with the few events in between.
+ */
+static void seek_stream(int index, long tick)
+{
+   MIDI_SNAPSHOT snap;
+   int divisions = MAX(midifile->divisions, 1);
+   int c, i;
+
+   snap = midi_stream->snapshot[index / MIDI_SNAPSHOT_EVENTS];
+
+   for (i=index-(index%MIDI_SNAPSHOT_EVENTS); i<index; i++)
+      snapshot_event(&snap, midi_stream->event+i, divisions);
+
+   if (tick > snap.time)
+      snap.timers += (tick - snap.time) * snap.speed;
+
+   for (c=0; c<16; c++) {
+      midi_channel[c].patch = snap.patch[c];
+      midi_channel[c].new_volume = snap.volume[c];
+      midi_channel[c].pan = snap.pan[c];
+      midi_channel[c].new_pitch_bend = snap.pitch_bend[c];
+   }
+
+   midi_speed = snap.speed;
+   midi_pos_speed = midi_speed * divisions;
+   midi_new_speed = -1;
+   midi_timers = snap.timers;
+   midi_timer_speed = 0;
+   midi_pos_counter = 0;
+
+   midi_cursor = index;
+   if (index < midi_stream->count)
+      midi_event_timer = (midi_stream->event[index].time - tick) * midi_speed;
+   else
+      midi_event_timer = 0;
+}
+
+END_OF_STATIC_FUNCTION(seek_stream);
+
+
+
 /* midi_seek:
- *  Seeks to the given midi_pos in the current MIDI file. If the target 
- *  is earlier in the file than the current midi_pos it seeks from the 
- *  beginning; otherwise it seeks from the current position. Returns zero 
- *  if successful, non-zero if it hit the end of the file (1 means it 
- *  stopped playing, 2 means it looped back to the start).
+ *  Seeks to the given midi_pos in the current MIDI file. The position is 
+ *  found with a binary search of the merged stream, so this takes about 
+ *  the same time wherever it goes, and none of the skipped events are 
+ *  played (not even to the callbacks). Returns zero if successful, 
+ *  non-zero if it hit the end of the file (1 means it stopped playing, 
+ *  2 means it looped back to the start).
  */
 int midi_seek(int target)
 {
-   int old_midi_loop;
    MIDI *old_midifile;
    MIDI_DRIVER *old_driver;
    int old_patch[16];
    int old_volume[16];
    int old_pan[16];
    int old_pitch_bend[16];
+   int divisions, count;
+   long tick, last;
    int c;
 
    if (!midifile)
@@ -1405,38 +1892,39 @@ int midi_seek(int target)
    /* save some variables and give temporary values */
    old_driver = midi_driver;
    midi_driver = &_midi_none;
-   old_midi_loop = midi_loop;
-   midi_loop = 0;
    old_midifile = midifile;
 
-   /* set flag to tell midi_player not to reinstall itself */
-   midi_seeking = 1;
+   /* start from scratch, the snapshots have all the state we need */
+   prepare_to_play(midifile);
 
-   /* are we seeking backwards? If so, skip back to the start of the file */
-   if (target <= midi_pos)
-      prepare_to_play(midifile);
+   /* like playing would, stop just before midi_pos reaches the target */
+   target = MAX(target, 1) - 1;
+   divisions = MAX(midifile->divisions, 1);
+   count = midi_stream->count;
+   last = (count > 0) ? midi_stream->event[count-1].time : 0;
 
-   /* now sit back and let midi_player get to the position */
-   while ((midi_pos < target) && (midi_pos >= 0)) {
-      int mmpc = midi_pos_counter;
-      int mmp = midi_pos;
+   if (target > LONG_MAX / divisions)
+      tick = LONG_MAX;
+   else
+      tick = (long)target * divisions;
 
-      mmpc -= midi_timer_speed;
-      while (mmpc <= 0) {
-	 mmpc += midi_pos_speed;
-	 mmp++;
-      }
-
-      if (mmp >= target)
-	 break;
-
-      midi_player();
+   if ((count > 0) && (tick <= last) && 
+       ((midi_loop_end <= 0) || (target < midi_loop_end))) {
+      seek_stream(find_event(tick), tick);
+      midi_pos = target;
+   }
+   else {
+      /* past the end: skip all of it, then stop */
+      seek_stream(count, last);
+      midi_pos = (int)MIN(last / divisions + 1, INT_MAX);
+      stop_midi();
    }
 
+   update_controllers();
+   midi_time = midi_timers / TIMERS_PER_SECOND;
+
    /* restore previously saved variables */
-   midi_loop = old_midi_loop;
    midi_driver = old_driver;
-   midi_seeking = 0;
 
    if (midi_pos >= 0) {
       /* refresh the driver with any changed parameters */
@@ -1465,14 +1953,14 @@ int midi_seek(int target)
 
       /* if we didn't hit the end of the file, continue playing */
       if (!midi_looping)
-	 install_int(midi_player, 20);
+	 midi_schedule(MSEC_TO_TIMER(20));
 
       return 0;
    }
 
    if ((midi_loop) && (!midi_looping)) {  /* was file looped? */
       prepare_to_play(old_midifile);
-      install_int(midi_player, 20);
+      midi_schedule(MSEC_TO_TIMER(20));
       return 2;                           /* seek past EOF => file restarted */
    }
 
@@ -1484,16 +1972,39 @@ END_OF_FUNCTION(midi_seek);
 
 
 /* get_midi_length:
- *  Returns the length, in seconds, of the specified midi. This will stop any
- *  currently playing midi. Don't call it too often, since it simulates playing
- *  all of the midi to get the time even if the midi contains tempo changes.
+ *  Returns the length, in seconds, of the specified midi. The time is
+ *  worked out from the last snapshot of the merged stream, so it is right
+ *  even if the midi contains tempo changes, and whatever is playing is
+ *  left alone. When nothing plays, midi_pos and midi_time are also set as
+ *  if the file had just played to the end, like they used to be.
  */
 int get_midi_length(MIDI *midi)
 {
-    play_midi(midi, 0);
-    while (midi_pos < 0); /* Without this, midi_seek won't work. */
-    midi_seek(INT_MAX);
-    return midi_time;
+   MIDI_STREAM *stream;
+   MIDI_SNAPSHOT snap;
+   int divisions, length, i;
+   ASSERT(midi);
+
+   stream = get_midi_stream(midi);
+   if (!stream)
+      return 0;
+
+   divisions = MAX(midi->divisions, 1);
+
+   i = stream->count - (stream->count % MIDI_SNAPSHOT_EVENTS);
+   snap = stream->snapshot[i / MIDI_SNAPSHOT_EVENTS];
+
+   for (; i<stream->count; i++)
+      snapshot_event(&snap, stream->event+i, divisions);
+
+   length = snap.timers / TIMERS_PER_SECOND;
+
+   if (!midifile) {
+      midi_pos = -(long)MIN(snap.time / divisions + 1, INT_MAX);
+      midi_time = length;
+   }
+
+   return length;
 }
 
 
@@ -1567,7 +2078,9 @@ static void midi_lock_mem(void)
    LOCK_VARIABLE(midi_alloc_channel);
    LOCK_VARIABLE(midi_alloc_note);
    LOCK_VARIABLE(midi_alloc_vol);
-   LOCK_VARIABLE(midi_track);
+   LOCK_VARIABLE(midi_stream);
+   LOCK_VARIABLE(midi_cursor);
+   LOCK_VARIABLE(midi_event_timer);
    LOCK_VARIABLE(midi_voice);
    LOCK_VARIABLE(midi_channel);
    LOCK_VARIABLE(midi_waiting);
@@ -1575,8 +2088,10 @@ static void midi_lock_mem(void)
    LOCK_VARIABLE(midi_msg_callback);
    LOCK_VARIABLE(midi_meta_callback);
    LOCK_VARIABLE(midi_sysex_callback);
-   LOCK_VARIABLE(midi_seeking);
    LOCK_VARIABLE(midi_looping);
+   LOCK_VARIABLE(_midi_clocked);
+   LOCK_VARIABLE(midi_clock_due);
+   LOCK_VARIABLE(midi_clock_mutex);
    LOCK_FUNCTION(parse_var_len);
    LOCK_FUNCTION(raw_program_change);
    LOCK_FUNCTION(midi_note_off);
@@ -1589,12 +2104,17 @@ static void midi_lock_mem(void)
    LOCK_FUNCTION(process_controller);
    LOCK_FUNCTION(process_meta_event);
    LOCK_FUNCTION(process_midi_event);
+   LOCK_FUNCTION(midi_schedule);
+   LOCK_FUNCTION(midi_unschedule);
    LOCK_FUNCTION(midi_player);
+   LOCK_FUNCTION(snapshot_event);
    LOCK_FUNCTION(prepare_to_play);
    LOCK_FUNCTION(play_midi);
    LOCK_FUNCTION(stop_midi);
    LOCK_FUNCTION(midi_pause);
    LOCK_FUNCTION(midi_resume);
+   LOCK_FUNCTION(find_event);
+   LOCK_FUNCTION(seek_stream);
    LOCK_FUNCTION(midi_seek);
 }
 
@@ -1607,9 +2127,28 @@ static void midi_lock_mem(void)
    CONSTRUCTOR_FUNCTION(void _midi_constructor(void));
 #endif
 
+/* compile_stream, forget_stream:
+ *  Let the datafile code merge the tracks of the MIDI files it loads, and
+ *  drop them again when it unloads them.
+ */
+static void compile_stream(MIDI *midi)
+{
+   get_midi_stream(midi);
+}
+
+static void forget_stream(MIDI *midi)
+{
+   if (midi == midifile)
+      stop_midi();
+
+   free_midi_stream(midi);
+}
+
 static struct _AL_LINKER_MIDI midi_linker = {
    midi_init,
-   midi_exit
+   midi_exit,
+   compile_stream,
+   forget_stream
 };
 
 void _midi_constructor(void)
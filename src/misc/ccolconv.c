@@ -284,13 +284,25 @@ void _colorconv_blit_8_to_32(struct GRAPHICS_RECT *src_rect, struct GRAPHICS_REC
 {
    unsigned char *src;
    unsigned char *dest;
+   int y;
+#ifndef ALLEGRO_SIMD_SSE2
    int width;
    int src_feed;
    int dest_feed;
-   int y, x;
+   int x;
    unsigned int src_data;
    unsigned int dest_data;
-   
+#endif
+
+#ifdef ALLEGRO_SIMD_SSE2
+   src = src_rect->data;
+   dest = dest_rect->data;
+   for (y = src_rect->height; y; y--) {
+      _simd_colorconv_line_8_to_32(dest, src, src_rect->width, _colorconv_indexed_palette);
+      src += src_rect->pitch;
+      dest += dest_rect->pitch;
+   }
+#else
    width = src_rect->width;
    src_feed = src_rect->pitch - width;
    dest_feed = dest_rect->pitch - (width << 2);
@@ -346,6 +358,7 @@ void _colorconv_blit_8_to_32(struct GRAPHICS_RECT *src_rect, struct GRAPHICS_REC
       src += src_feed;
       dest += dest_feed;
    }
+#endif
 }
 
 
@@ -657,7 +670,19 @@ void _colorconv_blit_16_to_24(struct GRAPHICS_RECT *src_rect, struct GRAPHICS_RE
 
 void _colorconv_blit_16_to_32(struct GRAPHICS_RECT *src_rect, struct GRAPHICS_RECT *dest_rect)
 {
+#ifdef ALLEGRO_SIMD_SSE2
+   unsigned char *src = src_rect->data;
+   unsigned char *dest = dest_rect->data;
+   int y;
+
+   for (y = src_rect->height; y; y--) {
+      _simd_colorconv_line_16_to_32(dest, src, src_rect->width);
+      src += src_rect->pitch;
+      dest += dest_rect->pitch;
+   }
+#else
    _colorconv_blit_15_to_32(src_rect, dest_rect);
+#endif
 }
 
 
@@ -29,12 +29,17 @@
 
 
 #include <string.h>
+#include <math.h>
 
 #include "allegro.h"
 #include "allegro/internal/aintern.h"
 
 
 
+/* number of decoded blocks each voice keeps for ADPCM samples */
+#define MIX_ADPCM_SLOTS       4
+
+
 typedef struct MIXER_VOICE
 {
    int playing;               /* are we active? */
@@ -52,11 +57,24 @@ typedef struct MIXER_VOICE
    long loop_end;             /* fixed point loop end position */
    int lvol;                  /* left channel volume */
    int rvol;                  /* right channel volume */
+   int sinc_bank;             /* sinc filter bank for the current speed */
+   int active;                /* are we in the active voice list? */
+   struct MIXER_VOICE *prev;  /* links in the active voice list */
+   struct MIXER_VOICE *next;
+   AL_METHOD(int, fill, (void *buf, int len, void *param));
+   void *fill_param;          /* user data for the fill function */
+   int fill_len;              /* length of the fragments to refill */
+   int fill_count;            /* number of fragments in the sample */
+   int fill_next;             /* next fragment to refill */
+   signed short *adpcm;       /* decoded blocks of an ADPCM sample */
+   int adpcm_block[MIX_ADPCM_SLOTS];            /* block held by each slot */
+   unsigned int adpcm_used[MIX_ADPCM_SLOTS];    /* when it was last read */
+   unsigned int adpcm_clock;
+   int adpcm_last;            /* slot read last */
 } MIXER_VOICE;
 
 
-/* MIX_FIX_SHIFT must be <= (sizeof(int)*8)-24 */
-#define MIX_FIX_SHIFT         8
+/* MIX_FIX_SHIFT lives in aintern.h, the SIMD kernels use it too */
 #define MIX_FIX_SCALE         (1<<MIX_FIX_SHIFT)
 
 #define UPDATE_FREQ           16
@@ -66,9 +84,49 @@ typedef struct MIXER_VOICE
 /* the samples currently being played */
 static MIXER_VOICE mixer_voice[MIXER_MAX_SFX];
 
+/* the voices which may be playing, so the mixer only has to visit those */
+static MIXER_VOICE *mix_active_first = NULL;
+static MIXER_VOICE *mix_active_last = NULL;
+
+/* whether any voice was in the list for the last buffer */
+static int mix_voices_active = FALSE;
+
 /* temporary sample mixing buffer */
 static signed int *mix_buffer = NULL;
 
+/* float mixing buffer of quality 3, converted into mix_buffer at the end */
+static float *mix_float_buffer = NULL;
+
+/* decoded ADPCM blocks, MIX_ADPCM_SLOTS stereo blocks for each voice */
+#define MIX_ADPCM_VOICE_SIZE  (MIX_ADPCM_SLOTS * ADPCM_BLOCK_FRAMES * 2)
+static signed short *mix_adpcm_cache = NULL;
+
+/* windowed sinc filters of quality 3. The filter must cut off below the
+ * output Nyquist frequency when a voice plays faster than the output rate,
+ * so there is one bank for each range of speeds, up to the speed in
+ * mix_sinc_speed[] (fixed point, the last bank also takes anything faster).
+ */
+#define MIX_SINC_BANKS        4
+#define MIX_SINC_CUTOFF       0.9
+#define MIX_SINC_BETA         7.0
+
+static float mix_sinc_table[MIX_SINC_BANKS][MIX_SINC_PHASES][MIX_SINC_TAPS];
+static int mix_sinc_ready = FALSE;
+
+/* quality 3 mixes in floating point, which is only safe when the mixer
+ * runs in a thread of its own. Elsewhere (DOS) it runs in an interrupt
+ * handler that does not save the FPU state, so it stays at quality 2.
+ */
+#ifdef ALLEGRO_MULTITHREADED
+   #define MIX_MAX_QUALITY    3
+#else
+   #define MIX_MAX_QUALITY    2
+#endif
+
+static AL_CONST long mix_sinc_speed[MIX_SINC_BANKS] = {
+   1 << MIX_FIX_SHIFT, 3 << (MIX_FIX_SHIFT-1), 2 << MIX_FIX_SHIFT, 3 << MIX_FIX_SHIFT
+};
+
 /* lookup table for converting sample volumes */
 #define MIX_VOLUME_LEVELS     32
 typedef signed int MIXER_VOL_TABLE[256];
@@ -84,23 +142,121 @@ static int mix_bits;
 /* shift factor for volume per voice */
 static int voice_volume_scale = 1;
 
+/* how far the mixer has cut back to stay within its time budget: each
+ * level makes voices MIX_BUDGET_STEP louder mix without interpolation,
+ * and once they all do, the quietest ones are left silent */
+#define MIX_BUDGET_STEP       32
+#define MIX_BUDGET_LEVELS     12
+static int mix_budget_level = 0;
+
+/* counters for get_mixer_stats(), only kept while mix_stats_on is set */
+static MIXER_STATS mix_stats;
+static int mix_stats_on = FALSE;
+static double mix_stats_total_usec;
+
 static void mixer_lock_mem(void);
+static void mixer_command(int type, int voice, int arg1, int arg2, AL_CONST SAMPLE *sample);
+
+/* commands the voice functions hand over to the mixer */
+#define MIXER_CMD_INIT              0
+#define MIXER_CMD_RELEASE           1
+#define MIXER_CMD_START             2
+#define MIXER_CMD_STOP              3
+#define MIXER_CMD_LOOP              4
+#define MIXER_CMD_SET_POSITION      5
+#define MIXER_CMD_SET_VOLUME        6
+#define MIXER_CMD_RAMP_VOLUME       7
+#define MIXER_CMD_STOP_VOLUME_RAMP  8
+#define MIXER_CMD_SET_FREQUENCY     9
+#define MIXER_CMD_SWEEP_FREQUENCY   10
+#define MIXER_CMD_STOP_FREQ_SWEEP   11
+#define MIXER_CMD_SET_PAN           12
+#define MIXER_CMD_SWEEP_PAN         13
+#define MIXER_CMD_STOP_PAN_SWEEP    14
+#define MIXER_CMD_VOLUME_SCALE      15
+#define MIXER_CMD_SET_FILL          16
+
+typedef struct MIXER_CMD
+{
+   int type;                  /* one of the MIXER_CMD_* values */
+   int voice;                 /* voice number */
+   int arg1, arg2;            /* parameters, depending on the type */
+   SAMPLE sample;             /* copy of the sample for MIXER_CMD_INIT */
+   AL_METHOD(int, fill, (void *buf, int len, void *param));
+   void *fill_param;          /* for MIXER_CMD_SET_FILL */
+} MIXER_CMD;
 
 #ifdef ALLEGRO_MULTITHREADED
-/* global mixer mutex */
+
+/* Serialises the threads sending commands to the mixer. The mixer itself
+ * doesn't take it: it reads the commands from a single producer, single
+ * consumer ring at the start of each buffer, so changing a voice no longer
+ * waits for a whole buffer to be mixed and the other way around. Only
+ * compilers without a memory barrier make the mixer lock it while it
+ * reads the ring, see MIXER_BARRIER() below.
+ */
 static void *mixer_mutex = NULL;
+
+#define MIXER_CMD_RING_SIZE   1024           /* must be a power of two */
+
+static MIXER_CMD mixer_cmd_ring[MIXER_CMD_RING_SIZE];
+static volatile unsigned int mixer_cmd_head = 0;   /* commands sent */
+static volatile unsigned int mixer_cmd_tail = 0;   /* commands carried out */
+static volatile unsigned int mixer_generation = 0; /* odd while mixing */
+static int mixer_idle = FALSE;      /* see _mixer_set_idle() */
+
+/* play state of the voices as the getters should report it, for voices
+ * whose commands are still waiting in the ring
+ */
+typedef struct MIXER_SHADOW
+{
+   unsigned int cmd;          /* mixer_cmd_head after its last command */
+   int playing;               /* same as in MIXER_VOICE */
+   long pos;
+   long len;
+} MIXER_SHADOW;
+
+static MIXER_SHADOW mixer_shadow[MIXER_MAX_SFX];
+
+/* orders the ring accesses between the two threads. Without a barrier,
+ * the mixer reads the ring with mixer_mutex held instead.
+ */
+#if (defined ALLEGRO_GCC) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 1)))
+   #define MIXER_BARRIER()    __sync_synchronize()
+#elif (defined ALLEGRO_MSVC) && (_MSC_VER >= 1400)
+   #include <intrin.h>
+   #pragma intrinsic(_InterlockedExchange)
+
+   /* an interlocked operation is a full barrier for the compiler and
+    * the processor, like MemoryBarrier() in the Windows headers
+    */
+   static INLINE void mixer_barrier(void)
+   {
+      long fence;
+      _InterlockedExchange(&fence, 0);
+   }
+
+   #define MIXER_BARRIER()    mixer_barrier()
+#else
+   #define MIXER_BARRIER()
+   #define MIXER_LOCKED_RING
+#endif
+
 #endif
 
 
 
 /* set_mixer_quality:
  *  Sets the resampling quality of the mixer. Valid values are the same as
- *  the 'quality' config variable.
+ *  the 'quality' config variable. Quality 3 is turned into 2 on platforms
+ *  where the mixer runs in an interrupt handler.
  */
 void set_mixer_quality(int quality)
 {
-   if((quality < 0) || (quality > 2))
+   if((quality < 0) || (quality > 3))
       quality = 2;
+   if(quality > MIX_MAX_QUALITY)
+      quality = MIX_MAX_QUALITY;
    if(mix_channels == 1)
       quality = 0;
 
@@ -124,6 +280,96 @@ END_OF_FUNCTION(get_mixer_quality);
 
 
 
+/* set_mixer_lod:
+ *  Sets which voices the mixer may mix without interpolation, whatever
+ *  the quality: those playing below the given volume, and those with less
+ *  than the given priority. Valid values are the same as the 'lod_volume'
+ *  and 'lod_priority' config variables.
+ */
+void set_mixer_lod(int volume, int priority)
+{
+   _sound_lod_volume = MID(0, volume, 256);
+   _sound_lod_priority = MID(0, priority, 256);
+}
+
+END_OF_FUNCTION(set_mixer_lod);
+
+
+
+/* set_mixer_budget:
+ *  Sets the time the mixer may take over a buffer, in percent of the time
+ *  the buffer plays for, or zero for no limit. The same as the
+ *  'mixer_budget' config variable.
+ */
+void set_mixer_budget(int percent)
+{
+   _sound_budget = MAX(percent, 0);
+   mix_budget_level = 0;
+}
+
+END_OF_FUNCTION(set_mixer_budget);
+
+
+
+/* set_mixer_stats:
+ *  Starts or stops collecting the counters read by get_mixer_stats(),
+ *  and clears them.
+ */
+void set_mixer_stats(int enable)
+{
+   mix_stats_on = FALSE;
+   memset(&mix_stats, 0, sizeof(mix_stats));
+   mix_stats_total_usec = 0;
+   mix_stats_on = enable;
+}
+
+END_OF_FUNCTION(set_mixer_stats);
+
+
+
+/* get_mixer_stats:
+ *  Copies the counters into stats, and starts measuring the peak levels
+ *  and the longest mixing time afresh. Returns zero on success, or -1 if
+ *  they aren't being collected or the driver doesn't use the mixer.
+ */
+int get_mixer_stats(MIXER_STATS *stats)
+{
+   if ((!mix_stats_on) || (digi_driver->init_voice != _mixer_init_voice))
+      return -1;
+
+   *stats = mix_stats;
+
+   if (stats->buffers > 0)
+      stats->avg_usec = mix_stats_total_usec / stats->buffers;
+
+   mix_stats.max_usec = 0;
+   mix_stats.peak_left = 0;
+   mix_stats.peak_right = 0;
+
+   return 0;
+}
+
+END_OF_FUNCTION(get_mixer_stats);
+
+
+
+/* _mixer_stats_underrun:
+ *  Called by the drivers when the device ran out of data, and whether they
+ *  got it playing again.
+ */
+void _mixer_stats_underrun(int recovered)
+{
+   if (mix_stats_on) {
+      mix_stats.underruns++;
+      if (recovered)
+         mix_stats.recoveries++;
+   }
+}
+
+END_OF_FUNCTION(_mixer_stats_underrun);
+
+
+
 /* get_mixer_frequency:
  *  Returns the mixer frequency, in Hz.
  */
@@ -229,24 +475,76 @@ void set_volume_per_voice(int scale)
    }
 
    /* Update the mixer voices' volumes */
-#ifdef ALLEGRO_MULTITHREADED
-   if(mixer_mutex)
-      system_driver->lock_mutex(mixer_mutex);
-#endif
-   voice_volume_scale = scale;
-
-   for(i = 0;i < mix_voices;++i)
-      update_mixer_volume(mixer_voice+i, _phys_voice+i);
-#ifdef ALLEGRO_MULTITHREADED
-   if(mixer_mutex)
-      system_driver->unlock_mutex(mixer_mutex);
-#endif
+   mixer_command(MIXER_CMD_VOLUME_SCALE, 0, scale, 0, NULL);
 }
 
 END_OF_FUNCTION(set_volume_per_voice);
 
 
 
+/* mixer_bessel_i0:
+ *  Modified Bessel function of order zero, for the Kaiser window.
+ */
+static double mixer_bessel_i0(double x)
+{
+   double sum = 1.0;
+   double term = 1.0;
+   int k;
+
+   for (k=1; k<32; k++) {
+      term *= (x / (2*k)) * (x / (2*k));
+      sum += term;
+   }
+
+   return sum;
+}
+
+
+
+/* mixer_build_sinc_table:
+ *  Fills the quality 3 filter banks with Kaiser windowed sinc functions.
+ *  Every row is normalized to a gain of one, so that resampling doesn't
+ *  change the level of the low frequencies.
+ */
+static void mixer_build_sinc_table(void)
+{
+   double half = MIX_SINC_TAPS / 2;
+   double cutoff, x, w, v, sum;
+   int b, p, k;
+
+   for (b=0; b<MIX_SINC_BANKS; b++) {
+      cutoff = MIX_SINC_CUTOFF * MIX_FIX_SCALE / mix_sinc_speed[b];
+
+      for (p=0; p<MIX_SINC_PHASES; p++) {
+         sum = 0.0;
+
+         for (k=0; k<MIX_SINC_TAPS; k++) {
+            /* distance from the sample position to the frame under tap k */
+            x = k - (MIX_SINC_TAPS/2 - 1) - (double)p / MIX_SINC_PHASES;
+
+            w = 1.0 - (x*x) / (half*half);
+            if (w > 0.0)
+               w = mixer_bessel_i0(MIX_SINC_BETA * sqrt(w)) / mixer_bessel_i0(MIX_SINC_BETA);
+            else
+               w = 0.0;
+
+            if (x == 0.0)
+               v = w;
+            else
+               v = w * sin(AL_PI * cutoff * x) / (AL_PI * cutoff * x);
+
+            mix_sinc_table[b][p][k] = v;
+            sum += v;
+         }
+
+         for (k=0; k<MIX_SINC_TAPS; k++)
+            mix_sinc_table[b][p][k] /= sum;
+      }
+   }
+}
+
+
+
 /* _mixer_init:
  *  Initialises the sample mixing code, returning 0 on success. You should
  *  pass it the number of samples you want it to mix each time the refill
@@ -261,8 +559,12 @@ int _mixer_init(int bufsize, int freq, int stereo, int is16bit, int *voices)
 {
    int i, j;
 
-   if((_sound_hq < 0) || (_sound_hq > 2))
+   if((_sound_hq < 0) || (_sound_hq > 3))
       _sound_hq = 2;
+   if(_sound_hq > MIX_MAX_QUALITY)
+      _sound_hq = MIX_MAX_QUALITY;
+   if(!stereo)
+      _sound_hq = 0;
 
    mix_voices = *voices;
    if(mix_voices > MIXER_MAX_SFX)
@@ -276,8 +578,12 @@ int _mixer_init(int bufsize, int freq, int stereo, int is16bit, int *voices)
    for (i=0; i<MIXER_MAX_SFX; i++) {
       mixer_voice[i].playing = FALSE;
       mixer_voice[i].data.buffer = NULL;
+      mixer_voice[i].active = FALSE;
+      mixer_voice[i].fill = NULL;
    }
 
+   mix_active_first = mix_active_last = NULL;
+
    /* temporary buffer for sample mixing */
    mix_buffer = _AL_MALLOC_ATOMIC(mix_size*mix_channels * sizeof(*mix_buffer));
    if (!mix_buffer) {
@@ -290,6 +596,43 @@ int _mixer_init(int bufsize, int freq, int stereo, int is16bit, int *voices)
 
    LOCK_DATA(mix_buffer, mix_size*mix_channels * sizeof(*mix_buffer));
 
+   /* the float bus is always there, in case of set_mixer_quality(3) */
+   mix_float_buffer = _AL_MALLOC_ATOMIC(mix_size*mix_channels * sizeof(*mix_float_buffer));
+   if (!mix_float_buffer) {
+      _AL_FREE(mix_buffer);
+      mix_buffer = NULL;
+      mix_size = 0;
+      mix_freq = 0;
+      mix_channels = 0;
+      mix_bits = 0;
+      return -1;
+   }
+
+   LOCK_DATA(mix_float_buffer, mix_size*mix_channels * sizeof(*mix_float_buffer));
+
+   mix_adpcm_cache = _AL_MALLOC_ATOMIC(mix_voices * MIX_ADPCM_VOICE_SIZE * sizeof(*mix_adpcm_cache));
+   if (!mix_adpcm_cache) {
+      _AL_FREE(mix_buffer);
+      mix_buffer = NULL;
+      _AL_FREE(mix_float_buffer);
+      mix_float_buffer = NULL;
+      mix_size = 0;
+      mix_freq = 0;
+      mix_channels = 0;
+      mix_bits = 0;
+      return -1;
+   }
+
+   LOCK_DATA(mix_adpcm_cache, mix_voices * MIX_ADPCM_VOICE_SIZE * sizeof(*mix_adpcm_cache));
+
+   for (i=0; i<mix_voices; i++)
+      mixer_voice[i].adpcm = mix_adpcm_cache + i*MIX_ADPCM_VOICE_SIZE;
+
+   if (!mix_sinc_ready) {
+      mixer_build_sinc_table();
+      mix_sinc_ready = TRUE;
+   }
+
    for (j=0; j<MIX_VOLUME_LEVELS; j++)
       for (i=0; i<256; i++)
 	 mix_vol_table[j][i] = ((i-128) * 256 * j / MIX_VOLUME_LEVELS) << 8;
@@ -302,12 +645,22 @@ int _mixer_init(int bufsize, int freq, int stereo, int is16bit, int *voices)
    if (!mixer_mutex) {
       _AL_FREE(mix_buffer);
       mix_buffer = NULL;
+      _AL_FREE(mix_float_buffer);
+      mix_float_buffer = NULL;
+      _AL_FREE(mix_adpcm_cache);
+      mix_adpcm_cache = NULL;
       mix_size = 0;
       mix_freq = 0;
       mix_channels = 0;
       mix_bits = 0;
       return -1;
    }
+
+   mixer_cmd_head = mixer_cmd_tail = 0;
+   mixer_generation = 0;
+
+   for (i=0; i<MIXER_MAX_SFX; i++)
+      mixer_shadow[i].cmd = 0;
 #endif
 
    return 0;
@@ -329,6 +682,14 @@ void _mixer_exit(void)
       _AL_FREE(mix_buffer);
    mix_buffer = NULL;
 
+   if (mix_float_buffer)
+      _AL_FREE(mix_float_buffer);
+   mix_float_buffer = NULL;
+
+   if (mix_adpcm_cache)
+      _AL_FREE(mix_adpcm_cache);
+   mix_adpcm_cache = NULL;
+
    mix_size = 0;
    mix_freq = 0;
    mix_channels = 0;
@@ -379,6 +740,10 @@ static INLINE void update_mixer_freq(MIXER_VOICE *mv, PHYS_VOICE *pv)
 {
    mv->diff = (pv->freq >> (12 - MIX_FIX_SHIFT)) / mix_freq;
 
+   for (mv->sinc_bank=0; mv->sinc_bank<MIX_SINC_BANKS-1; mv->sinc_bank++)
+      if (mv->diff <= mix_sinc_speed[mv->sinc_bank])
+         break;
+
    if (pv->playmode & PLAYMODE_BACKWARD)
       mv->diff = -mv->diff;
 }
@@ -466,177 +831,650 @@ END_OF_STATIC_FUNCTION(update_silent_mixer);
 
 
 
-/* helper for constructing the body of a sample mixing routine */
-#define MIXER()                                                              \
-{                                                                            \
-   if ((voice->playmode & PLAYMODE_LOOP) &&                                  \
-       (spl->loop_start < spl->loop_end)) {                                  \
-                                                                             \
-      if (voice->playmode & PLAYMODE_BACKWARD) {                             \
-         /* mix a backward looping sample */                                 \
-         while (len--) {                                                     \
-            MIX();                                                           \
-            spl->pos += spl->diff;                                           \
-            if (spl->pos < spl->loop_start) {                                \
-               if (voice->playmode & PLAYMODE_BIDIR) {                       \
-                  spl->diff = -spl->diff;                                    \
-                  /* however far the sample has overshot, move it the same */\
-                  /* distance from the loop point, within the loop section */\
-                  spl->pos = (spl->loop_start << 1) - spl->pos;              \
-                  voice->playmode ^= PLAYMODE_BACKWARD;                      \
-               }                                                             \
-               else                                                          \
-                  spl->pos += (spl->loop_end - spl->loop_start);             \
-            }                                                                \
-            if ((len & (UPDATE_FREQ-1)) == 0)                                \
-               update_mixer(spl, voice, len);                                \
-         }                                                                   \
-      }                                                                      \
-      else {                                                                 \
-         /* mix a forward looping sample */                                  \
-         while (len--) {                                                     \
-            MIX();                                                           \
-            spl->pos += spl->diff;                                           \
-            if (spl->pos >= spl->loop_end) {                                 \
-               if (voice->playmode & PLAYMODE_BIDIR) {                       \
-                  spl->diff = -spl->diff;                                    \
-                  /* however far the sample has overshot, move it the same */\
-                  /* distance from the loop point, within the loop section */\
-                  spl->pos = ((spl->loop_end - 1) << 1) - spl->pos;          \
-                  voice->playmode ^= PLAYMODE_BACKWARD;                      \
-               }                                                             \
-               else                                                          \
-                  spl->pos -= (spl->loop_end - spl->loop_start);             \
-            }                                                                \
-            if ((len & (UPDATE_FREQ-1)) == 0)                                \
-               update_mixer(spl, voice, len);                                \
-         }                                                                   \
-      }                                                                      \
-   }                                                                         \
-   else {                                                                    \
-      /* mix a non-looping sample */                                         \
-      while (len--) {                                                        \
-         MIX();                                                              \
-         spl->pos += spl->diff;                                              \
-         if ((unsigned long)spl->pos >= (unsigned long)spl->len) {           \
-            /* note: we don't need a different version for reverse play, */  \
-            /* as this will wrap and automatically do the Right Thing */     \
-            spl->playing = FALSE;                                            \
-            return;                                                          \
-         }                                                                   \
-         if ((len & (UPDATE_FREQ-1)) == 0)                                   \
-            update_mixer(spl, voice, len);                                   \
-      }                                                                      \
-   }                                                                         \
-}
-
-
-/* mix_silent_samples:
- *  This is used when the voice is silent, instead of the other
- *  mix_*_samples() functions. It just extrapolates the sample position,
- *  and stops the sample if it reaches the end and isn't set to loop.
- *  Since no mixing is necessary, this function is much faster than
- *  its friends. In addition, no buffer parameter is required,
- *  and the same function can be used for all sample types.
- *
- *  There is a catch. All the mix_stereo_*_samples() and
- *  mix_hq?_*_samples() functions (those which write to a stereo mixing
- *  buffer) divide len by 2 before using it in the MIXER() macro.
- *  Therefore, all the mix_silent_samples() for stereo buffers must divide
- *  the len parameter by 2.
+/* mixer_activate_voice:
+ *  Adds a voice to the end of the active voice list.
  */
-static void mix_silent_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, int len)
+static void mixer_activate_voice(MIXER_VOICE *mv)
 {
-   if ((voice->playmode & PLAYMODE_LOOP) &&
-       (spl->loop_start < spl->loop_end)) {
+   if (mv->active)
+      return;
 
-      if (voice->playmode & PLAYMODE_BACKWARD) {
-         /* mix a backward looping sample */
-         spl->pos += spl->diff * len;
-         if (spl->pos < spl->loop_start) {
-            if (voice->playmode & PLAYMODE_BIDIR) {
-               do {
-                  spl->diff = -spl->diff;
-                  spl->pos = (spl->loop_start << 1) - spl->pos;
-                  voice->playmode ^= PLAYMODE_BACKWARD;
-                  if (spl->pos < spl->loop_end) break;
-                  spl->diff = -spl->diff;
-                  spl->pos = ((spl->loop_end - 1) << 1) - spl->pos;
-                  voice->playmode ^= PLAYMODE_BACKWARD;
-               } while (spl->pos < spl->loop_start);
-            }
-            else {
-               do {
-                  spl->pos += (spl->loop_end - spl->loop_start);
-               } while (spl->pos < spl->loop_start);
-            }
-         }
-         update_silent_mixer(spl, voice, len);
-      }
-      else {
-         /* mix a forward looping sample */
-         spl->pos += spl->diff * len;
-         if (spl->pos >= spl->loop_end) {
-            if (voice->playmode & PLAYMODE_BIDIR) {
-               do {
-                  spl->diff = -spl->diff;
-                  spl->pos = ((spl->loop_end - 1) << 1) - spl->pos;
-                  voice->playmode ^= PLAYMODE_BACKWARD;
-                  if (spl->pos >= spl->loop_start) break;
-                  spl->diff = -spl->diff;
-                  spl->pos = (spl->loop_start << 1) - spl->pos;
-                  voice->playmode ^= PLAYMODE_BACKWARD;
-               } while (spl->pos >= spl->loop_end);
-            }
-            else {
-               do {
-                  spl->pos -= (spl->loop_end - spl->loop_start);
-               } while (spl->pos >= spl->loop_end);
-            }
-         }
-         update_silent_mixer(spl, voice, len);
-      }
-   }
-   else {
-      /* mix a non-looping sample */
-      spl->pos += spl->diff * len;
-      if ((unsigned long)spl->pos >= (unsigned long)spl->len) {
-         /* note: we don't need a different version for reverse play, */
-         /* as this will wrap and automatically do the Right Thing */
-         spl->playing = FALSE;
-         return;
-      }
-      update_silent_mixer(spl, voice, len);
-   }
+   mv->prev = mix_active_last;
+   mv->next = NULL;
+
+   if (mix_active_last)
+      mix_active_last->next = mv;
+   else
+      mix_active_first = mv;
+
+   mix_active_last = mv;
+   mv->active = TRUE;
 }
 
-END_OF_STATIC_FUNCTION(mix_silent_samples);
+END_OF_STATIC_FUNCTION(mixer_activate_voice);
 
 
 
-/* mix_mono_8x1_samples:
- *  Mixes from an eight bit sample into a mono buffer, until either len
- *  samples have been mixed or until the end of the sample is reached.
+/* mixer_deactivate_voice:
+ *  Removes a voice from the active voice list.
  */
-static void mix_mono_8x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+static void mixer_deactivate_voice(MIXER_VOICE *mv)
 {
-   signed int *lvol = (int *)(mix_vol_table + (spl->lvol>>1));
-   signed int *rvol = (int *)(mix_vol_table + (spl->rvol>>1));
+   if (!mv->active)
+      return;
 
-   #define MIX()                                                             \
-      *(buf)   += lvol[spl->data.u8[spl->pos>>MIX_FIX_SHIFT]];               \
-      *(buf++) += rvol[spl->data.u8[spl->pos>>MIX_FIX_SHIFT]];
+   if (mv->prev)
+      mv->prev->next = mv->next;
+   else
+      mix_active_first = mv->next;
 
-   MIXER();
+   if (mv->next)
+      mv->next->prev = mv->prev;
+   else
+      mix_active_last = mv->prev;
 
-   #undef MIX
+   mv->active = FALSE;
 }
 
-END_OF_STATIC_FUNCTION(mix_mono_8x1_samples);
+END_OF_STATIC_FUNCTION(mixer_deactivate_voice);
 
 
 
-/* mix_mono_8x2_samples:
+/* mixer_apply_command:
+ *  Carries out a command sent by one of the voice functions. This runs in
+ *  the mixer's thread when the command ring is in use.
+ */
+static void mixer_apply_command(AL_CONST MIXER_CMD *cmd)
+{
+   MIXER_VOICE *mv = mixer_voice + cmd->voice;
+   PHYS_VOICE *pv = _phys_voice + cmd->voice;
+   AL_CONST SAMPLE *sample = &cmd->sample;
+   int i, d, time;
+
+   switch (cmd->type) {
+
+      case MIXER_CMD_INIT:
+	 mv->playing = FALSE;
+	 mixer_deactivate_voice(mv);
+	 mv->channels = (sample->stereo ? 2 : 1);
+	 mv->bits = sample->bits;
+	 mv->pos = 0;
+	 mv->len = sample->len << MIX_FIX_SHIFT;
+	 mv->loop_start = sample->loop_start << MIX_FIX_SHIFT;
+	 mv->loop_end = sample->loop_end << MIX_FIX_SHIFT;
+	 mv->data.buffer = sample->data;
+	 mv->fill = NULL;
+	 for (i=0; i<MIX_ADPCM_SLOTS; i++)
+	    mv->adpcm_block[i] = -1;
+	 update_mixer_volume(mv, pv);
+	 update_mixer_freq(mv, pv);
+	 break;
+
+      case MIXER_CMD_RELEASE:
+	 mv->playing = FALSE;
+	 mv->data.buffer = NULL;
+	 mv->fill = NULL;
+	 mixer_deactivate_voice(mv);
+	 break;
+
+      case MIXER_CMD_START:
+	 if (mv->pos >= mv->len)
+	    mv->pos = 0;
+	 mv->playing = TRUE;
+	 mixer_activate_voice(mv);
+	 break;
+
+      case MIXER_CMD_STOP:
+	 mv->playing = FALSE;
+	 mixer_deactivate_voice(mv);
+	 break;
+
+      case MIXER_CMD_LOOP:
+	 update_mixer_freq(mv, pv);
+	 break;
+
+      case MIXER_CMD_SET_POSITION:
+	 mv->pos = (cmd->arg1 << MIX_FIX_SHIFT);
+	 if (mv->pos >= mv->len) {
+	    mv->playing = FALSE;
+	    mixer_deactivate_voice(mv);
+	 }
+	 break;
+
+      case MIXER_CMD_SET_VOLUME:
+	 pv->vol = cmd->arg1 << 12;
+	 pv->dvol = 0;
+	 update_mixer_volume(mv, pv);
+	 break;
+
+      case MIXER_CMD_RAMP_VOLUME:
+	 d = (cmd->arg2 << 12) - pv->vol;
+	 time = MAX(cmd->arg1 * (mix_freq / UPDATE_FREQ) / 1000, 1);
+	 pv->target_vol = cmd->arg2 << 12;
+	 pv->dvol = d / time;
+	 break;
+
+      case MIXER_CMD_STOP_VOLUME_RAMP:
+	 pv->dvol = 0;
+	 break;
+
+      case MIXER_CMD_SET_FREQUENCY:
+	 pv->freq = cmd->arg1 << 12;
+	 pv->dfreq = 0;
+	 update_mixer_freq(mv, pv);
+	 break;
+
+      case MIXER_CMD_SWEEP_FREQUENCY:
+	 d = (cmd->arg2 << 12) - pv->freq;
+	 time = MAX(cmd->arg1 * (mix_freq / UPDATE_FREQ) / 1000, 1);
+	 pv->target_freq = cmd->arg2 << 12;
+	 pv->dfreq = d / time;
+	 break;
+
+      case MIXER_CMD_STOP_FREQ_SWEEP:
+	 pv->dfreq = 0;
+	 break;
+
+      case MIXER_CMD_SET_PAN:
+	 pv->pan = cmd->arg1 << 12;
+	 pv->dpan = 0;
+	 update_mixer_volume(mv, pv);
+	 break;
+
+      case MIXER_CMD_SWEEP_PAN:
+	 d = (cmd->arg2 << 12) - pv->pan;
+	 time = MAX(cmd->arg1 * (mix_freq / UPDATE_FREQ) / 1000, 1);
+	 pv->target_pan = cmd->arg2 << 12;
+	 pv->dpan = d / time;
+	 break;
+
+      case MIXER_CMD_STOP_PAN_SWEEP:
+	 pv->dpan = 0;
+	 break;
+
+      case MIXER_CMD_VOLUME_SCALE:
+	 voice_volume_scale = cmd->arg1;
+	 for (i=0; i<mix_voices; i++)
+	    update_mixer_volume(mixer_voice+i, _phys_voice+i);
+	 break;
+
+      case MIXER_CMD_SET_FILL:
+	 mv->fill = cmd->fill;
+	 mv->fill_param = cmd->fill_param;
+	 mv->fill_len = cmd->arg1;
+	 mv->fill_count = (mv->len >> MIX_FIX_SHIFT) / cmd->arg1;
+	 mv->fill_next = MIN((mv->pos >> MIX_FIX_SHIFT) / cmd->arg1, mv->fill_count-1);
+	 break;
+   }
+}
+
+END_OF_STATIC_FUNCTION(mixer_apply_command);
+
+
+
+#ifdef ALLEGRO_MULTITHREADED
+
+/* mixer_shadow_voice:
+ *  Returns the copy of a voice's play state that the getters report while
+ *  commands for it are queued, seeding it from the mixer's own state if the
+ *  mixer has already caught up with the voice. Call with mixer_mutex held.
+ */
+static MIXER_SHADOW *mixer_shadow_voice(int voice)
+{
+   MIXER_SHADOW *sh = mixer_shadow + voice;
+
+   if ((int)(sh->cmd - mixer_cmd_tail) <= 0) {
+      MIXER_BARRIER();
+      sh->playing = mixer_voice[voice].playing;
+      sh->pos = mixer_voice[voice].pos;
+      sh->len = mixer_voice[voice].len;
+   }
+
+   return sh;
+}
+
+
+
+/* mixer_apply_ring:
+ *  Carries out the queued commands. Only one thread may do so at a time,
+ *  and never while the mixer is working on a buffer.
+ */
+static void mixer_apply_ring(void)
+{
+   unsigned int head, tail;
+
+   head = mixer_cmd_head;
+   tail = mixer_cmd_tail;
+
+   MIXER_BARRIER();
+
+   while (tail != head) {
+      mixer_apply_command(mixer_cmd_ring + (tail & (MIXER_CMD_RING_SIZE-1)));
+      tail++;
+   }
+
+   MIXER_BARRIER();
+   mixer_cmd_tail = tail;
+}
+
+
+
+/* mixer_send_command:
+ *  Queues a command for the mixer, which carries it out at the start of
+ *  the next buffer.
+ */
+static void mixer_send_command(AL_CONST MIXER_CMD *cmd)
+{
+   MIXER_SHADOW *sh;
+   unsigned int gen;
+
+   system_driver->lock_mutex(mixer_mutex);
+
+   /* the mixer empties the ring every buffer, so this hardly ever waits.
+    * It may need the lock to do so, so don't hold it meanwhile. When the
+    * mixer is idle it isn't going to empty it, so do that here instead.
+    */
+   while (mixer_cmd_head - mixer_cmd_tail >= MIXER_CMD_RING_SIZE) {
+      if (mixer_idle) {
+	 mixer_apply_ring();
+	 break;
+      }
+
+      system_driver->unlock_mutex(mixer_mutex);
+      if (system_driver->yield_timeslice)
+	 system_driver->yield_timeslice();
+      system_driver->lock_mutex(mixer_mutex);
+   }
+
+   /* keep track of what the getters should report meanwhile */
+   sh = mixer_shadow_voice(cmd->voice);
+
+   switch (cmd->type) {
+
+      case MIXER_CMD_INIT:
+	 sh->playing = FALSE;
+	 sh->pos = 0;
+	 sh->len = cmd->sample.len << MIX_FIX_SHIFT;
+	 break;
+
+      case MIXER_CMD_RELEASE:
+      case MIXER_CMD_STOP:
+	 sh->playing = FALSE;
+	 break;
+
+      case MIXER_CMD_START:
+	 if (sh->pos >= sh->len)
+	    sh->pos = 0;
+	 sh->playing = TRUE;
+	 break;
+
+      case MIXER_CMD_SET_POSITION:
+	 sh->pos = (cmd->arg1 << MIX_FIX_SHIFT);
+	 if (sh->pos >= sh->len)
+	    sh->playing = FALSE;
+	 break;
+   }
+
+   mixer_cmd_ring[mixer_cmd_head & (MIXER_CMD_RING_SIZE-1)] = *cmd;
+   sh->cmd = mixer_cmd_head + 1;
+
+   MIXER_BARRIER();
+   mixer_cmd_head++;
+
+   system_driver->unlock_mutex(mixer_mutex);
+
+   /* the caller is free to destroy the sample once it has been released,
+    * so wait until the mixer is done with any buffer it was in the middle
+    * of: it will see the command before it starts the next one
+    */
+   if (cmd->type == MIXER_CMD_RELEASE) {
+      MIXER_BARRIER();
+      gen = mixer_generation;
+      if (gen & 1) {
+	 while (mixer_generation == gen) {
+	    if (system_driver->yield_timeslice)
+	       system_driver->yield_timeslice();
+	 }
+      }
+   }
+}
+
+
+
+/* mixer_receive_commands:
+ *  Carries out the queued commands, from the mixer's thread.
+ */
+static void mixer_receive_commands(void)
+{
+#ifdef MIXER_LOCKED_RING
+   system_driver->lock_mutex(mixer_mutex);
+#endif
+
+   mixer_apply_ring();
+
+#ifdef MIXER_LOCKED_RING
+   system_driver->unlock_mutex(mixer_mutex);
+#endif
+}
+
+#endif
+
+
+
+/* mixer_post_command:
+ *  Sends a command to the mixer, or carries it out straight away when
+ *  there is no mixer thread to hand it over to.
+ */
+static void mixer_post_command(AL_CONST MIXER_CMD *cmd)
+{
+#ifdef ALLEGRO_MULTITHREADED
+   if (mixer_mutex) {
+      mixer_send_command(cmd);
+      return;
+   }
+#endif
+
+   mixer_apply_command(cmd);
+}
+
+END_OF_STATIC_FUNCTION(mixer_post_command);
+
+
+
+/* mixer_command:
+ *  Builds a command for the mixer and posts it.
+ */
+static void mixer_command(int type, int voice, int arg1, int arg2, AL_CONST SAMPLE *sample)
+{
+   MIXER_CMD cmd;
+
+   cmd.type = type;
+   cmd.voice = voice;
+   cmd.arg1 = arg1;
+   cmd.arg2 = arg2;
+
+   /* the sample may be gone by the time the mixer sees the command */
+   if (sample)
+      cmd.sample = *sample;
+
+   mixer_post_command(&cmd);
+}
+
+END_OF_STATIC_FUNCTION(mixer_command);
+
+
+
+#ifdef ALLEGRO_SIMD_SSE2
+
+/* shortest run worth handing over to the SIMD kernels */
+#define MIX_RUN_MIN           4
+
+/* mix_run_length:
+ *  Returns how many samples can be mixed from the current position without
+ *  reaching a loop point or the end of the sample, and without going past
+ *  the next update_mixer() call if the voice is ramping or sweeping, so
+ *  that they can be mixed in one go. interp is the number of frames the
+ *  mixer reads after the position: the run also stays clear of those and,
+ *  for the sinc filter, of the interp-1 frames it reads before it.
+ */
+static INLINE int mix_run_length(MIXER_VOICE *spl, PHYS_VOICE *voice, int len, int interp)
+{
+   int max = len;
+   long lo, hi, n;
+   long first = 0;
+
+   if ((voice->dvol) || (voice->dpan) || (voice->dfreq))
+      max = ((len-1) & (UPDATE_FREQ-1)) + 1;
+
+   if ((voice->playmode & PLAYMODE_LOOP) && (spl->loop_start < spl->loop_end)) {
+      lo = spl->loop_start;
+      hi = spl->loop_end;
+   }
+   else {
+      lo = 0;
+      hi = spl->len;
+   }
+
+   if (interp > 1) {
+      first = (long)(interp-1) << MIX_FIX_SHIFT;
+      lo += first;
+      hi -= (long)interp << MIX_FIX_SHIFT;
+   }
+   else if ((interp) && (hi > spl->len - MIX_FIX_SCALE))
+      hi = spl->len - MIX_FIX_SCALE;
+
+   if (spl->diff < 0) {
+      if ((spl->pos < lo) || (spl->pos >= hi))
+         return 0;
+      n = (spl->pos - lo) / -spl->diff;
+   }
+   else {
+      /* playing forward, the sample may not have reached the loop yet */
+      if ((spl->pos < first) || (spl->pos >= hi))
+         return 0;
+      n = (spl->diff > 0) ? (hi - 1 - spl->pos) / spl->diff : max;
+   }
+
+   return (n < max) ? n : max;
+}
+
+/* mixes runs of samples with MIX_RUN() where possible, see below */
+#define MIX_SIMD_RUN()                                                       \
+   {                                                                         \
+      int run = mix_run_length(spl, voice, len, MIX_INTERP);                 \
+      if (run >= MIX_RUN_MIN) {                                              \
+         MIX_RUN(run);                                                       \
+         spl->pos += spl->diff * run;                                        \
+         len -= run;                                                         \
+         if ((len & (UPDATE_FREQ-1)) == 0)                                   \
+            update_mixer(spl, voice, len);                                   \
+         continue;                                                           \
+      }                                                                      \
+   }
+
+#else
+
+#define MIX_SIMD_RUN()
+
+#endif
+
+
+
+/* helper for constructing the body of a sample mixing routine: MIX()
+ * mixes one sample, and with SIMD support, MIX_RUN(n) mixes n samples
+ * which are known not to reach a loop point. The low quality volume
+ * tables are linear, so MIX_RUN() takes entry 0x81 as the multiplier.
+ */
+#define MIXER()                                                              \
+{                                                                            \
+   if ((voice->playmode & PLAYMODE_LOOP) &&                                  \
+       (spl->loop_start < spl->loop_end)) {                                  \
+                                                                             \
+      /* a bidirectional loop changes direction within the buffer */         \
+      while (len > 0) {                                                      \
+         if (voice->playmode & PLAYMODE_BACKWARD) {                          \
+            /* mix a backward looping sample */                              \
+            while (len > 0) {                                                \
+               MIX_SIMD_RUN();                                               \
+               len--;                                                        \
+               MIX();                                                        \
+               spl->pos += spl->diff;                                        \
+               if ((len & (UPDATE_FREQ-1)) == 0)                             \
+                  update_mixer(spl, voice, len);                             \
+               if (spl->pos < spl->loop_start) {                             \
+                  if (voice->playmode & PLAYMODE_BIDIR) {                    \
+                     spl->diff = -spl->diff;                                 \
+                     /* however far the sample has overshot, move it the */  \
+                     /* same distance from the loop point, within the loop */\
+                     spl->pos = (spl->loop_start << 1) - spl->pos;           \
+                     voice->playmode ^= PLAYMODE_BACKWARD;                   \
+                     break;                                                  \
+                  }                                                          \
+                  else                                                       \
+                     spl->pos += (spl->loop_end - spl->loop_start);          \
+               }                                                             \
+            }                                                                \
+         }                                                                   \
+         else {                                                              \
+            /* mix a forward looping sample */                               \
+            while (len > 0) {                                                \
+               MIX_SIMD_RUN();                                               \
+               len--;                                                        \
+               MIX();                                                        \
+               spl->pos += spl->diff;                                        \
+               if ((len & (UPDATE_FREQ-1)) == 0)                             \
+                  update_mixer(spl, voice, len);                             \
+               if (spl->pos >= spl->loop_end) {                              \
+                  if (voice->playmode & PLAYMODE_BIDIR) {                    \
+                     spl->diff = -spl->diff;                                 \
+                     /* however far the sample has overshot, move it the */  \
+                     /* same distance from the loop point, within the loop */\
+                     spl->pos = ((spl->loop_end - 1) << 1) - spl->pos;       \
+                     voice->playmode ^= PLAYMODE_BACKWARD;                   \
+                     break;                                                  \
+                  }                                                          \
+                  else                                                       \
+                     spl->pos -= (spl->loop_end - spl->loop_start);          \
+               }                                                             \
+            }                                                                \
+         }                                                                   \
+      }                                                                      \
+   }                                                                         \
+   else {                                                                    \
+      /* mix a non-looping sample */                                         \
+      while (len > 0) {                                                      \
+         MIX_SIMD_RUN();                                                     \
+         len--;                                                              \
+         MIX();                                                              \
+         spl->pos += spl->diff;                                              \
+         if ((unsigned long)spl->pos >= (unsigned long)spl->len) {           \
+            /* note: we don't need a different version for reverse play, */  \
+            /* as this will wrap and automatically do the Right Thing */     \
+            spl->playing = FALSE;                                            \
+            return;                                                          \
+         }                                                                   \
+         if ((len & (UPDATE_FREQ-1)) == 0)                                   \
+            update_mixer(spl, voice, len);                                   \
+      }                                                                      \
+   }                                                                         \
+}
+
+
+/* mix_silent_samples:
+ *  This is used when the voice is silent, instead of the other
+ *  mix_*_samples() functions. It just extrapolates the sample position,
+ *  and stops the sample if it reaches the end and isn't set to loop.
+ *  Since no mixing is necessary, this function is much faster than
+ *  its friends. In addition, no buffer parameter is required,
+ *  and the same function can be used for all sample types.
+ *
+ *  There is a catch. All the mix_stereo_*_samples() and
+ *  mix_hq?_*_samples() functions (those which write to a stereo mixing
+ *  buffer) divide len by 2 before using it in the MIXER() macro.
+ *  Therefore, all the mix_silent_samples() for stereo buffers must divide
+ *  the len parameter by 2.
+ */
+static void mix_silent_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, int len)
+{
+   if ((voice->playmode & PLAYMODE_LOOP) &&
+       (spl->loop_start < spl->loop_end)) {
+
+      if (voice->playmode & PLAYMODE_BACKWARD) {
+         /* mix a backward looping sample */
+         spl->pos += spl->diff * len;
+         if (spl->pos < spl->loop_start) {
+            if (voice->playmode & PLAYMODE_BIDIR) {
+               do {
+                  spl->diff = -spl->diff;
+                  spl->pos = (spl->loop_start << 1) - spl->pos;
+                  voice->playmode ^= PLAYMODE_BACKWARD;
+                  if (spl->pos < spl->loop_end) break;
+                  spl->diff = -spl->diff;
+                  spl->pos = ((spl->loop_end - 1) << 1) - spl->pos;
+                  voice->playmode ^= PLAYMODE_BACKWARD;
+               } while (spl->pos < spl->loop_start);
+            }
+            else {
+               do {
+                  spl->pos += (spl->loop_end - spl->loop_start);
+               } while (spl->pos < spl->loop_start);
+            }
+         }
+         update_silent_mixer(spl, voice, len);
+      }
+      else {
+         /* mix a forward looping sample */
+         spl->pos += spl->diff * len;
+         if (spl->pos >= spl->loop_end) {
+            if (voice->playmode & PLAYMODE_BIDIR) {
+               do {
+                  spl->diff = -spl->diff;
+                  spl->pos = ((spl->loop_end - 1) << 1) - spl->pos;
+                  voice->playmode ^= PLAYMODE_BACKWARD;
+                  if (spl->pos >= spl->loop_start) break;
+                  spl->diff = -spl->diff;
+                  spl->pos = (spl->loop_start << 1) - spl->pos;
+                  voice->playmode ^= PLAYMODE_BACKWARD;
+               } while (spl->pos >= spl->loop_end);
+            }
+            else {
+               do {
+                  spl->pos -= (spl->loop_end - spl->loop_start);
+               } while (spl->pos >= spl->loop_end);
+            }
+         }
+         update_silent_mixer(spl, voice, len);
+      }
+   }
+   else {
+      /* mix a non-looping sample */
+      spl->pos += spl->diff * len;
+      if ((unsigned long)spl->pos >= (unsigned long)spl->len) {
+         /* note: we don't need a different version for reverse play, */
+         /* as this will wrap and automatically do the Right Thing */
+         spl->playing = FALSE;
+         return;
+      }
+      update_silent_mixer(spl, voice, len);
+   }
+}
+
+END_OF_STATIC_FUNCTION(mix_silent_samples);
+
+
+
+/* mix_mono_8x1_samples:
+ *  Mixes from an eight bit sample into a mono buffer, until either len
+ *  samples have been mixed or until the end of the sample is reached.
+ */
+static void mix_mono_8x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+{
+   signed int *lvol = (int *)(mix_vol_table + (spl->lvol>>1));
+   signed int *rvol = (int *)(mix_vol_table + (spl->rvol>>1));
+
+   #define MIX()                                                             \
+      *(buf)   += lvol[spl->data.u8[spl->pos>>MIX_FIX_SHIFT]];               \
+      *(buf++) += rvol[spl->data.u8[spl->pos>>MIX_FIX_SHIFT]];
+
+   #define MIX_INTERP  FALSE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples(buf, spl->data.buffer,                               \
+                        SIMD_MIX_MONO_OUT,                                   \
+                        spl->pos, spl->diff, n, lvol[0x81], rvol[0x81]);     \
+      buf += (n);
+
+   MIXER();
+
+   #undef MIX_RUN
+   #undef MIX_INTERP
+   #undef MIX
+}
+
+END_OF_STATIC_FUNCTION(mix_mono_8x1_samples);
+
+
+
+/* mix_mono_8x2_samples:
  *  Mixes from an eight bit stereo sample into a mono buffer, until either
  *  len samples have been mixed or until the end of the sample is reached.
  */
@@ -645,424 +1483,1108 @@ static void mix_mono_8x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int
    signed int *lvol = (int *)(mix_vol_table + (spl->lvol>>1));
    signed int *rvol = (int *)(mix_vol_table + (spl->rvol>>1));
 
-   #define MIX()                                                             \
-      *(buf)   += lvol[spl->data.u8[(spl->pos>>MIX_FIX_SHIFT)*2  ]];         \
-      *(buf++) += rvol[spl->data.u8[(spl->pos>>MIX_FIX_SHIFT)*2+1]];
+   #define MIX()                                                             \
+      *(buf)   += lvol[spl->data.u8[(spl->pos>>MIX_FIX_SHIFT)*2  ]];         \
+      *(buf++) += rvol[spl->data.u8[(spl->pos>>MIX_FIX_SHIFT)*2+1]];
+
+   #define MIX_INTERP  FALSE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples(buf, spl->data.buffer,                               \
+                        SIMD_MIX_MONO_OUT | SIMD_MIX_STEREO,                 \
+                        spl->pos, spl->diff, n, lvol[0x81], rvol[0x81]);     \
+      buf += (n);
+
+   MIXER();
+
+   #undef MIX_RUN
+   #undef MIX_INTERP
+   #undef MIX
+}
+
+END_OF_STATIC_FUNCTION(mix_mono_8x2_samples);
+
+
+
+/* mix_mono_16x1_samples:
+ *  Mixes from a 16 bit sample into a mono buffer, until either len samples
+ *  have been mixed or until the end of the sample is reached.
+ */
+static void mix_mono_16x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+{
+   signed int *lvol = (int *)(mix_vol_table + (spl->lvol>>1));
+   signed int *rvol = (int *)(mix_vol_table + (spl->rvol>>1));
+
+   #define MIX()                                                             \
+      *(buf)   += lvol[(spl->data.u16[spl->pos>>MIX_FIX_SHIFT])>>8];         \
+      *(buf++) += rvol[(spl->data.u16[spl->pos>>MIX_FIX_SHIFT])>>8];
+
+   #define MIX_INTERP  FALSE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples(buf, spl->data.buffer,                               \
+                        SIMD_MIX_MONO_OUT | SIMD_MIX_16BIT,                  \
+                        spl->pos, spl->diff, n, lvol[0x81], rvol[0x81]);     \
+      buf += (n);
+
+   MIXER();
+
+   #undef MIX_RUN
+   #undef MIX_INTERP
+   #undef MIX
+}
+
+END_OF_STATIC_FUNCTION(mix_mono_16x1_samples);
+
+
+
+/* mix_mono_16x2_samples:
+ *  Mixes from a 16 bit stereo sample into a mono buffer, until either len
+ *  samples have been mixed or until the end of the sample is reached.
+ */
+static void mix_mono_16x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+{
+   signed int *lvol = (int *)(mix_vol_table + (spl->lvol>>1));
+   signed int *rvol = (int *)(mix_vol_table + (spl->rvol>>1));
+
+   #define MIX()                                                             \
+      *(buf)   += lvol[(spl->data.u16[(spl->pos>>MIX_FIX_SHIFT)*2  ])>>8];   \
+      *(buf++) += rvol[(spl->data.u16[(spl->pos>>MIX_FIX_SHIFT)*2+1])>>8];
+
+   #define MIX_INTERP  FALSE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples(buf, spl->data.buffer,                               \
+                        SIMD_MIX_MONO_OUT | SIMD_MIX_16BIT | SIMD_MIX_STEREO,\
+                        spl->pos, spl->diff, n, lvol[0x81], rvol[0x81]);     \
+      buf += (n);
+
+   MIXER();
+
+   #undef MIX_RUN
+   #undef MIX_INTERP
+   #undef MIX
+}
+
+END_OF_STATIC_FUNCTION(mix_mono_16x2_samples);
+
+
+
+/* mix_stereo_8x1_samples:
+ *  Mixes from an eight bit sample into a stereo buffer, until either len
+ *  samples have been mixed or until the end of the sample is reached.
+ */
+static void mix_stereo_8x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+{
+   signed int *lvol = (int *)(mix_vol_table + spl->lvol);
+   signed int *rvol = (int *)(mix_vol_table + spl->rvol);
+
+   #define MIX()                                                             \
+      *(buf++) += lvol[spl->data.u8[spl->pos>>MIX_FIX_SHIFT]];               \
+      *(buf++) += rvol[spl->data.u8[spl->pos>>MIX_FIX_SHIFT]];
+
+   #define MIX_INTERP  FALSE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples(buf, spl->data.buffer,                               \
+                        0,                                                   \
+                        spl->pos, spl->diff, n, lvol[0x81], rvol[0x81]);     \
+      buf += (n)*2;
+
+   MIXER();
+
+   #undef MIX_RUN
+   #undef MIX_INTERP
+   #undef MIX
+}
+
+END_OF_STATIC_FUNCTION(mix_stereo_8x1_samples);
+
+
+
+/* mix_stereo_8x2_samples:
+ *  Mixes from an eight bit stereo sample into a stereo buffer, until either
+ *  len samples have been mixed or until the end of the sample is reached.
+ */
+static void mix_stereo_8x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+{
+   signed int *lvol = (int *)(mix_vol_table + spl->lvol);
+   signed int *rvol = (int *)(mix_vol_table + spl->rvol);
+
+   #define MIX()                                                             \
+      *(buf++) += lvol[spl->data.u8[(spl->pos>>MIX_FIX_SHIFT)*2  ]];         \
+      *(buf++) += rvol[spl->data.u8[(spl->pos>>MIX_FIX_SHIFT)*2+1]];
+
+   #define MIX_INTERP  FALSE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples(buf, spl->data.buffer,                               \
+                        SIMD_MIX_STEREO,                                     \
+                        spl->pos, spl->diff, n, lvol[0x81], rvol[0x81]);     \
+      buf += (n)*2;
+
+   MIXER();
+
+   #undef MIX_RUN
+   #undef MIX_INTERP
+   #undef MIX
+}
+
+END_OF_STATIC_FUNCTION(mix_stereo_8x2_samples);
+
+
+
+/* mix_stereo_16x1_samples:
+ *  Mixes from a 16 bit sample into a stereo buffer, until either len samples
+ *  have been mixed or until the end of the sample is reached.
+ */
+static void mix_stereo_16x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+{
+   signed int *lvol = (int *)(mix_vol_table + spl->lvol);
+   signed int *rvol = (int *)(mix_vol_table + spl->rvol);
+
+   #define MIX()                                                             \
+      *(buf++) += lvol[(spl->data.u16[spl->pos>>MIX_FIX_SHIFT])>>8];         \
+      *(buf++) += rvol[(spl->data.u16[spl->pos>>MIX_FIX_SHIFT])>>8];
+
+   #define MIX_INTERP  FALSE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples(buf, spl->data.buffer,                               \
+                        SIMD_MIX_16BIT,                                      \
+                        spl->pos, spl->diff, n, lvol[0x81], rvol[0x81]);     \
+      buf += (n)*2;
+
+   MIXER();
+
+   #undef MIX_RUN
+   #undef MIX_INTERP
+   #undef MIX
+}
+
+END_OF_STATIC_FUNCTION(mix_stereo_16x1_samples);
+
+
+
+/* mix_stereo_16x2_samples:
+ *  Mixes from a 16 bit stereo sample into a stereo buffer, until either len
+ *  samples have been mixed or until the end of the sample is reached.
+ */
+static void mix_stereo_16x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+{
+   signed int *lvol = (int *)(mix_vol_table + spl->lvol);
+   signed int *rvol = (int *)(mix_vol_table + spl->rvol);
+
+   #define MIX()                                                             \
+      *(buf++) += lvol[(spl->data.u16[(spl->pos>>MIX_FIX_SHIFT)*2  ])>>8];   \
+      *(buf++) += rvol[(spl->data.u16[(spl->pos>>MIX_FIX_SHIFT)*2+1])>>8];
+
+   #define MIX_INTERP  FALSE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples(buf, spl->data.buffer,                               \
+                        SIMD_MIX_16BIT | SIMD_MIX_STEREO,                    \
+                        spl->pos, spl->diff, n, lvol[0x81], rvol[0x81]);     \
+      buf += (n)*2;
+
+   MIXER();
+
+   #undef MIX_RUN
+   #undef MIX_INTERP
+   #undef MIX
+}
+
+END_OF_STATIC_FUNCTION(mix_stereo_16x2_samples);
+
+/* mix_hq1_8x1_samples:
+ *  Mixes from a mono 8 bit sample into a high quality stereo buffer,
+ *  until either len samples have been mixed or until the end of the
+ *  sample is reached.
+ */
+static void mix_hq1_8x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+{
+   int lvol = spl->lvol;
+   int rvol = spl->rvol;
+
+   #define MIX()                                                             \
+      *(buf++) += (spl->data.u8[spl->pos>>MIX_FIX_SHIFT]-0x80) * lvol;       \
+      *(buf++) += (spl->data.u8[spl->pos>>MIX_FIX_SHIFT]-0x80) * rvol;
+
+   #define MIX_INTERP  FALSE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples(buf, spl->data.buffer,                               \
+                        SIMD_MIX_HQ,                                         \
+                        spl->pos, spl->diff, n, lvol, rvol);                 \
+      buf += (n)*2;
+
+   MIXER();
+
+   #undef MIX_RUN
+   #undef MIX_INTERP
+   #undef MIX
+}
+
+END_OF_STATIC_FUNCTION(mix_hq1_8x1_samples);
+
+
+
+/* mix_hq1_8x2_samples:
+ *  Mixes from a stereo 8 bit sample into a high quality stereo buffer,
+ *  until either len samples have been mixed or until the end of the
+ *  sample is reached.
+ */
+static void mix_hq1_8x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+{
+   int lvol = spl->lvol;
+   int rvol = spl->rvol;
+
+   #define MIX()                                                             \
+      *(buf++) += (spl->data.u8[(spl->pos>>MIX_FIX_SHIFT)*2  ]-0x80) * lvol; \
+      *(buf++) += (spl->data.u8[(spl->pos>>MIX_FIX_SHIFT)*2+1]-0x80) * rvol;
+
+   #define MIX_INTERP  FALSE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples(buf, spl->data.buffer,                               \
+                        SIMD_MIX_HQ | SIMD_MIX_STEREO,                       \
+                        spl->pos, spl->diff, n, lvol, rvol);                 \
+      buf += (n)*2;
+
+   MIXER();
+
+   #undef MIX_RUN
+   #undef MIX_INTERP
+   #undef MIX
+}
+
+END_OF_STATIC_FUNCTION(mix_hq1_8x2_samples);
+
+
+
+/* mix_hq1_16x1_samples:
+ *  Mixes from a mono 16 bit sample into a high-quality stereo buffer,
+ *  until either len samples have been mixed or until the end of the sample
+ *  is reached.
+ */
+static void mix_hq1_16x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+{
+   int lvol = spl->lvol;
+   int rvol = spl->rvol;
+
+   #define MIX()                                                             \
+      *(buf++) += ((spl->data.u16[spl->pos>>MIX_FIX_SHIFT]-0x8000)*lvol)>>8; \
+      *(buf++) += ((spl->data.u16[spl->pos>>MIX_FIX_SHIFT]-0x8000)*rvol)>>8;
+
+   #define MIX_INTERP  FALSE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples(buf, spl->data.buffer,                               \
+                        SIMD_MIX_HQ | SIMD_MIX_16BIT,                        \
+                        spl->pos, spl->diff, n, lvol, rvol);                 \
+      buf += (n)*2;
+
+   MIXER();
+
+   #undef MIX_RUN
+   #undef MIX_INTERP
+   #undef MIX
+}
+
+END_OF_STATIC_FUNCTION(mix_hq1_16x1_samples);
+
+
+
+/* mix_hq1_16x2_samples:
+ *  Mixes from a stereo 16 bit sample into a high-quality stereo buffer,
+ *  until either len samples have been mixed or until the end of the sample
+ *  is reached.
+ */
+static void mix_hq1_16x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+{
+   int lvol = spl->lvol;
+   int rvol = spl->rvol;
+
+   #define MIX()                                                                 \
+      *(buf++) += ((spl->data.u16[(spl->pos>>MIX_FIX_SHIFT)*2  ]-0x8000)*lvol)>>8;\
+      *(buf++) += ((spl->data.u16[(spl->pos>>MIX_FIX_SHIFT)*2+1]-0x8000)*rvol)>>8;
+
+   #define MIX_INTERP  FALSE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples(buf, spl->data.buffer,                               \
+                        SIMD_MIX_HQ | SIMD_MIX_16BIT | SIMD_MIX_STEREO,      \
+                        spl->pos, spl->diff, n, lvol, rvol);                 \
+      buf += (n)*2;
+
+   MIXER();
+
+   #undef MIX_RUN
+   #undef MIX_INTERP
+   #undef MIX
+}
+
+END_OF_STATIC_FUNCTION(mix_hq1_16x2_samples);
+
+
+/* Helper to apply a 16-bit volume to a 24-bit sample */
+#define MULSC(a, b) ((int)((LONG_LONG)((a) << 4) * ((b) << 12) >> 32))
+
+/* mix_hq2_8x1_samples:
+ *  Mixes from a mono 8 bit sample into an interpolated stereo buffer,
+ *  until either len samples have been mixed or until the end of the
+ *  sample is reached.
+ */
+static void mix_hq2_8x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+{
+   int lvol = spl->lvol;
+   int rvol = spl->rvol;
+   int v, v1, v2;
+
+   #define MIX()                                                             \
+      v = spl->pos>>MIX_FIX_SHIFT;                                           \
+                                                                             \
+      v1 = (spl->data.u8[v]<<16) - 0x800000;                                 \
+                                                                             \
+      if (spl->pos >= spl->len-MIX_FIX_SCALE) {                              \
+         if ((voice->playmode & (PLAYMODE_LOOP |                             \
+                                 PLAYMODE_BIDIR)) == PLAYMODE_LOOP &&        \
+             spl->loop_start < spl->loop_end && spl->loop_end == spl->len)   \
+            v2 = (spl->data.u8[spl->loop_start>>MIX_FIX_SHIFT]<<16)-0x800000;\
+         else                                                                \
+            v2 = 0;                                                          \
+      }                                                                      \
+      else                                                                   \
+         v2 = (spl->data.u8[v+1]<<16) - 0x800000;                            \
+                                                                             \
+      v = spl->pos & (MIX_FIX_SCALE-1);                                      \
+      v = ((v2*v) + (v1*(MIX_FIX_SCALE-v))) >> MIX_FIX_SHIFT;                \
+                                                                             \
+      *(buf++) += MULSC(v, lvol);                                            \
+      *(buf++) += MULSC(v, rvol);
+
+   #define MIX_INTERP  TRUE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples_interp(buf, spl->data.buffer,                        \
+                               0,                                            \
+                               spl->pos, spl->diff, n, lvol, rvol);          \
+      buf += (n)*2;
+
+   MIXER();
+
+   #undef MIX_RUN
+   #undef MIX_INTERP
+   #undef MIX
+}
+
+END_OF_STATIC_FUNCTION(mix_hq2_8x1_samples);
+
+
+
+/* mix_hq2_8x2_samples:
+ *  Mixes from a stereo 8 bit sample into an interpolated stereo buffer,
+ *  until either len samples have been mixed or until the end of the
+ *  sample is reached.
+ */
+static void mix_hq2_8x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+{
+   int lvol = spl->lvol;
+   int rvol = spl->rvol;
+   int v, va, v1a, v2a, vb, v1b, v2b;
+
+   #define MIX()                                                             \
+      v = (spl->pos>>MIX_FIX_SHIFT) << 1; /* x2 for stereo */                \
+                                                                             \
+      v1a = (spl->data.u8[v]<<16) - 0x800000;                                \
+      v1b = (spl->data.u8[v+1]<<16) - 0x800000;                              \
+                                                                             \
+      if (spl->pos >= spl->len-MIX_FIX_SCALE) {                              \
+         if ((voice->playmode & (PLAYMODE_LOOP |                             \
+                                 PLAYMODE_BIDIR)) == PLAYMODE_LOOP &&        \
+             spl->loop_start < spl->loop_end && spl->loop_end == spl->len) { \
+            v2a = (spl->data.u8[((spl->loop_start>>MIX_FIX_SHIFT)<<1)]<<16) - 0x800000;\
+            v2b = (spl->data.u8[((spl->loop_start>>MIX_FIX_SHIFT)<<1)+1]<<16) - 0x800000;\
+         }                                                                   \
+         else                                                                \
+            v2a = v2b = 0;                                                   \
+      }                                                                      \
+      else {                                                                 \
+         v2a = (spl->data.u8[v+2]<<16) - 0x800000;                           \
+         v2b = (spl->data.u8[v+3]<<16) - 0x800000;                           \
+      }                                                                      \
+                                                                             \
+      v = spl->pos & (MIX_FIX_SCALE-1);                                      \
+      va = ((v2a*v) + (v1a*(MIX_FIX_SCALE-v))) >> MIX_FIX_SHIFT;             \
+      vb = ((v2b*v) + (v1b*(MIX_FIX_SCALE-v))) >> MIX_FIX_SHIFT;             \
+                                                                             \
+      *(buf++) += MULSC(va, lvol);                                           \
+      *(buf++) += MULSC(vb, rvol);
+
+   #define MIX_INTERP  TRUE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples_interp(buf, spl->data.buffer,                        \
+                               SIMD_MIX_STEREO,                              \
+                               spl->pos, spl->diff, n, lvol, rvol);          \
+      buf += (n)*2;
 
    MIXER();
 
+   #undef MIX_RUN
+   #undef MIX_INTERP
    #undef MIX
 }
 
-END_OF_STATIC_FUNCTION(mix_mono_8x2_samples);
+END_OF_STATIC_FUNCTION(mix_hq2_8x2_samples);
 
 
 
-/* mix_mono_16x1_samples:
- *  Mixes from a 16 bit sample into a mono buffer, until either len samples
- *  have been mixed or until the end of the sample is reached.
+/* mix_hq2_16x1_samples:
+ *  Mixes from a mono 16 bit sample into an interpolated stereo buffer,
+ *  until either len samples have been mixed or until the end of the sample
+ *  is reached.
  */
-static void mix_mono_16x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+static void mix_hq2_16x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
 {
-   signed int *lvol = (int *)(mix_vol_table + (spl->lvol>>1));
-   signed int *rvol = (int *)(mix_vol_table + (spl->rvol>>1));
+   int lvol = spl->lvol;
+   int rvol = spl->rvol;
+   int v, v1, v2;
 
    #define MIX()                                                             \
-      *(buf)   += lvol[(spl->data.u16[spl->pos>>MIX_FIX_SHIFT])>>8];         \
-      *(buf++) += rvol[(spl->data.u16[spl->pos>>MIX_FIX_SHIFT])>>8];
+      v = spl->pos>>MIX_FIX_SHIFT;                                           \
+                                                                             \
+      v1 = (spl->data.u16[v]<<8) - 0x800000;                                 \
+                                                                             \
+      if (spl->pos >= spl->len-MIX_FIX_SCALE) {                              \
+         if ((voice->playmode & (PLAYMODE_LOOP |                             \
+                                 PLAYMODE_BIDIR)) == PLAYMODE_LOOP &&        \
+             spl->loop_start < spl->loop_end && spl->loop_end == spl->len)   \
+            v2 = (spl->data.u16[spl->loop_start>>MIX_FIX_SHIFT]<<8)-0x800000;\
+         else                                                                \
+            v2 = 0;                                                          \
+      }                                                                      \
+      else                                                                   \
+         v2 = (spl->data.u16[v+1]<<8) - 0x800000;                            \
+                                                                             \
+      v = spl->pos & (MIX_FIX_SCALE-1);                                      \
+      v = ((v2*v) + (v1*(MIX_FIX_SCALE-v))) >> MIX_FIX_SHIFT;                \
+                                                                             \
+      *(buf++) += MULSC(v, lvol);                                            \
+      *(buf++) += MULSC(v, rvol);
+
+   #define MIX_INTERP  TRUE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples_interp(buf, spl->data.buffer,                        \
+                               SIMD_MIX_16BIT,                               \
+                               spl->pos, spl->diff, n, lvol, rvol);          \
+      buf += (n)*2;
 
    MIXER();
 
+   #undef MIX_RUN
+   #undef MIX_INTERP
    #undef MIX
 }
 
-END_OF_STATIC_FUNCTION(mix_mono_16x1_samples);
+END_OF_STATIC_FUNCTION(mix_hq2_16x1_samples);
 
 
 
-/* mix_mono_16x2_samples:
- *  Mixes from a 16 bit stereo sample into a mono buffer, until either len
- *  samples have been mixed or until the end of the sample is reached.
+/* mix_hq2_16x2_samples:
+ *  Mixes from a stereo 16 bit sample into an interpolated stereo buffer,
+ *  until either len samples have been mixed or until the end of the sample
+ *  is reached.
  */
-static void mix_mono_16x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+static void mix_hq2_16x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
 {
-   signed int *lvol = (int *)(mix_vol_table + (spl->lvol>>1));
-   signed int *rvol = (int *)(mix_vol_table + (spl->rvol>>1));
+   int lvol = spl->lvol;
+   int rvol = spl->rvol;
+   int v, va, v1a, v2a, vb, v1b, v2b;
 
    #define MIX()                                                             \
-      *(buf)   += lvol[(spl->data.u16[(spl->pos>>MIX_FIX_SHIFT)*2  ])>>8];   \
-      *(buf++) += rvol[(spl->data.u16[(spl->pos>>MIX_FIX_SHIFT)*2+1])>>8];
+      v = (spl->pos>>MIX_FIX_SHIFT) << 1; /* x2 for stereo */                \
+                                                                             \
+      v1a = (spl->data.u16[v]<<8) - 0x800000;                                \
+      v1b = (spl->data.u16[v+1]<<8) - 0x800000;                              \
+                                                                             \
+      if (spl->pos >= spl->len-MIX_FIX_SCALE) {                              \
+         if ((voice->playmode & (PLAYMODE_LOOP |                             \
+                                 PLAYMODE_BIDIR)) == PLAYMODE_LOOP &&        \
+             spl->loop_start < spl->loop_end && spl->loop_end == spl->len) { \
+            v2a = (spl->data.u16[((spl->loop_start>>MIX_FIX_SHIFT)<<1)]<<8) - 0x800000;\
+            v2b = (spl->data.u16[((spl->loop_start>>MIX_FIX_SHIFT)<<1)+1]<<8) - 0x800000;\
+         }                                                                   \
+         else                                                                \
+            v2a = v2b = 0;                                                   \
+      }                                                                      \
+      else {                                                                 \
+         v2a = (spl->data.u16[v+2]<<8) - 0x800000;                           \
+         v2b = (spl->data.u16[v+3]<<8) - 0x800000;                           \
+      }                                                                      \
+                                                                             \
+      v = spl->pos & (MIX_FIX_SCALE-1);                                      \
+      va = ((v2a*v) + (v1a*(MIX_FIX_SCALE-v))) >> MIX_FIX_SHIFT;             \
+      vb = ((v2b*v) + (v1b*(MIX_FIX_SCALE-v))) >> MIX_FIX_SHIFT;             \
+                                                                             \
+      *(buf++) += MULSC(va, lvol);                                           \
+      *(buf++) += MULSC(vb, rvol);
+
+   #define MIX_INTERP  TRUE
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples_interp(buf, spl->data.buffer,                        \
+                               SIMD_MIX_16BIT | SIMD_MIX_STEREO,             \
+                               spl->pos, spl->diff, n, lvol, rvol);          \
+      buf += (n)*2;
 
    MIXER();
 
+   #undef MIX_RUN
+   #undef MIX_INTERP
    #undef MIX
 }
 
-END_OF_STATIC_FUNCTION(mix_mono_16x2_samples);
+END_OF_STATIC_FUNCTION(mix_hq2_16x2_samples);
 
 
 
-/* mix_stereo_8x1_samples:
- *  Mixes from an eight bit sample into a stereo buffer, until either len
- *  samples have been mixed or until the end of the sample is reached.
+/* mix_adpcm_value:
+ *  Reads channel ch of frame i of an ADPCM sample, which must be inside the
+ *  sample. Each voice keeps the last few blocks it decoded, enough for a
+ *  filter reaching across a block boundary or round a short loop, and
+ *  decodes a block whenever it moves on to one it doesn't have.
  */
-static void mix_stereo_8x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+static INLINE int mix_adpcm_value(MIXER_VOICE *mv, long i, int ch)
 {
-   signed int *lvol = (int *)(mix_vol_table + spl->lvol);
-   signed int *rvol = (int *)(mix_vol_table + spl->rvol);
-
-   #define MIX()                                                             \
-      *(buf++) += lvol[spl->data.u8[spl->pos>>MIX_FIX_SHIFT]];               \
-      *(buf++) += rvol[spl->data.u8[spl->pos>>MIX_FIX_SHIFT]];
+   int block = i >> ADPCM_BLOCK_SHIFT;
+   int slot = mv->adpcm_last;
+   int j;
+
+   if (mv->adpcm_block[slot] != block) {
+      for (slot=0; slot<MIX_ADPCM_SLOTS; slot++)
+         if (mv->adpcm_block[slot] == block)
+            break;
+
+      if (slot == MIX_ADPCM_SLOTS) {
+         /* replace the slot which was read least recently */
+         slot = 0;
+         for (j=1; j<MIX_ADPCM_SLOTS; j++)
+            if (mv->adpcm_used[j] < mv->adpcm_used[slot])
+               slot = j;
+
+         _adpcm_decode_block(mv->adpcm + slot*ADPCM_BLOCK_FRAMES*2,
+                             mv->data.u8 + block*ADPCM_CHANNEL_SIZE*mv->channels,
+                             mv->channels);
+         mv->adpcm_block[slot] = block;
+      }
 
-   MIXER();
+      mv->adpcm_used[slot] = ++mv->adpcm_clock;
+      mv->adpcm_last = slot;
+   }
 
-   #undef MIX
+   return mv->adpcm[slot*ADPCM_BLOCK_FRAMES*2 + (i & (ADPCM_BLOCK_FRAMES-1)) * mv->channels + ch];
 }
 
-END_OF_STATIC_FUNCTION(mix_stereo_8x1_samples);
-
 
 
-/* mix_stereo_8x2_samples:
- *  Mixes from an eight bit stereo sample into a stereo buffer, until either
- *  len samples have been mixed or until the end of the sample is reached.
+/* mix_source_value:
+ *  Reads channel ch of source frame i for the sinc filter and the
+ *  interpolating ADPCM mixer, centered on zero. Frames past the loop come
+ *  from its other end, or from its mirror image with bidirectional loops,
+ *  and frames outside the sample are silent.
  */
-static void mix_stereo_8x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+static INLINE int mix_source_value(MIXER_VOICE *spl, PHYS_VOICE *voice, long i, int ch)
 {
-   signed int *lvol = (int *)(mix_vol_table + spl->lvol);
-   signed int *rvol = (int *)(mix_vol_table + spl->rvol);
+   long start, end;
 
-   #define MIX()                                                             \
-      *(buf++) += lvol[spl->data.u8[(spl->pos>>MIX_FIX_SHIFT)*2  ]];         \
-      *(buf++) += rvol[spl->data.u8[(spl->pos>>MIX_FIX_SHIFT)*2+1]];
+   if ((voice->playmode & PLAYMODE_LOOP) &&
+       (spl->loop_start < spl->loop_end)) {
+      start = spl->loop_start >> MIX_FIX_SHIFT;
+      end = spl->loop_end >> MIX_FIX_SHIFT;
 
-   MIXER();
+      /* until a backward voice reaches the loop, it plays what is past it */
+      if ((i >= end) && (spl->pos < spl->loop_end)) {
+         if (voice->playmode & PLAYMODE_BIDIR)
+            i = (end << 1) - 1 - i;
+         else
+            i -= end - start;
+      }
+      else if ((i < start) && (voice->playmode & PLAYMODE_BACKWARD)) {
+         if (voice->playmode & PLAYMODE_BIDIR)
+            i = (start << 1) - 1 - i;
+         else
+            i += end - start;
+      }
+   }
 
-   #undef MIX
-}
+   if ((i < 0) || (i >= (spl->len >> MIX_FIX_SHIFT)))
+      return 0;
 
-END_OF_STATIC_FUNCTION(mix_stereo_8x2_samples);
+   if (spl->bits == 4)
+      return mix_adpcm_value(spl, i, ch);
 
+   i = i * spl->channels + ch;
 
+   if (spl->bits == 8)
+      return spl->data.u8[i] - 0x80;
+   else
+      return spl->data.u16[i] - 0x8000;
+}
 
-/* mix_stereo_16x1_samples:
- *  Mixes from a 16 bit sample into a stereo buffer, until either len samples
- *  have been mixed or until the end of the sample is reached.
+
+
+/* mix_sinc_frame:
+ *  Runs the sinc filter at the position pos and adds the output frame to
+ *  the float buffer. bits and channels are constants wherever this is
+ *  used, so only the code for one sample format is kept each time.
  */
-static void mix_stereo_16x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+static INLINE float *mix_sinc_frame(MIXER_VOICE *spl, PHYS_VOICE *voice, long pos, float *buf, float lvol, float rvol, int bits, int channels)
 {
-   signed int *lvol = (int *)(mix_vol_table + spl->lvol);
-   signed int *rvol = (int *)(mix_vol_table + spl->rvol);
+   AL_CONST float *c;
+   long i, start, end;
+   float l = 0.0, r = 0.0;
+   int k;
 
-   #define MIX()                                                             \
-      *(buf++) += lvol[(spl->data.u16[spl->pos>>MIX_FIX_SHIFT])>>8];         \
-      *(buf++) += rvol[(spl->data.u16[spl->pos>>MIX_FIX_SHIFT])>>8];
+   c = mix_sinc_table[spl->sinc_bank][(pos & (MIX_FIX_SCALE-1)) >> (MIX_FIX_SHIFT - MIX_SINC_PHASE_BITS)];
+   i = (pos >> MIX_FIX_SHIFT) - (MIX_SINC_TAPS/2 - 1);
 
-   MIXER();
+   start = 0;
+   end = spl->len >> MIX_FIX_SHIFT;
 
-   #undef MIX
-}
+   if ((voice->playmode & PLAYMODE_LOOP) &&
+       (spl->loop_start < spl->loop_end)) {
+      if (spl->pos < spl->loop_end)
+         end = spl->loop_end >> MIX_FIX_SHIFT;
+      if (voice->playmode & PLAYMODE_BACKWARD)
+         start = spl->loop_start >> MIX_FIX_SHIFT;
+   }
 
-END_OF_STATIC_FUNCTION(mix_stereo_16x1_samples);
+   if ((bits != 4) && (i >= start) && (i + MIX_SINC_TAPS <= end)) {
+      /* the whole filter is inside the sample */
+      if (bits == 8) {
+         AL_CONST unsigned char *s = spl->data.u8 + i*channels;
+         for (k=0; k<MIX_SINC_TAPS; k++, s+=channels) {
+            l += c[k] * (s[0] - 0x80);
+            if (channels == 2)
+               r += c[k] * (s[1] - 0x80);
+         }
+      }
+      else {
+         AL_CONST unsigned short *s = spl->data.u16 + i*channels;
+         for (k=0; k<MIX_SINC_TAPS; k++, s+=channels) {
+            l += c[k] * (s[0] - 0x8000);
+            if (channels == 2)
+               r += c[k] * (s[1] - 0x8000);
+         }
+      }
+   }
+   else {
+      for (k=0; k<MIX_SINC_TAPS; k++) {
+         l += c[k] * mix_source_value(spl, voice, i+k, 0);
+         if (channels == 2)
+            r += c[k] * mix_source_value(spl, voice, i+k, 1);
+      }
+   }
 
+   if (channels == 1)
+      r = l;
 
+   *(buf++) += l * lvol;
+   *(buf++) += r * rvol;
 
-/* mix_stereo_16x2_samples:
- *  Mixes from a 16 bit stereo sample into a stereo buffer, until either len
- *  samples have been mixed or until the end of the sample is reached.
+   return buf;
+}
+
+
+
+/* mix_hq3_8x1_samples:
+ *  Mixes from a mono 8 bit sample into the float stereo buffer
+ *  through the windowed sinc filter, until either len samples have been
+ *  mixed or until the end of the sample is reached.
  */
-static void mix_stereo_16x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+static void mix_hq3_8x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, float *buf, int len)
 {
-   signed int *lvol = (int *)(mix_vol_table + spl->lvol);
-   signed int *rvol = (int *)(mix_vol_table + spl->rvol);
+   float lvol = spl->lvol * (1.0 / (65536.0 * 0x80));
+   float rvol = spl->rvol * (1.0 / (65536.0 * 0x80));
 
    #define MIX()                                                             \
-      *(buf++) += lvol[(spl->data.u16[(spl->pos>>MIX_FIX_SHIFT)*2  ])>>8];   \
-      *(buf++) += rvol[(spl->data.u16[(spl->pos>>MIX_FIX_SHIFT)*2+1])>>8];
+      buf = mix_sinc_frame(spl, voice, spl->pos, buf, lvol, rvol, 8, 1);
+
+   #define MIX_INTERP  (MIX_SINC_TAPS/2)
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples_sinc(buf, spl->data.buffer,                          \
+                             0,                                              \
+                             spl->pos, spl->diff, n,                         \
+                             mix_sinc_table[spl->sinc_bank][0], lvol, rvol); \
+      buf += (n)*2;
 
    MIXER();
 
+   #undef MIX_RUN
+   #undef MIX_INTERP
    #undef MIX
 }
 
-END_OF_STATIC_FUNCTION(mix_stereo_16x2_samples);
+END_OF_STATIC_FUNCTION(mix_hq3_8x1_samples);
 
-/* mix_hq1_8x1_samples:
- *  Mixes from a mono 8 bit sample into a high quality stereo buffer,
- *  until either len samples have been mixed or until the end of the
- *  sample is reached.
+
+
+/* mix_hq3_8x2_samples:
+ *  Mixes from a stereo 8 bit sample into the float stereo buffer
+ *  through the windowed sinc filter, until either len samples have been
+ *  mixed or until the end of the sample is reached.
  */
-static void mix_hq1_8x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+static void mix_hq3_8x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, float *buf, int len)
 {
-   int lvol = spl->lvol;
-   int rvol = spl->rvol;
+   float lvol = spl->lvol * (1.0 / (65536.0 * 0x80));
+   float rvol = spl->rvol * (1.0 / (65536.0 * 0x80));
 
    #define MIX()                                                             \
-      *(buf++) += (spl->data.u8[spl->pos>>MIX_FIX_SHIFT]-0x80) * lvol;       \
-      *(buf++) += (spl->data.u8[spl->pos>>MIX_FIX_SHIFT]-0x80) * rvol;
+      buf = mix_sinc_frame(spl, voice, spl->pos, buf, lvol, rvol, 8, 2);
+
+   #define MIX_INTERP  (MIX_SINC_TAPS/2)
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples_sinc(buf, spl->data.buffer,                          \
+                             SIMD_MIX_STEREO,                                \
+                             spl->pos, spl->diff, n,                         \
+                             mix_sinc_table[spl->sinc_bank][0], lvol, rvol); \
+      buf += (n)*2;
 
    MIXER();
 
+   #undef MIX_RUN
+   #undef MIX_INTERP
    #undef MIX
 }
 
-END_OF_STATIC_FUNCTION(mix_hq1_8x1_samples);
+END_OF_STATIC_FUNCTION(mix_hq3_8x2_samples);
 
 
 
-/* mix_hq1_8x2_samples:
- *  Mixes from a stereo 8 bit sample into a high quality stereo buffer,
- *  until either len samples have been mixed or until the end of the
- *  sample is reached.
+/* mix_hq3_16x1_samples:
+ *  Mixes from a mono 16 bit sample into the float stereo buffer
+ *  through the windowed sinc filter, until either len samples have been
+ *  mixed or until the end of the sample is reached.
  */
-static void mix_hq1_8x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+static void mix_hq3_16x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, float *buf, int len)
 {
-   int lvol = spl->lvol;
-   int rvol = spl->rvol;
+   float lvol = spl->lvol * (1.0 / (65536.0 * 0x8000));
+   float rvol = spl->rvol * (1.0 / (65536.0 * 0x8000));
 
    #define MIX()                                                             \
-      *(buf++) += (spl->data.u8[(spl->pos>>MIX_FIX_SHIFT)*2  ]-0x80) * lvol; \
-      *(buf++) += (spl->data.u8[(spl->pos>>MIX_FIX_SHIFT)*2+1]-0x80) * rvol;
+      buf = mix_sinc_frame(spl, voice, spl->pos, buf, lvol, rvol, 16, 1);
+
+   #define MIX_INTERP  (MIX_SINC_TAPS/2)
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples_sinc(buf, spl->data.buffer,                          \
+                             SIMD_MIX_16BIT,                                 \
+                             spl->pos, spl->diff, n,                         \
+                             mix_sinc_table[spl->sinc_bank][0], lvol, rvol); \
+      buf += (n)*2;
 
    MIXER();
 
+   #undef MIX_RUN
+   #undef MIX_INTERP
    #undef MIX
 }
 
-END_OF_STATIC_FUNCTION(mix_hq1_8x2_samples);
+END_OF_STATIC_FUNCTION(mix_hq3_16x1_samples);
 
 
 
-/* mix_hq1_16x1_samples:
- *  Mixes from a mono 16 bit sample into a high-quality stereo buffer,
- *  until either len samples have been mixed or until the end of the sample
- *  is reached.
+/* mix_hq3_16x2_samples:
+ *  Mixes from a stereo 16 bit sample into the float stereo buffer
+ *  through the windowed sinc filter, until either len samples have been
+ *  mixed or until the end of the sample is reached.
  */
-static void mix_hq1_16x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+static void mix_hq3_16x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, float *buf, int len)
 {
-   int lvol = spl->lvol;
-   int rvol = spl->rvol;
+   float lvol = spl->lvol * (1.0 / (65536.0 * 0x8000));
+   float rvol = spl->rvol * (1.0 / (65536.0 * 0x8000));
 
    #define MIX()                                                             \
-      *(buf++) += ((spl->data.u16[spl->pos>>MIX_FIX_SHIFT]-0x8000)*lvol)>>8; \
-      *(buf++) += ((spl->data.u16[spl->pos>>MIX_FIX_SHIFT]-0x8000)*rvol)>>8;
+      buf = mix_sinc_frame(spl, voice, spl->pos, buf, lvol, rvol, 16, 2);
+
+   #define MIX_INTERP  (MIX_SINC_TAPS/2)
+   #define MIX_RUN(n)                                                        \
+      _simd_mix_samples_sinc(buf, spl->data.buffer,                          \
+                             (SIMD_MIX_16BIT | SIMD_MIX_STEREO),             \
+                             spl->pos, spl->diff, n,                         \
+                             mix_sinc_table[spl->sinc_bank][0], lvol, rvol); \
+      buf += (n)*2;
 
    MIXER();
 
+   #undef MIX_RUN
+   #undef MIX_INTERP
    #undef MIX
 }
 
-END_OF_STATIC_FUNCTION(mix_hq1_16x1_samples);
+END_OF_STATIC_FUNCTION(mix_hq3_16x2_samples);
 
 
 
-/* mix_hq1_16x2_samples:
- *  Mixes from a stereo 16 bit sample into a high-quality stereo buffer,
- *  until either len samples have been mixed or until the end of the sample
- *  is reached.
+/* The ADPCM mixers below decode their samples through mix_adpcm_value(),
+ * so there is no SIMD kernel for them: MIX_RUN() mixes the run frame by
+ * frame, with MIX_AT() taking the position to mix from.
  */
-static void mix_hq1_16x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+#define MIX_ADPCM_RUN(n)                                                     \
+   {                                                                         \
+      long run_pos = spl->pos;                                               \
+      int run_len;                                                           \
+      for (run_len=(n); run_len>0; run_len--, run_pos+=spl->diff) {          \
+         MIX_AT(run_pos);                                                    \
+      }                                                                      \
+   }
+
+
+
+/* mix_adpcm_samples:
+ *  Mixes from an ADPCM sample into a mono or stereo buffer, until either
+ *  len samples have been mixed or until the end of the sample is reached.
+ */
+static void mix_adpcm_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
 {
-   int lvol = spl->lvol;
-   int rvol = spl->rvol;
+   signed int *lvol, *rvol;
+   int ch = spl->channels - 1;
+   int step = mix_channels;
+   long v;
+
+   if (mix_channels == 1) {
+      lvol = (int *)(mix_vol_table + (spl->lvol>>1));
+      rvol = (int *)(mix_vol_table + (spl->rvol>>1));
+   }
+   else {
+      lvol = (int *)(mix_vol_table + spl->lvol);
+      rvol = (int *)(mix_vol_table + spl->rvol);
+   }
 
-   #define MIX()                                                                 \
-      *(buf++) += ((spl->data.u16[(spl->pos>>MIX_FIX_SHIFT)*2  ]-0x8000)*lvol)>>8;\
-      *(buf++) += ((spl->data.u16[(spl->pos>>MIX_FIX_SHIFT)*2+1]-0x8000)*rvol)>>8;
+   #define MIX_AT(p)                                                         \
+      v = (p)>>MIX_FIX_SHIFT;                                                \
+      *(buf)          += lvol[(mix_adpcm_value(spl, v, 0)+0x8000)>>8];       \
+      *(buf+step-1)   += rvol[(mix_adpcm_value(spl, v, ch)+0x8000)>>8];      \
+      buf += step;
+
+   #define MIX()       MIX_AT(spl->pos)
+   #define MIX_INTERP  FALSE
+   #define MIX_RUN(n)  MIX_ADPCM_RUN(n)
 
    MIXER();
 
+   #undef MIX_RUN
+   #undef MIX_INTERP
    #undef MIX
+   #undef MIX_AT
 }
 
-END_OF_STATIC_FUNCTION(mix_hq1_16x2_samples);
+END_OF_STATIC_FUNCTION(mix_adpcm_samples);
 
 
-/* Helper to apply a 16-bit volume to a 24-bit sample */
-#define MULSC(a, b) ((int)((LONG_LONG)((a) << 4) * ((b) << 12) >> 32))
 
-/* mix_hq2_8x1_samples:
- *  Mixes from a mono 8 bit sample into an interpolated stereo buffer,
- *  until either len samples have been mixed or until the end of the
- *  sample is reached.
+/* mix_hq1_adpcm_samples:
+ *  Mixes from an ADPCM sample into a high quality stereo buffer, until
+ *  either len samples have been mixed or until the end of the sample is
+ *  reached.
  */
-static void mix_hq2_8x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+static void mix_hq1_adpcm_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
 {
    int lvol = spl->lvol;
    int rvol = spl->rvol;
-   int v, v1, v2;
+   int ch = spl->channels - 1;
+   long v;
 
-   #define MIX()                                                             \
-      v = spl->pos>>MIX_FIX_SHIFT;                                           \
-                                                                             \
-      v1 = (spl->data.u8[v]<<16) - 0x800000;                                 \
-                                                                             \
-      if (spl->pos >= spl->len-MIX_FIX_SCALE) {                              \
-         if ((voice->playmode & (PLAYMODE_LOOP |                             \
-                                 PLAYMODE_BIDIR)) == PLAYMODE_LOOP &&        \
-             spl->loop_start < spl->loop_end && spl->loop_end == spl->len)   \
-            v2 = (spl->data.u8[spl->loop_start>>MIX_FIX_SHIFT]<<16)-0x800000;\
-         else                                                                \
-            v2 = 0;                                                          \
-      }                                                                      \
-      else                                                                   \
-         v2 = (spl->data.u8[v+1]<<16) - 0x800000;                            \
-                                                                             \
-      v = spl->pos & (MIX_FIX_SCALE-1);                                      \
-      v = ((v2*v) + (v1*(MIX_FIX_SCALE-v))) >> MIX_FIX_SHIFT;                \
-                                                                             \
-      *(buf++) += MULSC(v, lvol);                                            \
-      *(buf++) += MULSC(v, rvol);
+   #define MIX_AT(p)                                                         \
+      v = (p)>>MIX_FIX_SHIFT;                                                \
+      *(buf++) += (mix_adpcm_value(spl, v, 0)*lvol)>>8;                      \
+      *(buf++) += (mix_adpcm_value(spl, v, ch)*rvol)>>8;
+
+   #define MIX()       MIX_AT(spl->pos)
+   #define MIX_INTERP  FALSE
+   #define MIX_RUN(n)  MIX_ADPCM_RUN(n)
 
    MIXER();
 
+   #undef MIX_RUN
+   #undef MIX_INTERP
    #undef MIX
+   #undef MIX_AT
 }
 
-END_OF_STATIC_FUNCTION(mix_hq2_8x1_samples);
+END_OF_STATIC_FUNCTION(mix_hq1_adpcm_samples);
 
 
 
-/* mix_hq2_8x2_samples:
- *  Mixes from a stereo 8 bit sample into an interpolated stereo buffer,
- *  until either len samples have been mixed or until the end of the
- *  sample is reached.
+/* mix_hq2_adpcm_samples:
+ *  Mixes from an ADPCM sample into an interpolated stereo buffer, until
+ *  either len samples have been mixed or until the end of the sample is
+ *  reached.
  */
-static void mix_hq2_8x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+static void mix_hq2_adpcm_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
 {
    int lvol = spl->lvol;
    int rvol = spl->rvol;
-   int v, va, v1a, v2a, vb, v1b, v2b;
+   int ch = spl->channels - 1;
+   int f, va, vb;
+   long v;
 
-   #define MIX()                                                             \
-      v = (spl->pos>>MIX_FIX_SHIFT) << 1; /* x2 for stereo */                \
+   #define MIX_AT(p)                                                         \
+      v = (p)>>MIX_FIX_SHIFT;                                                \
+      f = (p) & (MIX_FIX_SCALE-1);                                           \
                                                                              \
-      v1a = (spl->data.u8[v]<<16) - 0x800000;                                \
-      v1b = (spl->data.u8[v+1]<<16) - 0x800000;                              \
-                                                                             \
-      if (spl->pos >= spl->len-MIX_FIX_SCALE) {                              \
-         if ((voice->playmode & (PLAYMODE_LOOP |                             \
-                                 PLAYMODE_BIDIR)) == PLAYMODE_LOOP &&        \
-             spl->loop_start < spl->loop_end && spl->loop_end == spl->len) { \
-            v2a = (spl->data.u8[((spl->loop_start>>MIX_FIX_SHIFT)<<1)]<<16) - 0x800000;\
-            v2b = (spl->data.u8[((spl->loop_start>>MIX_FIX_SHIFT)<<1)+1]<<16) - 0x800000;\
-         }                                                                   \
-         else                                                                \
-            v2a = v2b = 0;                                                   \
-      }                                                                      \
-      else {                                                                 \
-         v2a = (spl->data.u8[v+2]<<16) - 0x800000;                           \
-         v2b = (spl->data.u8[v+3]<<16) - 0x800000;                           \
-      }                                                                      \
-                                                                             \
-      v = spl->pos & (MIX_FIX_SCALE-1);                                      \
-      va = ((v2a*v) + (v1a*(MIX_FIX_SCALE-v))) >> MIX_FIX_SHIFT;             \
-      vb = ((v2b*v) + (v1b*(MIX_FIX_SCALE-v))) >> MIX_FIX_SHIFT;             \
+      /* 16 bit values times the fraction make 24 bit ones */                \
+      va = ((mix_source_value(spl, voice, v+1, 0) * f) +                     \
+            (mix_source_value(spl, voice, v, 0) * (MIX_FIX_SCALE-f)))        \
+           << (8 - MIX_FIX_SHIFT);                                           \
+      vb = ((mix_source_value(spl, voice, v+1, ch) * f) +                    \
+            (mix_source_value(spl, voice, v, ch) * (MIX_FIX_SCALE-f)))       \
+           << (8 - MIX_FIX_SHIFT);                                           \
                                                                              \
       *(buf++) += MULSC(va, lvol);                                           \
       *(buf++) += MULSC(vb, rvol);
 
+   #define MIX()       MIX_AT(spl->pos)
+   #define MIX_INTERP  TRUE
+   #define MIX_RUN(n)  MIX_ADPCM_RUN(n)
+
    MIXER();
 
+   #undef MIX_RUN
+   #undef MIX_INTERP
    #undef MIX
+   #undef MIX_AT
 }
 
-END_OF_STATIC_FUNCTION(mix_hq2_8x2_samples);
+END_OF_STATIC_FUNCTION(mix_hq2_adpcm_samples);
 
 
 
-/* mix_hq2_16x1_samples:
- *  Mixes from a mono 16 bit sample into an interpolated stereo buffer,
- *  until either len samples have been mixed or until the end of the sample
- *  is reached.
+/* mix_hq3_adpcm_samples:
+ *  Mixes from an ADPCM sample into the float stereo buffer through the
+ *  windowed sinc filter, until either len samples have been mixed or until
+ *  the end of the sample is reached.
  */
-static void mix_hq2_16x1_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+static void mix_hq3_adpcm_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, float *buf, int len)
 {
-   int lvol = spl->lvol;
-   int rvol = spl->rvol;
-   int v, v1, v2;
+   float lvol = spl->lvol * (1.0 / (65536.0 * 0x8000));
+   float rvol = spl->rvol * (1.0 / (65536.0 * 0x8000));
+   int channels = spl->channels;
 
-   #define MIX()                                                             \
-      v = spl->pos>>MIX_FIX_SHIFT;                                           \
-                                                                             \
-      v1 = (spl->data.u16[v]<<8) - 0x800000;                                 \
-                                                                             \
-      if (spl->pos >= spl->len-MIX_FIX_SCALE) {                              \
-         if ((voice->playmode & (PLAYMODE_LOOP |                             \
-                                 PLAYMODE_BIDIR)) == PLAYMODE_LOOP &&        \
-             spl->loop_start < spl->loop_end && spl->loop_end == spl->len)   \
-            v2 = (spl->data.u16[spl->loop_start>>MIX_FIX_SHIFT]<<8)-0x800000;\
-         else                                                                \
-            v2 = 0;                                                          \
-      }                                                                      \
-      else                                                                   \
-         v2 = (spl->data.u16[v+1]<<8) - 0x800000;                            \
-                                                                             \
-      v = spl->pos & (MIX_FIX_SCALE-1);                                      \
-      v = ((v2*v) + (v1*(MIX_FIX_SCALE-v))) >> MIX_FIX_SHIFT;                \
-                                                                             \
-      *(buf++) += MULSC(v, lvol);                                            \
-      *(buf++) += MULSC(v, rvol);
+   #define MIX_AT(p)                                                         \
+      buf = mix_sinc_frame(spl, voice, p, buf, lvol, rvol, 4, channels);
+
+   #define MIX()       MIX_AT(spl->pos)
+   #define MIX_INTERP  (MIX_SINC_TAPS/2)
+   #define MIX_RUN(n)  MIX_ADPCM_RUN(n)
 
    MIXER();
 
+   #undef MIX_RUN
+   #undef MIX_INTERP
    #undef MIX
+   #undef MIX_AT
 }
 
-END_OF_STATIC_FUNCTION(mix_hq2_16x1_samples);
+END_OF_STATIC_FUNCTION(mix_hq3_adpcm_samples);
 
 
 
-/* mix_hq2_16x2_samples:
- *  Mixes from a stereo 16 bit sample into an interpolated stereo buffer,
- *  until either len samples have been mixed or until the end of the sample
- *  is reached.
+#define MAX_24 (0x00FFFFFF)
+
+/* mix_refill_voice:
+ *  Hands the fragments of a voice that have finished playing back to its
+ *  fill function, so they are ready again by the time the voice loops
+ *  round to them. The fill function returns non-zero to stop the voice.
  */
-static void mix_hq2_16x2_samples(MIXER_VOICE *spl, PHYS_VOICE *voice, signed int *buf, int len)
+static void mix_refill_voice(MIXER_VOICE *mv)
 {
-   int lvol = spl->lvol;
-   int rvol = spl->rvol;
-   int v, va, v1a, v2a, vb, v1b, v2b;
+   int cur, size, stop;
 
-   #define MIX()                                                             \
-      v = (spl->pos>>MIX_FIX_SHIFT) << 1; /* x2 for stereo */                \
-                                                                             \
-      v1a = (spl->data.u16[v]<<8) - 0x800000;                                \
-      v1b = (spl->data.u16[v+1]<<8) - 0x800000;                              \
-                                                                             \
-      if (spl->pos >= spl->len-MIX_FIX_SCALE) {                              \
-         if ((voice->playmode & (PLAYMODE_LOOP |                             \
-                                 PLAYMODE_BIDIR)) == PLAYMODE_LOOP &&        \
-             spl->loop_start < spl->loop_end && spl->loop_end == spl->len) { \
-            v2a = (spl->data.u16[((spl->loop_start>>MIX_FIX_SHIFT)<<1)]<<8) - 0x800000;\
-            v2b = (spl->data.u16[((spl->loop_start>>MIX_FIX_SHIFT)<<1)+1]<<8) - 0x800000;\
-         }                                                                   \
-         else                                                                \
-            v2a = v2b = 0;                                                   \
-      }                                                                      \
-      else {                                                                 \
-         v2a = (spl->data.u16[v+2]<<8) - 0x800000;                           \
-         v2b = (spl->data.u16[v+3]<<8) - 0x800000;                           \
-      }                                                                      \
-                                                                             \
-      v = spl->pos & (MIX_FIX_SCALE-1);                                      \
-      va = ((v2a*v) + (v1a*(MIX_FIX_SCALE-v))) >> MIX_FIX_SHIFT;             \
-      vb = ((v2b*v) + (v1b*(MIX_FIX_SCALE-v))) >> MIX_FIX_SHIFT;             \
-                                                                             \
-      *(buf++) += MULSC(va, lvol);                                           \
-      *(buf++) += MULSC(vb, rvol);
+   cur = MIN((mv->pos >> MIX_FIX_SHIFT) / mv->fill_len, mv->fill_count-1);
+   size = mv->fill_len * mv->channels * ((mv->bits == 8) ? 1 : sizeof(short));
 
-   MIXER();
+   while (mv->fill_next != cur) {
+      stop = mv->fill(mv->data.u8 + mv->fill_next*size, mv->fill_len, mv->fill_param);
 
-   #undef MIX
+      if (++mv->fill_next >= mv->fill_count)
+	 mv->fill_next = 0;
+
+      if (stop) {
+	 mv->playing = FALSE;
+	 break;
+      }
+   }
 }
 
-END_OF_STATIC_FUNCTION(mix_hq2_16x2_samples);
+END_OF_STATIC_FUNCTION(mix_refill_voice);
 
 
 
-#define MAX_24 (0x00FFFFFF)
+/* mixer_voice_quality:
+ *  Picks the quality to mix voice i with. Voices which are quiet enough,
+ *  or matter little enough, skip the interpolation, and the quietest ones
+ *  are left silent while the mixer is short of time (-1).
+ */
+static INLINE int mixer_voice_quality(int i, int hq, int cheap_vol, int mute_vol)
+{
+   int vol = _phys_voice[i].vol >> 12;
+
+   if (vol < mute_vol)
+      return -1;
+
+   if ((hq > 1) && ((vol < cheap_vol) ||
+                    (_phys_voice[i].priority < _sound_lod_priority)))
+      return 1;
+
+   return hq;
+}
+
+
+
+/* mixer_stats_levels:
+ *  Updates the peak levels and counts the values which will be clipped,
+ *  from the 24 bit buffer. This runs in the interrupt handler on DOS, so
+ *  it must not touch the FPU.
+ */
+static void mixer_stats_levels(signed int *p)
+{
+   int peak[2];
+   int i, v;
+
+   peak[0] = mix_stats.peak_left;
+   peak[1] = mix_stats.peak_right;
+
+   for (i=0; i<mix_size*mix_channels; i++) {
+      v = ABS(p[i]) >> 8;
+      if ((p[i] > 0x7FFFFF) || (p[i] < -0x800000))
+         mix_stats.clipped++;
+
+      if (v > peak[i & (mix_channels-1)])
+         peak[i & (mix_channels-1)] = v;
+   }
+
+   mix_stats.peak_left = peak[0];
+   mix_stats.peak_right = (mix_channels == 2) ? peak[1] : peak[0];
+}
+
+END_OF_STATIC_FUNCTION(mixer_stats_levels);
+
+
+
+/* mixer_stats_float_levels:
+ *  Like mixer_stats_levels(), but for the float buffer of quality 3.
+ */
+static void mixer_stats_float_levels(float *f)
+{
+   int peak[2];
+   int i, v;
+
+   peak[0] = mix_stats.peak_left;
+   peak[1] = mix_stats.peak_right;
+
+   for (i=0; i<mix_size*mix_channels; i++) {
+      v = (int)(fabs(f[i]) * 0x8000);
+      if ((f[i] >= 1.0) || (f[i] < -1.0))
+         mix_stats.clipped++;
+
+      if (v > peak[i & (mix_channels-1)])
+         peak[i & (mix_channels-1)] = v;
+   }
+
+   mix_stats.peak_left = peak[0];
+   mix_stats.peak_right = (mix_channels == 2) ? peak[1] : peak[0];
+}
+
+END_OF_STATIC_FUNCTION(mixer_stats_float_levels);
+
+
 
 /* _mix_some_samples:
  *  Mixes samples into a buffer in memory (the buf parameter should be a
@@ -1073,20 +2595,93 @@ END_OF_STATIC_FUNCTION(mix_hq2_16x2_samples);
 void _mix_some_samples(uintptr_t buf, unsigned short seg, int issigned)
 {
    signed int *p = mix_buffer;
+   float *f = mix_float_buffer;
+   int hq = _sound_hq;
+   int int_bus = (hq < 3);
+   int cheap_vol, mute_vol, q;
+   int timed = (((_sound_budget > 0) || (mix_stats_on)) && (timer_driver) && (timer_driver->read_usec));
+   unsigned long start = 0;
+   double elapsed, budget;
+   int mixed = 0, silent = 0;
+   MIXER_VOICE *mv, *next;
    int i;
 
-   /* clear mixing buffer */
-   memset(p, 0, mix_size*mix_channels * sizeof(*p));
+   if (timed)
+      start = timer_driver->read_usec();
+
+   if ((!timed) || (_sound_budget <= 0))
+      mix_budget_level = 0;
+
+   cheap_vol = _sound_lod_volume + mix_budget_level * MIX_BUDGET_STEP;
+   mute_vol = cheap_vol - 256;
 
 #ifdef ALLEGRO_MULTITHREADED
-   system_driver->lock_mutex(mixer_mutex);
+   /* catch up with the voice functions */
+   mixer_generation++;
+   MIXER_BARRIER();
+   mixer_receive_commands();
 #endif
 
-   for (i=0; i<mix_voices; i++) {
+   mix_voices_active = (mix_active_first != NULL);
+
+   /* clear mixing buffer */
+   if (hq >= 3)
+      memset(f, 0, mix_size*mix_channels * sizeof(*f));
+   else
+      memset(p, 0, mix_size*mix_channels * sizeof(*p));
+
+   for (mv=mix_active_first; mv; mv=next) {
+      next = mv->next;
+      i = mv - mixer_voice;
+
       if (mixer_voice[i].playing) {
-         if ((_phys_voice[i].vol > 0) || (_phys_voice[i].dvol > 0)) {
+         if ((_phys_voice[i].vol > 0) || (_phys_voice[i].dvol > 0))
+            q = mixer_voice_quality(i, hq, cheap_vol, mute_vol);
+         else
+            q = -1;
+
+         /* cheaper voices of quality 3 go through the 24 bit buffer */
+         if ((q >= 0) && (q < 3) && (!int_bus)) {
+            memset(p, 0, mix_size*mix_channels * sizeof(*p));
+            int_bus = TRUE;
+         }
+
+         if (q >= 0)
+            mixed++;
+         else
+            silent++;
+
+         if (q >= 0) {
+            /* ADPCM samples, decoded as they are mixed */
+            if (mixer_voice[i].bits == 4) {
+               if (q >= 3)
+                  mix_hq3_adpcm_samples(mixer_voice+i, _phys_voice+i, f, mix_size);
+               else if (q >= 2)
+                  mix_hq2_adpcm_samples(mixer_voice+i, _phys_voice+i, p, mix_size);
+               else if (q)
+                  mix_hq1_adpcm_samples(mixer_voice+i, _phys_voice+i, p, mix_size);
+               else
+                  mix_adpcm_samples(mixer_voice+i, _phys_voice+i, p, mix_size);
+            }
+            /* windowed sinc mixing, into the float buffer */
+            else if (q >= 3) {
+               /* stereo input -> float output */
+               if (mixer_voice[i].channels != 1) {
+                  if (mixer_voice[i].bits == 8)
+                     mix_hq3_8x2_samples(mixer_voice+i, _phys_voice+i, f, mix_size);
+                  else
+                     mix_hq3_16x2_samples(mixer_voice+i, _phys_voice+i, f, mix_size);
+               }
+               /* mono input -> float output */
+               else {
+                  if (mixer_voice[i].bits == 8)
+                     mix_hq3_8x1_samples(mixer_voice+i, _phys_voice+i, f, mix_size);
+                  else
+                     mix_hq3_16x1_samples(mixer_voice+i, _phys_voice+i, f, mix_size);
+               }
+            }
             /* Interpolated mixing */
-            if (_sound_hq >= 2) {
+            else if (q >= 2) {
                /* stereo input -> interpolated output */
                if (mixer_voice[i].channels != 1) {
                   if (mixer_voice[i].bits == 8)
@@ -1103,7 +2698,7 @@ void _mix_some_samples(uintptr_t buf, unsigned short seg, int issigned)
                }
             }
             /* high quality mixing */
-            else if (_sound_hq) {
+            else if (q) {
                /* stereo input -> high quality output */
                if (mixer_voice[i].channels != 1) {
                   if (mixer_voice[i].bits == 8)
@@ -1156,16 +2751,71 @@ void _mix_some_samples(uintptr_t buf, unsigned short seg, int issigned)
          }
          else
             mix_silent_samples(mixer_voice+i, _phys_voice+i, mix_size);
+
+         if (mixer_voice[i].fill)
+            mix_refill_voice(mixer_voice+i);
       }
+
+      /* drop voices that have finished */
+      if (!mixer_voice[i].playing)
+         mixer_deactivate_voice(mv);
    }
 
 #ifdef ALLEGRO_MULTITHREADED
-   system_driver->unlock_mutex(mixer_mutex);
+   MIXER_BARRIER();
+   mixer_generation++;
 #endif
 
-   _farsetsel(seg);
+   /* cut back when the voices took longer than the budget allows, and
+    * only return to full quality once there is time to spare */
+   if ((timed) && (_sound_budget > 0)) {
+      elapsed = (double)(timer_driver->read_usec() - start);
+      budget = mix_size * 10000.0 * _sound_budget / mix_freq;
+
+      if (elapsed > budget) {
+         if (mix_budget_level < MIX_BUDGET_LEVELS)
+            mix_budget_level++;
+      }
+      else if ((elapsed < budget * 0.75) && (mix_budget_level > 0))
+         mix_budget_level--;
+   }
+
+   /* the float buffer is only clipped here, on its way to the 24 bit one */
+   if (hq >= 3) {
+      if (int_bus) {
+         for (i=0; i<mix_size*mix_channels; i++)
+            f[i] += p[i] * (1.0 / 0x800000);
+      }
+
+      if (mix_stats_on)
+         mixer_stats_float_levels(f);
+
+#ifdef ALLEGRO_SIMD_SSE2
+      _simd_mix_from_float(p, f, mix_size*mix_channels);
+#else
+      for (i=0; i<mix_size*mix_channels; i++) {
+         if (f[i] >= 1.0)
+            p[i] = 0x7FFFFF;
+         else if (f[i] <= -1.0)
+            p[i] = -0x800000;
+         else
+            p[i] = (int)floor(f[i] * 0x800000 + 0.5);
+      }
+#endif
+   }
+   else if (mix_stats_on)
+      mixer_stats_levels(p);
 
    /* transfer to the audio driver's buffer */
+#ifdef ALLEGRO_SIMD_SSE2
+   /* no segments to worry about on SIMD capable platforms */
+   if (mix_bits == 16)
+      _simd_mix_to_16bit((void *)buf, p, mix_size*mix_channels, issigned);
+   else
+      _simd_mix_to_8bit((void *)buf, p, mix_size*mix_channels, issigned);
+#else
+   _farsetsel(seg);
+
    if (mix_bits == 16) {
       if (issigned) {
          for (i=mix_size*mix_channels; i>0; i--) {
@@ -1198,29 +2848,63 @@ void _mix_some_samples(uintptr_t buf, unsigned short seg, int issigned)
          }
       }
    }
+#endif
+
+   if (mix_stats_on) {
+      mix_stats.buffers++;
+      mix_stats.voices = mixed;
+      mix_stats.silent_voices = silent;
+
+      if (timed) {
+         mix_stats.usec = timer_driver->read_usec() - start;
+         mix_stats.max_usec = MAX(mix_stats.max_usec, mix_stats.usec);
+         mix_stats_total_usec += mix_stats.usec;
+      }
+   }
 }
 
 END_OF_FUNCTION(_mix_some_samples);
 
 
 
+/* _mixer_voices_active:
+ *  Returns TRUE if any voice took part in the last call to
+ *  _mix_some_samples(), including those which stopped during it. Drivers
+ *  which don't run in realtime use this to skip over silence.
+ */
+int _mixer_voices_active(void)
+{
+   return mix_voices_active;
+}
+
+
+
+/* _mixer_set_idle:
+ *  Drivers which also run code that plays voices on the thread calling
+ *  _mix_some_samples(), like the MIDI player with an external clock, mark
+ *  the time spent in it as idle. Meanwhile the mixer can't empty the
+ *  command ring, so a full ring is emptied by the thread filling it.
+ */
+void _mixer_set_idle(int idle)
+{
+#ifdef ALLEGRO_MULTITHREADED
+   if (mixer_mutex) {
+      /* waits for a thread in the middle of emptying the ring */
+      system_driver->lock_mutex(mixer_mutex);
+      mixer_idle = idle;
+      system_driver->unlock_mutex(mixer_mutex);
+   }
+#endif
+}
+
+
+
 /* _mixer_init_voice:
  *  Initialises the specificed voice ready for playing a sample.
  */
 void _mixer_init_voice(int voice, AL_CONST SAMPLE *sample)
 {
-   mixer_voice[voice].playing = FALSE;
-   mixer_voice[voice].channels = (sample->stereo ? 2 : 1);
-   mixer_voice[voice].bits = sample->bits;
-   mixer_voice[voice].pos = 0;
-   mixer_voice[voice].len = sample->len << MIX_FIX_SHIFT;
-   mixer_voice[voice].loop_start = sample->loop_start << MIX_FIX_SHIFT;
-   mixer_voice[voice].loop_end = sample->loop_end << MIX_FIX_SHIFT;
-
-   mixer_voice[voice].data.buffer = sample->data;
-
-   update_mixer_volume(mixer_voice+voice, _phys_voice+voice);
-   update_mixer_freq(mixer_voice+voice, _phys_voice+voice);
+   mixer_command(MIXER_CMD_INIT, voice, 0, 0, sample);
 }
 
 END_OF_FUNCTION(_mixer_init_voice);
@@ -1232,16 +2916,7 @@ END_OF_FUNCTION(_mixer_init_voice);
  */
 void _mixer_release_voice(int voice)
 {
-#ifdef ALLEGRO_MULTITHREADED
-   system_driver->lock_mutex(mixer_mutex);
-#endif
-
-   mixer_voice[voice].playing = FALSE;
-   mixer_voice[voice].data.buffer = NULL;
-
-#ifdef ALLEGRO_MULTITHREADED
-   system_driver->unlock_mutex(mixer_mutex);
-#endif
+   mixer_command(MIXER_CMD_RELEASE, voice, 0, 0, NULL);
 }
 
 END_OF_FUNCTION(_mixer_release_voice);
@@ -1253,10 +2928,7 @@ END_OF_FUNCTION(_mixer_release_voice);
  */
 void _mixer_start_voice(int voice)
 {
-   if (mixer_voice[voice].pos >= mixer_voice[voice].len)
-      mixer_voice[voice].pos = 0;
-
-   mixer_voice[voice].playing = TRUE;
+   mixer_command(MIXER_CMD_START, voice, 0, 0, NULL);
 }
 
 END_OF_FUNCTION(_mixer_start_voice);
@@ -1268,7 +2940,7 @@ END_OF_FUNCTION(_mixer_start_voice);
  */
 void _mixer_stop_voice(int voice)
 {
-   mixer_voice[voice].playing = FALSE;
+   mixer_command(MIXER_CMD_STOP, voice, 0, 0, NULL);
 }
 
 END_OF_FUNCTION(_mixer_stop_voice);
@@ -1280,7 +2952,7 @@ END_OF_FUNCTION(_mixer_stop_voice);
  */
 void _mixer_loop_voice(int voice, int loopmode)
 {
-   update_mixer_freq(mixer_voice+voice, _phys_voice+voice);
+   mixer_command(MIXER_CMD_LOOP, voice, loopmode, 0, NULL);
 }
 
 END_OF_FUNCTION(_mixer_loop_voice);
@@ -1292,11 +2964,28 @@ END_OF_FUNCTION(_mixer_loop_voice);
  */
 int _mixer_get_position(int voice)
 {
-   if ((!mixer_voice[voice].playing) ||
-       (mixer_voice[voice].pos >= mixer_voice[voice].len))
+   int playing = mixer_voice[voice].playing;
+   long pos = mixer_voice[voice].pos;
+   long len = mixer_voice[voice].len;
+
+#ifdef ALLEGRO_MULTITHREADED
+   /* report the voice as it will be once the mixer has caught up */
+   if (mixer_mutex) {
+      MIXER_SHADOW *sh;
+
+      system_driver->lock_mutex(mixer_mutex);
+      sh = mixer_shadow_voice(voice);
+      playing = sh->playing;
+      pos = sh->pos;
+      len = sh->len;
+      system_driver->unlock_mutex(mixer_mutex);
+   }
+#endif
+
+   if ((!playing) || (pos >= len))
       return -1;
 
-   return (mixer_voice[voice].pos >> MIX_FIX_SHIFT);
+   return (pos >> MIX_FIX_SHIFT);
 }
 
 END_OF_FUNCTION(_mixer_get_position);
@@ -1311,9 +3000,7 @@ void _mixer_set_position(int voice, int position)
    if (position < 0)
       position = 0;
 
-   mixer_voice[voice].pos = (position << MIX_FIX_SHIFT);
-   if (mixer_voice[voice].pos >= mixer_voice[voice].len)
-      mixer_voice[voice].playing = FALSE;
+   mixer_command(MIXER_CMD_SET_POSITION, voice, position, 0, NULL);
 }
 
 END_OF_FUNCTION(_mixer_set_position);
@@ -1337,7 +3024,7 @@ END_OF_FUNCTION(_mixer_get_volume);
  */
 void _mixer_set_volume(int voice, int volume)
 {
-   update_mixer_volume(mixer_voice+voice, _phys_voice+voice);
+   mixer_command(MIXER_CMD_SET_VOLUME, voice, volume, 0, NULL);
 }
 
 END_OF_FUNCTION(_mixer_set_volume);
@@ -1349,11 +3036,7 @@ END_OF_FUNCTION(_mixer_set_volume);
  */
 void _mixer_ramp_volume(int voice, int time, int endvol)
 {
-   int d = (endvol << 12) - _phys_voice[voice].vol;
-   time = MAX(time * (mix_freq / UPDATE_FREQ) / 1000, 1);
-
-   _phys_voice[voice].target_vol = endvol << 12;
-   _phys_voice[voice].dvol = d / time;
+   mixer_command(MIXER_CMD_RAMP_VOLUME, voice, time, endvol, NULL);
 }
 
 END_OF_FUNCTION(_mixer_ramp_volume);
@@ -1365,7 +3048,7 @@ END_OF_FUNCTION(_mixer_ramp_volume);
  */
 void _mixer_stop_volume_ramp(int voice)
 {
-   _phys_voice[voice].dvol = 0;
+   mixer_command(MIXER_CMD_STOP_VOLUME_RAMP, voice, 0, 0, NULL);
 }
 
 END_OF_FUNCTION(_mixer_stop_volume_ramp);
@@ -1389,7 +3072,7 @@ END_OF_FUNCTION(_mixer_get_frequency);
  */
 void _mixer_set_frequency(int voice, int frequency)
 {
-   update_mixer_freq(mixer_voice+voice, _phys_voice+voice);
+   mixer_command(MIXER_CMD_SET_FREQUENCY, voice, frequency, 0, NULL);
 }
 
 END_OF_FUNCTION(_mixer_set_frequency);
@@ -1401,11 +3084,7 @@ END_OF_FUNCTION(_mixer_set_frequency);
  */
 void _mixer_sweep_frequency(int voice, int time, int endfreq)
 {
-   int d = (endfreq << 12) - _phys_voice[voice].freq;
-   time = MAX(time * (mix_freq / UPDATE_FREQ) / 1000, 1);
-
-   _phys_voice[voice].target_freq = endfreq << 12;
-   _phys_voice[voice].dfreq = d / time;
+   mixer_command(MIXER_CMD_SWEEP_FREQUENCY, voice, time, endfreq, NULL);
 }
 
 END_OF_FUNCTION(_mixer_sweep_frequency);
@@ -1417,7 +3096,7 @@ END_OF_FUNCTION(_mixer_sweep_frequency);
  */
 void _mixer_stop_frequency_sweep(int voice)
 {
-   _phys_voice[voice].dfreq = 0;
+   mixer_command(MIXER_CMD_STOP_FREQ_SWEEP, voice, 0, 0, NULL);
 }
 
 END_OF_FUNCTION(_mixer_stop_frequency_sweep);
@@ -1441,7 +3120,7 @@ END_OF_FUNCTION(_mixer_get_pan);
  */
 void _mixer_set_pan(int voice, int pan)
 {
-   update_mixer_volume(mixer_voice+voice, _phys_voice+voice);
+   mixer_command(MIXER_CMD_SET_PAN, voice, pan, 0, NULL);
 }
 
 END_OF_FUNCTION(_mixer_set_pan);
@@ -1453,11 +3132,7 @@ END_OF_FUNCTION(_mixer_set_pan);
  */
 void _mixer_sweep_pan(int voice, int time, int endpan)
 {
-   int d = (endpan << 12) - _phys_voice[voice].pan;
-   time = MAX(time * (mix_freq / UPDATE_FREQ) / 1000, 1);
-
-   _phys_voice[voice].target_pan = endpan << 12;
-   _phys_voice[voice].dpan = d / time;
+   mixer_command(MIXER_CMD_SWEEP_PAN, voice, time, endpan, NULL);
 }
 
 END_OF_FUNCTION(_mixer_sweep_pan);
@@ -1469,7 +3144,7 @@ END_OF_FUNCTION(_mixer_sweep_pan);
  */
 void _mixer_stop_pan_sweep(int voice)
 {
-   _phys_voice[voice].dpan = 0;
+   mixer_command(MIXER_CMD_STOP_PAN_SWEEP, voice, 0, 0, NULL);
 }
 
 END_OF_FUNCTION(_mixer_stop_pan_sweep);
@@ -1512,21 +3187,60 @@ END_OF_FUNCTION(_mixer_set_vibrato);
 
 
 
+/* _mixer_set_fill:
+ *  Makes the mixer call the fill function, from its own thread, with each
+ *  len sample fragment of a looping voice as soon as it has been played,
+ *  so that it can be refilled in place.
+ */
+void _mixer_set_fill(int voice, AL_METHOD(int, fill, (void *buf, int len, void *param)), void *param, int len)
+{
+   MIXER_CMD cmd;
+   ASSERT(len > 0);
+
+   cmd.type = MIXER_CMD_SET_FILL;
+   cmd.voice = voice;
+   cmd.arg1 = len;
+   cmd.arg2 = 0;
+   cmd.fill = fill;
+   cmd.fill_param = param;
+
+   mixer_post_command(&cmd);
+}
+
+END_OF_FUNCTION(_mixer_set_fill);
+
+
+
 /* mixer_lock_mem:
  *  Locks memory used by the functions in this file.
  */
 static void mixer_lock_mem(void)
 {
    LOCK_VARIABLE(mixer_voice);
+   LOCK_VARIABLE(mix_active_first);
+   LOCK_VARIABLE(mix_active_last);
+   LOCK_VARIABLE(mix_voices_active);
+   LOCK_VARIABLE(mix_stats);
+   LOCK_VARIABLE(mix_stats_on);
+   LOCK_VARIABLE(mix_stats_total_usec);
    LOCK_VARIABLE(mix_buffer);
+   LOCK_VARIABLE(mix_float_buffer);
+   LOCK_VARIABLE(mix_sinc_table);
+   LOCK_VARIABLE(mix_adpcm_cache);
    LOCK_VARIABLE(mix_vol_table);
    LOCK_VARIABLE(mix_voices);
+   LOCK_VARIABLE(mix_budget_level);
    LOCK_VARIABLE(mix_size);
    LOCK_VARIABLE(mix_freq);
    LOCK_VARIABLE(mix_channels);
    LOCK_VARIABLE(mix_bits);
    LOCK_FUNCTION(set_mixer_quality);
    LOCK_FUNCTION(get_mixer_quality);
+   LOCK_FUNCTION(set_mixer_lod);
+   LOCK_FUNCTION(set_mixer_budget);
+   LOCK_FUNCTION(set_mixer_stats);
+   LOCK_FUNCTION(get_mixer_stats);
+   LOCK_FUNCTION(_mixer_stats_underrun);
    LOCK_FUNCTION(get_mixer_buffer_length);
    LOCK_FUNCTION(get_mixer_frequency);
    LOCK_FUNCTION(get_mixer_bits);
@@ -1550,9 +3264,25 @@ static void mixer_lock_mem(void)
    LOCK_FUNCTION(mix_hq2_8x2_samples);
    LOCK_FUNCTION(mix_hq2_16x1_samples);
    LOCK_FUNCTION(mix_hq2_16x2_samples);
+   LOCK_FUNCTION(mix_hq3_8x1_samples);
+   LOCK_FUNCTION(mix_hq3_8x2_samples);
+   LOCK_FUNCTION(mix_hq3_16x1_samples);
+   LOCK_FUNCTION(mix_hq3_16x2_samples);
+   LOCK_FUNCTION(mix_adpcm_samples);
+   LOCK_FUNCTION(mix_hq1_adpcm_samples);
+   LOCK_FUNCTION(mix_hq2_adpcm_samples);
+   LOCK_FUNCTION(mix_hq3_adpcm_samples);
    LOCK_FUNCTION(update_mixer_volume);
    LOCK_FUNCTION(update_mixer);
    LOCK_FUNCTION(update_silent_mixer);
+   LOCK_FUNCTION(mixer_activate_voice);
+   LOCK_FUNCTION(mixer_deactivate_voice);
+   LOCK_FUNCTION(mixer_apply_command);
+   LOCK_FUNCTION(mixer_post_command);
+   LOCK_FUNCTION(mixer_command);
+   LOCK_FUNCTION(mix_refill_voice);
+   LOCK_FUNCTION(mixer_stats_levels);
+   LOCK_FUNCTION(mixer_stats_float_levels);
    LOCK_FUNCTION(_mix_some_samples);
    LOCK_FUNCTION(_mixer_init_voice);
    LOCK_FUNCTION(_mixer_release_voice);
@@ -1576,4 +3306,7 @@ static void mixer_lock_mem(void)
    LOCK_FUNCTION(_mixer_set_echo);
    LOCK_FUNCTION(_mixer_set_tremolo);
    LOCK_FUNCTION(_mixer_set_vibrato);
+   LOCK_FUNCTION(_mixer_set_fill);
+
+   _adpcm_lock_mem();
 }
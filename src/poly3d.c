@@ -24,6 +24,7 @@
 
 #include <limits.h>
 #include <float.h>
+#include <math.h>
 
 #include "allegro.h"
 #include "allegro/internal/aintern.h"
@@ -864,7 +865,7 @@ SCANLINE_FILLER _get_scanline_filler(int type, int *flags, POLYGON_SEGMENT *info
       info->umask = texture->w - 1;
       info->vmask = texture->h - 1;
       info->vshift = 0;
-      while ((1 << info->vshift) < texture->w)
+      while ((1 << info->vshift) * BYTES_PER_PIXEL(bitmap_color_depth(texture)) < _bitmap_pitch(texture))
 	 info->vshift++;
    }
    else {
@@ -931,12 +932,71 @@ void _clip_polygon_segment_f(POLYGON_SEGMENT *info, int gap, int flags)
 
 
 
+/* The range of scanlines the helpers below may draw, along with the bits
+ * of global state they need, so that the same polygon can be drawn one
+ * band at a time by the batch renderer. Lines above the band are still
+ * stepped through, which keeps the output identical to a single pass.
+ */
+typedef struct POLY3D_BAND
+{
+   int top, bottom;                    /* scanlines to draw */
+   SCANLINE_FILLER alternative;        /* _optim_alternative_drawer */
+   BITMAP *zbuf;                       /* _zbuffer */
+} POLY3D_BAND;
+
+
+
+/* full_band:
+ *  Sets up a band covering the whole bitmap, for immediate drawing.
+ */
+static void full_band(POLY3D_BAND *band)
+{
+   band->top = INT_MIN;
+   band->bottom = INT_MAX;
+   band->alternative = _optim_alternative_drawer;
+   band->zbuf = _zbuffer;
+}
+
+
+
+/* skip_polygon_segment:
+ *  Steps the interpolated values of an edge over a scanline that is not
+ *  drawn, exactly like the drawing loops do.
+ */
+static INLINE void skip_polygon_segment(POLYGON_SEGMENT *s, int flags)
+{
+   if (flags & INTERP_1COL)
+      s->c += s->dc;
+
+   if (flags & INTERP_3COL) {
+      s->r += s->dr;
+      s->g += s->dg;
+      s->b += s->db;
+   }
+
+   if (flags & INTERP_FIX_UV) {
+      s->u += s->du;
+      s->v += s->dv;
+   }
+
+   if (flags & INTERP_Z) {
+      s->z += s->dz;
+
+      if (flags & INTERP_FLOAT_UV) {
+	 s->fu += s->dfu;
+	 s->fv += s->dfv;
+      }
+   }
+}
+
+
+
 /* draw_polygon_segment: 
  *  Polygon helper function to fill a scanline. Calculates deltas for 
  *  whichever values need interpolating, clips the segment, and then calls
  *  the lowlevel scanline filler.
  */
-static void draw_polygon_segment(BITMAP *bmp, int ytop, int ybottom, POLYGON_EDGE *e1, POLYGON_EDGE *e2, SCANLINE_FILLER drawer, int flags, int color, POLYGON_SEGMENT *info)
+static void draw_polygon_segment(BITMAP *bmp, int ytop, int ybottom, POLYGON_EDGE *e1, POLYGON_EDGE *e2, SCANLINE_FILLER drawer, int flags, int color, POLYGON_SEGMENT *info, POLY3D_BAND *band)
 {
    int x, y, w, gap;
    fixed step, width;
@@ -956,8 +1016,21 @@ static void draw_polygon_segment(BITMAP *bmp, int ytop, int ybottom, POLYGON_EDG
    if (flags & INTERP_FLAT)
       info->c = color;
 
+   if (ybottom > band->bottom)
+      ybottom = band->bottom;
+
    /* for each scanline in the polygon... */
    for (y=ytop; y<=ybottom; y++) {
+      if (y < band->top) {
+	 if (save_drawer != _poly_scanline_dummy) {
+	    skip_polygon_segment(s1, flags);
+	    skip_polygon_segment(s2, flags);
+	 }
+	 e1->x += e1->dx;
+	 e2->x += e2->dx;
+	 continue;
+      }
+
       x = fixceil(e1->x);
       w = fixceil(e2->x) - x;
       drawer = save_drawer;
@@ -1058,11 +1131,11 @@ static void draw_polygon_segment(BITMAP *bmp, int ytop, int ybottom, POLYGON_EDG
 	       info->v = info->fv * z1;
 	       info->du = info->dfu * z1;
 	       info->dv = info->dfv * z1;
-	       drawer = _optim_alternative_drawer;
+	       drawer = band->alternative;
 	    }
 
             if (flags & INTERP_ZBUF) 
-               info->zbuf_addr = bmp_write_line(_zbuffer, y) + x * sizeof(float);
+               info->zbuf_addr = bmp_write_line(band->zbuf, y) + x * sizeof(float);
 
 	    info->read_addr = bmp_read_line(bmp, y) + dx;
 	    drawer(bmp_write_line(bmp, y) + dx, w, info);
@@ -1080,7 +1153,7 @@ static void draw_polygon_segment(BITMAP *bmp, int ytop, int ybottom, POLYGON_EDG
  *  Helper function for rendering 3d polygon, used by both the fixed point
  *  and floating point drawing functions.
  */
-static void do_polygon3d(BITMAP *bmp, int top, int bottom, POLYGON_EDGE *left_edge, SCANLINE_FILLER drawer, int flags, int color, POLYGON_SEGMENT *info)
+static void do_polygon3d(BITMAP *bmp, int top, int bottom, POLYGON_EDGE *left_edge, SCANLINE_FILLER drawer, int flags, int color, POLYGON_SEGMENT *info, POLY3D_BAND *band)
 {
    int ytop, ybottom;
    #ifdef ALLEGRO_DOS
@@ -1110,9 +1183,9 @@ static void do_polygon3d(BITMAP *bmp, int top, int bottom, POLYGON_EDGE *left_ed
 	 ybottom = left_edge->bottom;
 
       /* fill the scanline */
-      draw_polygon_segment(bmp, ytop, ybottom, left_edge, right_edge, drawer, flags, color, info);
+      draw_polygon_segment(bmp, ytop, ybottom, left_edge, right_edge, drawer, flags, color, info, band);
 
-      if (ybottom >= bottom) break;
+      if ((ybottom >= bottom) || (ybottom >= band->bottom)) break;
 
       /* update edges */
       if (ybottom >= left_edge->bottom)
@@ -1135,35 +1208,20 @@ static void do_polygon3d(BITMAP *bmp, int top, int bottom, POLYGON_EDGE *left_ed
 
 
 
-/* polygon3d:
- *  Draws a 3d polygon in the specified mode. The vertices parameter should
- *  be followed by that many pointers to V3D structures, which describe each
- *  vertex of the polygon.
+/* render_polygon3d:
+ *  Builds the edge list of a polygon in the edges array, which must have
+ *  room for vc entries, and draws it.
  */
-void _soft_polygon3d(BITMAP *bmp, int type, BITMAP *texture, int vc, V3D *vtx[])
+static void render_polygon3d(BITMAP *bmp, SCANLINE_FILLER drawer, int flags, POLYGON_SEGMENT *info, int vc, V3D *vtx[], POLYGON_EDGE *edges, POLY3D_BAND *band)
 {
    int c;
-   int flags;
    int top = INT_MAX;
    int bottom = INT_MIN;
    V3D *v1, *v2;
    POLYGON_EDGE *edge, *edge0, *start_edge;
    POLYGON_EDGE *list_edges = NULL;
-   POLYGON_SEGMENT info;
-   SCANLINE_FILLER drawer;
-   ASSERT(bmp);
 
-   if (vc < 3)
-      return;
-
-   /* set up the drawing mode */
-   drawer = _get_scanline_filler(type, &flags, &info, texture, bmp);
-   if (!drawer)
-      return;
-
-   /* allocate some space for the active edge table */
-   _grow_scratch_mem(sizeof(POLYGON_EDGE) * vc);
-   start_edge = edge0 = edge = (POLYGON_EDGE *)_scratch_mem;
+   start_edge = edge0 = edge = edges;
 
    /* fill the double-linked list of edges (order unimportant) */
    v2 = vtx[vc-1];
@@ -1191,47 +1249,34 @@ void _soft_polygon3d(BITMAP *bmp, int type, BITMAP *texture, int vc, V3D *vtx[])
       }
    }
 
-   if (list_edges) {
+   if ((list_edges) && (top <= band->bottom) && (bottom >= band->top)) {
       /* close the double-linked list */
       edge0->prev = --edge;
       edge->next = edge0;
 
       /* render the polygon */
-      do_polygon3d(bmp, top, bottom, start_edge, drawer, flags, vtx[0]->c, &info);
+      do_polygon3d(bmp, top, bottom, start_edge, drawer, flags, vtx[0]->c, info, band);
    }
 }
 
 
 
-/* polygon3d_f:
- *  Floating point version of polygon3d().
+/* render_polygon3d_f:
+ *  Builds the edge list of a polygon in the edges array, which must have
+ *  room for vc entries, and draws it.
  */
-void _soft_polygon3d_f(BITMAP *bmp, int type, BITMAP *texture, int vc, V3D_f *vtx[])
+static void render_polygon3d_f(BITMAP *bmp, SCANLINE_FILLER drawer, int flags, POLYGON_SEGMENT *info, int vc, V3D_f *vtx[], POLYGON_EDGE *edges, POLY3D_BAND *band)
 {
    int c;
-   int flags;
    int top = INT_MAX;
    int bottom = INT_MIN;
    V3D_f *v1, *v2;
    POLYGON_EDGE *edge, *edge0, *start_edge;
    POLYGON_EDGE *list_edges = NULL;
-   POLYGON_SEGMENT info;
-   SCANLINE_FILLER drawer;
-   ASSERT(bmp);
-
-   if (vc < 3)
-      return;
-
-   /* set up the drawing mode */
-   drawer = _get_scanline_filler(type, &flags, &info, texture, bmp);
-   if (!drawer)
-      return;
 
-   /* allocate some space for the active edge table */
-   _grow_scratch_mem(sizeof(POLYGON_EDGE) * vc);
-   start_edge = edge0 = edge = (POLYGON_EDGE *)_scratch_mem;
+   start_edge = edge0 = edge = edges;
 
-   /* fill the double-linked list of edges in clockwise order */
+   /* fill the double-linked list of edges (order unimportant) */
    v2 = vtx[vc-1];
 
    for (c=0; c<vc; c++) {
@@ -1239,7 +1284,7 @@ void _soft_polygon3d_f(BITMAP *bmp, int type, BITMAP *texture, int vc, V3D_f *vt
       v2 = vtx[c];
 
       if (_fill_3d_edge_structure_f(edge, v1, v2, flags, bmp)) {
-         if (edge->top < top) {
+	 if (edge->top < top) {
             top = edge->top;
 	    start_edge = edge;
          }
@@ -1257,23 +1302,243 @@ void _soft_polygon3d_f(BITMAP *bmp, int type, BITMAP *texture, int vc, V3D_f *vt
       }
    }
 
-   if (list_edges) {
+   if ((list_edges) && (top <= band->bottom) && (bottom >= band->top)) {
       /* close the double-linked list */
       edge0->prev = --edge;
       edge->next = edge0;
 
       /* render the polygon */
-      do_polygon3d(bmp, top, bottom, start_edge, drawer, flags, vtx[0]->c, &info);
+      do_polygon3d(bmp, top, bottom, start_edge, drawer, flags, vtx[0]->c, info, band);
    }
 }
 
 
 
+/* Polygons drawn while a batch is being recorded are kept in a list, and
+ * drawn by flush_polygon3d_batch(). The bitmap is then cut into bands of
+ * BATCH_BAND_HEIGHT scanlines, and each band draws the polygons that touch
+ * it, in the order they were queued, on one of the worker threads.
+ */
+#define BATCH_POLYGON         0
+#define BATCH_POLYGON_F       1
+#define BATCH_TRIANGLE        2
+#define BATCH_TRIANGLE_F      3
+
+#define BATCH_BAND_HEIGHT     32
+
+
+typedef union POLY3D_VERTEX
+{
+   V3D v;
+   V3D_f f;
+} POLY3D_VERTEX;
+
+
+typedef struct POLY3D_ITEM
+{
+   int kind;                           /* BATCH_* */
+   int vc, first;                      /* vertices, in batch_vertex */
+   int top, bottom;                    /* scanlines it may cover */
+   int flags;
+   SCANLINE_FILLER drawer;
+   SCANLINE_FILLER alternative;
+   BITMAP *zbuf;
+   POLYGON_SEGMENT info;
+} POLY3D_ITEM;
+
+
+static BITMAP *batch_bmp = NULL;
+
+static POLY3D_ITEM *batch_item = NULL;
+static int batch_items = 0;
+static int batch_max_items = 0;
+
+static POLY3D_VERTEX *batch_vertex = NULL;
+static int batch_vertices = 0;
+static int batch_max_vertices = 0;
+static int batch_max_vc = 0;
+
+
+static void draw_batch(void);
+
+
+
+/* batch_range:
+ *  Works out which scanlines of the clipping rectangle a polygon spanning
+ *  ymin to ymax may cover. Errs on the large side, as the bands only use
+ *  this to decide which polygons to look at.
+ */
+static void batch_range(BITMAP *bmp, float ymin, float ymax, POLY3D_ITEM *item)
+{
+   int lo = (bmp->clip) ? bmp->ct : 0;
+   int hi = (bmp->clip) ? bmp->cb - 1 : bmp->h - 1;
+
+   if ((ymax < lo) || (ymin > hi + 1)) {
+      item->top = 1;
+      item->bottom = 0;
+      return;
+   }
+
+   item->top = (ymin > lo) ? (int)floor(ymin) : lo;
+   item->bottom = (ymax < hi) ? (int)ceil(ymax) : hi;
+}
+
+
+
+/* batch_add:
+ *  Queues a polygon for the batch being recorded. Returns FALSE if it
+ *  could not be queued, in which case the polygons queued so far have
+ *  been drawn and the caller should draw this one right away.
+ */
+static int batch_add(int kind, SCANLINE_FILLER drawer, int flags, POLYGON_SEGMENT *info, int vc, void **vtx)
+{
+   POLY3D_ITEM *item;
+   POLY3D_VERTEX *v;
+   float y, ymin, ymax;
+   int c;
+
+   if (batch_items >= batch_max_items) {
+      int size = MAX(batch_max_items * 2, 256);
+      item = _AL_REALLOC(batch_item, size * sizeof(POLY3D_ITEM));
+      if (!item) {
+	 draw_batch();
+	 return FALSE;
+      }
+      batch_item = item;
+      batch_max_items = size;
+   }
+
+   if (batch_vertices + vc > batch_max_vertices) {
+      int size = MAX(batch_max_vertices * 2, batch_vertices + vc);
+      size = MAX(size, 1024);
+      v = _AL_REALLOC(batch_vertex, size * sizeof(POLY3D_VERTEX));
+      if (!v) {
+	 draw_batch();
+	 return FALSE;
+      }
+      batch_vertex = v;
+      batch_max_vertices = size;
+   }
+
+   item = &batch_item[batch_items];
+   v = &batch_vertex[batch_vertices];
+
+   ymin = FLT_MAX;
+   ymax = -FLT_MAX;
+
+   for (c=0; c<vc; c++) {
+      if ((kind == BATCH_POLYGON) || (kind == BATCH_TRIANGLE)) {
+	 v[c].v = *((V3D *)vtx[c]);
+	 y = fixtof(v[c].v.y);
+      }
+      else {
+	 v[c].f = *((V3D_f *)vtx[c]);
+	 y = v[c].f.y;
+      }
+
+      if (y < ymin)
+	 ymin = y;
+      if (y > ymax)
+	 ymax = y;
+   }
+
+   batch_range(batch_bmp, ymin, ymax, item);
+
+   /* nothing to draw, but it still counts as handled */
+   if (item->bottom < item->top)
+      return TRUE;
+
+   item->kind = kind;
+   item->vc = vc;
+   item->first = batch_vertices;
+   item->flags = flags;
+   item->drawer = drawer;
+   item->alternative = _optim_alternative_drawer;
+   item->zbuf = _zbuffer;
+   item->info = *info;
+
+   batch_items++;
+   batch_vertices += vc;
+
+   if (vc > batch_max_vc)
+      batch_max_vc = vc;
+
+   return TRUE;
+}
+
+
+
+/* polygon3d:
+ *  Draws a 3d polygon in the specified mode. The vertices parameter should
+ *  be followed by that many pointers to V3D structures, which describe each
+ *  vertex of the polygon.
+ */
+void _soft_polygon3d(BITMAP *bmp, int type, BITMAP *texture, int vc, V3D *vtx[])
+{
+   int flags;
+   POLYGON_SEGMENT info;
+   SCANLINE_FILLER drawer;
+   POLY3D_BAND band;
+   ASSERT(bmp);
+
+   if (vc < 3)
+      return;
+
+   /* set up the drawing mode */
+   drawer = _get_scanline_filler(type, &flags, &info, texture, bmp);
+   if (!drawer)
+      return;
+
+   /* queue it if a batch is being recorded for this bitmap */
+   if ((bmp == batch_bmp) && (batch_add(BATCH_POLYGON, drawer, flags, &info, vc, (void **)vtx)))
+      return;
+
+   /* allocate some space for the active edge table */
+   _grow_scratch_mem(sizeof(POLYGON_EDGE) * vc);
+
+   full_band(&band);
+   render_polygon3d(bmp, drawer, flags, &info, vc, vtx, (POLYGON_EDGE *)_scratch_mem, &band);
+}
+
+
+
+/* polygon3d_f:
+ *  Floating point version of polygon3d().
+ */
+void _soft_polygon3d_f(BITMAP *bmp, int type, BITMAP *texture, int vc, V3D_f *vtx[])
+{
+   int flags;
+   POLYGON_SEGMENT info;
+   SCANLINE_FILLER drawer;
+   POLY3D_BAND band;
+   ASSERT(bmp);
+
+   if (vc < 3)
+      return;
+
+   /* set up the drawing mode */
+   drawer = _get_scanline_filler(type, &flags, &info, texture, bmp);
+   if (!drawer)
+      return;
+
+   /* queue it if a batch is being recorded for this bitmap */
+   if ((bmp == batch_bmp) && (batch_add(BATCH_POLYGON_F, drawer, flags, &info, vc, (void **)vtx)))
+      return;
+
+   /* allocate some space for the active edge table */
+   _grow_scratch_mem(sizeof(POLYGON_EDGE) * vc);
+
+   full_band(&band);
+   render_polygon3d_f(bmp, drawer, flags, &info, vc, vtx, (POLYGON_EDGE *)_scratch_mem, &band);
+}
+
+
+
 /* draw_triangle_part:
  *  Triangle helper function to fill a triangle part. Computes interpolation,
  *  clips the segment, and then calls the lowlevel scanline filler.
  */
-static void draw_triangle_part(BITMAP *bmp, int ytop, int ybottom, POLYGON_EDGE *left_edge, POLYGON_EDGE *right_edge, SCANLINE_FILLER drawer, int flags, int color, POLYGON_SEGMENT *info)
+static void draw_triangle_part(BITMAP *bmp, int ytop, int ybottom, POLYGON_EDGE *left_edge, POLYGON_EDGE *right_edge, SCANLINE_FILLER drawer, int flags, int color, POLYGON_SEGMENT *info, POLY3D_BAND *band)
 {
    int x, y, w;
    int gap;
@@ -1294,7 +1559,18 @@ static void draw_triangle_part(BITMAP *bmp, int ytop, int ybottom, POLYGON_EDGE
    if (flags & INTERP_FLAT)
       info->c = color;
 
+   if (ybottom > band->bottom)
+      ybottom = band->bottom;
+
    for (y=ytop; y<=ybottom; y++) {
+      if (y < band->top) {
+	 if (drawer != _poly_scanline_dummy)
+	    skip_polygon_segment(s1, flags);
+	 left_edge->x += left_edge->dx;
+	 right_edge->x += right_edge->dx;
+	 continue;
+      }
+
       x = fixceil(left_edge->x);
       w = fixceil(right_edge->x) - x;
       step = (x << 16) - left_edge->x;
@@ -1364,11 +1640,11 @@ static void draw_triangle_part(BITMAP *bmp, int ytop, int ybottom, POLYGON_EDGE
 	       info->v = info->fv * z1;
 	       info->du = info->dfu * z1;
 	       info->dv = info->dfv * z1;
-	       drawer = _optim_alternative_drawer;
+	       drawer = band->alternative;
 	    }
 
             if (flags & INTERP_ZBUF) 
-               info->zbuf_addr = bmp_write_line(_zbuffer, y) + x * sizeof(float);
+               info->zbuf_addr = bmp_write_line(band->zbuf, y) + x * sizeof(float);
 
 	    info->read_addr = bmp_read_line(bmp, y) + dx;
 	    drawer(bmp_write_line(bmp, y) + dx, w, info);
@@ -1523,13 +1799,11 @@ void _clip_polygon_segment(POLYGON_SEGMENT *info, fixed gap, int flags)
 
 
 
-/* triangle3d:
- *  Draws a 3d triangle.
+/* render_triangle3d:
+ *  Draws the part of a 3d triangle that lies within the band.
  */
-void _soft_triangle3d(BITMAP *bmp, int type, BITMAP *texture, V3D *v1, V3D *v2, V3D *v3)
+static void render_triangle3d(BITMAP *bmp, SCANLINE_FILLER drawer, int flags, POLYGON_SEGMENT *info, V3D *v1, V3D *v2, V3D *v3, POLY3D_BAND *band)
 {
-   int flags;
-
    #ifdef ALLEGRO_DOS
       int old87 = 0;
    #endif
@@ -1537,15 +1811,8 @@ void _soft_triangle3d(BITMAP *bmp, int type, BITMAP *texture, V3D *v1, V3D *v2,
    int color = v1->c;
    V3D *vt1, *vt2, *vt3;
    POLYGON_EDGE edge1, edge2;
-   POLYGON_SEGMENT info;
-   SCANLINE_FILLER drawer;
    ASSERT(bmp);
 
-   /* set up the drawing mode */
-   drawer = _get_scanline_filler(type, &flags, &info, texture, bmp);
-   if (!drawer)
-      return;
-
    /* sort the vertices so that vt1->y <= vt2->y <= vt3->y */
    if (v1->y > v2->y) {
       vt1 = v2;
@@ -1576,7 +1843,8 @@ void _soft_triangle3d(BITMAP *bmp, int type, BITMAP *texture, V3D *v1, V3D *v2,
    #endif
 
    /* do 3D triangle*/
-   if (_fill_3d_edge_structure(&edge1, vt1, vt3, flags, bmp)) {
+   if ((_fill_3d_edge_structure(&edge1, vt1, vt3, flags, bmp)) &&
+       (edge1.top <= band->bottom) && (edge1.bottom >= band->top)) {
 
       acquire_bitmap(bmp);
 
@@ -1589,16 +1857,16 @@ void _soft_triangle3d(BITMAP *bmp, int type, BITMAP *texture, V3D *v1, V3D *v2,
 	 _clip_polygon_segment(&s1, h, flags);
 
 	 w = edge1.x + fixmul(h, edge1.dx) - vt2->x;
-	 if (w) _triangle_deltas(bmp, w, &s1, &info, vt2, flags);
+	 if (w) _triangle_deltas(bmp, w, &s1, info, vt2, flags);
       }
 
       /* draws part between y1 and y2 */
       if (_fill_3d_edge_structure(&edge2, vt1, vt2, flags, bmp))
-	 draw_triangle_part(bmp, edge2.top, edge2.bottom, &edge1, &edge2, drawer, flags, color, &info);
+	 draw_triangle_part(bmp, edge2.top, edge2.bottom, &edge1, &edge2, drawer, flags, color, info, band);
 
       /* draws part between y2 and y3 */
       if (_fill_3d_edge_structure(&edge2, vt2, vt3, flags, bmp))
-	 draw_triangle_part(bmp, edge2.top, edge2.bottom, &edge1, &edge2, drawer, flags, color, &info);
+	 draw_triangle_part(bmp, edge2.top, edge2.bottom, &edge1, &edge2, drawer, flags, color, info, band);
 
       bmp_unwrite_line(bmp);
       release_bitmap(bmp);
@@ -1613,13 +1881,11 @@ void _soft_triangle3d(BITMAP *bmp, int type, BITMAP *texture, V3D *v1, V3D *v2,
 
 
 
-/* triangle3d_f:
- *  Draws a 3d triangle.
+/* render_triangle3d_f:
+ *  Draws the part of a 3d triangle that lies within the band.
  */
-void _soft_triangle3d_f(BITMAP *bmp, int type, BITMAP *texture, V3D_f *v1, V3D_f *v2, V3D_f *v3)
+static void render_triangle3d_f(BITMAP *bmp, SCANLINE_FILLER drawer, int flags, POLYGON_SEGMENT *info, V3D_f *v1, V3D_f *v2, V3D_f *v3, POLY3D_BAND *band)
 {
-   int flags;
-
    #ifdef ALLEGRO_DOS
       int old87 = 0;
    #endif
@@ -1627,15 +1893,8 @@ void _soft_triangle3d_f(BITMAP *bmp, int type, BITMAP *texture, V3D_f *v1, V3D_f
    int color = v1->c;
    V3D_f *vt1, *vt2, *vt3;
    POLYGON_EDGE edge1, edge2;
-   POLYGON_SEGMENT info;
-   SCANLINE_FILLER drawer;
    ASSERT(bmp);
 
-   /* set up the drawing mode */
-   drawer = _get_scanline_filler(type, &flags, &info, texture, bmp);
-   if (!drawer)
-      return;
-
    /* sort the vertices so that vt1->y <= vt2->y <= vt3->y */
    if (v1->y > v2->y) {
       vt1 = v2;
@@ -1666,7 +1925,8 @@ void _soft_triangle3d_f(BITMAP *bmp, int type, BITMAP *texture, V3D_f *v1, V3D_f
    #endif
 
    /* do 3D triangle*/
-   if (_fill_3d_edge_structure_f(&edge1, vt1, vt3, flags, bmp)) {
+   if ((_fill_3d_edge_structure_f(&edge1, vt1, vt3, flags, bmp)) &&
+       (edge1.top <= band->bottom) && (edge1.bottom >= band->top)) {
 
       acquire_bitmap(bmp);
 
@@ -1679,16 +1939,16 @@ void _soft_triangle3d_f(BITMAP *bmp, int type, BITMAP *texture, V3D_f *v1, V3D_f
 	 _clip_polygon_segment(&s1, h, flags);
 
 	 w = edge1.x + fixmul(h, edge1.dx) - ftofix(vt2->x);
-	 if (w) _triangle_deltas_f(bmp, w, &s1, &info, vt2, flags);
+	 if (w) _triangle_deltas_f(bmp, w, &s1, info, vt2, flags);
       }
 
       /* draws part between y1 and y2 */
       if (_fill_3d_edge_structure_f(&edge2, vt1, vt2, flags, bmp))
-	 draw_triangle_part(bmp, edge2.top, edge2.bottom, &edge1, &edge2, drawer, flags, color, &info);
+	 draw_triangle_part(bmp, edge2.top, edge2.bottom, &edge1, &edge2, drawer, flags, color, info, band);
 
       /* draws part between y2 and y3 */
       if (_fill_3d_edge_structure_f(&edge2, vt2, vt3, flags, bmp))
-	 draw_triangle_part(bmp, edge2.top, edge2.bottom, &edge1, &edge2, drawer, flags, color, &info);
+	 draw_triangle_part(bmp, edge2.top, edge2.bottom, &edge1, &edge2, drawer, flags, color, info, band);
 
       bmp_unwrite_line(bmp);
       release_bitmap(bmp);
@@ -1703,6 +1963,274 @@ void _soft_triangle3d_f(BITMAP *bmp, int type, BITMAP *texture, V3D_f *v1, V3D_f
 
 
 
+/* draw_batch_item:
+ *  Draws the part of a queued polygon that lies within the band, using
+ *  the edges and vtx arrays, which have room for batch_max_vc entries.
+ */
+static void draw_batch_item(BITMAP *bmp, POLY3D_ITEM *item, POLY3D_BAND *band, POLYGON_EDGE *edges, void **vtx)
+{
+   POLY3D_VERTEX *v = &batch_vertex[item->first];
+   POLYGON_SEGMENT info = item->info;
+   int c;
+
+   band->alternative = item->alternative;
+   band->zbuf = item->zbuf;
+
+   switch (item->kind) {
+
+      case BATCH_POLYGON:
+	 for (c=0; c<item->vc; c++)
+	    vtx[c] = &v[c].v;
+	 render_polygon3d(bmp, item->drawer, item->flags, &info, item->vc, (V3D **)vtx, edges, band);
+	 break;
+
+      case BATCH_POLYGON_F:
+	 for (c=0; c<item->vc; c++)
+	    vtx[c] = &v[c].f;
+	 render_polygon3d_f(bmp, item->drawer, item->flags, &info, item->vc, (V3D_f **)vtx, edges, band);
+	 break;
+
+      case BATCH_TRIANGLE:
+	 render_triangle3d(bmp, item->drawer, item->flags, &info, &v[0].v, &v[1].v, &v[2].v, band);
+	 break;
+
+      case BATCH_TRIANGLE_F:
+	 render_triangle3d_f(bmp, item->drawer, item->flags, &info, &v[0].f, &v[1].f, &v[2].f, band);
+	 break;
+   }
+}
+
+
+
+typedef struct POLY3D_BINS
+{
+   BITMAP *bmp;
+   int *start;                         /* first entry of each band */
+   int *index;                         /* polygons touching each band */
+   POLYGON_EDGE *edges;                /* batch_max_vc per worker */
+   void **vtx;                         /* batch_max_vc per worker */
+} POLY3D_BINS;
+
+
+
+/* draw_batch_band:
+ *  Worker job: draws one band of the batch.
+ */
+static void draw_batch_band(void *arg, int job, int worker)
+{
+   POLY3D_BINS *bins = arg;
+   POLY3D_BAND band;
+   int i;
+
+   band.top = job * BATCH_BAND_HEIGHT;
+   band.bottom = band.top + BATCH_BAND_HEIGHT - 1;
+
+   for (i=bins->start[job]; i<bins->start[job+1]; i++)
+      draw_batch_item(bins->bmp, &batch_item[bins->index[i]], &band,
+		      bins->edges + worker * batch_max_vc,
+		      bins->vtx + worker * batch_max_vc);
+}
+
+
+
+/* draw_batch:
+ *  Draws and forgets the polygons queued so far.
+ */
+static void draw_batch(void)
+{
+   BITMAP *bmp = batch_bmp;
+   POLY3D_BINS bins;
+   POLY3D_BAND band;
+   int workers, bands, entries;
+   int i, b, b1, b2;
+   void *tracker;
+
+   if (!batch_items)
+      return;
+
+   workers = (is_memory_bitmap(bmp)) ? _get_worker_count() : 1;
+   bands = (bmp->h + BATCH_BAND_HEIGHT - 1) / BATCH_BAND_HEIGHT;
+
+   _grow_scratch_mem((sizeof(POLYGON_EDGE) + sizeof(void *)) * batch_max_vc * workers);
+
+   bins.bmp = bmp;
+   bins.edges = (POLYGON_EDGE *)_scratch_mem;
+   bins.vtx = (void **)(bins.edges + batch_max_vc * workers);
+   bins.start = NULL;
+   bins.index = NULL;
+
+   acquire_bitmap(bmp);
+
+   if ((workers > 1) && (bands > 1)) {
+      /* sort the polygons into the bands they touch, keeping their order */
+      entries = 0;
+      for (i=0; i<batch_items; i++)
+	 entries += batch_item[i].bottom / BATCH_BAND_HEIGHT - batch_item[i].top / BATCH_BAND_HEIGHT + 1;
+
+      bins.start = _AL_MALLOC((bands + 1) * sizeof(int));
+      bins.index = _AL_MALLOC(entries * sizeof(int));
+   }
+
+   if ((bins.start) && (bins.index)) {
+      for (b=0; b<=bands; b++)
+	 bins.start[b] = 0;
+
+      for (i=0; i<batch_items; i++) {
+	 b1 = batch_item[i].top / BATCH_BAND_HEIGHT;
+	 b2 = batch_item[i].bottom / BATCH_BAND_HEIGHT;
+	 for (b=b1; b<=b2; b++)
+	    bins.start[b+1]++;
+      }
+
+      for (b=0; b<bands; b++)
+	 bins.start[b+1] += bins.start[b];
+
+      for (i=0; i<batch_items; i++) {
+	 b1 = batch_item[i].top / BATCH_BAND_HEIGHT;
+	 b2 = batch_item[i].bottom / BATCH_BAND_HEIGHT;
+	 for (b=b1; b<=b2; b++)
+	    bins.index[bins.start[b]++] = i;
+      }
+
+      /* the fill loop left each start at the end of its band */
+      for (b=bands; b>0; b--)
+	 bins.start[b] = bins.start[b-1];
+      bins.start[0] = 0;
+
+      /* the dirty tracker is not thread safe, but it has no need to see
+       * the workers: the tracked vtable already marked every polygon
+       * when it was queued
+       */
+      tracker = _dirty_suspend(bmp);
+
+      _run_worker_jobs(draw_batch_band, &bins, bands);
+
+      _dirty_resume(bmp, tracker);
+   }
+   else {
+      /* draw everything on this thread, in a single pass */
+      for (i=0; i<batch_items; i++) {
+	 full_band(&band);
+	 draw_batch_item(bmp, &batch_item[i], &band, bins.edges, bins.vtx);
+      }
+   }
+
+   release_bitmap(bmp);
+
+   if (bins.start)
+      _AL_FREE(bins.start);
+
+   if (bins.index)
+      _AL_FREE(bins.index);
+
+   batch_items = 0;
+   batch_vertices = 0;
+   batch_max_vc = 0;
+}
+
+
+
+/* begin_polygon3d_batch:
+ *  Starts queueing the polygons drawn onto bmp with polygon3d(),
+ *  triangle3d() and quad3d() and their floating point versions, so that
+ *  flush_polygon3d_batch() can draw them all at once, spread over several
+ *  threads. Any batch already being recorded is flushed first.
+ */
+void begin_polygon3d_batch(BITMAP *bmp)
+{
+   ASSERT(bmp);
+
+   flush_polygon3d_batch();
+
+   batch_bmp = bmp;
+}
+
+
+
+/* flush_polygon3d_batch:
+ *  Draws the polygons queued since begin_polygon3d_batch(), and stops
+ *  queueing them.
+ */
+void flush_polygon3d_batch(void)
+{
+   if (!batch_bmp)
+      return;
+
+   draw_batch();
+
+   batch_bmp = NULL;
+}
+
+
+
+/* triangle3d:
+ *  Draws a 3d triangle.
+ */
+void _soft_triangle3d(BITMAP *bmp, int type, BITMAP *texture, V3D *v1, V3D *v2, V3D *v3)
+{
+   int flags;
+   POLYGON_SEGMENT info;
+   SCANLINE_FILLER drawer;
+   POLY3D_BAND band;
+   ASSERT(bmp);
+
+   /* set up the drawing mode */
+   drawer = _get_scanline_filler(type, &flags, &info, texture, bmp);
+   if (!drawer)
+      return;
+
+   /* queue it if a batch is being recorded for this bitmap */
+   if (bmp == batch_bmp) {
+      V3D *vtx[3];
+
+      vtx[0] = v1;
+      vtx[1] = v2;
+      vtx[2] = v3;
+
+      if (batch_add(BATCH_TRIANGLE, drawer, flags, &info, 3, (void **)vtx))
+	 return;
+   }
+
+   full_band(&band);
+   render_triangle3d(bmp, drawer, flags, &info, v1, v2, v3, &band);
+}
+
+
+
+/* triangle3d_f:
+ *  Draws a 3d triangle.
+ */
+void _soft_triangle3d_f(BITMAP *bmp, int type, BITMAP *texture, V3D_f *v1, V3D_f *v2, V3D_f *v3)
+{
+   int flags;
+   POLYGON_SEGMENT info;
+   SCANLINE_FILLER drawer;
+   POLY3D_BAND band;
+   ASSERT(bmp);
+
+   /* set up the drawing mode */
+   drawer = _get_scanline_filler(type, &flags, &info, texture, bmp);
+   if (!drawer)
+      return;
+
+   /* queue it if a batch is being recorded for this bitmap */
+   if (bmp == batch_bmp) {
+      V3D_f *vtx[3];
+
+      vtx[0] = v1;
+      vtx[1] = v2;
+      vtx[2] = v3;
+
+      if (batch_add(BATCH_TRIANGLE_F, drawer, flags, &info, 3, (void **)vtx))
+	 return;
+   }
+
+   full_band(&band);
+   render_triangle3d_f(bmp, drawer, flags, &info, v1, v2, v3, &band);
+}
+
+
+
 /* quad3d:
  *  Draws a 3d quad.
  */
@@ -0,0 +1,803 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Streamed samples.
+ *
+ *      A streamed sample looks like any other SAMPLE to the program, but
+ *      only keeps a small ring of fragments in memory. The voice playing
+ *      it really loops over the ring: the mixer reports each fragment as
+ *      soon as it has been played, and a background thread reads the next
+ *      bit of the file into it, so that slow reads don't hold up the mixer
+ *      or the timer handlers. Without pthreads, a timer handler does the
+ *      reading instead. Positions and loop points are translated between
+ *      the file and the ring by the voice functions.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+
+#include <string.h>
+
+#include "allegro.h"
+#include "allegro/internal/aintern.h"
+
+#if (defined ALLEGRO_MULTITHREADED) && (defined ALLEGRO_HAVE_LIBPTHREAD)
+   #define STREAM_THREAD
+   #include <pthread.h>
+   #include <sys/time.h>
+#endif
+
+
+#define FRAG_COUNT      8           /* fragments in the ring */
+
+#define FRAG_EMPTY      -1          /* tag of a played fragment */
+#define FRAG_END        -2          /* tag of a fragment past the end */
+
+/* orders the ring accesses between the mixer and the refill */
+#if (defined ALLEGRO_GCC) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 1)))
+   #define STREAM_BARRIER()   __sync_synchronize()
+#else
+   #define STREAM_BARRIER()
+#endif
+
+
+typedef struct SAMPLE_STREAM
+{
+   SAMPLE spl;                      /* what the program sees, must be first */
+   SAMPLE ring;                     /* what the voice really plays */
+   char *filename;                  /* for opening the file again */
+   PACKFILE *f;                     /* the file, or NULL if it must be opened */
+   long data_start;                 /* offset of the sample data in the file */
+   unsigned long fpos;              /* frame the file is positioned at */
+   unsigned long pos;               /* next frame to go into the ring */
+   int frame_size;                  /* bytes per frame */
+   int frag_len;                    /* frames per fragment */
+   volatile long tag[FRAG_COUNT];   /* sample position of each fragment */
+   volatile unsigned int filled;    /* fragments written to the ring */
+   volatile unsigned int played;    /* fragments played by the mixer */
+   volatile int ended;              /* did the voice play to the end? */
+   int loop;                        /* is the voice looping? */
+   int wrapped;                     /* has the ring gone past the loop end? */
+   int voice;                       /* the voice playing us, or -1 */
+   void *mutex;                     /* serialises the refill and the voice */
+   struct SAMPLE_STREAM *next;      /* in the list of the refill thread */
+} SAMPLE_STREAM;
+
+
+
+#ifdef STREAM_THREAD
+
+#define STREAM_POLL_USEC   20000    /* in case a wakeup got lost */
+
+static pthread_mutex_t stream_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t stream_thread;
+static SAMPLE_STREAM *stream_list = NULL;    /* streams to refill */
+static int stream_running = FALSE;
+static int stream_quit = FALSE;
+static volatile int stream_wanted = FALSE;   /* a fragment was played */
+
+#endif
+
+
+
+/* read_wav_header:
+ *  Reads the header of a PCM WAV file, up to the start of the sample data,
+ *  and sets up the format of the stream. Returns the length of the sample
+ *  data in bytes, or -1 on error.
+ */
+static long read_wav_header(PACKFILE *f, SAMPLE_STREAM *ss)
+{
+   char buffer[12];
+   long length;
+   long offset = 12;
+   int channels = 1;
+   int bits = 8;
+   int freq = 22050;
+
+   if ((pack_fread(buffer, 12, f) != 12) ||
+       (memcmp(buffer, "RIFF", 4)) || (memcmp(buffer+8, "WAVE", 4)))
+      return -1;
+
+   while (pack_fread(buffer, 4, f) == 4) {
+      length = pack_igetl(f);
+      offset += 8;
+
+      if (length < 0)
+	 return -1;
+
+      if (memcmp(buffer, "fmt ", 4) == 0) {
+	 if ((length < 16) || (pack_igetw(f) != 1))
+	    return -1;
+
+	 channels = pack_igetw(f);
+	 freq = pack_igetl(f);
+	 pack_igetl(f);                /* skip six bytes */
+	 pack_igetw(f);
+	 bits = pack_igetw(f);
+
+	 if (((channels != 1) && (channels != 2)) ||
+	     ((bits != 8) && (bits != 16)) || (freq <= 0))
+	    return -1;
+
+	 if (pack_fseek(f, length-16) != 0)
+	    return -1;
+      }
+      else if (memcmp(buffer, "data", 4) == 0) {
+	 ss->spl.bits = bits;
+	 ss->spl.stereo = (channels == 2) ? TRUE : FALSE;
+	 ss->spl.freq = freq;
+	 ss->data_start = offset;
+	 return length;
+      }
+      else if (pack_fseek(f, length) != 0)
+	 return -1;
+
+      offset += length;
+   }
+
+   return -1;
+}
+
+
+
+/* read_voc_header:
+ *  Reads the header of a mono VOC file, up to the start of the sample
+ *  data, and sets up the format of the stream. Returns the length of the
+ *  sample data in bytes, or -1 on error.
+ */
+static long read_voc_header(PACKFILE *f, SAMPLE_STREAM *ss)
+{
+   char buffer[0x16];
+   long length;
+   int ver, x;
+
+   if ((pack_fread(buffer, 0x16, f) != 0x16) ||
+       (memcmp(buffer, "Creative Voice File", 0x13)))
+      return -1;
+
+   ver = pack_igetw(f);
+   if (ver != 0x010A && ver != 0x0114)
+      return -1;
+
+   ver = pack_igetw(f);
+   if (ver != 0x1129 && ver != 0x111f)
+      return -1;
+
+   ver = pack_getc(f);                 /* block type */
+
+   length = pack_igetw(f);             /* length is three bytes long */
+   length += pack_getc(f) << 16;
+
+   if (ver == 0x01) {
+      length -= 2;
+      x = pack_getc(f);                /* one byte of frequency */
+      pack_getc(f);
+
+      ss->spl.bits = 8;
+      ss->spl.freq = 1000000 / (256-x);
+      ss->data_start = 0x20;
+   }
+   else if (ver == 0x09) {
+      length -= 12;
+      ss->spl.freq = pack_igetw(f);    /* two bytes of frequency */
+      pack_igetw(f);
+
+      ss->spl.bits = pack_getc(f);
+      if ((ss->spl.bits != 8) && (ss->spl.bits != 16))
+	 return -1;
+
+      if (pack_getc(f) != 1)           /* mono only */
+	 return -1;
+
+      pack_fread(buffer, 6, f);
+      ss->data_start = 0x2A;
+   }
+   else
+      return -1;
+
+   if (ss->spl.freq <= 0)
+      return -1;
+
+   ss->spl.stereo = FALSE;
+   return length;
+}
+
+
+
+/* read_frames:
+ *  Reads up to n frames of sample data starting at the given position,
+ *  converting them to the format Allegro plays. Returns how many frames
+ *  were read.
+ */
+static int read_frames(SAMPLE_STREAM *ss, unsigned char *buf, unsigned long pos, int n)
+{
+   unsigned char *p;
+   long bytes;
+   int i;
+
+   if ((!ss->f) || (pos != ss->fpos)) {
+      /* packfiles only seek forwards, so go back by opening it again */
+      if ((!ss->f) || (pos < ss->fpos)) {
+	 if (ss->f)
+	    pack_fclose(ss->f);
+
+	 ss->f = pack_fopen(ss->filename, F_READ);
+	 if (!ss->f)
+	    return 0;
+
+	 ss->fpos = 0;
+	 if (pack_fseek(ss->f, ss->data_start) != 0)
+	    goto error;
+      }
+
+      if (pack_fseek(ss->f, (pos - ss->fpos) * ss->frame_size) != 0)
+	 goto error;
+
+      ss->fpos = pos;
+   }
+
+   bytes = pack_fread(buf, n * ss->frame_size, ss->f);
+   n = bytes / ss->frame_size;
+   ss->fpos += n;
+
+   /* the file is out of step with fpos after a partial frame */
+   if (bytes % ss->frame_size) {
+      pack_fclose(ss->f);
+      ss->f = NULL;
+   }
+
+   if (ss->spl.bits == 16) {
+      p = buf;
+      for (i=n * ss->frame_size/2; i>0; i--) {
+	 *((unsigned short *)p) = (p[0] | (p[1] << 8)) ^ 0x8000;
+	 p += 2;
+      }
+   }
+
+   return n;
+
+ error:
+   pack_fclose(ss->f);
+   ss->f = NULL;
+   return 0;
+}
+
+
+
+/* silence_frames:
+ *  Fills part of the ring with silence.
+ */
+static void silence_frames(SAMPLE_STREAM *ss, unsigned char *buf, int n)
+{
+   unsigned short *p;
+
+   if (ss->spl.bits == 8) {
+      memset(buf, 0x80, n * ss->frame_size);
+   }
+   else {
+      p = (unsigned short *)buf;
+      for (n = n * ss->frame_size/2; n>0; n--)
+	 *(p++) = 0x8000;
+   }
+}
+
+
+
+/* fill_fragment:
+ *  Reads the next fragment of the sample into the ring, following the
+ *  loop if the voice is looping, or padding it with silence after the end.
+ *  Call with the mutex held.
+ */
+static void fill_fragment(SAMPLE_STREAM *ss, int frag)
+{
+   unsigned char *buf = (unsigned char *)ss->ring.data + frag * ss->frag_len * ss->frame_size;
+   unsigned long end;
+   int looping = ((ss->loop) && (ss->spl.loop_start < ss->spl.loop_end));
+   int done = 0;
+   int n;
+
+   ss->tag[frag] = (ss->pos < ss->spl.len) ? (long)ss->pos : FRAG_END;
+
+   while (done < ss->frag_len) {
+      if ((looping) && (ss->pos >= ss->spl.loop_end)) {
+	 ss->pos = ss->spl.loop_start;
+	 ss->wrapped = TRUE;
+      }
+
+      end = (looping) ? ss->spl.loop_end : ss->spl.len;
+      if (ss->pos >= end)
+	 break;
+
+      n = read_frames(ss, buf + done * ss->frame_size, ss->pos, MIN((unsigned long)(ss->frag_len - done), end - ss->pos));
+      if (n <= 0)
+	 break;
+
+      done += n;
+      ss->pos += n;
+   }
+
+   if (done < ss->frag_len)
+      silence_frames(ss, buf + done * ss->frame_size, ss->frag_len - done);
+}
+
+
+
+/* stream_played:
+ *  Mixer fill function, called from the mixing thread once a fragment has
+ *  been played. It only clears the fragment, so that an underrun plays
+ *  silence rather than old data, and leaves reading the file to the
+ *  refill. Stops the voice when the next fragment is past the end.
+ */
+static int stream_played(void *buf, int len, void *param)
+{
+   SAMPLE_STREAM *ss = param;
+   int frag = ((unsigned char *)buf - (unsigned char *)ss->ring.data) / (ss->frag_len * ss->frame_size);
+
+   silence_frames(ss, buf, len);
+   ss->tag[frag] = FRAG_EMPTY;
+
+   STREAM_BARRIER();
+   ss->played++;
+
+#ifdef STREAM_THREAD
+   /* signalling without stream_mutex keeps the mixer from ever waiting
+    * for a read, at the price of a wakeup going missing now and then
+    */
+   stream_wanted = TRUE;
+   pthread_cond_signal(&stream_cond);
+#endif
+
+   if (ss->tag[(frag+1) % FRAG_COUNT] == FRAG_END) {
+      ss->ended = TRUE;
+      return TRUE;
+   }
+
+   return FALSE;
+}
+
+
+
+/* stream_refill:
+ *  Reads the file into the fragments which have been played. Called by
+ *  the refill thread, or as a timer handler where there is none.
+ */
+static void stream_refill(void *param)
+{
+   SAMPLE_STREAM *ss = param;
+
+   system_driver->lock_mutex(ss->mutex);
+
+   if (ss->voice >= 0) {
+      STREAM_BARRIER();
+
+      /* the mixer got a whole lap ahead, so carry on from where it is */
+      if ((int)(ss->filled - ss->played) < 1)
+	 ss->filled = ss->played + 1;
+
+      while (ss->filled - ss->played < FRAG_COUNT) {
+	 fill_fragment(ss, ss->filled % FRAG_COUNT);
+
+	 STREAM_BARRIER();
+	 ss->filled++;
+      }
+   }
+
+   system_driver->unlock_mutex(ss->mutex);
+}
+
+
+
+#ifdef STREAM_THREAD
+
+/* stream_proc:
+ *  The refill thread, woken up by stream_played().
+ */
+static void *stream_proc(void *arg)
+{
+   SAMPLE_STREAM *ss;
+   struct timeval now;
+   struct timespec until;
+
+   pthread_mutex_lock(&stream_mutex);
+
+   for (;;) {
+      if ((!stream_wanted) && (!stream_quit)) {
+	 gettimeofday(&now, NULL);
+	 until.tv_sec = now.tv_sec;
+	 until.tv_nsec = (now.tv_usec + STREAM_POLL_USEC) * 1000L;
+	 if (until.tv_nsec >= 1000000000L) {
+	    until.tv_sec++;
+	    until.tv_nsec -= 1000000000L;
+	 }
+	 pthread_cond_timedwait(&stream_cond, &stream_mutex, &until);
+      }
+
+      if (stream_quit)
+	 break;
+
+      stream_wanted = FALSE;
+
+      for (ss=stream_list; ss; ss=ss->next)
+	 stream_refill(ss);
+   }
+
+   pthread_mutex_unlock(&stream_mutex);
+
+   return NULL;
+}
+
+
+
+/* shutdown_stream_thread:
+ *  Stops the refill thread at exit.
+ */
+static void shutdown_stream_thread(void)
+{
+   pthread_mutex_lock(&stream_mutex);
+   stream_quit = TRUE;
+   pthread_cond_signal(&stream_cond);
+   pthread_mutex_unlock(&stream_mutex);
+
+   pthread_join(stream_thread, NULL);
+
+   stream_running = FALSE;
+   stream_quit = FALSE;
+
+   _remove_exit_func(shutdown_stream_thread);
+}
+
+#endif
+
+
+
+/* stream_restart:
+ *  Fills the whole ring from the given position and sets up a physical
+ *  voice to play it. The voice must not be in use by the mixer. Call with
+ *  the mutex held.
+ */
+static void stream_restart(SAMPLE_STREAM *ss, int phys, unsigned long pos, int playing)
+{
+   int i;
+
+   ss->pos = pos;
+   ss->wrapped = FALSE;
+   ss->ended = (pos >= ss->spl.len);
+
+   for (i=0; i<FRAG_COUNT; i++)
+      fill_fragment(ss, i);
+
+   ss->filled = FRAG_COUNT;
+   ss->played = 0;
+
+   /* the voice goes round and round the ring, whatever the program wants */
+   _phys_voice[phys].playmode = PLAYMODE_LOOP;
+   digi_driver->init_voice(phys, &ss->ring);
+   _mixer_set_fill(phys, stream_played, ss, ss->frag_len);
+
+   if ((playing) && (!ss->ended))
+      digi_driver->start_voice(phys);
+}
+
+
+
+/* stream_seek:
+ *  Takes a physical voice away from the mixer and restarts it from the
+ *  given position. Call with the mutex held.
+ */
+static void stream_seek(SAMPLE_STREAM *ss, int phys, unsigned long pos)
+{
+   int playing = (digi_driver->get_position(phys) >= 0);
+
+   digi_driver->stop_voice(phys);
+   digi_driver->release_voice(phys);
+
+   stream_restart(ss, phys, pos, playing);
+}
+
+
+
+/* load_streamed_sample:
+ *  Opens a WAV or VOC file for playing straight from the disk, keeping only
+ *  a small buffer in memory. Other files, short files, and files played by
+ *  drivers which don't use the Allegro mixer are loaded normally, as is
+ *  everything on platforms where timer handlers can't read files.
+ */
+SAMPLE *load_streamed_sample(AL_CONST char *filename)
+{
+#ifdef ALLEGRO_MULTITHREADED
+   char tmp[32], *aext;
+   SAMPLE_STREAM *ss;
+   PACKFILE *f;
+   long size;
+   int i;
+   ASSERT(filename);
+
+   /* the mixer must be playing from the ring for it to be refilled */
+   if ((digi_driver->init_voice != _mixer_init_voice) || (!system_driver->create_mutex))
+      return load_sample(filename);
+
+   aext = uconvert_toascii(get_extension(filename), tmp);
+   if ((stricmp(aext, "wav") != 0) && (stricmp(aext, "voc") != 0))
+      return load_sample(filename);
+
+   f = pack_fopen(filename, F_READ);
+   if (!f)
+      return NULL;
+
+   ss = _AL_MALLOC(sizeof(SAMPLE_STREAM));
+   if (!ss) {
+      pack_fclose(f);
+      return NULL;
+   }
+
+   memset(ss, 0, sizeof(SAMPLE_STREAM));
+
+   if (stricmp(aext, "wav") == 0)
+      size = read_wav_header(f, ss);
+   else
+      size = read_voc_header(f, ss);
+
+   /* anything but PCM data, such as IMA ADPCM, is left to load_sample() */
+   if (size < 0) {
+      pack_fclose(f);
+      _AL_FREE(ss);
+      return load_sample(filename);
+   }
+
+   ss->frame_size = ((ss->spl.bits == 8) ? 1 : sizeof(short)) * ((ss->spl.stereo) ? 2 : 1);
+   ss->frag_len = MAX(ss->spl.freq / 16, 256);
+
+   /* it isn't worth streaming a sample no longer than the ring */
+   if (size / ss->frame_size <= ss->frag_len * FRAG_COUNT) {
+      pack_fclose(f);
+      _AL_FREE(ss);
+      return load_sample(filename);
+   }
+
+   ss->spl.priority = 128;
+   ss->spl.len = size / ss->frame_size;
+   ss->spl.loop_start = 0;
+   ss->spl.loop_end = ss->spl.len;
+   ss->spl.param = SAMPLE_STREAM_ID;
+   ss->spl.data = NULL;
+
+   ss->ring = ss->spl;
+   ss->ring.len = ss->frag_len * FRAG_COUNT;
+   ss->ring.loop_end = ss->ring.len;
+   ss->ring.param = 0;
+   ss->ring.data = _AL_MALLOC_ATOMIC(ss->ring.len * ss->frame_size);
+
+   ss->filename = _ustrdup(filename, _al_malloc);
+   ss->f = f;
+   ss->fpos = 0;
+   ss->voice = -1;
+   ss->mutex = system_driver->create_mutex();
+
+   if ((!ss->ring.data) || (!ss->filename) || (!ss->mutex))
+      goto error;
+
+   for (i=0; i<FRAG_COUNT; i++)
+      ss->tag[i] = FRAG_EMPTY;
+
+#ifdef STREAM_THREAD
+   pthread_mutex_lock(&stream_mutex);
+
+   if (!stream_running) {
+      if (pthread_create(&stream_thread, NULL, stream_proc, NULL) != 0) {
+	 pthread_mutex_unlock(&stream_mutex);
+	 goto error;
+      }
+      stream_running = TRUE;
+      _add_exit_func(shutdown_stream_thread, "shutdown_stream_thread");
+   }
+
+   ss->next = stream_list;
+   stream_list = ss;
+
+   pthread_mutex_unlock(&stream_mutex);
+#else
+   /* refill at twice the rate fragments are played at */
+   if (install_param_int(stream_refill, ss, MAX(ss->frag_len * 500 / ss->spl.freq, 1)) != 0)
+      goto error;
+#endif
+
+   return &ss->spl;
+
+ error:
+   if (ss->mutex)
+      system_driver->destroy_mutex(ss->mutex);
+   if (ss->filename)
+      _AL_FREE(ss->filename);
+   if (ss->ring.data)
+      _AL_FREE(ss->ring.data);
+   _AL_FREE(ss);
+   pack_fclose(f);
+   return NULL;
+#else
+   return load_sample(filename);
+#endif
+}
+
+
+
+/* _sample_stream_voice:
+ *  Returns the voice playing a streamed sample, or -1.
+ */
+int _sample_stream_voice(AL_CONST SAMPLE *spl)
+{
+   return ((SAMPLE_STREAM *)spl)->voice;
+}
+
+
+
+/* _sample_stream_init_voice:
+ *  Sets up a physical voice for playing a streamed sample from the start,
+ *  instead of the init_voice() method of the driver.
+ */
+void _sample_stream_init_voice(AL_CONST SAMPLE *spl, int voice, int phys)
+{
+   SAMPLE_STREAM *ss = (SAMPLE_STREAM *)spl;
+
+   system_driver->lock_mutex(ss->mutex);
+
+   ss->voice = voice;
+   ss->loop = FALSE;
+   stream_restart(ss, phys, 0, FALSE);
+
+   system_driver->unlock_mutex(ss->mutex);
+}
+
+
+
+/* _sample_stream_start_voice:
+ *  Rewinds a streamed sample which has played to the end, as the mixer
+ *  does for other samples, before the voice is started again.
+ */
+void _sample_stream_start_voice(AL_CONST SAMPLE *spl, int phys)
+{
+   SAMPLE_STREAM *ss = (SAMPLE_STREAM *)spl;
+
+   system_driver->lock_mutex(ss->mutex);
+
+   if (ss->ended)
+      stream_seek(ss, phys, 0);
+
+   system_driver->unlock_mutex(ss->mutex);
+}
+
+
+
+/* stream_get_position:
+ *  Converts a position in the ring, as returned by the driver, into a
+ *  position in the streamed sample. Call with the mutex held.
+ */
+static int stream_get_position(SAMPLE_STREAM *ss, int pos)
+{
+   long tag;
+
+   if ((pos < 0) || (ss->ended))
+      return -1;
+
+   tag = ss->tag[pos / ss->frag_len];
+
+   if (tag == FRAG_END)
+      return -1;
+
+   /* the refill is late, so this is all we know */
+   if (tag == FRAG_EMPTY)
+      return ss->pos;
+
+   pos = tag + pos % ss->frag_len;
+
+   if ((ss->loop) && (ss->spl.loop_start < ss->spl.loop_end) && ((unsigned long)pos >= ss->spl.loop_end))
+      pos = ss->spl.loop_start + (pos - ss->spl.loop_end) % (ss->spl.loop_end - ss->spl.loop_start);
+
+   if ((unsigned long)pos >= ss->spl.len)
+      return -1;
+
+   return pos;
+}
+
+
+
+/* _sample_stream_get_position:
+ *  Converts a position in the ring into one in the streamed sample, for
+ *  voice_get_position().
+ */
+int _sample_stream_get_position(AL_CONST SAMPLE *spl, int pos)
+{
+   SAMPLE_STREAM *ss = (SAMPLE_STREAM *)spl;
+
+   system_driver->lock_mutex(ss->mutex);
+   pos = stream_get_position(ss, pos);
+   system_driver->unlock_mutex(ss->mutex);
+
+   return pos;
+}
+
+
+
+/* _sample_stream_set_position:
+ *  Moves a voice playing a streamed sample to a new position, refilling
+ *  the ring from there.
+ */
+void _sample_stream_set_position(AL_CONST SAMPLE *spl, int phys, int pos)
+{
+   SAMPLE_STREAM *ss = (SAMPLE_STREAM *)spl;
+
+   system_driver->lock_mutex(ss->mutex);
+   stream_seek(ss, phys, MAX(pos, 0));
+   system_driver->unlock_mutex(ss->mutex);
+}
+
+
+
+/* _sample_stream_set_playmode:
+ *  Switches looping on or off for a voice playing a streamed sample. The
+ *  ring only has to be refilled if it already holds data read the other
+ *  way. Playing backwards isn't supported.
+ */
+void _sample_stream_set_playmode(AL_CONST SAMPLE *spl, int phys, int playmode)
+{
+   SAMPLE_STREAM *ss = (SAMPLE_STREAM *)spl;
+   int loop = (playmode & PLAYMODE_LOOP) ? TRUE : FALSE;
+   long pos;
+
+   system_driver->lock_mutex(ss->mutex);
+
+   if (loop != ss->loop) {
+      pos = stream_get_position(ss, digi_driver->get_position(phys));
+      if (pos < 0)
+	 pos = MAX(ss->tag[0], 0);
+
+      ss->loop = loop;
+
+      if (((loop) && (ss->pos >= ss->spl.loop_end)) || ((!loop) && (ss->wrapped)))
+	 stream_seek(ss, phys, pos);
+   }
+
+   system_driver->unlock_mutex(ss->mutex);
+}
+
+
+
+/* _sample_stream_destroy:
+ *  Frees a streamed sample, which must not be playing any more.
+ */
+void _sample_stream_destroy(SAMPLE *spl)
+{
+   SAMPLE_STREAM *ss = (SAMPLE_STREAM *)spl;
+#ifdef STREAM_THREAD
+   SAMPLE_STREAM **p;
+
+   /* this waits for the refill thread to be done with it */
+   pthread_mutex_lock(&stream_mutex);
+
+   for (p=&stream_list; *p; p=&(*p)->next) {
+      if (*p == ss) {
+	 *p = ss->next;
+	 break;
+      }
+   }
+
+   pthread_mutex_unlock(&stream_mutex);
+#else
+   remove_param_int(stream_refill, ss);
+#endif
+
+   if (ss->f)
+      pack_fclose(ss->f);
+
+   system_driver->destroy_mutex(ss->mutex);
+   _AL_FREE(ss->filename);
+   _AL_FREE(ss->ring.data);
+   _AL_FREE(ss);
+}
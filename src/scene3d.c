@@ -39,10 +39,24 @@ static int scene_npoly = 0, scene_maxpoly = 0;
 static BITMAP *scene_bmp;
 static COLOR_MAP *scene_cmap;
 static int scene_alpha;
-static int last_x, scene_y;
-static uintptr_t scene_addr;
-static float last_z;
 static POLYGON_EDGE **hash = NULL;
+static void *band_mem = NULL;
+static int band_mem_size = 0;
+
+/* render_scene() can split the bitmap in bands of this many lines */
+#define SCENE_BAND_HEIGHT 32
+
+/* per band rendering state */
+typedef struct SCENE_BAND
+{
+   int top, bottom;              /* scanlines to draw */
+   POLYGON_EDGE *inact;          /* edges not active yet */
+   int set_state;                /* load each polygon's blending state */
+   int last_x, y;
+   uintptr_t addr;
+   float last_z;
+   int x1, y1, x2, y2;           /* area drawn */
+} SCENE_BAND;
 
 float scene_gap = 100.0;
 
@@ -131,6 +145,12 @@ void destroy_scene(void)
       hash = NULL;
    }
 
+   if (band_mem) {
+      _AL_FREE(band_mem);
+      band_mem = NULL;
+      band_mem_size = 0;
+   }
+
    scene_maxedge = scene_maxpoly = 0;
 }
 
@@ -493,7 +513,7 @@ int scene_polygon3d_f(int type, BITMAP *texture, int vc, V3D_f *vtx[])
  *  end values for x are taken from e01 and e02, the polygon style from poly.
  */
 static void scene_segment(POLYGON_EDGE *e01, POLYGON_EDGE *e02,
-                          POLYGON_INFO *poly)
+                          POLYGON_INFO *poly, SCENE_BAND *band)
 {
    int x, w, gap, flags;
    fixed step, width;
@@ -506,8 +526,8 @@ static void scene_segment(POLYGON_EDGE *e01, POLYGON_EDGE *e02,
    POLYGON_SEGMENT *info = &poly->info, *dat1, *dat2;
    SCANLINE_FILLER drawer;
 
-   if ((x01 < last_x) && (z01 < last_z))
-      x01 = last_x;
+   if ((x01 < band->last_x) && (z01 < band->last_z))
+      x01 = band->last_x;
    if (scene_bmp->clip) {
       if (x01 < scene_bmp->cl)
          x01 = scene_bmp->cl;
@@ -588,6 +608,11 @@ static void scene_segment(POLYGON_EDGE *e01, POLYGON_EDGE *e02,
 
    if (w <= 0) return;
 
+   if (x < band->x1) band->x1 = x;
+   if (x + w - 1 > band->x2) band->x2 = x + w - 1;
+   if (band->y < band->y1) band->y1 = band->y;
+   if (band->y > band->y2) band->y2 = band->y;
+
    if ((flags & OPT_FLOAT_UV_TO_FIX) && (info->dz == 0)) {
       float z1 = 1. / info->z;
       info->u = info->fu * z1;
@@ -599,31 +624,33 @@ static void scene_segment(POLYGON_EDGE *e01, POLYGON_EDGE *e02,
    else
       drawer = poly->drawer;
 
-   color_map = poly->cmap;
-   _blender_alpha = poly->alpha;
-   if (flags & INTERP_BLEND) {
-      _blender_col_15 = poly->b15;
-      _blender_col_16 = poly->b16;
-      _blender_col_24 = poly->b24;
-      _blender_col_32 = poly->b32;
+   if (band->set_state) {
+      color_map = poly->cmap;
+      _blender_alpha = poly->alpha;
+      if (flags & INTERP_BLEND) {
+         _blender_col_15 = poly->b15;
+         _blender_col_16 = poly->b16;
+         _blender_col_24 = poly->b24;
+         _blender_col_32 = poly->b32;
+      }
    }
 
    if (drawer == _poly_scanline_dummy) {
       if (flags & INTERP_NOSOLID) {
          drawing_mode(poly->dmode, poly->dpat, poly->xanchor, poly->yanchor);
-         scene_bmp->vtable->hfill(scene_bmp, x, scene_y, x+w-1, poly->color);
+         scene_bmp->vtable->hfill(scene_bmp, x, band->y, x+w-1, poly->color);
          solid_mode();
       }
       else
-         scene_bmp->vtable->hfill(scene_bmp, x, scene_y, x+w-1, poly->color);
+         scene_bmp->vtable->hfill(scene_bmp, x, band->y, x+w-1, poly->color);
    } 
    else {
       int dx = x * BYTES_PER_PIXEL(bitmap_color_depth(scene_bmp));
       if (flags & INTERP_ZBUF)
-         info->zbuf_addr = bmp_write_line(_zbuffer, scene_y) + x * sizeof(float);
+         info->zbuf_addr = bmp_write_line(_zbuffer, band->y) + x * sizeof(float);
 
-      info->read_addr = bmp_read_line(scene_bmp, scene_y) + dx;
-      drawer(scene_addr + dx, w, info);
+      info->read_addr = bmp_read_line(scene_bmp, band->y) + dx;
+      drawer(band->addr + dx, w, info);
    }
 }
 
@@ -636,7 +663,7 @@ static void scene_segment(POLYGON_EDGE *e01, POLYGON_EDGE *e02,
  *  Returns nonzero if something was drawn.
  */
 static int scene_trans_seg(POLYGON_EDGE *e1, POLYGON_EDGE *e2,
-                           POLYGON_INFO *p0, POLYGON_INFO *p)
+                           POLYGON_INFO *p0, POLYGON_INFO *p, SCENE_BAND *band)
 {
    int c;
 
@@ -651,7 +678,7 @@ static int scene_trans_seg(POLYGON_EDGE *e1, POLYGON_EDGE *e2,
 
    /* p is first opaque or the very last */
    while (p) {
-      scene_segment(e1, e2, p);
+      scene_segment(e1, e2, p, band);
       p = p->prev;
    }
    return 1;
@@ -659,123 +686,114 @@ static int scene_trans_seg(POLYGON_EDGE *e1, POLYGON_EDGE *e2,
 
 
 
-/* render_scene:
- *  Renders all the specified scene_polygon3d()'s on the bitmap passed to
- *  clear_scene(). Rendering is done one scanline at a time, with no pixel
- *  being processed more than once. Note that between clear_scene() and
- *  render_scene() you shouldn't change the clip rectangle of the destination
- *  bitmap. Also, all the textures passed to scene_polygon3d() are stored
- *  as pointers only and actually used in render_scene().
+/* scene_scanlines:
+ *  Walks the edges in band->inact down the clip region, up to the bottom
+ *  of the band, and draws the scanlines that are inside the band. Lines
+ *  above it only step and re-sort the active edges, so that they reach the
+ *  band in the same state as when the whole bitmap is drawn in one go.
  */
-void render_scene(void)
+static void scene_scanlines(SCENE_BAND *band)
 {
-   int p;
-   #ifdef ALLEGRO_DOS
-      int old87 = 0;
-   #endif
    POLYGON_EDGE *edge, *start_edge = NULL;
    POLYGON_EDGE *active_edges = NULL, *last_edge = NULL;
    POLYGON_INFO *active_poly = NULL;
 
-   ASSERT(scene_maxedge > 0);
-   ASSERT(scene_maxpoly > 0);
-   
-   scene_cmap = color_map;
-   scene_alpha = _blender_alpha;
-   solid_mode();
-   /* set fpu to single-precision, truncate mode */
-   #ifdef ALLEGRO_DOS
-      old87 = _control87(PC_24 | RC_CHOP, MCW_PC | MCW_RC);
-   #endif
-
-   acquire_bitmap(scene_bmp);
-   bmp_select(scene_bmp);
-
-   for (p=0; p<scene_npoly; p++) {
-      scene_poly[p].inside = 0;
-   }
-
    /* for each scanline in the clip region... */
-   for (scene_y=scene_bmp->ct; scene_y<scene_bmp->cb; scene_y++) {
-      scene_addr = bmp_write_line(scene_bmp, scene_y);
+   for (band->y=scene_bmp->ct; band->y<=band->bottom; band->y++) {
+      /* nothing to do until the next edge starts */
+      if ((!active_edges) && (band->inact) && (band->inact->top > band->y)) {
+	 band->y = band->inact->top;
+	 if (band->y > band->bottom)
+	    break;
+      }
 
       /* check for newly active edges */
-      edge = scene_inact;
-      while ((edge) && (edge->top == scene_y)) {
+      edge = band->inact;
+      while ((edge) && (edge->top == band->y)) {
 	 POLYGON_EDGE *next_edge = edge->next;
-	 scene_inact = _remove_edge(scene_inact, edge);
+	 band->inact = _remove_edge(band->inact, edge);
 	 active_edges = _add_edge_hash(active_edges, edge, TRUE);
 	 edge = next_edge;
       }
 
       /* no edges on this line */
-      if (!active_edges) continue;
-
-      /* fill the scanline */
-      last_x = INT_MIN;
-      last_z = 0.0;
-      for (edge=active_edges; edge; edge=edge->next) {
-         int x = fixceil(edge->x);
-         POLYGON_INFO *poly = edge->poly;
-
-         /* one polygon changes status */
-         poly->inside = 1 - poly->inside;
-         if (poly->inside) {
-            POLYGON_INFO *pos = active_poly;
-            POLYGON_INFO *prev = NULL;
-
-            poly->left_edge = edge;
-	    poly->right_edge = NULL;
-	    
-            /* find its place in the list */
-            while (pos && far_z(scene_y, edge, pos)) {
-               prev = pos;
-               pos = pos->next;
-            }
-            /* poly overlaps pos. Was pos visible ? */
-            if (scene_trans_seg(start_edge, edge, pos, active_poly)) {
-               start_edge = edge;
-            }
-            /* link */
-            poly->next = pos;
-            poly->prev = prev;
-            if (pos) pos->prev = poly;
-            if (prev) 
-	       prev->next = poly;
-            else {
-               start_edge = edge;
-               active_poly = poly;
-            }
-         } 
-	 else {
-            poly->right_edge = edge;
-            /* poly ends here. Was it visible ? */
-            if (scene_trans_seg(start_edge, edge, poly, active_poly)) {
-               start_edge = edge;
-               if (x > last_x) {
-                  last_x = x;
-                  last_z = edge->dat.z;
-               }
-            }
-            /* unlink */
-            if (poly->next) 
-	       poly->next->prev = poly->prev;
-            if (poly->prev)
-	       poly->prev->next = poly->next;
-            else
-               active_poly = poly->next;
-         }
-         /* prepare for backward scan */
-         last_edge = edge;
+      if (!active_edges) {
+	 if (!band->inact)
+	    break;
+	 continue;
       }
 
+      if (band->y >= band->top) {
+	 band->addr = bmp_write_line(scene_bmp, band->y);
+
+	 /* fill the scanline */
+	 band->last_x = INT_MIN;
+	 band->last_z = 0.0;
+	 for (edge=active_edges; edge; edge=edge->next) {
+	    int x = fixceil(edge->x);
+	    POLYGON_INFO *poly = edge->poly;
+
+	    /* one polygon changes status */
+	    poly->inside = 1 - poly->inside;
+	    if (poly->inside) {
+	       POLYGON_INFO *pos = active_poly;
+	       POLYGON_INFO *prev = NULL;
+
+	       poly->left_edge = edge;
+	       poly->right_edge = NULL;
+
+	       /* find its place in the list */
+	       while (pos && far_z(band->y, edge, pos)) {
+		  prev = pos;
+		  pos = pos->next;
+	       }
+	       /* poly overlaps pos. Was pos visible ? */
+	       if (scene_trans_seg(start_edge, edge, pos, active_poly, band)) {
+		  start_edge = edge;
+	       }
+	       /* link */
+	       poly->next = pos;
+	       poly->prev = prev;
+	       if (pos) pos->prev = poly;
+	       if (prev) 
+		  prev->next = poly;
+	       else {
+		  start_edge = edge;
+		  active_poly = poly;
+	       }
+	    } 
+	    else {
+	       poly->right_edge = edge;
+	       /* poly ends here. Was it visible ? */
+	       if (scene_trans_seg(start_edge, edge, poly, active_poly, band)) {
+		  start_edge = edge;
+		  if (x > band->last_x) {
+		     band->last_x = x;
+		     band->last_z = edge->dat.z;
+		  }
+	       }
+	       /* unlink */
+	       if (poly->next) 
+		  poly->next->prev = poly->prev;
+	       if (poly->prev)
+		  poly->prev->next = poly->next;
+	       else
+		  active_poly = poly->next;
+	    }
+	 }
+      }
+
+      /* prepare for backward scan */
+      for (last_edge=active_edges; last_edge->next; last_edge=last_edge->next)
+	 ;
+
       /* update edges, remove dead ones, re-sort */
       edge = last_edge;
       active_edges = NULL;
 
       while (edge) {
 	 POLYGON_EDGE *prev_edge = edge->prev;
-	 if (scene_y < edge->bottom) {
+	 if (band->y < edge->bottom) {
             POLYGON_SEGMENT *dat = &edge->dat;
             int flags = edge->poly->flags;
 
@@ -810,6 +828,202 @@ void render_scene(void)
    }
 
    bmp_unwrite_line(scene_bmp);
+}
+
+
+
+/* room for each worker's copies of the edges and polygons */
+typedef struct SCENE_COPIES
+{
+   POLYGON_EDGE *edges;
+   POLYGON_INFO *polys;
+   int *drawn;                   /* x1, y1, x2, y2 of each band */
+} SCENE_COPIES;
+
+
+
+/* render_scene_band:
+ *  Worker job: draws one band of the scene, using private copies of the
+ *  edges and polygons that reach into it.
+ */
+static void render_scene_band(void *arg, int job, int worker)
+{
+   SCENE_COPIES *copies = arg;
+   POLYGON_EDGE *edges = copies->edges + worker * scene_nedge;
+   POLYGON_INFO *polys = copies->polys + worker * scene_npoly;
+   POLYGON_EDGE *edge, *tail = NULL;
+   SCENE_BAND band;
+   int p;
+
+   band.top = scene_bmp->ct + job * SCENE_BAND_HEIGHT;
+   band.bottom = MIN(band.top + SCENE_BAND_HEIGHT, scene_bmp->cb) - 1;
+   band.inact = NULL;
+   band.set_state = FALSE;
+   band.x1 = band.y1 = INT_MAX;
+   band.x2 = band.y2 = INT_MIN;
+
+   /* copy the edges in the order they become active */
+   for (edge=scene_inact; edge; edge=edge->next) {
+      if (edge->top > band.bottom)
+	 break;
+
+      if (edge->bottom < band.top)
+	 continue;
+
+      p = edge->poly - scene_poly;
+      polys[p] = scene_poly[p];
+      polys[p].inside = 0;
+
+      *edges = *edge;
+      edges->poly = &polys[p];
+      edges->prev = tail;
+      edges->next = NULL;
+
+      if (tail)
+	 tail->next = edges;
+      else
+	 band.inact = edges;
+
+      tail = edges++;
+   }
+
+   scene_scanlines(&band);
+
+   copies->drawn[job*4+0] = band.x1;
+   copies->drawn[job*4+1] = band.y1;
+   copies->drawn[job*4+2] = band.x2;
+   copies->drawn[job*4+3] = band.y2;
+}
+
+
+
+/* same_scene_state:
+ *  Returns TRUE if all the polygons use the global state they fill in,
+ *  which lets the bands be drawn in parallel without touching it.
+ */
+static int same_scene_state(void)
+{
+   POLYGON_INFO *p0 = &scene_poly[0];
+   POLYGON_INFO *p;
+   int blend = FALSE;
+   int i;
+
+   for (i=0; i<scene_npoly; i++) {
+      p = &scene_poly[i];
+
+      if ((p->flags & INTERP_NOSOLID) || (p->cmap != p0->cmap) || (p->alpha != p0->alpha))
+	 return FALSE;
+
+      if (p->flags & INTERP_BLEND) {
+	 if (!blend) {
+	    _blender_col_15 = p->b15;
+	    _blender_col_16 = p->b16;
+	    _blender_col_24 = p->b24;
+	    _blender_col_32 = p->b32;
+	    blend = TRUE;
+	 }
+	 else if ((p->b15 != _blender_col_15) || (p->b16 != _blender_col_16) ||
+		  (p->b24 != _blender_col_24) || (p->b32 != _blender_col_32))
+	    return FALSE;
+      }
+   }
+
+   color_map = p0->cmap;
+   _blender_alpha = p0->alpha;
+
+   return TRUE;
+}
+
+
+
+/* render_scene:
+ *  Renders all the specified scene_polygon3d()'s on the bitmap passed to
+ *  clear_scene(). Rendering is done one scanline at a time, with no pixel
+ *  being processed more than once. Note that between clear_scene() and
+ *  render_scene() you shouldn't change the clip rectangle of the destination
+ *  bitmap. Also, all the textures passed to scene_polygon3d() are stored
+ *  as pointers only and actually used in render_scene().
+ *  On memory bitmaps, the clip region is split into bands that are drawn
+ *  in parallel by the worker threads, as long as every polygon was set up
+ *  with the same color map, blender and drawing mode.
+ */
+void render_scene(void)
+{
+   int p, workers, bands, size;
+   void *tracker;
+   #ifdef ALLEGRO_DOS
+      int old87 = 0;
+   #endif
+   SCENE_COPIES copies;
+   SCENE_BAND band;
+
+   ASSERT(scene_maxedge > 0);
+   ASSERT(scene_maxpoly > 0);
+   
+   scene_cmap = color_map;
+   scene_alpha = _blender_alpha;
+   solid_mode();
+   /* set fpu to single-precision, truncate mode */
+   #ifdef ALLEGRO_DOS
+      old87 = _control87(PC_24 | RC_CHOP, MCW_PC | MCW_RC);
+   #endif
+
+   acquire_bitmap(scene_bmp);
+   bmp_select(scene_bmp);
+
+   for (p=0; p<scene_npoly; p++) {
+      scene_poly[p].inside = 0;
+   }
+
+   workers = (is_memory_bitmap(scene_bmp)) ? _get_worker_count() : 1;
+   bands = (scene_bmp->cb - scene_bmp->ct + SCENE_BAND_HEIGHT - 1) / SCENE_BAND_HEIGHT;
+
+   if ((workers > 1) && (bands > 1) && (scene_npoly > 0)) {
+      size = (sizeof(POLYGON_EDGE) * scene_nedge + sizeof(POLYGON_INFO) * scene_npoly) * workers +
+	     sizeof(int) * 4 * bands;
+      if (size > band_mem_size) {
+	 if (band_mem)
+	    _AL_FREE(band_mem);
+	 band_mem = _AL_MALLOC(size);
+	 band_mem_size = (band_mem) ? size : 0;
+      }
+   }
+
+   if ((workers > 1) && (bands > 1) && (scene_npoly > 0) && (band_mem) && (same_scene_state())) {
+      copies.edges = band_mem;
+      copies.polys = (POLYGON_INFO *)(copies.edges + scene_nedge * workers);
+      copies.drawn = (int *)(copies.polys + scene_npoly * workers);
+
+      /* the dirty tracker is not thread safe, so the bands are marked as
+       * changed once all of them have been drawn
+       */
+      tracker = _dirty_suspend(scene_bmp);
+
+      _run_worker_jobs(render_scene_band, &copies, bands);
+
+      _dirty_resume(scene_bmp, tracker);
+
+      if (tracker) {
+	 for (p=0; p<bands; p++) {
+	    if (copies.drawn[p*4+0] <= copies.drawn[p*4+2])
+	       _dirty_mark_area(scene_bmp, copies.drawn[p*4+0], copies.drawn[p*4+1],
+				copies.drawn[p*4+2], copies.drawn[p*4+3]);
+	 }
+      }
+   }
+   else {
+      band.top = scene_bmp->ct;
+      band.bottom = scene_bmp->cb - 1;
+      band.inact = scene_inact;
+      band.set_state = TRUE;
+      band.x1 = band.y1 = INT_MAX;
+      band.x2 = band.y2 = INT_MIN;
+
+      scene_scanlines(&band);
+
+      scene_inact = band.inact;
+   }
+
    release_bitmap(scene_bmp);
 
    /* reset fpu mode */
@@ -142,11 +142,26 @@ static VOICE virt_voice[VIRTUAL_VOICES];  /* list of active samples */
 
 PHYS_VOICE _phys_voice[DIGI_VOICES];      /* physical -> virtual voice map */
 
+static int virt_free[VIRTUAL_VOICES];     /* stacks of free voices */
+static int virt_free_count = 0;
+static int virt_voice_limit = 0;          /* the rest belongs to MIDI */
+static int phys_free[DIGI_VOICES];
+static int phys_free_count = 0;
+
+static int steal_heap[DIGI_VOICES];       /* voices in use, best to steal first */
+static int steal_heap_pos[DIGI_VOICES];   /* position in steal_heap, or -1 */
+static int steal_heap_size = 0;
+
+static int reap_skip = 0;                 /* searches for stopped voices to skip */
+
 int _digi_volume = -1;                    /* current volume settings */
 int _midi_volume = -1;
 
 int _sound_flip_pan = FALSE;              /* reverse l/r sample panning? */
 int _sound_hq = 2;                        /* mixer speed vs. quality */
+int _sound_lod_volume = 0;                /* voices the mixer may skimp on */
+int _sound_lod_priority = 0;
+int _sound_budget = 0;                     /* mixer time, in percent of a buffer */
 
 int _sound_freq = -1;                     /* common hardware parameters */
 int _sound_stereo = -1;
@@ -159,6 +174,7 @@ int _sound_irq = -1;
 
 static void update_sweeps(void);
 static void sound_lock_mem(void);
+static void init_voice_lists(void);
 
 
 
@@ -172,6 +188,9 @@ static void read_sound_config(void)
 
    _sound_flip_pan = get_config_int(sound, uconvert_ascii("flip_pan",     tmp2), FALSE);
    _sound_hq       = get_config_int(sound, uconvert_ascii("quality",      tmp2), _sound_hq);
+   _sound_lod_volume = get_config_int(sound, uconvert_ascii("lod_volume", tmp2), _sound_lod_volume);
+   _sound_lod_priority = get_config_int(sound, uconvert_ascii("lod_priority", tmp2), _sound_lod_priority);
+   _sound_budget   = get_config_int(sound, uconvert_ascii("mixer_budget", tmp2), _sound_budget);
    _sound_port     = get_config_hex(sound, uconvert_ascii("sound_port",   tmp2), -1);
    _sound_dma      = get_config_int(sound, uconvert_ascii("sound_dma",    tmp2), -1);
    _sound_irq      = get_config_int(sound, uconvert_ascii("sound_irq",    tmp2), -1);
@@ -533,6 +552,8 @@ int install_sound(int digi, int midi, AL_CONST char *cfg_path)
       }
    }
 
+   init_voice_lists();
+
    /* simulate ramp/sweep effects for drivers that don't do it directly */
    if ((!digi_driver->ramp_volume) ||
        (!digi_driver->sweep_frequency) ||
@@ -841,7 +862,7 @@ void lock_sample(SAMPLE *spl)
 {
    ASSERT(spl);
    LOCK_DATA(spl, sizeof(SAMPLE));
-   LOCK_DATA(spl->data, spl->len * ((spl->bits==8) ? 1 : sizeof(short)) * ((spl->stereo) ? 2 : 1));
+   LOCK_DATA(spl->data, _sample_data_size(spl->bits, spl->stereo, spl->len));
 }
 
 
@@ -996,6 +1017,53 @@ SAMPLE *load_wav(AL_CONST char *filename)
 
 
 
+/* load_wav_adpcm:
+ *  Helper for load_wav_pf(), which reads an IMA ADPCM data chunk. The WAV
+ *  blocks can have any size, so they are decoded and then compressed again
+ *  into the blocks of an ADPCM sample.
+ */
+static SAMPLE *load_wav_adpcm(PACKFILE *f, int length, int channels, int freq, int align, int spb, int frames)
+{
+   unsigned char *data;
+   signed short *pcm;
+   SAMPLE *spl = NULL;
+   long len;
+
+   if (spb <= 0)
+      return NULL;
+
+   /* the fact chunk is optional, otherwise count the frames in the blocks */
+   len = (length / align) * spb;
+   if (length % align > 4*channels)
+      len += MIN(1 + (length % align - 4*channels) / (4*channels) * 8, spb);
+   if ((frames >= 0) && (frames < len))
+      len = frames;
+   if (len <= 0)
+      return NULL;
+
+   data = _AL_MALLOC_ATOMIC(length);
+   pcm = _AL_MALLOC_ATOMIC(len * channels * sizeof(short));
+
+   if ((data) && (pcm) && (pack_fread(data, length, f) == length)) {
+      len = _adpcm_decode_wav(pcm, data, length, channels, align, spb, len);
+
+      if (len > 0) {
+	 spl = create_sample(4, ((channels == 2) ? TRUE : FALSE), freq, len);
+	 if (spl)
+	    _adpcm_encode(spl->data, pcm, channels, len);
+      }
+   }
+
+   if (data)
+      _AL_FREE(data);
+   if (pcm)
+      _AL_FREE(pcm);
+
+   return spl;
+}
+
+
+
 /* load_wav_pf:
  *  Reads a RIFF WAV format sample from the packfile given, returning a
  *  SAMPLE structure, or NULL on error.
@@ -1017,6 +1085,10 @@ SAMPLE *load_wav_pf(PACKFILE *f)
    int freq = 22050;
    int bits = 8;
    int channels = 1;
+   int format = 1;
+   int align = 0;
+   int spb = 0;
+   int frames = -1;
    int s;
    SAMPLE *spl = NULL;
    ASSERT(f);
@@ -1034,9 +1106,9 @@ SAMPLE *load_wav_pf(PACKFILE *f)
       length = pack_igetl(f);          /* read chunk length */
 
       if (memcmp(buffer, "fmt ", 4) == 0) {
-	 i = pack_igetw(f);            /* should be 1 for PCM data */
+	 format = pack_igetw(f);       /* 1 for PCM, 0x11 for IMA ADPCM */
 	 length -= 2;
-	 if (i != 1) 
+	 if ((format != 1) && (format != 0x11))
 	    goto getout;
 
 	 channels = pack_igetw(f);     /* mono or stereo data */
@@ -1047,15 +1119,39 @@ SAMPLE *load_wav_pf(PACKFILE *f)
 	 freq = pack_igetl(f);         /* sample frequency */
 	 length -= 4;
 
-	 pack_igetl(f);                /* skip six bytes */
-	 pack_igetw(f);
-	 length -= 6;
+	 pack_igetl(f);                /* skip the data rate */
+	 length -= 4;
+
+	 align = pack_igetw(f);        /* block size */
+	 length -= 2;
 
 	 bits = pack_igetw(f);         /* 8 or 16 bit data? */
 	 length -= 2;
-	 if ((bits != 8) && (bits != 16))
+
+	 if (format == 0x11) {
+	    if ((bits != 4) || (align <= 4*channels))
+	       goto getout;
+
+	    /* frames per block, in the extra format bytes */
+	    if (length >= 4) {
+	       pack_igetw(f);
+	       spb = pack_igetw(f);
+	       length -= 4;
+	    }
+	    else
+	       spb = 1 + (align - 4*channels) / (4*channels) * 8;
+	 }
+	 else if ((bits != 8) && (bits != 16))
 	    goto getout;
       }
+      else if ((memcmp(buffer, "fact", 4) == 0) && (length >= 4)) {
+	 frames = pack_igetl(f);       /* length of compressed data */
+	 length -= 4;
+      }
+      else if ((memcmp(buffer, "data", 4) == 0) && (format == 0x11)) {
+	 spl = load_wav_adpcm(f, length, channels, freq, align, spb, frames);
+	 length = 0;
+      }
       else if (memcmp(buffer, "data", 4) == 0) {
 	 if (channels == 2) {
 	    /* allocate enough space even if length is odd for some reason */
@@ -1107,6 +1203,19 @@ SAMPLE *load_wav_pf(PACKFILE *f)
 
 
 
+/* _sample_data_size:
+ *  Returns the size in bytes of the data of a sample.
+ */
+long _sample_data_size(int bits, int stereo, long len)
+{
+   if (bits == 4)
+      return ((len + ADPCM_BLOCK_FRAMES - 1) >> ADPCM_BLOCK_SHIFT) * ADPCM_CHANNEL_SIZE * ((stereo) ? 2 : 1);
+
+   return len * ((bits==8) ? 1 : sizeof(short)) * ((stereo) ? 2 : 1);
+}
+
+
+
 /* create_sample:
  *  Constructs a new sample structure of the specified type.
  */
@@ -1129,7 +1238,7 @@ SAMPLE *create_sample(int bits, int stereo, int freq, int len)
    spl->loop_end = len;
    spl->param = 0;
 
-   spl->data = _AL_MALLOC_ATOMIC(len * ((bits==8) ? 1 : sizeof(short)) * ((stereo) ? 2 : 1));
+   spl->data = _AL_MALLOC_ATOMIC(_sample_data_size(bits, stereo, len));
    if (!spl->data) {
       _AL_FREE(spl);
       return NULL;
@@ -1150,8 +1259,13 @@ void destroy_sample(SAMPLE *spl)
    if (spl) {
       stop_sample(spl);
 
+      if (spl->param == SAMPLE_STREAM_ID) {
+	 _sample_stream_destroy(spl);
+	 return;
+      }
+
       if (spl->data) {
-	 UNLOCK_DATA(spl->data, spl->len * ((spl->bits==8) ? 1 : sizeof(short)) * ((spl->stereo) ? 2 : 1));
+	 UNLOCK_DATA(spl->data, _sample_data_size(spl->bits, spl->stereo, spl->len));
 	 _AL_FREE(spl->data);
       }
 
@@ -1260,126 +1374,344 @@ END_OF_FUNCTION(stop_sample);
 
 
 
-/* allocate_physical_voice:
- *  Allocates a physical voice, killing off others as required in order
- *  to make room for it.
+/* steal_first:
+ *  Tells whether physical voice a is a better candidate for being killed
+ *  off than b. Low priority voices always go first, then the ones which
+ *  are not looping, then the ones which have been playing for longest.
+ *  Age never outweighs priority, and the order does not change while the
+ *  voices play, so it can be kept in a heap.
  */
-static INLINE int allocate_physical_voice(int priority)
+static INLINE int steal_first(int a, int b)
+{
+   VOICE *va = virt_voice + _phys_voice[a].num;
+   VOICE *vb = virt_voice + _phys_voice[b].num;
+   int la = _phys_voice[a].playmode & PLAYMODE_LOOP;
+   int lb = _phys_voice[b].playmode & PLAYMODE_LOOP;
+
+   if (va->priority != vb->priority)
+      return (va->priority < vb->priority);
+
+   if ((!la) != (!lb))
+      return (!la);
+
+   return (va->time - vb->time < 0);
+}
+
+
+
+/* steal_heap_move:
+ *  Puts a physical voice at a given position in the steal heap.
+ */
+static INLINE void steal_heap_move(int phys, int pos)
+{
+   steal_heap[pos] = phys;
+   steal_heap_pos[phys] = pos;
+}
+
+
+
+/* steal_heap_fix:
+ *  Moves the heap entry at pos up or down until the heap is in order.
+ */
+static void steal_heap_fix(int pos)
+{
+   int phys = steal_heap[pos];
+   int parent, child;
+
+   while (pos > 0) {
+      parent = (pos-1) / 2;
+      if (!steal_first(phys, steal_heap[parent]))
+	 break;
+      steal_heap_move(steal_heap[parent], pos);
+      pos = parent;
+   }
+
+   for (;;) {
+      child = pos*2 + 1;
+      if (child >= steal_heap_size)
+	 break;
+      if ((child+1 < steal_heap_size) &&
+	  (steal_first(steal_heap[child+1], steal_heap[child])))
+	 child++;
+      if (!steal_first(steal_heap[child], phys))
+	 break;
+      steal_heap_move(steal_heap[child], pos);
+      pos = child;
+   }
+
+   steal_heap_move(phys, pos);
+}
+
+END_OF_STATIC_FUNCTION(steal_heap_fix);
+
+
+
+/* steal_heap_add:
+ *  Adds a physical voice which has just been allocated to the steal heap.
+ */
+static void steal_heap_add(int phys)
+{
+   steal_heap_move(phys, steal_heap_size++);
+   steal_heap_fix(steal_heap_pos[phys]);
+}
+
+END_OF_STATIC_FUNCTION(steal_heap_add);
+
+
+
+/* steal_heap_remove:
+ *  Takes a physical voice out of the steal heap, if it is in there.
+ */
+static void steal_heap_remove(int phys)
+{
+   int pos = steal_heap_pos[phys];
+
+   if (pos < 0)
+      return;
+
+   steal_heap_pos[phys] = -1;
+
+   if (pos < --steal_heap_size) {
+      steal_heap_move(steal_heap[steal_heap_size], pos);
+      steal_heap_fix(pos);
+   }
+}
+
+END_OF_STATIC_FUNCTION(steal_heap_remove);
+
+
+
+/* steal_heap_update:
+ *  Called when something affecting the steal_first() order of a voice
+ *  changes.
+ */
+static void steal_heap_update(int phys)
+{
+   if ((phys >= 0) && (steal_heap_pos[phys] >= 0))
+      steal_heap_fix(steal_heap_pos[phys]);
+}
+
+END_OF_STATIC_FUNCTION(steal_heap_update);
+
+
+
+/* init_voice_lists:
+ *  Sets up the free voice stacks once the drivers know how many voices
+ *  they have.
+ */
+static void init_voice_lists(void)
 {
-   VOICE *voice;
-   int best = -1;
-   int best_score = 0;
-   int score;
    int c;
 
-   /* look for a free voice */
-   for (c=0; c<digi_driver->voices; c++)
-      if (_phys_voice[c].num < 0)
-	 return c;
+   virt_voice_limit = VIRTUAL_VOICES;
+   if (midi_driver->max_voices < 0)
+      virt_voice_limit -= midi_driver->voices;
+
+   virt_free_count = 0;
+   for (c=virt_voice_limit-1; c>=0; c--)
+      virt_free[virt_free_count++] = c;
+
+   phys_free_count = 0;
+   for (c=digi_driver->voices-1; c>=0; c--)
+      phys_free[phys_free_count++] = c;
+
+   for (c=0; c<DIGI_VOICES; c++)
+      steal_heap_pos[c] = -1;
+
+   steal_heap_size = 0;
+   reap_skip = 0;
+}
+
+
+
+/* free_virtual_voice:
+ *  Marks a virtual voice as unused.
+ */
+static void free_virtual_voice(int virt)
+{
+   if ((virt_voice[virt].sample) && (virt < virt_voice_limit))
+      virt_free[virt_free_count++] = virt;
+
+   virt_voice[virt].sample = NULL;
+   virt_voice[virt].num = -1;
+}
+
+END_OF_STATIC_FUNCTION(free_virtual_voice);
+
+
+
+/* free_physical_voice:
+ *  Marks a physical voice as unused.
+ */
+static void free_physical_voice(int phys)
+{
+   if ((_phys_voice[phys].num >= 0) && (phys < digi_driver->voices))
+      phys_free[phys_free_count++] = phys;
+
+   _phys_voice[phys].num = -1;
+   steal_heap_remove(phys);
+}
+
+END_OF_STATIC_FUNCTION(free_physical_voice);
+
+
+
+/* reap_stopped_voices:
+ *  Frees all the autokill voices which have finished playing. If there
+ *  are none, the next few calls are skipped, so that when every voice is
+ *  busy, looking for stopped ones costs about the same however many there
+ *  are.
+ */
+static void reap_stopped_voices(void)
+{
+   int found = 0;
+   int c, virt;
 
-   /* look for an autokill voice that has stopped */
    for (c=0; c<digi_driver->voices; c++) {
-      voice = virt_voice + _phys_voice[c].num;
-      if ((voice->autokill) && (digi_driver->get_position(c) < 0)) {
+      virt = _phys_voice[c].num;
+
+      if ((virt >= 0) && (virt_voice[virt].autokill) &&
+	  (digi_driver->get_position(c) < 0)) {
 	 digi_driver->release_voice(c);
-	 voice->sample = NULL;
-	 voice->num = -1;
-	 _phys_voice[c].num = -1;
-	 return c;
+	 free_physical_voice(c);
+	 free_virtual_voice(virt);
+	 found++;
       }
    }
 
-   /* ok, we're going to have to get rid of something to make room... */
-   for (c=0; c<digi_driver->voices; c++) {
-      voice = virt_voice + _phys_voice[c].num;
+   reap_skip = (found ? 0 : steal_heap_size / 16);
+}
 
-      /* sort by voice priorities */
-      if (voice->priority <= priority) {
-	 score = 65536 - voice->priority * 256;
+END_OF_STATIC_FUNCTION(reap_stopped_voices);
 
-	 /* bias with a least-recently-used counter */
-	 score += MID(0, retrace_count - voice->time, 32768);
 
-	 /* bias according to whether the voice is looping or not */
-	 if (!(_phys_voice[c].playmode & PLAYMODE_LOOP))
-	    score += 32768;
 
-	 if (score > best_score) {
-	    best = c;
-	    best_score = score;
-	 }
-      }
-   }
+/* allocate_physical_voice:
+ *  Allocates a physical voice, killing off others as required in order
+ *  to make room for it.
+ */
+static INLINE int allocate_physical_voice(int priority)
+{
+   int best, virt;
 
-   if (best >= 0) {
-      /* kill off the old voice */
-      digi_driver->stop_voice(best);
-      digi_driver->release_voice(best);
-      virt_voice[_phys_voice[best].num].num = -1;
-      _phys_voice[best].num = -1;
-      return best;
+   /* look for a free voice, or an autokill voice that has stopped */
+   if (phys_free_count == 0) {
+      if (reap_skip > 0)
+	 reap_skip--;
+      else
+	 reap_stopped_voices();
    }
 
-   return -1;
+   if (phys_free_count > 0)
+      return phys_free[--phys_free_count];
+
+   /* ok, we're going to have to get rid of something to make room. The
+    * heap is ordered by priority first, so if its top is too important
+    * to kill, so is every other voice.
+    */
+   if (steal_heap_size <= 0)
+      return -1;
+
+   best = steal_heap[0];
+   if (virt_voice[_phys_voice[best].num].priority > priority)
+      return -1;
+
+   /* kill off the old voice */
+   digi_driver->stop_voice(best);
+   digi_driver->release_voice(best);
+
+   /* nobody is holding on to an autokill voice, so it can go */
+   virt = _phys_voice[best].num;
+   virt_voice[virt].num = -1;
+   if (virt_voice[virt].autokill)
+      free_virtual_voice(virt);
+
+   _phys_voice[best].num = -1;
+   steal_heap_remove(best);
+   return best;
 }
 
 
 
 /* allocate_virtual_voice:
  *  Allocates a virtual voice. This doesn't need to worry about killing off 
- *  others to make room, as we allow up to 256 virtual voices to be used
- *  simultaneously.
+ *  others to make room, as we allow up to VIRTUAL_VOICES virtual voices
+ *  to be used simultaneously. Free voices are kept on a stack; when it runs
+ *  dry, stopped autokill voices are reaped in one batch.
  */
 static INLINE int allocate_virtual_voice(void)
 {
-   int num_virt_voices, c;
+   if (virt_free_count == 0)
+      reap_stopped_voices();
 
-   num_virt_voices = VIRTUAL_VOICES;
-   if (midi_driver->max_voices < 0)
-      num_virt_voices -= midi_driver->voices;
-
-   /* look for a free voice */
-   for (c=0; c<num_virt_voices; c++)
-      if (!virt_voice[c].sample)
-	 return c;
-
-   /* look for a stopped autokill voice */
-   for (c=0; c<num_virt_voices; c++) {
-      if (virt_voice[c].autokill) {
-	 if (virt_voice[c].num < 0) {
-	    virt_voice[c].sample = NULL;
-	    return c;
-	 }
-	 else {
-	    if (digi_driver->get_position(virt_voice[c].num) < 0) {
-	       digi_driver->release_voice(virt_voice[c].num);
-	       _phys_voice[virt_voice[c].num].num = -1;
-	       virt_voice[c].sample = NULL;
-	       virt_voice[c].num = -1;
-	       return c;
-	    }
-	 }
-      }
-   }
+   if (virt_free_count > 0)
+      return virt_free[--virt_free_count];
 
    return -1;
 }
 
 
 
+/* kill_voice:
+ *  Takes the physical voice away from a virtual voice, as if it had been
+ *  killed off to make room for another one.
+ */
+static void kill_voice(int virt)
+{
+   int phys = virt_voice[virt].num;
+
+   digi_driver->stop_voice(phys);
+   digi_driver->release_voice(phys);
+   free_physical_voice(phys);
+
+   virt_voice[virt].num = -1;
+   if (virt_voice[virt].autokill)
+      free_virtual_voice(virt);
+}
+
+
+
+/* init_phys_voice:
+ *  Sets up a physical voice for playing a sample, leaving streamed samples
+ *  to their own code.
+ */
+static void init_phys_voice(int virt, int phys, AL_CONST SAMPLE *spl)
+{
+   int old;
+
+   if (spl->param == SAMPLE_STREAM_ID) {
+      /* there is only one ring, so only one voice can play from it */
+      old = _sample_stream_voice(spl);
+      if ((old >= 0) && (old != virt) && (virt_voice[old].sample == spl) && (virt_voice[old].num >= 0))
+	 kill_voice(old);
+
+      _sample_stream_init_voice(spl, virt, phys);
+   }
+   else
+      digi_driver->init_voice(phys, spl);
+}
+
+END_OF_STATIC_FUNCTION(init_phys_voice);
+
+
+
 /* allocate_voice:
  *  Allocates a voice ready for playing the specified sample, returning
  *  the voice number (note this is not the same as the physical voice
  *  number used by the sound drivers, and must only be used with the other
  *  voice functions, _not_ passed directly to the driver routines).
  *  Returns -1 if there is no voice available (this should never happen,
- *  since there are 256 virtual voices and anyone who needs more than that
+ *  since there are 2048 virtual voices and anyone who needs more than that
  *  needs some urgent repairs to their brain :-)
  */
 int allocate_voice(AL_CONST SAMPLE *spl)
 {
    int phys, virt;
    ASSERT(spl);
+
+   /* only Allegro's mixer can decode ADPCM samples */
+   if ((spl->bits == 4) && (digi_driver->init_voice != _mixer_init_voice))
+      return -1;
    
    phys = allocate_physical_voice(spl->priority);
    virt = allocate_virtual_voice();
@@ -1400,10 +1732,16 @@ int allocate_voice(AL_CONST SAMPLE *spl)
 	 _phys_voice[phys].dvol = 0;
 	 _phys_voice[phys].dpan = 0;
 	 _phys_voice[phys].dfreq = 0;
+	 _phys_voice[phys].priority = spl->priority;
 
-	 digi_driver->init_voice(phys, spl);
+	 init_phys_voice(virt, phys, spl);
+	 steal_heap_add(phys);
       }
    }
+   else if (phys >= 0) {
+      /* no use for it after all */
+      phys_free[phys_free_count++] = phys;
+   }
 
    return virt;
 }
@@ -1422,11 +1760,10 @@ void deallocate_voice(int voice)
    if (virt_voice[voice].num >= 0) {
       digi_driver->stop_voice(virt_voice[voice].num);
       digi_driver->release_voice(virt_voice[voice].num);
-      _phys_voice[virt_voice[voice].num].num = -1;
-      virt_voice[voice].num = -1;
+      free_physical_voice(virt_voice[voice].num);
    }
 
-   virt_voice[voice].sample = NULL;
+   free_virtual_voice(voice);
 }
 
 END_OF_FUNCTION(deallocate_voice);
@@ -1442,6 +1779,10 @@ void reallocate_voice(int voice, AL_CONST SAMPLE *spl)
    ASSERT(spl);
    ASSERT(voice >= 0 && voice < VIRTUAL_VOICES);
 
+   /* only Allegro's mixer can decode ADPCM samples */
+   if ((spl->bits == 4) && (digi_driver->init_voice != _mixer_init_voice))
+      return;
+
    phys =  virt_voice[voice].num;
 
    if (phys >= 0) {
@@ -1462,8 +1803,10 @@ void reallocate_voice(int voice, AL_CONST SAMPLE *spl)
       _phys_voice[phys].dvol = 0;
       _phys_voice[phys].dpan = 0;
       _phys_voice[phys].dfreq = 0;
+      _phys_voice[phys].priority = spl->priority;
 
-      digi_driver->init_voice(phys, spl);
+      init_phys_voice(voice, phys, spl);
+      steal_heap_update(phys);
    }
 }
 
@@ -1479,6 +1822,10 @@ void release_voice(int voice)
 {
    ASSERT(voice >= 0 && voice < VIRTUAL_VOICES);
    virt_voice[voice].autokill = TRUE;
+
+   /* it has already been killed off, so nothing is left to wait for */
+   if (virt_voice[voice].num < 0)
+      free_virtual_voice(voice);
 }
 
 END_OF_FUNCTION(release_voice);
@@ -1491,10 +1838,15 @@ END_OF_FUNCTION(release_voice);
 void voice_start(int voice)
 {
    ASSERT(voice >= 0 && voice < VIRTUAL_VOICES);
-   if (virt_voice[voice].num >= 0)
+   if (virt_voice[voice].num >= 0) {
+      if (virt_voice[voice].sample->param == SAMPLE_STREAM_ID)
+	 _sample_stream_start_voice(virt_voice[voice].sample, virt_voice[voice].num);
+
       digi_driver->start_voice(virt_voice[voice].num);
+   }
 
    virt_voice[voice].time = retrace_count;
+   steal_heap_update(virt_voice[voice].num);
 }
 
 END_OF_FUNCTION(voice_start);
@@ -1523,6 +1875,11 @@ void voice_set_priority(int voice, int priority)
    ASSERT(voice >= 0 && voice < VIRTUAL_VOICES);
    ASSERT(priority >= 0 && priority <= 255);
    virt_voice[voice].priority = priority;
+
+   if (virt_voice[voice].num >= 0)
+      _phys_voice[virt_voice[voice].num].priority = priority;
+
+   steal_heap_update(virt_voice[voice].num);
 }
 
 END_OF_FUNCTION(voice_set_priority);
@@ -1554,6 +1911,27 @@ END_OF_FUNCTION(voice_check);
 
 
 
+/* _voice_set_fill:
+ *  Asks the mixer to call the fill function, from the mixing thread, with
+ *  every len sample fragment of the voice that has finished playing, so
+ *  that it can be refilled in place; the voice stops if it returns
+ *  non-zero. Returns zero on success, or -1 if the voice is not mixed by
+ *  Allegro.
+ */
+int _voice_set_fill(int voice, AL_METHOD(int, fill, (void *buf, int len, void *param)), void *param, int len)
+{
+   ASSERT(voice >= 0 && voice < VIRTUAL_VOICES);
+   ASSERT(fill);
+
+   if ((virt_voice[voice].num < 0) || (digi_driver->init_voice != _mixer_init_voice))
+      return -1;
+
+   _mixer_set_fill(virt_voice[voice].num, fill, param, len);
+   return 0;
+}
+
+
+
 /* voice_get_position:
  *  Returns the current play position of a voice, or -1 if that cannot
  *  be determined (because it has finished or been preempted by a
@@ -1561,11 +1939,18 @@ END_OF_FUNCTION(voice_check);
  */
 int voice_get_position(int voice)
 {
+   int pos;
    ASSERT(voice >= 0 && voice < VIRTUAL_VOICES);
-   if (virt_voice[voice].num >= 0)
-      return digi_driver->get_position(virt_voice[voice].num);
-   else
+
+   if (virt_voice[voice].num < 0)
       return -1;
+
+   pos = digi_driver->get_position(virt_voice[voice].num);
+
+   if (virt_voice[voice].sample->param == SAMPLE_STREAM_ID)
+      pos = _sample_stream_get_position(virt_voice[voice].sample, pos);
+
+   return pos;
 }
 
 END_OF_FUNCTION(voice_get_position);
@@ -1578,8 +1963,12 @@ END_OF_FUNCTION(voice_get_position);
 void voice_set_position(int voice, int position)
 {
    ASSERT(voice >= 0 && voice < VIRTUAL_VOICES);
-   if (virt_voice[voice].num >= 0)
-      digi_driver->set_position(virt_voice[voice].num, position);
+   if (virt_voice[voice].num >= 0) {
+      if (virt_voice[voice].sample->param == SAMPLE_STREAM_ID)
+	 _sample_stream_set_position(virt_voice[voice].sample, virt_voice[voice].num, position);
+      else
+	 digi_driver->set_position(virt_voice[voice].num, position);
+   }
 }
 
 END_OF_FUNCTION(voice_set_position);
@@ -1593,8 +1982,15 @@ void voice_set_playmode(int voice, int playmode)
 {
    ASSERT(voice >= 0 && voice < VIRTUAL_VOICES);
    if (virt_voice[voice].num >= 0) {
+      if (virt_voice[voice].sample->param == SAMPLE_STREAM_ID) {
+	 _sample_stream_set_playmode(virt_voice[voice].sample, virt_voice[voice].num, playmode);
+	 steal_heap_update(virt_voice[voice].num);
+	 return;
+      }
+
       _phys_voice[virt_voice[voice].num].playmode = playmode;
       digi_driver->loop_voice(virt_voice[voice].num, playmode);
+      steal_heap_update(virt_voice[voice].num);
 
       if (playmode & PLAYMODE_BACKWARD)
 	 digi_driver->set_position(virt_voice[voice].num, virt_voice[voice].sample->len-1);
@@ -2095,14 +2491,34 @@ static void sound_lock_mem(void)
    LOCK_VARIABLE(midi_recorder);
    LOCK_VARIABLE(virt_voice);
    LOCK_VARIABLE(_phys_voice);
+   LOCK_VARIABLE(virt_free);
+   LOCK_VARIABLE(virt_free_count);
+   LOCK_VARIABLE(virt_voice_limit);
+   LOCK_VARIABLE(phys_free);
+   LOCK_VARIABLE(phys_free_count);
+   LOCK_VARIABLE(steal_heap);
+   LOCK_VARIABLE(steal_heap_pos);
+   LOCK_VARIABLE(steal_heap_size);
+   LOCK_VARIABLE(reap_skip);
    LOCK_VARIABLE(_digi_volume);
    LOCK_VARIABLE(_midi_volume);
    LOCK_VARIABLE(_sound_flip_pan);
    LOCK_VARIABLE(_sound_hq);
+   LOCK_VARIABLE(_sound_lod_volume);
+   LOCK_VARIABLE(_sound_lod_priority);
+   LOCK_VARIABLE(_sound_budget);
    LOCK_FUNCTION(_dummy_detect);
    LOCK_FUNCTION(play_sample);
    LOCK_FUNCTION(adjust_sample);
    LOCK_FUNCTION(stop_sample);
+   LOCK_FUNCTION(steal_heap_fix);
+   LOCK_FUNCTION(steal_heap_add);
+   LOCK_FUNCTION(steal_heap_remove);
+   LOCK_FUNCTION(steal_heap_update);
+   LOCK_FUNCTION(free_virtual_voice);
+   LOCK_FUNCTION(free_physical_voice);
+   LOCK_FUNCTION(init_phys_voice);
+   LOCK_FUNCTION(reap_stopped_voices);
    LOCK_FUNCTION(allocate_voice);
    LOCK_FUNCTION(deallocate_voice);
    LOCK_FUNCTION(reallocate_voice);
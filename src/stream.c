@@ -21,11 +21,11 @@
 
 
 
-/* play_audio_stream:
- *  Creates a new audio stream and starts it playing. The length is the
- *  size of each transfer buffer.
+/* create_audio_stream:
+ *  Creates a new audio stream, ready to be filled and started. The length
+ *  is the size of each transfer buffer.
  */
-AUDIOSTREAM *play_audio_stream(int len, int bits, int stereo, int freq, int vol, int pan)
+static AUDIOSTREAM *create_audio_stream(int len, int bits, int stereo, int freq, int vol, int pan, AL_METHOD(void, callback, (void *buf, int len, void *param)), void *param)
 {
    AUDIOSTREAM *stream;
    int i, bufcount;
@@ -39,6 +39,12 @@ AUDIOSTREAM *play_audio_stream(int len, int bits, int stereo, int freq, int vol,
    else
       i = 2048;
 
+   /* the mixer refills callback streams once per buffer, and a stream
+    * faster than the mixer gets through more than a buffer's worth
+    */
+   if ((callback) && (get_mixer_frequency() > 0) && (freq > get_mixer_frequency()))
+      i *= freq / get_mixer_frequency() + 1;
+
    if (len >= i)
       bufcount = 1;
    else
@@ -54,6 +60,8 @@ AUDIOSTREAM *play_audio_stream(int len, int bits, int stereo, int freq, int vol,
    stream->bufnum = 0;
    stream->active = 1;
    stream->locked = NULL;
+   stream->callback = callback;
+   stream->param = param;
 
    /* create the underlying sample */
    stream->samp = create_sample(bits, stereo, freq, len*bufcount*2);
@@ -94,12 +102,96 @@ AUDIOSTREAM *play_audio_stream(int len, int bits, int stereo, int freq, int vol,
 
 
 
+/* play_audio_stream:
+ *  Creates a new audio stream and starts it playing. The length is the
+ *  size of each transfer buffer.
+ */
+AUDIOSTREAM *play_audio_stream(int len, int bits, int stereo, int freq, int vol, int pan)
+{
+   return create_audio_stream(len, bits, stereo, freq, vol, pan, NULL, NULL);
+}
+
+
+
+/* stream_fill:
+ *  Mixer fill function for callback streams.
+ */
+static int stream_fill(void *buf, int len, void *param)
+{
+   AUDIOSTREAM *stream = param;
+
+   stream->callback(buf, len, stream->param);
+   return 0;
+}
+
+
+
+/* stream_poll:
+ *  Timer handler feeding callback streams on drivers that don't use the
+ *  Allegro mixer.
+ */
+static void stream_poll(void *param)
+{
+   AUDIOSTREAM *stream = param;
+   void *buf;
+
+   while ((buf = get_audio_stream_buffer(stream)) != NULL) {
+      stream->callback(buf, stream->len, stream->param);
+      free_audio_stream_buffer(stream);
+   }
+}
+
+
+
+/* play_audio_stream_callback:
+ *  Creates a new audio stream and starts it playing, calling the callback
+ *  function whenever a buffer of the specified length needs filling. The
+ *  mixer calls it directly with a pointer into the voice's sample data,
+ *  so the stream keeps playing whatever the calling thread is doing.
+ */
+AUDIOSTREAM *play_audio_stream_callback(int len, int bits, int stereo, int freq, int vol, int pan, AL_METHOD(void, callback, (void *buf, int len, void *param)), void *param)
+{
+   AUDIOSTREAM *stream;
+   int i, size;
+   ASSERT(callback);
+
+   stream = create_audio_stream(len, bits, stereo, freq, vol, pan, callback, param);
+   if (!stream)
+      return NULL;
+
+   if (_voice_set_fill(stream->voice, stream_fill, stream, len) == 0) {
+      /* the mixer refills each fragment once it has been played */
+      size = len * ((bits == 8) ? 1 : sizeof(short)) * ((stereo) ? 2 : 1);
+
+      for (i=0; i < stream->bufcount*2; i++)
+	 callback((char *)stream->samp->data + i*size, len, param);
+
+      voice_start(stream->voice);
+   }
+   else {
+      /* poll from the timer thread instead, at twice the buffer rate */
+      if (install_param_int(stream_poll, stream, MAX(len*500/freq, 1)) != 0) {
+	 stop_audio_stream(stream);
+	 return NULL;
+      }
+
+      stream_poll(stream);
+   }
+
+   return stream;
+}
+
+
+
 /* stop_audio_stream:
  *  Destroys an audio stream when it is no longer required.
  */
 void stop_audio_stream(AUDIOSTREAM *stream)
 {
    ASSERT(stream);
+
+   if (stream->callback)
+      remove_param_int(stream_poll, stream);
    
    if ((stream->locked) && (digi_driver->unlock_voice))
       digi_driver->unlock_voice(stream->voice);
@@ -27,7 +27,21 @@ TIMER_DRIVER *timer_driver = NULL;        /* the active driver */
 
 int _timer_installed = FALSE;
 
-TIMER_QUEUE _timer_queue[MAX_TIMERS];     /* list of active callbacks */
+static TIMER_QUEUE timer_queue_static[MAX_TIMERS];
+TIMER_QUEUE *_timer_queue = timer_queue_static; /* list of callbacks */
+int _timer_queue_size = MAX_TIMERS;
+
+/* the running callbacks, as a binary min-heap of _timer_queue indices
+ * ordered by deadline */
+static int timer_heap_static[MAX_TIMERS];
+static int *timer_heap = timer_heap_static;
+static int timer_heap_count = 0;
+
+static unsigned long timer_clock = 0;     /* ticks handled so far */
+static int timer_max_catchup = 0;         /* late calls to make, 0=all */
+
+/* compares two deadlines on the wrapping timer clock */
+#define TIMER_BEFORE(a, b)    ((long)((a) - (b)) < 0)
 
 volatile int retrace_count = 0;           /* used for retrace syncing */
 void (*retrace_proc)(void) = NULL;
@@ -64,16 +78,144 @@ static int timer_semaphore = FALSE;       /* reentrant interrupt? */
 
 static volatile long timer_delay = 0;     /* lost interrupt rollover */
 
+/* frame pacing, in microseconds except for frame_period */
+#define FRAME_SPIN_MIN     100            /* shortest final spin */
+#define FRAME_SPIN_MAX     4000           /* longest final spin */
+
+static long frame_period = 0;             /* in timer ticks, 0 if unset */
+static double frame_period_usec;
+static int frame_started = FALSE;         /* frame_next is valid */
+static unsigned long frame_next;          /* start of the next frame */
+static double frame_next_frac;            /* and its fractional part */
+static long frame_spin = 1000;            /* how long to spin at the end */
+static FRAME_STATS frame_stats;
+static double frame_overshoot_sum;
+static double frame_spin_sum;
+
+static int frame_fallback = FALSE;        /* frame_fallback_tick running? */
+static volatile unsigned long frame_fallback_clock = 0;
+
+
+
+/* timer_heap_set:
+ *  Stores timer x at position pos of the deadline heap.
+ */
+static void timer_heap_set(int pos, int x)
+{
+   timer_heap[pos] = x;
+   _timer_queue[x].heap_pos = pos;
+}
+
+END_OF_STATIC_FUNCTION(timer_heap_set);
+
+
+
+/* timer_heap_up:
+ *  Moves the timer at position pos towards the top of the heap until its
+ *  parent is due before it.
+ */
+static void timer_heap_up(int pos)
+{
+   int x = timer_heap[pos];
+   int parent;
+
+   while (pos > 0) {
+      parent = (pos-1) / 2;
+      if (!TIMER_BEFORE(_timer_queue[x].due, _timer_queue[timer_heap[parent]].due))
+	 break;
+      timer_heap_set(pos, timer_heap[parent]);
+      pos = parent;
+   }
+
+   timer_heap_set(pos, x);
+}
+
+END_OF_STATIC_FUNCTION(timer_heap_up);
+
+
+
+/* timer_heap_down:
+ *  Moves the timer at position pos towards the bottom of the heap until
+ *  it is due before its children.
+ */
+static void timer_heap_down(int pos)
+{
+   int x = timer_heap[pos];
+   int child;
+
+   for (;;) {
+      child = pos*2 + 1;
+      if (child >= timer_heap_count)
+	 break;
+      if ((child+1 < timer_heap_count) &&
+	  (TIMER_BEFORE(_timer_queue[timer_heap[child+1]].due, _timer_queue[timer_heap[child]].due)))
+	 child++;
+      if (!TIMER_BEFORE(_timer_queue[timer_heap[child]].due, _timer_queue[x].due))
+	 break;
+      timer_heap_set(pos, timer_heap[child]);
+      pos = child;
+   }
+
+   timer_heap_set(pos, x);
+}
+
+END_OF_STATIC_FUNCTION(timer_heap_down);
+
+
+
+/* timer_heap_update:
+ *  Inserts timer x into the heap, or moves it after its deadline changed.
+ */
+static void timer_heap_update(int x)
+{
+   if (_timer_queue[x].heap_pos < 0)
+      timer_heap_set(timer_heap_count++, x);
+
+   timer_heap_up(_timer_queue[x].heap_pos);
+   timer_heap_down(_timer_queue[x].heap_pos);
+}
+
+END_OF_STATIC_FUNCTION(timer_heap_update);
+
+
+
+/* timer_heap_remove:
+ *  Takes timer x out of the heap, if it is there.
+ */
+static void timer_heap_remove(int x)
+{
+   int pos = _timer_queue[x].heap_pos;
+   int last;
+
+   if (pos < 0)
+      return;
+
+   _timer_queue[x].heap_pos = -1;
+   last = timer_heap[--timer_heap_count];
+
+   if (last != x) {
+      timer_heap_set(pos, last);
+      timer_heap_up(pos);
+      timer_heap_down(_timer_queue[last].heap_pos);
+   }
+}
+
+END_OF_STATIC_FUNCTION(timer_heap_remove);
+
 
 
 /* _handle_timer_tick:
- *  Called by the driver to handle a timer tick.
+ *  Called by the driver to handle a timer tick. Runs the callbacks that
+ *  are due in deadline order, and returns the time until the next one.
  */
 long _handle_timer_tick(int interval)
 {
    long new_delay = 0x8000;
-   long d;
-   int i;
+   long d, late;
+   TIMER_QUEUE *t;
+   void (*proc)(void);
+   void (*param_proc)(void *param);
+   void *param;
 
    timer_delay += interval;
 
@@ -99,29 +241,38 @@ long _handle_timer_tick(int interval)
 	 retrace_proc();
    }
 
-   /* process the user callbacks */
-   for (i=0; i<MAX_TIMERS; i++) { 
-      if (((_timer_queue[i].proc) || (_timer_queue[i].param_proc)) &&
-	  (_timer_queue[i].speed > 0)) {
+   timer_clock += d;
 
-	 _timer_queue[i].counter -= d;
+   /* process the user callbacks, earliest deadline first */
+   while (timer_heap_count > 0) {
+      t = &_timer_queue[timer_heap[0]];
 
-	 while ((_timer_queue[i].counter <= 0) && 
-		((_timer_queue[i].proc) || (_timer_queue[i].param_proc)) && 
-		(_timer_queue[i].speed > 0)) {
-	    _timer_queue[i].counter += _timer_queue[i].speed;
-	    if (_timer_queue[i].param_proc)
-	       _timer_queue[i].param_proc(_timer_queue[i].param);
-	    else
-	       _timer_queue[i].proc();
-	 }
-
-	 if ((_timer_queue[i].counter > 0) && 
-	     ((_timer_queue[i].proc) || (_timer_queue[i].param_proc)) && 
-	     (_timer_queue[i].counter < new_delay)) {
-	    new_delay = _timer_queue[i].counter;
-	 }
+      if (TIMER_BEFORE(timer_clock, t->due)) {
+	 if ((long)(t->due - timer_clock) < new_delay)
+	    new_delay = t->due - timer_clock;
+	 break;
       }
+
+      /* drop the calls beyond the catch-up limit, keeping the phase */
+      if (timer_max_catchup > 0) {
+	 late = (long)(timer_clock - t->due) / t->speed;
+	 if (late >= timer_max_catchup)
+	    t->due += (late - timer_max_catchup + 1) * t->speed;
+      }
+
+      proc = t->proc;
+      param_proc = t->param_proc;
+      param = t->param;
+
+      t->due += t->speed;
+      timer_heap_down(0);
+
+      /* the callback may install or remove timers, which can move the
+       * queue, so t must not be used past this point */
+      if (param_proc)
+	 param_proc(param);
+      else
+	 proc();
    }
 
    timer_delay -= d;
@@ -157,6 +308,18 @@ END_OF_STATIC_FUNCTION(rest_int);
 
 
 
+/* frame_fallback_tick:
+ *  Millisecond clock for frame pacing when the driver has none.
+ */
+static void frame_fallback_tick(void)
+{
+   frame_fallback_clock += 1000;
+}
+
+END_OF_STATIC_FUNCTION(frame_fallback_tick);
+
+
+
 /* rest_callback:
  *  Waits for time milliseconds.
  */
@@ -209,6 +372,186 @@ void rest(unsigned int time)
 
 
 
+/* frame_read_usec:
+ *  Reads the microsecond clock used for frame pacing.
+ */
+static unsigned long frame_read_usec(void)
+{
+   if (timer_driver->read_usec)
+      return timer_driver->read_usec();
+
+   return frame_fallback_clock;
+}
+
+
+
+/* frame_rest_usec:
+ *  Sleeps for about the specified number of microseconds.
+ */
+static void frame_rest_usec(unsigned long usecs)
+{
+   if (timer_driver->rest_usec)
+      timer_driver->rest_usec(usecs);
+   else
+      rest(usecs / 1000);
+}
+
+
+
+/* frame_advance:
+ *  Moves the frame time forward by n periods.
+ */
+static void frame_advance(int n)
+{
+   double t = frame_period_usec * n + frame_next_frac;
+   unsigned long whole = (unsigned long)t;
+
+   frame_next += whole;
+   frame_next_frac = t - whole;
+}
+
+
+
+/* set_frame_period:
+ *  Sets the period, in hardware timer ticks, that wait_for_next_frame()
+ *  paces the caller to, or stops pacing if speed is zero. Installs the
+ *  timer if needed. Returns zero on success.
+ */
+int set_frame_period(long speed)
+{
+   if (!timer_driver) {
+      if (install_timer() != 0)
+	 return -1;
+   }
+
+   if (frame_fallback) {
+      remove_int(frame_fallback_tick);
+      frame_fallback = FALSE;
+   }
+
+   frame_period = MAX(speed, 0);
+   frame_started = FALSE;
+   reset_frame_stats();
+
+   if (!frame_period)
+      return 0;
+
+   /* without a fine clock from the driver, count milliseconds ourselves */
+   if (!timer_driver->read_usec) {
+      if (install_int(frame_fallback_tick, 1) != 0) {
+	 frame_period = 0;
+	 return -1;
+      }
+      frame_fallback = TRUE;
+   }
+
+   frame_period_usec = (double)frame_period * 1000000.0 / TIMERS_PER_SECOND;
+
+   return 0;
+}
+
+
+
+/* wait_for_next_frame:
+ *  Waits until the start of the next frame period. Sleeps while there is
+ *  plenty of time, then spins for the last stretch, whose length adapts
+ *  to how late the OS tends to wake us up. A caller that arrives too late
+ *  returns at once; frame times that have passed entirely are skipped
+ *  and their number is returned.
+ */
+int wait_for_next_frame(void)
+{
+   unsigned long now, start, target;
+   long remaining, overshoot, oversleep, margin;
+   int missed = 0;
+
+   ASSERT(frame_period > 0);
+   if (frame_period <= 0)
+      return 0;
+
+   now = frame_read_usec();
+
+   if (!frame_started) {
+      frame_next = now;
+      frame_next_frac = 0;
+      frame_advance(1);
+      frame_started = TRUE;
+   }
+
+   remaining = (long)(frame_next - now);
+
+   if (remaining <= 0) {
+      overshoot = -remaining;
+      missed = (int)(overshoot / frame_period_usec);
+      frame_advance(missed + 1);
+      frame_stats.late++;
+   }
+   else {
+      if (remaining > frame_spin) {
+	 target = frame_next - frame_spin;
+	 frame_rest_usec(remaining - frame_spin);
+
+	 /* leave room for the worst recent oversleep, and let that
+	  * estimate decay slowly when sleeps get more accurate */
+	 oversleep = (long)(frame_read_usec() - target);
+	 margin = MAX(oversleep, 0) + FRAME_SPIN_MIN;
+	 if (margin > frame_spin)
+	    frame_spin = MIN(margin, FRAME_SPIN_MAX);
+	 else
+	    frame_spin -= (frame_spin - margin) / 16;
+      }
+
+      start = frame_read_usec();
+      do {
+	 now = frame_read_usec();
+      } while ((long)(now - frame_next) < 0);
+
+      frame_spin_sum += (double)(long)(now - start);
+      overshoot = (long)(now - frame_next);
+      frame_advance(1);
+   }
+
+   frame_stats.frames++;
+   frame_stats.missed += missed;
+   frame_overshoot_sum += overshoot;
+   if (overshoot > frame_stats.overshoot_max)
+      frame_stats.overshoot_max = overshoot;
+
+   return missed;
+}
+
+
+
+/* get_frame_stats:
+ *  Reports how well wait_for_next_frame() kept to the frame period since
+ *  the last reset.
+ */
+void get_frame_stats(FRAME_STATS *stats)
+{
+   ASSERT(stats);
+
+   *stats = frame_stats;
+
+   if (frame_stats.frames > 0) {
+      stats->overshoot_avg = (long)(frame_overshoot_sum / frame_stats.frames);
+      stats->spin_avg = (long)(frame_spin_sum / frame_stats.frames);
+   }
+}
+
+
+
+/* reset_frame_stats:
+ *  Clears the frame pacing statistics.
+ */
+void reset_frame_stats(void)
+{
+   memset(&frame_stats, 0, sizeof(frame_stats));
+   frame_overshoot_sum = 0;
+   frame_spin_sum = 0;
+}
+
+
+
 /* timer_can_simulate_retrace: [deprecated but used internally]
  *  Checks whether the current driver is capable of a video retrace
  *  syncing mode.
@@ -256,7 +599,7 @@ static int find_timer_slot(void (*proc)(void))
 {
    int x;
 
-   for (x=0; x<MAX_TIMERS; x++)
+   for (x=0; x<_timer_queue_size; x++)
       if (_timer_queue[x].proc == proc)
 	 return x;
 
@@ -276,7 +619,7 @@ static int find_param_timer_slot(void (*proc)(void *param), void *param)
 {
    int x;
 
-   for (x=0; x<MAX_TIMERS; x++)
+   for (x=0; x<_timer_queue_size; x++)
       if ((_timer_queue[x].param_proc == proc) && (_timer_queue[x].param == param))
 	 return x;
 
@@ -287,17 +630,87 @@ END_OF_STATIC_FUNCTION(find_param_timer_slot);
 
 
 
+/* clear_timer_slot:
+ *  Marks a timer queue entry as unused.
+ */
+static void clear_timer_slot(TIMER_QUEUE *t)
+{
+   t->proc = NULL;
+   t->param_proc = NULL;
+   t->param = NULL;
+   t->speed = 0;
+   t->counter = 0;
+   t->due = 0;
+   t->heap_pos = -1;
+}
+
+END_OF_STATIC_FUNCTION(clear_timer_slot);
+
+
+
+#ifdef ALLEGRO_MULTITHREADED
+
+/* grow_timer_queue:
+ *  Doubles the size of the timer queue. Must be called with timer_mutex
+ *  held, so that _handle_timer_tick() never sees the old queue again.
+ */
+static int grow_timer_queue(void)
+{
+   int size = _timer_queue_size * 2;
+   TIMER_QUEUE *queue;
+   int *heap;
+   int x;
+
+   queue = _AL_MALLOC(size * sizeof(TIMER_QUEUE));
+   heap = _AL_MALLOC(size * sizeof(int));
+
+   if ((!queue) || (!heap)) {
+      if (queue)
+	 _AL_FREE(queue);
+      if (heap)
+	 _AL_FREE(heap);
+      return -1;
+   }
+
+   memcpy(queue, _timer_queue, _timer_queue_size * sizeof(TIMER_QUEUE));
+   memcpy(heap, timer_heap, timer_heap_count * sizeof(int));
+
+   for (x=_timer_queue_size; x<size; x++)
+      clear_timer_slot(&queue[x]);
+
+   if (_timer_queue != timer_queue_static) {
+      _AL_FREE(_timer_queue);
+      _AL_FREE(timer_heap);
+   }
+
+   _timer_queue = queue;
+   timer_heap = heap;
+   _timer_queue_size = size;
+
+   return 0;
+}
+
+#endif
+
+
+
 /* find_empty_timer_slot:
- *  Searches the list of user timer callbacks for an empty slot.
+ *  Searches the list of user timer callbacks for an empty slot, making
+ *  room for more if the platform allows it.
  */
 static int find_empty_timer_slot(void)
 {
    int x;
 
-   for (x=0; x<MAX_TIMERS; x++)
+   for (x=0; x<_timer_queue_size; x++)
       if ((!_timer_queue[x].proc) && (!_timer_queue[x].param_proc))
 	 return x;
 
+#ifdef ALLEGRO_MULTITHREADED
+   if (grow_timer_queue() == 0)
+      return x;
+#endif
+
    return -1;
 }
 
@@ -313,6 +726,7 @@ END_OF_STATIC_FUNCTION(find_empty_timer_slot);
  */
 static int install_timer_int(void *proc, void *param, long speed, int param_used)
 {
+   TIMER_QUEUE *t;
    int x;
 
    if (!timer_driver) {                   /* make sure we are installed */
@@ -323,41 +737,58 @@ static int install_timer_int(void *proc, void *param, long speed, int param_used
    if (param_used) {
       if (timer_driver->install_param_int) 
 	 return timer_driver->install_param_int((void (*)(void *))proc, param, speed);
-
-      x = find_param_timer_slot((void (*)(void *))proc, param);
    }
    else {
       if (timer_driver->install_int) 
 	 return timer_driver->install_int((void (*)(void))proc, speed);
+   }
+
+#ifdef ALLEGRO_MULTITHREADED
+   system_driver->lock_mutex(timer_mutex);
+#endif
 
+   if (param_used)
+      x = find_param_timer_slot((void (*)(void *))proc, param);
+   else
       x = find_timer_slot((void (*)(void))proc); 
-   }
 
    if (x < 0)
       x = find_empty_timer_slot();
 
-   if (x < 0)
-      return -1;
-
+   if (x < 0) {
 #ifdef ALLEGRO_MULTITHREADED
-   system_driver->lock_mutex(timer_mutex);
+      system_driver->unlock_mutex(timer_mutex);
 #endif
+      return -1;
+   }
+
+   t = &_timer_queue[x];
 
-   if ((proc == _timer_queue[x].proc) || (proc == _timer_queue[x].param_proc)) { 
-      _timer_queue[x].counter -= _timer_queue[x].speed;
-      _timer_queue[x].counter += speed;
+   if ((proc == t->proc) || (proc == t->param_proc)) { 
+      t->counter -= t->speed;
+      t->counter += speed;
+      if (t->heap_pos >= 0)
+	 t->due += speed - t->speed;
+      else
+	 t->due = timer_clock + speed;
    }
    else {
-      _timer_queue[x].counter = speed;
+      t->counter = speed;
+      t->due = timer_clock + speed;
       if (param_used) {
-	 _timer_queue[x].param = param;
-	 _timer_queue[x].param_proc = proc;
+	 t->param = param;
+	 t->param_proc = proc;
       }
       else
-	 _timer_queue[x].proc = proc;
+	 t->proc = proc;
    }
 
-   _timer_queue[x].speed = speed;
+   t->speed = speed;
+
+   if (speed > 0)
+      timer_heap_update(x);
+   else
+      timer_heap_remove(x);
 
 #ifdef ALLEGRO_MULTITHREADED
    system_driver->unlock_mutex(timer_mutex);
@@ -434,33 +865,32 @@ static void remove_timer_int(void *proc, void *param, int param_used)
 	 timer_driver->remove_param_int((void (*)(void *))proc, param);
 	 return;
       }
-
-      x = find_param_timer_slot((void (*)(void *))proc, param);
    }
    else {
       if ((timer_driver) && (timer_driver->remove_int)) {
 	 timer_driver->remove_int((void (*)(void))proc);
 	 return;
       }
-
-      x = find_timer_slot((void (*)(void))proc); 
    }
 
-   if (x < 0)
-      return;
-
 #ifdef ALLEGRO_MULTITHREADED
-   system_driver->lock_mutex(timer_mutex);
+   if (timer_mutex)
+      system_driver->lock_mutex(timer_mutex);
 #endif
 
-   _timer_queue[x].proc = NULL;
-   _timer_queue[x].param_proc = NULL;
-   _timer_queue[x].param = NULL;
-   _timer_queue[x].speed = 0;
-   _timer_queue[x].counter = 0;
+   if (param_used)
+      x = find_param_timer_slot((void (*)(void *))proc, param);
+   else
+      x = find_timer_slot((void (*)(void))proc); 
+
+   if (x >= 0) {
+      timer_heap_remove(x);
+      clear_timer_slot(&_timer_queue[x]);
+   }
 
 #ifdef ALLEGRO_MULTITHREADED
-   system_driver->unlock_mutex(timer_mutex);
+   if (timer_mutex)
+      system_driver->unlock_mutex(timer_mutex);
 #endif
 }
 
@@ -499,13 +929,18 @@ static void clear_timer_queue(void)
 {
    int i;
 
-   for (i=0; i<MAX_TIMERS; i++) {
-      _timer_queue[i].proc = NULL;
-      _timer_queue[i].param_proc = NULL;
-      _timer_queue[i].param = NULL;
-      _timer_queue[i].speed = 0;
-      _timer_queue[i].counter = 0;
+   if (_timer_queue != timer_queue_static) {
+      _AL_FREE(_timer_queue);
+      _AL_FREE(timer_heap);
+      _timer_queue = timer_queue_static;
+      timer_heap = timer_heap_static;
+      _timer_queue_size = MAX_TIMERS;
    }
+
+   for (i=0; i<MAX_TIMERS; i++)
+      clear_timer_slot(&_timer_queue[i]);
+
+   timer_heap_count = 0;
 }
 
 
@@ -518,6 +953,7 @@ static void clear_timer_queue(void)
 int install_timer(void)
 {
    _DRIVER_INFO *driver_list;
+   char tmp1[64], tmp2[64];
    int i;
 
    if (timer_driver)
@@ -530,10 +966,21 @@ int install_timer(void)
    _timer_use_retrace = FALSE;
    _retrace_hpp_value = -1;
    timer_delay = 0;
+   timer_clock = 0;
+
+   timer_max_catchup = get_config_int(uconvert_ascii("system", tmp1),
+				      uconvert_ascii("timer_max_catchup", tmp2), 0);
 
    LOCK_VARIABLE(timer_driver);
    LOCK_VARIABLE(timer_delay);
    LOCK_VARIABLE(_timer_queue);
+   LOCK_VARIABLE(_timer_queue_size);
+   LOCK_VARIABLE(timer_queue_static);
+   LOCK_VARIABLE(timer_heap);
+   LOCK_VARIABLE(timer_heap_static);
+   LOCK_VARIABLE(timer_heap_count);
+   LOCK_VARIABLE(timer_clock);
+   LOCK_VARIABLE(timer_max_catchup);
    LOCK_VARIABLE(timer_semaphore);
    LOCK_VARIABLE(vsync_counter);
    LOCK_VARIABLE(_timer_use_retrace);
@@ -542,10 +989,18 @@ int install_timer(void)
    LOCK_VARIABLE(retrace_proc);
    LOCK_VARIABLE(rest_count);
    LOCK_FUNCTION(rest_int);
+   LOCK_VARIABLE(frame_fallback_clock);
+   LOCK_FUNCTION(frame_fallback_tick);
    LOCK_FUNCTION(_handle_timer_tick);
    LOCK_FUNCTION(find_timer_slot);
    LOCK_FUNCTION(find_param_timer_slot);
    LOCK_FUNCTION(find_empty_timer_slot);
+   LOCK_FUNCTION(clear_timer_slot);
+   LOCK_FUNCTION(timer_heap_set);
+   LOCK_FUNCTION(timer_heap_up);
+   LOCK_FUNCTION(timer_heap_down);
+   LOCK_FUNCTION(timer_heap_update);
+   LOCK_FUNCTION(timer_heap_remove);
    LOCK_FUNCTION(install_timer_int);
    LOCK_FUNCTION(install_int);
    LOCK_FUNCTION(install_int_ex);
@@ -601,6 +1056,9 @@ void remove_timer(void)
 
    _timer_use_retrace = FALSE;
 
+   frame_period = 0;
+   frame_fallback = FALSE;
+
    timer_driver->exit();
    timer_driver = NULL;
 
@@ -34,6 +34,11 @@
    #define ALSA_PCM_NEW_HW_PARAMS_API 1
    #include <alsa/asoundlib.h>
    #include <math.h>
+   #ifdef ALLEGRO_HAVE_LIBPTHREAD
+      #include <pthread.h>
+      #include <sched.h>
+      #include <signal.h>
+   #endif
 #endif
 
 
@@ -79,6 +84,13 @@ static double alsa_mixer_allegro_ratio = 0.0;
 #define ALSA_DEFAULT_BUFFER_MS  100
 #define ALSA_DEFAULT_NUMFRAGS   5
 
+/* in mmap mode the whole ring is kept under 10 ms by default */
+#define ALSA_MMAP_BUFFER_MS     8
+#define ALSA_MMAP_NUMFRAGS      3
+
+/* longest time the mmap thread sleeps before it checks whether to quit */
+#define ALSA_MMAP_POLL_MS       100
+
 static snd_pcm_t *pcm_handle;
 static unsigned char *alsa_bufdata;
 static int alsa_bits, alsa_signed, alsa_stereo;
@@ -90,6 +102,16 @@ static struct pollfd *ufds = NULL;
 static int pdc = 0;
 static int poll_next;
 
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+static int alsa_mmap;                     /* mixing straight into the ring? */
+static pthread_t alsa_mmap_thread;
+static volatile int alsa_mmap_quit;
+static snd_pcm_uframes_t alsa_pending;    /* frames left in alsa_bufdata */
+#define ALSA_MMAP_MODE  alsa_mmap
+#else
+#define ALSA_MMAP_MODE  FALSE
+#endif
+
 static char alsa_desc[256] = EMPTY_STRING;
 
 static int alsa_detect(int input);
@@ -176,6 +198,7 @@ static int xrun_recovery(snd_pcm_t *handle, int err)
       err = snd_pcm_prepare(pcm_handle);
       if (err < 0)
 	 fprintf(stderr, "Can't recovery from underrun, prepare failed: %s\n", snd_strerror(err));
+      _mixer_stats_underrun(err >= 0);
       return 0;
    }
    /* TODO: Can't wait here like that - we are inside an 'interrupt' after all. */
@@ -260,6 +283,122 @@ static void alsa_update(int threaded)
 
 
 
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+
+/* alsa_mmap_recover:
+ *  Gets the PCM going again after an underrun or a suspend. Unlike
+ *  alsa_update(), the mmap thread is free to wait for a suspended device
+ *  to come back.
+ */
+static void alsa_mmap_recover(int err)
+{
+   if (xrun_recovery(pcm_handle, err) < 0) {
+      if (err == -ESTRPIPE) {
+	 while (((err = snd_pcm_resume(pcm_handle)) == -EAGAIN) && (!alsa_mmap_quit))
+	    _unix_rest_usec(10000);
+      }
+
+      if ((err < 0) && (snd_pcm_prepare(pcm_handle) < 0))
+	 _unix_rest_usec(ALSA_MMAP_POLL_MS * 1000);
+   }
+}
+
+
+
+/* alsa_mmap_fill:
+ *  Fills one period of the ring. The mixer normally renders straight into
+ *  the mapped area; only when the hardware gives us less than a period in
+ *  one piece does the period go through alsa_bufdata.
+ */
+static int alsa_mmap_fill(void)
+{
+   const snd_pcm_channel_area_t *areas;
+   snd_pcm_uframes_t offset, frames;
+   snd_pcm_sframes_t ret;
+   unsigned char *dst;
+   int err;
+
+   frames = alsa_bufsize;
+   err = snd_pcm_mmap_begin(pcm_handle, &areas, &offset, &frames);
+   if (err < 0)
+      return err;
+
+   dst = (unsigned char *)areas[0].addr + (areas[0].first / 8) + offset * alsa_sample_size;
+
+   if ((alsa_pending == 0) && (frames >= alsa_bufsize)) {
+      _mix_some_samples((uintptr_t)dst, 0, alsa_signed);
+      frames = alsa_bufsize;
+   }
+   else {
+      if (alsa_pending == 0) {
+	 _mix_some_samples((uintptr_t)alsa_bufdata, 0, alsa_signed);
+	 alsa_pending = alsa_bufsize;
+      }
+
+      frames = MIN(frames, alsa_pending);
+      memcpy(dst, alsa_bufdata + (alsa_bufsize - alsa_pending) * alsa_sample_size,
+	     frames * alsa_sample_size);
+      alsa_pending -= frames;
+   }
+
+   ret = snd_pcm_mmap_commit(pcm_handle, offset, frames);
+   if (ret < 0)
+      return ret;
+
+   return (ret == (snd_pcm_sframes_t)frames) ? 0 : -EPIPE;
+}
+
+
+
+/* alsa_mmap_proc:
+ *  The audio thread of the mmap mode: sleeps on the PCM descriptors until
+ *  a period is free, and fills it.
+ */
+static void *alsa_mmap_proc(void *arg)
+{
+   struct sched_param sparam;
+   snd_pcm_sframes_t avail;
+   unsigned short revents;
+   sigset_t mask;
+   int err;
+
+   sigfillset(&mask);
+   pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+   /* running ahead of everything else is what keeps the latency low, but
+    * only privileged processes may ask for it */
+   sparam.sched_priority = sched_get_priority_min(SCHED_FIFO);
+   pthread_setschedparam(pthread_self(), SCHED_FIFO, &sparam);
+
+   while (!alsa_mmap_quit) {
+      avail = snd_pcm_avail_update(pcm_handle);
+      if (avail < 0) {
+	 alsa_mmap_recover(avail);
+	 continue;
+      }
+
+      if ((snd_pcm_uframes_t)avail < alsa_bufsize) {
+	 if (poll(ufds, pdc, ALSA_MMAP_POLL_MS) <= 0)
+	    continue;
+
+	 snd_pcm_poll_descriptors_revents(pcm_handle, ufds, pdc, &revents);
+	 if (revents & POLLERR)
+	    alsa_mmap_recover((snd_pcm_state(pcm_handle) == SND_PCM_STATE_SUSPENDED) ? -ESTRPIPE : -EPIPE);
+	 continue;
+      }
+
+      err = alsa_mmap_fill();
+      if (err < 0)
+	 alsa_mmap_recover(err);
+   }
+
+   return NULL;
+}
+
+#endif
+
+
+
 /* alsa_detect:
  *  Detects driver presence.
  */
@@ -291,9 +430,10 @@ static int alsa_detect(int input)
 static int alsa_init(int input, int voices)
 {
    int ret = 0;
-   char tmp1[128], tmp2[128];
+   char tmp1[128], tmp2[128], tmp3[128];
    int format = 0;
    unsigned int numfrags = 0;
+   int fd_events;
    snd_pcm_uframes_t fragsize;
 
    if (input) {
@@ -314,9 +454,14 @@ static int alsa_init(int input, int voices)
    fragsize = get_config_int(uconvert_ascii("sound", tmp1),
 			     uconvert_ascii("alsa_fragsize", tmp2), 0);
 
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+   alsa_mmap = get_config_int(uconvert_ascii("sound", tmp1),
+			      uconvert_ascii("alsa_mmap", tmp2), 0);
+#endif
+
    numfrags = get_config_int(uconvert_ascii("sound", tmp1),
 			     uconvert_ascii("alsa_numfrags", tmp2),
-			     ALSA_DEFAULT_NUMFRAGS);
+			     ALSA_MMAP_MODE ? ALSA_MMAP_NUMFRAGS : ALSA_DEFAULT_NUMFRAGS);
 
    ret = snd_pcm_open(&pcm_handle, alsa_device, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
    if (ret < 0) {
@@ -357,12 +502,20 @@ static int alsa_init(int input, int voices)
 
    format = ((alsa_bits == 16) ? SND_PCM_FORMAT_U16_NE : SND_PCM_FORMAT_U8);
 
+   /* the ring is the hardware's own buffer, so use the format most cards
+    * have rather than relying on a plugin to convert */
+   if ((ALSA_MMAP_MODE) && (alsa_bits == 16)) {
+      format = SND_PCM_FORMAT_S16_NE;
+      alsa_signed = 1;
+   }
+
    switch (format) {
 
       case SND_PCM_FORMAT_U8:
 	 alsa_bits = 8;
 	 break;
 
+      case SND_PCM_FORMAT_S16_NE:
       case SND_PCM_FORMAT_U16_NE:
 	 if (sizeof(short) != 2) {
 	    ustrzcpy(allegro_error, ALLEGRO_ERROR_SIZE, get_config_text("Unsupported sample format"));
@@ -378,7 +531,7 @@ static int alsa_init(int input, int voices)
    alsa_sample_size = (alsa_bits / 8) * (alsa_stereo ? 2 : 1);
 
    if (fragsize == 0) {
-      unsigned int size = alsa_rate * ALSA_DEFAULT_BUFFER_MS / 1000 / numfrags;
+      unsigned int size = alsa_rate * (ALSA_MMAP_MODE ? ALSA_MMAP_BUFFER_MS : ALSA_DEFAULT_BUFFER_MS) / 1000 / numfrags;
       fragsize = 1;
       while (fragsize < size)
 	 fragsize <<= 1;
@@ -388,7 +541,8 @@ static int alsa_init(int input, int voices)
    snd_pcm_sw_params_malloc(&swparams);
 
    ALSA9_CHECK(snd_pcm_hw_params_any(pcm_handle, hwparams));
-   ALSA9_CHECK(snd_pcm_hw_params_set_access(pcm_handle, hwparams, SND_PCM_ACCESS_RW_INTERLEAVED));
+   ALSA9_CHECK(snd_pcm_hw_params_set_access(pcm_handle, hwparams,
+      ALSA_MMAP_MODE ? SND_PCM_ACCESS_MMAP_INTERLEAVED : SND_PCM_ACCESS_RW_INTERLEAVED));
    ALSA9_CHECK(snd_pcm_hw_params_set_format(pcm_handle, hwparams, format));
    ALSA9_CHECK(snd_pcm_hw_params_set_channels(pcm_handle, hwparams, alsa_stereo + 1));
 
@@ -404,8 +558,10 @@ static int alsa_init(int input, int voices)
    TRACE (PREFIX_I "alsa_bufsize = %ld, alsa_fragments = %d\n", alsa_bufsize, alsa_fragments);
 
    ALSA9_CHECK(snd_pcm_sw_params_current(pcm_handle, swparams));
-   ALSA9_CHECK(snd_pcm_sw_params_set_start_threshold(pcm_handle, swparams, alsa_bufsize));
-   ALSA9_CHECK(snd_pcm_sw_params_set_avail_min(pcm_handle, swparams, fragsize));
+   /* in mmap mode the ring is filled up before the card starts */
+   ALSA9_CHECK(snd_pcm_sw_params_set_start_threshold(pcm_handle, swparams,
+      ALSA_MMAP_MODE ? alsa_bufsize * alsa_fragments : alsa_bufsize));
+   ALSA9_CHECK(snd_pcm_sw_params_set_avail_min(pcm_handle, swparams, alsa_bufsize));
    ALSA9_CHECK(snd_pcm_sw_params_set_xfer_align(pcm_handle, swparams, 1));
    ALSA9_CHECK(snd_pcm_sw_params(pcm_handle, swparams));
 
@@ -442,17 +598,44 @@ static int alsa_init(int input, int voices)
 
    poll_next = 0;
 
-   _mix_some_samples((uintptr_t) alsa_bufdata, 0, alsa_signed);
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+   if (alsa_mmap) {
+      alsa_pending = 0;
+      alsa_mmap_quit = FALSE;
 
-   /* Add audio interrupt. */
-   _unix_bg_man->register_func(alsa_update);
+      if (pthread_create(&alsa_mmap_thread, NULL, alsa_mmap_proc, NULL) != 0) {
+	 ustrzcpy(allegro_error, ALLEGRO_ERROR_SIZE, get_config_text("Can not create audio thread"));
+	 goto Error;
+      }
+   }
+   else
+#endif
+   {
+      _mix_some_samples((uintptr_t) alsa_bufdata, 0, alsa_signed);
+
+      /* Add audio interrupt. A single descriptor can wake us as soon as
+       * there is room for another period; alsa_update() demangles its
+       * events.
+       */
+      if (pdc == 1) {
+	 fd_events = 0;
+	 if (ufds[0].events & POLLIN)
+	    fd_events |= BG_FUNC_READ;
+	 if (ufds[0].events & POLLOUT)
+	    fd_events |= BG_FUNC_WRITE;
+	 _unix_bg_man->register_func_ex(alsa_update, BG_DEFAULT_PERIOD, ufds[0].fd, fd_events);
+      }
+      else
+	 _unix_bg_man->register_func(alsa_update);
+   }
 
    uszprintf(alsa_desc, sizeof(alsa_desc),
 	     get_config_text
-	     ("Alsa 0.9, Device '%s': %d bits, %s, %d bps, %s"),
+	     ("Alsa 0.9, Device '%s': %d bits, %s, %d bps, %s%s"),
 	     alsa_device, alsa_bits,
 	     uconvert_ascii((alsa_signed ? "signed" : "unsigned"), tmp1),
-	     alsa_rate, uconvert_ascii((alsa_stereo ? "stereo" : "mono"), tmp2));
+	     alsa_rate, uconvert_ascii((alsa_stereo ? "stereo" : "mono"), tmp2),
+	     uconvert_ascii((ALSA_MMAP_MODE ? ", mmap" : ""), tmp3));
 
    digi_driver->desc = alsa_desc;
    return 0;
@@ -476,7 +659,14 @@ static void alsa_exit(int input)
    if (input)
       return;
 
-   _unix_bg_man->unregister_func(alsa_update);
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+   if (alsa_mmap) {
+      alsa_mmap_quit = TRUE;
+      pthread_join(alsa_mmap_thread, NULL);
+   }
+   else
+#endif
+      _unix_bg_man->unregister_func(alsa_update);
 
    _AL_FREE(alsa_bufdata);
    alsa_bufdata = NULL;
@@ -181,6 +181,18 @@ static int jack_process (jack_nframes_t nframes, void *arg)
 
 
 
+/* jack_xrun:
+ *  Called by JACK when a cycle missed its deadline. The server keeps on
+ *  running, so it counts as recovered.
+ */
+static int jack_xrun (void *arg)
+{
+   _mixer_stats_underrun(TRUE);
+   return 0;
+}
+
+
+
 /* jack_detect:
  *  Detects driver presence.
  */
@@ -230,6 +242,7 @@ static int jack_init(int input, int voices)
    jack_signed = 0;
 
    jack_set_process_callback (jack_client, jack_process, NULL);
+   jack_set_xrun_callback (jack_client, jack_xrun, NULL);
 
    output_left = jack_port_register (jack_client, jack_stereo ? "left" : "mono",
       JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
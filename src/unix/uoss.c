@@ -76,6 +76,7 @@ static int oss_fd;
 static int oss_bufsize;
 static unsigned char *oss_bufdata;
 static int oss_signed, oss_format;
+static int oss_started;
 
 static int oss_save_bits, oss_save_stereo, oss_save_freq;
 static int oss_rec_bufsize;
@@ -172,6 +173,12 @@ static void oss_update(int threaded)
    audio_buf_info bufinfo;
 
    if (ioctl(oss_fd, SNDCTL_DSP_GETOSPACE, &bufinfo) != -1) {
+      /* all fragments free means the device played everything we gave
+       * it, and OSS just carries on once there is more */
+      if ((oss_started) && (bufinfo.fragments >= bufinfo.fragstotal))
+	 _mixer_stats_underrun(TRUE);
+      oss_started = TRUE;
+
       /* Write fragments.  */
       for (i = 0; i < bufinfo.fragments; i++) {
 	 write(oss_fd, oss_bufdata, oss_bufsize);
@@ -396,7 +403,9 @@ static int oss_init(int input, int voices)
    _mix_some_samples((uintptr_t) oss_bufdata, 0, oss_signed);
 
    /* Add audio interrupt.  */
-   _unix_bg_man->register_func(oss_update);
+   /* refill as soon as a fragment is free */
+   oss_started = FALSE;
+   _unix_bg_man->register_func_ex(oss_update, BG_DEFAULT_PERIOD, oss_fd, BG_FUNC_WRITE);
 
    uszprintf(oss_desc, sizeof(oss_desc), get_config_text("%s: %d bits, %s, %d bps, %s"),
 		      _oss_driver, _sound_bits,
@@ -585,7 +594,9 @@ static void oss_rec_stop(void)
 
    open_oss_device(0);
 
-   _unix_bg_man->register_func(oss_update);
+   /* refill as soon as a fragment is free */
+   oss_started = FALSE;
+   _unix_bg_man->register_func_ex(oss_update, BG_DEFAULT_PERIOD, oss_fd, BG_FUNC_WRITE);
 }
 
 
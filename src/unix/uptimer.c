@@ -26,8 +26,14 @@
 #include <pthread.h>
 #include <signal.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/time.h>
 
+#ifdef ALLEGRO_HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+
 
 /* See hack later.  */
 #ifdef ALLEGRO_LINUX_VGA
@@ -39,8 +45,12 @@
 #endif
 
 
-#define TIMER_TO_USEC(x)  ((long)((x) / 1.193181))
-#define USEC_TO_TIMER(x)  ((long)((x) * (TIMERS_PER_SECOND / 1000000.)))
+/* split into whole seconds and the rest so that 64 bits never overflow,
+ * and round towards later times so we never wake up a tick early */
+#define NSEC_TO_TIMER(x)  ((x) / 1000000000 * TIMERS_PER_SECOND + \
+			   (x) % 1000000000 * TIMERS_PER_SECOND / 1000000000)
+#define TIMER_TO_NSEC(x)  ((x) / TIMERS_PER_SECOND * 1000000000 + \
+			   ((x) % TIMERS_PER_SECOND * 1000000000 + TIMERS_PER_SECOND - 1) / TIMERS_PER_SECOND)
 
 
 static int ptimer_init(void);
@@ -59,7 +69,9 @@ TIMER_DRIVER timerdrv_unix_pthreads =
    NULL, NULL,		/* install_int, remove_int */
    NULL, NULL,		/* install_param_int, remove_param_int */
    NULL, NULL,		/* can_simulate_retrace, simulate_retrace */
-   _unix_rest		/* rest */
+   _unix_rest,		/* rest */
+   _unix_read_usec,	/* read_usec */
+   _unix_rest_usec	/* rest_usec */
 };
 
 
@@ -67,6 +79,12 @@ TIMER_DRIVER timerdrv_unix_pthreads =
 static pthread_t thread;
 static int thread_alive;
 
+static int monotonic;
+
+#ifdef ALLEGRO_HAVE_SYS_TIMERFD_H
+static int timer_fd = -1;
+#endif
+
 
 
 static void block_all_signals(void)
@@ -80,15 +98,93 @@ static void block_all_signals(void)
 
 
 
+/* ptimer_clock:
+ *  Returns the time in nanoseconds, preferably from the monotonic clock,
+ *  which unlike gettimeofday() doesn't jump when the date is changed.
+ */
+static int64_t ptimer_clock(void)
+{
+   struct timeval tv;
+
+#if defined ALLEGRO_HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+   struct timespec ts;
+
+   if (monotonic) {
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+   }
+#endif
+
+   gettimeofday(&tv, 0);
+   return (int64_t)tv.tv_sec * 1000000000 + (int64_t)tv.tv_usec * 1000;
+}
+
+
+
+/* ptimer_sleep_until:
+ *  Sleeps until ptimer_clock() reaches `when'. Waiting for an absolute
+ *  time means that the time spent handling the tick doesn't add up.
+ */
+static void ptimer_sleep_until(int64_t when)
+{
+   struct timeval delay;
+   int64_t ns;
+
+#ifdef ALLEGRO_HAVE_SYS_TIMERFD_H
+   if ((monotonic) && (timer_fd >= 0)) {
+      struct itimerspec its;
+      uint64_t expirations;
+      ssize_t got;
+
+      its.it_interval.tv_sec = 0;
+      its.it_interval.tv_nsec = 0;
+      its.it_value.tv_sec = when / 1000000000;
+      its.it_value.tv_nsec = when % 1000000000;
+
+      if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == 0) {
+	 do {
+	    got = read(timer_fd, &expirations, sizeof(expirations));
+	 } while ((got < 0) && (errno == EINTR));
+
+	 /* anything else falls back to the sleeps below */
+	 if (got == sizeof(expirations))
+	    return;
+      }
+   }
+#endif
+
+#if defined ALLEGRO_HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC && defined TIMER_ABSTIME
+   if (monotonic) {
+      struct timespec ts;
+
+      ts.tv_sec = when / 1000000000;
+      ts.tv_nsec = when % 1000000000;
+
+      if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == 0)
+	 return;
+   }
+#endif
+
+   ns = when - ptimer_clock();
+   if (ns <= 0)
+      return;
+
+   /* `select' is more accurate than `usleep' on my system.  */
+   delay.tv_sec = ns / 1000000000;
+   delay.tv_usec = (ns % 1000000000) / 1000;
+   select(0, NULL, NULL, NULL, &delay);
+}
+
+
+
 /* ptimer_thread_func:
  *  The timer thread.
  */
 static void *ptimer_thread_func(void *unused)
 {
-   struct timeval old_time;
-   struct timeval new_time;
-   struct timeval delay;
-   long interval = 0x8000;
+   int64_t start, now, next;
+   int64_t ticks = 0, new_ticks;
+   long interval = 0;
 
    block_all_signals();
 
@@ -122,22 +218,21 @@ static void *ptimer_thread_func(void *unused)
    }
 #endif
 
-   gettimeofday(&old_time, 0);
+   start = ptimer_clock();
 
    while (thread_alive) {
-      /* `select' is more accurate than `usleep' on my system.  */
-      delay.tv_sec = interval / TIMERS_PER_SECOND;
-      delay.tv_usec = TIMER_TO_USEC(interval) % 1000000L;
-      select(0, NULL, NULL, NULL, &delay);
-
-      /* Calculate actual time elapsed.  */
-      gettimeofday(&new_time, 0);
-      interval = USEC_TO_TIMER((new_time.tv_sec - old_time.tv_sec) * 1000000L
-			       + (new_time.tv_usec - old_time.tv_usec));
-      old_time = new_time;
-
-      /* Handle a tick.  */
+      /* Calculate actual time elapsed. Counting whole ticks since the
+       * start, rather than rounding each interval, means no drift.  */
+      now = ptimer_clock();
+      new_ticks = NSEC_TO_TIMER(now - start);
+      interval = new_ticks - ticks;
+      ticks = new_ticks;
+
+      /* Handle a tick, and sleep until the next callback is due.  */
       interval = _handle_timer_tick(interval);
+
+      next = start + TIMER_TO_NSEC(ticks + interval);
+      ptimer_sleep_until(next);
    }
 
    return NULL;
@@ -150,10 +245,30 @@ static void *ptimer_thread_func(void *unused)
  */
 static int ptimer_init(void)
 {
+#if defined ALLEGRO_HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+   struct timespec ts;
+
+   /* all the clocks used must agree, so decide once */
+   monotonic = (clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+#else
+   monotonic = FALSE;
+#endif
+
+#ifdef ALLEGRO_HAVE_SYS_TIMERFD_H
+   /* we can do without it on kernels older than 2.6.25 */
+   timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+#endif
+
    thread_alive = 1;
 
    if (pthread_create(&thread, NULL, ptimer_thread_func, NULL) != 0) {
       thread_alive = 0;
+#ifdef ALLEGRO_HAVE_SYS_TIMERFD_H
+      if (timer_fd >= 0) {
+	 close(timer_fd);
+	 timer_fd = -1;
+      }
+#endif
       return -1;
    }
 
@@ -171,6 +286,13 @@ static void ptimer_exit(void)
       thread_alive = 0;
       pthread_join(thread, NULL);
    }
+
+#ifdef ALLEGRO_HAVE_SYS_TIMERFD_H
+   if (timer_fd >= 0) {
+      close(timer_fd);
+      timer_fd = -1;
+   }
+#endif
 }
 
 
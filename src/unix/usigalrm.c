@@ -310,6 +310,13 @@ static int bg_man_sigalrm_register_func(bg_func f)
 }
 
 
+static int bg_man_sigalrm_register_func_ex(bg_func f, int period, int fd, int fd_events)
+{
+   /* everything runs from the SIGALRM tick */
+   return bg_man_sigalrm_register_func(f);
+}
+
+
 static int bg_man_sigalrm_unregister_func(bg_func f)
 {
    int i;
@@ -354,7 +361,8 @@ struct bg_manager _bg_man_sigalrm =
    bg_man_sigalrm_unregister_func,
    bg_man_sigalrm_enable_interrupts,
    bg_man_sigalrm_disable_interrupts,
-   bg_man_sigalrm_interrupts_disabled
+   bg_man_sigalrm_interrupts_disabled,
+   bg_man_sigalrm_register_func_ex
 };
 
 
@@ -39,6 +39,9 @@ BEGIN_DIGI_DRIVER_LIST
 #if (defined ALLEGRO_WITH_OSSDIGI)
    DIGI_DRIVER_OSS
 #endif
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+   DIGI_DRIVER_WAV
+#endif
 END_DIGI_DRIVER_LIST
 
 
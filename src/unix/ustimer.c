@@ -41,7 +41,9 @@ TIMER_DRIVER timerdrv_unix_sigalrm =
    NULL, NULL,		/* install_int, remove_int */
    NULL, NULL,		/* install_param_int, remove_param_int */
    NULL, NULL,		/* can_simulate_retrace, simulate_retrace */
-   _unix_rest		/* rest */
+   _unix_rest,		/* rest */
+   _unix_read_usec,	/* read_usec */
+   _unix_rest_usec	/* rest_usec */
 };
 
 
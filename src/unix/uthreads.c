@@ -28,6 +28,18 @@
 #include <signal.h>
 #include <sys/time.h>
 #include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+#if defined ALLEGRO_HAVE_SYS_EPOLL_H && defined ALLEGRO_HAVE_SYS_TIMERFD_H
+   #define BG_MAN_EPOLL
+   #include <sys/epoll.h>
+   #include <sys/timerfd.h>
+#endif
 
 
 static void bg_man_pthreads_enable_interrupts(void);
@@ -35,7 +47,22 @@ static void bg_man_pthreads_disable_interrupts(void);
 
 #define MAX_FUNCS 16
 
-static bg_func funcs[MAX_FUNCS];
+/* shortest time between two calls caused by the same descriptor, so that
+ * a callback which leaves its descriptor ready can't hog the thread */
+#define MIN_FD_INTERVAL 1000
+
+typedef struct BG_FUNC_INFO
+{
+   bg_func func;
+   int period;             /* microseconds between calls, or 0 */
+   int fd;                 /* descriptor to wait on, or -1 */
+   int fd_events;          /* BG_FUNC_READ and/or BG_FUNC_WRITE */
+   int fd_armed;           /* fd is part of the wait set */
+   int64_t next_call;      /* when the period next expires */
+   int64_t fd_rearm;       /* when fd may be watched again */
+} BG_FUNC_INFO;
+
+static BG_FUNC_INFO funcs[MAX_FUNCS];
 static int max_func; /* highest+1 used entry */
 
 static pthread_t thread = 0;
@@ -44,6 +71,18 @@ static pthread_mutex_t cli_mutex;
 static pthread_cond_t cli_cond;
 static int cli_count;
 
+static int wake_pipe[2] = { -1, -1 };
+
+#ifdef BG_MAN_EPOLL
+static int epoll_fd = -1;
+static int timer_fd = -1;
+#endif
+
+/* wait set for poll(), rebuilt by the thread on every pass */
+static struct pollfd poll_fds[MAX_FUNCS + 1];
+static int poll_func[MAX_FUNCS + 1];
+static int poll_count;
+
 
 
 /* block_all_signals:
@@ -62,53 +101,254 @@ static void block_all_signals(void)
 
 #ifndef ALLEGRO_MACOSX
 
+/* bg_man_time:
+ *  Returns the current time in microseconds, from the monotonic clock
+ *  where there is one.
+ */
+static int64_t bg_man_time(void)
+{
+   struct timeval tv;
+
+#if defined ALLEGRO_HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+   struct timespec ts;
+
+   if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+      return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+
+   gettimeofday(&tv, NULL);
+   return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+
+/* bg_man_wake:
+ *  Interrupts the wait of the background thread, so that it picks up
+ *  changes to the function list. A full pipe (EAGAIN) is fine, since
+ *  there is a wakeup pending already.
+ */
+static void bg_man_wake(void)
+{
+   char c = 0;
+
+   if (wake_pipe[1] < 0)
+      return;
+
+   while ((write(wake_pipe[1], &c, 1) < 0) && (errno == EINTR))
+      ;
+}
+
+
+
+/* bg_man_drain_wake:
+ *  Empties the wakeup pipe.
+ */
+static void bg_man_drain_wake(void)
+{
+   char buf[64];
+
+   while (read(wake_pipe[0], buf, sizeof(buf)) > 0)
+      ;
+}
+
+
+
+/* bg_man_arm_fd:
+ *  Adds the descriptor of function `n' to the wait set.
+ */
+static void bg_man_arm_fd(int n)
+{
+#ifdef BG_MAN_EPOLL
+   struct epoll_event ev;
+
+   if (epoll_fd >= 0) {
+      ev.events = EPOLLONESHOT;
+      if (funcs[n].fd_events & BG_FUNC_READ)
+	 ev.events |= EPOLLIN;
+      if (funcs[n].fd_events & BG_FUNC_WRITE)
+	 ev.events |= EPOLLOUT;
+      ev.data.u32 = n;
+
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, funcs[n].fd, &ev) != 0)
+	 epoll_ctl(epoll_fd, EPOLL_CTL_ADD, funcs[n].fd, &ev);
+   }
+#endif
+
+   funcs[n].fd_armed = TRUE;
+}
+
+
+
+/* bg_man_prepare_wait:
+ *  Re-arms the descriptors that are allowed to wake us again and returns
+ *  the time at which the next periodic call is due, or -1 if there is
+ *  none. Called with cli_mutex held.
+ */
+static int64_t bg_man_prepare_wait(int64_t now)
+{
+   int64_t next = -1;
+   int n;
+
+   poll_count = 0;
+   poll_fds[poll_count].fd = wake_pipe[0];
+   poll_fds[poll_count].events = POLLIN;
+   poll_func[poll_count++] = -1;
+
+   for (n = 0; n < max_func; n++) {
+      BG_FUNC_INFO *info = &funcs[n];
+
+      if (!info->func)
+	 continue;
+
+      if (info->period > 0) {
+	 if ((next < 0) || (info->next_call < next))
+	    next = info->next_call;
+      }
+
+      if (info->fd < 0)
+	 continue;
+
+      if (!info->fd_armed) {
+	 if (now >= info->fd_rearm)
+	    bg_man_arm_fd(n);
+	 else if ((next < 0) || (info->fd_rearm < next))
+	    next = info->fd_rearm;
+      }
+
+      if (info->fd_armed) {
+	 poll_fds[poll_count].fd = info->fd;
+	 poll_fds[poll_count].events = 0;
+	 if (info->fd_events & BG_FUNC_READ)
+	    poll_fds[poll_count].events |= POLLIN;
+	 if (info->fd_events & BG_FUNC_WRITE)
+	    poll_fds[poll_count].events |= POLLOUT;
+	 poll_func[poll_count++] = n;
+      }
+   }
+
+   return next;
+}
+
+
+
+/* bg_man_wait:
+ *  Sleeps until `when' (or forever if -1), a descriptor in the wait set
+ *  becomes ready, or someone calls bg_man_wake(). Flags the functions
+ *  whose descriptors fired in `ready'.
+ */
+static void bg_man_wait(int64_t when, int *ready)
+{
+   int64_t delay = -1;
+   int i, n;
+
+   if (when >= 0) {
+      delay = when - bg_man_time();
+      if (delay <= 0)
+	 return;
+   }
+
+#ifdef BG_MAN_EPOLL
+   if (epoll_fd >= 0) {
+      struct epoll_event ev[MAX_FUNCS + 2];
+      struct itimerspec its;
+
+      /* the timer gives us microsecond wakeups, epoll_wait() only has
+       * millisecond timeouts */
+      memset(&its, 0, sizeof(its));
+      if (delay > 0) {
+	 its.it_value.tv_sec = delay / 1000000;
+	 its.it_value.tv_nsec = (delay % 1000000) * 1000;
+      }
+      timerfd_settime(timer_fd, 0, &its, NULL);
+
+      n = epoll_wait(epoll_fd, ev, MAX_FUNCS + 2, -1);
+
+      for (i = 0; i < n; i++) {
+	 if (ev[i].data.u32 < MAX_FUNCS)
+	    ready[ev[i].data.u32] = TRUE;
+	 else if (ev[i].data.u32 == MAX_FUNCS + 1)
+	    bg_man_drain_wake();
+      }
+      return;
+   }
+#endif
+
+   /* round up, so that we don't wake up just before we are due */
+   n = poll(poll_fds, poll_count, (delay < 0) ? -1 : (int)((delay + 999) / 1000));
+
+   for (i = 0; (n > 0) && (i < poll_count); i++) {
+      if (poll_fds[i].revents) {
+	 if (poll_func[i] < 0)
+	    bg_man_drain_wake();
+	 else
+	    ready[poll_func[i]] = TRUE;
+      }
+   }
+}
+
+
+
 /* bg_man_pthreads_threadfunc:
- *  Thread function for the background thread.
+ *  Thread function for the background thread. Sleeps until a function's
+ *  period expires or its descriptor becomes ready, and calls whatever is
+ *  due.
  */
 static void *bg_man_pthreads_threadfunc(void *arg)
 {
-   struct timeval old_time, new_time;
-   struct timeval delay;
-   unsigned long interval;
+   int ready[MAX_FUNCS];
+   int64_t now, next;
+   bg_func f;
    int n;
 
    block_all_signals();
 
-   interval = 0;
-   gettimeofday(&old_time, 0);
+   for (n = 0; n < MAX_FUNCS; n++)
+      ready[n] = FALSE;
 
    while (thread_alive) {
-      gettimeofday(&new_time, 0);
-      /* add the new time difference to the remainder of the old difference */
-      interval += ((new_time.tv_sec - old_time.tv_sec) * 1000000L +
-		   (new_time.tv_usec - old_time.tv_usec));
-      old_time = new_time;
-
-      /* run the callbacks for each 10ms elapsed, but limit to 18ms */
-      if (interval > 18000)
-         interval = 18000;      
-      while (interval > 10000) {
-	 interval -= 10000;	  
-
-	 pthread_mutex_lock(&cli_mutex);
-
-	 /* wait until interrupts are enabled */
-	 while (cli_count > 0)
-	    pthread_cond_wait(&cli_cond, &cli_mutex);
-
-	 /* call all the callbacks */
-	 for (n = 0; n < max_func; n++) {
-	    if (funcs[n])
-	       funcs[n](1);
+      pthread_mutex_lock(&cli_mutex);
+
+      /* wait until interrupts are enabled */
+      while (cli_count > 0)
+	 pthread_cond_wait(&cli_cond, &cli_mutex);
+
+      /* call the callbacks that are due */
+      now = bg_man_time();
+
+      for (n = 0; n < max_func; n++) {
+	 BG_FUNC_INFO *info = &funcs[n];
+
+	 if (!info->func) {
+	    ready[n] = FALSE;
+	    continue;
 	 }
 
-	 pthread_mutex_unlock(&cli_mutex);
+	 if (ready[n] && (info->fd >= 0)) {
+	    info->fd_armed = FALSE;
+	    info->fd_rearm = now + MIN_FD_INTERVAL;
+	 }
+	 else if ((info->period <= 0) || (now < info->next_call))
+	    continue;
+
+	 ready[n] = FALSE;
+
+	 /* don't try to catch up on missed periods */
+	 if (info->period > 0) {
+	    info->next_call += info->period;
+	    if (info->next_call <= now)
+	       info->next_call = now + info->period;
+	 }
+
+	 /* the callback may unregister itself */
+	 f = info->func;
+	 f(1);
       }
 
-      /* rest a little bit before checking again */
-      delay.tv_sec = 0;
-      delay.tv_usec = 1000;
-      select(0, NULL, NULL, NULL, &delay);
+      next = bg_man_prepare_wait(bg_man_time());
+
+      pthread_mutex_unlock(&cli_mutex);
+
+      bg_man_wait(next, ready);
    }
 
    return NULL;
@@ -116,6 +356,32 @@ static void *bg_man_pthreads_threadfunc(void *arg)
 
 
 
+/* bg_man_pthreads_close_fds:
+ *  Closes the descriptors used for waiting.
+ */
+static void bg_man_pthreads_close_fds(void)
+{
+#ifdef BG_MAN_EPOLL
+   if (timer_fd >= 0) {
+      close(timer_fd);
+      timer_fd = -1;
+   }
+
+   if (epoll_fd >= 0) {
+      close(epoll_fd);
+      epoll_fd = -1;
+   }
+#endif
+
+   if (wake_pipe[0] >= 0) {
+      close(wake_pipe[0]);
+      close(wake_pipe[1]);
+      wake_pipe[0] = wake_pipe[1] = -1;
+   }
+}
+
+
+
 /* bg_man_pthreads_init:
  *  Spawns the background thread.
  */
@@ -127,10 +393,48 @@ static int bg_man_pthreads_init(void)
    ASSERT(!thread_alive);
 
    for (i = 0; i < MAX_FUNCS; i++)
-      funcs[i] = NULL;
+      funcs[i].func = NULL;
 
    max_func = 0;
 
+   if (pipe(wake_pipe) != 0) {
+      wake_pipe[0] = wake_pipe[1] = -1;
+      return -1;
+   }
+
+   for (i = 0; i < 2; i++) {
+      fcntl(wake_pipe[i], F_SETFL, fcntl(wake_pipe[i], F_GETFL) | O_NONBLOCK);
+      fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC);
+   }
+
+#ifdef BG_MAN_EPOLL
+   /* fall back to poll() on kernels without epoll or timerfd */
+   epoll_fd = epoll_create(MAX_FUNCS + 2);
+   if (epoll_fd >= 0) {
+      struct epoll_event ev;
+
+      fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+
+      timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+
+      if (timer_fd >= 0) {
+	 fcntl(timer_fd, F_SETFD, FD_CLOEXEC);
+
+	 ev.events = EPOLLIN;
+	 ev.data.u32 = MAX_FUNCS;
+	 epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+	 ev.events = EPOLLIN;
+	 ev.data.u32 = MAX_FUNCS + 1;
+	 epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_pipe[0], &ev);
+      }
+      else {
+	 close(epoll_fd);
+	 epoll_fd = -1;
+      }
+   }
+#endif
+
    cli_count = 0;
    pthread_mutex_init(&cli_mutex, NULL);
    pthread_cond_init(&cli_cond, NULL);
@@ -141,6 +445,7 @@ static int bg_man_pthreads_init(void)
       pthread_mutex_destroy(&cli_mutex);
       pthread_cond_destroy(&cli_cond);
       thread = 0;
+      bg_man_pthreads_close_fds();
       return -1;
    }
 
@@ -158,42 +463,71 @@ static void bg_man_pthreads_exit(void)
 
    if (thread) {
       thread_alive = FALSE;
+      bg_man_wake();
       pthread_join(thread, NULL);
       pthread_mutex_destroy(&cli_mutex);
       pthread_cond_destroy(&cli_cond);
       thread = 0;
+      bg_man_pthreads_close_fds();
    }
 }
 
 
 
-/* bg_man_pthreads_register_func:
- *  Registers a function to be called by the background thread.
+/* bg_man_pthreads_register_func_ex:
+ *  Registers a function to be called by the background thread every
+ *  `period' microseconds and/or whenever `fd' is ready for `fd_events'.
  */
-static int bg_man_pthreads_register_func(bg_func f)
+static int bg_man_pthreads_register_func_ex(bg_func f, int period, int fd, int fd_events)
 {
+   BG_FUNC_INFO *info;
    int i, ret = 0;
 
+   ASSERT(period > 0 || fd >= 0);
+
    bg_man_pthreads_disable_interrupts();
 
-   for (i = 0; i < MAX_FUNCS && funcs[i]; i++)
+   for (i = 0; i < MAX_FUNCS && funcs[i].func; i++)
       ;
 
    if (i == MAX_FUNCS)
       ret = -1;
    else {
-      funcs[i] = f;
+      info = &funcs[i];
+      info->func = f;
+      info->period = period;
+      info->fd = (fd_events ? fd : -1);
+      info->fd_events = fd_events;
+      info->fd_armed = FALSE;
+      info->next_call = bg_man_time() + period;
+      info->fd_rearm = 0;
+
+      if (info->fd >= 0)
+	 bg_man_arm_fd(i);
+
       if (i == max_func)
 	 max_func++;
    }
 
    bg_man_pthreads_enable_interrupts();
 
+   bg_man_wake();
+
    return ret;
 }
 
 
 
+/* bg_man_pthreads_register_func:
+ *  Registers a function to be called by the background thread.
+ */
+static int bg_man_pthreads_register_func(bg_func f)
+{
+   return bg_man_pthreads_register_func_ex(f, BG_DEFAULT_PERIOD, -1, 0);
+}
+
+
+
 /* really_unregister_func:
  *  Unregisters a function registered with bg_man_pthreads_register_func.
  */
@@ -201,17 +535,24 @@ static int really_unregister_func(bg_func f)
 {
    int i;
 
-   for (i = 0; i < max_func && funcs[i] != f; i++)
+   for (i = 0; i < max_func && funcs[i].func != f; i++)
       ;
 
    if (i == max_func)
       return -1;
    else {
-      funcs[i] = NULL;
+#ifdef BG_MAN_EPOLL
+      /* the caller is free to close the descriptor once we return */
+      if ((funcs[i].fd >= 0) && (epoll_fd >= 0)) {
+	 struct epoll_event ev;
+	 epoll_ctl(epoll_fd, EPOLL_CTL_DEL, funcs[i].fd, &ev);
+      }
+#endif
+      funcs[i].func = NULL;
       if (i+1 == max_func)
 	 do {
 	    max_func--;
-	 } while ((max_func > 0) && !funcs[max_func-1]);
+	 } while ((max_func > 0) && !funcs[max_func-1].func);
       return 0;
    }
 }
@@ -298,7 +639,8 @@ struct bg_manager _bg_man_pthreads = {
    bg_man_pthreads_unregister_func,
    bg_man_pthreads_enable_interrupts,
    bg_man_pthreads_disable_interrupts,
-   bg_man_pthreads_interrupts_disabled
+   bg_man_pthreads_interrupts_disabled,
+   bg_man_pthreads_register_func_ex
 };
 
 #endif
@@ -20,6 +20,7 @@
 
 #include "allegro.h"
 #include "allegro/platform/aintunix.h"
+#include <time.h>
 #include <sys/time.h>
 
 
@@ -68,55 +69,137 @@ static int timeval_subtract(struct timeval *result,
 
 
 
-void _unix_rest(unsigned int ms, void (*callback) (void))
+/* unix_monotonic:
+ *  Returns whether CLOCK_MONOTONIC can be used.
+ */
+static int unix_monotonic(void)
 {
-   if (callback) {
-      struct timeval tv, tv_end;
-
-      gettimeofday (&tv_end, NULL);
-      tv_end.tv_usec += ms * 1000;
-      tv_end.tv_sec  += (tv_end.tv_usec / 1000000L);
-      tv_end.tv_usec %= 1000000L;
-
-      while (1)
-      {
-         (*callback)();
-         gettimeofday (&tv, NULL);
-         if (tv.tv_sec > tv_end.tv_sec)
-            break;
-         if (tv.tv_sec == tv_end.tv_sec && tv.tv_usec >= tv_end.tv_usec)
-             break;
+#if defined ALLEGRO_HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+   static int monotonic = -1;
+   struct timespec ts;
+
+   if (monotonic < 0)
+      monotonic = (clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+
+   return monotonic;
+#else
+   return FALSE;
+#endif
+}
+
+
+
+/* _unix_read_usec:
+ *  Returns a wrapping microsecond count, from the monotonic clock where
+ *  there is one.
+ */
+unsigned long _unix_read_usec(void)
+{
+   struct timeval tv;
+
+#if defined ALLEGRO_HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+   struct timespec ts;
+
+   if (unix_monotonic()) {
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return (unsigned long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+   }
+#endif
+
+   gettimeofday(&tv, NULL);
+   return (unsigned long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+
+/* unix_sleep:
+ *  Sleeps for the specified time, resuming after signals.
+ */
+static void unix_sleep(unsigned long secs, unsigned long usecs)
+{
+   struct timeval now;
+   struct timeval end;
+   struct timeval delay;
+   int result;
+
+#if defined ALLEGRO_HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC && defined TIMER_ABSTIME
+   if (unix_monotonic()) {
+      struct timespec ts;
+
+      /* an absolute deadline survives being interrupted */
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      ts.tv_sec += secs + usecs / 1000000;
+      ts.tv_nsec += (usecs % 1000000) * 1000;
+      if (ts.tv_nsec >= 1000000000) {
+	 ts.tv_sec++;
+	 ts.tv_nsec -= 1000000000;
       }
+
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+	 ;
+      return;
    }
-   else {
-      struct timeval now;
-      struct timeval end;
-      struct timeval delay;
-      int result;
+#endif
 
-      gettimeofday(&now, NULL);
+   gettimeofday(&now, NULL);
 
-      end = now;
-      end.tv_usec += ms * 1000;
-      end.tv_sec  += (end.tv_usec / 1000000L);
-      end.tv_usec %= 1000000L;
+   end = now;
+   end.tv_sec  += secs;
+   end.tv_usec += usecs;
+   end.tv_sec  += (end.tv_usec / 1000000L);
+   end.tv_usec %= 1000000L;
 
-      while (1) {
-	 if (timeval_subtract(&delay, &end, &now))
-	    break;
+   while (1) {
+      if (timeval_subtract(&delay, &end, &now))
+	 break;
 
 #ifdef ALLEGRO_MACOSX
-	 result = usleep((delay.tv_sec * 1000000L) + delay.tv_usec);
+      result = usleep((delay.tv_sec * 1000000L) + delay.tv_usec);
 #else
-	 result = select(0, NULL, NULL, NULL, &delay);
+      result = select(0, NULL, NULL, NULL, &delay);
 #endif
-	 if (result == 0)	/* ok */
-	    break;
-	 if ((result != -1) || (errno != EINTR))
-	    break;
+      if (result == 0)	/* ok */
+	 break;
+      if ((result != -1) || (errno != EINTR))
+	 break;
+
+      /* interrupted */
+      gettimeofday(&now, NULL);
+   }
+}
 
-	 /* interrupted */
-	 gettimeofday(&now, NULL);
+
+
+/* _unix_rest_usec:
+ *  Sleeps for the specified number of microseconds.
+ */
+void _unix_rest_usec(unsigned long usecs)
+{
+   unix_sleep(0, usecs);
+}
+
+
+
+void _unix_rest(unsigned int ms, void (*callback) (void))
+{
+   if (callback) {
+      unsigned long start = _unix_read_usec();
+      unsigned int secs = ms / 1000;
+
+      /* whole seconds first, so that the microsecond count can't wrap */
+      while (secs > 0) {
+	 do {
+	    (*callback)();
+	 } while (_unix_read_usec() - start < 1000000);
+	 start += 1000000;
+	 secs--;
       }
+
+      do {
+	 (*callback)();
+      } while (_unix_read_usec() - start < (ms % 1000) * 1000UL);
+   }
+   else {
+      unix_sleep(ms / 1000, (ms % 1000) * 1000UL);
    }
 }
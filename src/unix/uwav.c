@@ -0,0 +1,384 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      WAV file sound driver.
+ *
+ *      Runs the mixer as fast as it can on a thread of its own, and
+ *      writes the output to a WAV or raw file instead of a soundcard.
+ *      The MIDI player is clocked by the amount of audio written, so
+ *      DIGMID renders the same file each time however busy the machine
+ *      is. Time in which nothing plays is skipped.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+
+#include "allegro.h"
+
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+
+#include "allegro/internal/aintern.h"
+#include "allegro/platform/aintunix.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/* frames mixed at a time */
+#define WAV_FRAMES      512
+
+/* size of the RIFF header written in front of the data */
+#define WAV_HEADER_SIZE 44
+
+static FILE *wav_file;
+static int wav_raw;
+static unsigned char *wav_bufdata;
+static int wav_bufsize;
+static int wav_bits, wav_stereo, wav_rate;
+static unsigned long wav_written;
+
+static pthread_t wav_thread;
+static volatile int wav_quit;
+
+static long wav_midi_rem;
+
+static int wav_detect(int input);
+static int wav_init(int input, int voices);
+static void wav_exit(int input);
+static int wav_set_mixer_volume(int volume);
+static int wav_buffer_size(void);
+
+static char wav_desc[256] = EMPTY_STRING;
+
+DIGI_DRIVER digi_wav =
+{
+   DIGI_WAV,
+   empty_string,
+   empty_string,
+   "WAV file",
+   0,
+   0,
+   MIXER_MAX_SFX,
+   MIXER_DEF_SFX,
+
+   wav_detect,
+   wav_init,
+   wav_exit,
+   wav_set_mixer_volume,
+   NULL,
+
+   NULL,
+   NULL,
+   wav_buffer_size,
+   _mixer_init_voice,
+   _mixer_release_voice,
+   _mixer_start_voice,
+   _mixer_stop_voice,
+   _mixer_loop_voice,
+
+   _mixer_get_position,
+   _mixer_set_position,
+
+   _mixer_get_volume,
+   _mixer_set_volume,
+   _mixer_ramp_volume,
+   _mixer_stop_volume_ramp,
+
+   _mixer_get_frequency,
+   _mixer_set_frequency,
+   _mixer_sweep_frequency,
+   _mixer_stop_frequency_sweep,
+
+   _mixer_get_pan,
+   _mixer_set_pan,
+   _mixer_sweep_pan,
+   _mixer_stop_pan_sweep,
+
+   _mixer_set_echo,
+   _mixer_set_tremolo,
+   _mixer_set_vibrato,
+   0, 0,
+   0,
+   0,
+   0,
+   0,
+   0,
+   0
+};
+
+
+
+/* wav_buffer_size:
+ *  Returns the size of a fragment in frames, for the audiostream code.
+ */
+static int wav_buffer_size(void)
+{
+   return WAV_FRAMES;
+}
+
+
+
+/* wav_put_long, wav_put_word:
+ *  Store little endian values in the header.
+ */
+static void wav_put_long(unsigned char *p, unsigned long v)
+{
+   p[0] = v & 0xFF;
+   p[1] = (v >> 8) & 0xFF;
+   p[2] = (v >> 16) & 0xFF;
+   p[3] = (v >> 24) & 0xFF;
+}
+
+static void wav_put_word(unsigned char *p, int v)
+{
+   p[0] = v & 0xFF;
+   p[1] = (v >> 8) & 0xFF;
+}
+
+
+
+/* wav_write_header:
+ *  Writes the RIFF header at the start of the file, for the given length
+ *  of the data chunk.
+ */
+static void wav_write_header(unsigned long size)
+{
+   unsigned char h[WAV_HEADER_SIZE];
+   int align = (wav_stereo ? 2 : 1) * wav_bits / 8;
+
+   /* keep the chunk sizes from wrapping around */
+   if (size > 0xFFFFFFFFUL - (WAV_HEADER_SIZE - 8))
+      size = 0xFFFFFFFFUL - (WAV_HEADER_SIZE - 8);
+
+   memcpy(h, "RIFF", 4);
+   wav_put_long(h+4, size + WAV_HEADER_SIZE - 8);
+   memcpy(h+8, "WAVEfmt ", 8);
+   wav_put_long(h+16, 16);
+   wav_put_word(h+20, 1);
+   wav_put_word(h+22, wav_stereo ? 2 : 1);
+   wav_put_long(h+24, wav_rate);
+   wav_put_long(h+28, wav_rate * align);
+   wav_put_word(h+32, align);
+   wav_put_word(h+34, wav_bits);
+   memcpy(h+36, "data", 4);
+   wav_put_long(h+40, size);
+
+   fseek(wav_file, 0, SEEK_SET);
+   fwrite(h, 1, WAV_HEADER_SIZE, wav_file);
+}
+
+
+
+/* wav_midi_ticks:
+ *  Returns the number of timer ticks which one fragment lasts for. The
+ *  remainder is carried over, so the MIDI player doesn't drift from the
+ *  audio however long the file is.
+ */
+static long wav_midi_ticks(void)
+{
+   long ticks = WAV_FRAMES * (TIMERS_PER_SECOND / wav_rate);
+
+   wav_midi_rem += WAV_FRAMES * (TIMERS_PER_SECOND % wav_rate);
+   ticks += wav_midi_rem / wav_rate;
+   wav_midi_rem %= wav_rate;
+
+   return ticks;
+}
+
+
+
+/* wav_render:
+ *  Thread which mixes fragments one after the other. Fragments are only
+ *  written while voices or the MIDI player are busy, otherwise it sleeps
+ *  until the program plays something.
+ */
+static void *wav_render(void *arg)
+{
+   sigset_t mask;
+   int midi;
+#ifdef ALLEGRO_BIG_ENDIAN
+   unsigned char *p, c;
+   int i;
+#endif
+
+   sigfillset(&mask);
+   pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+   while (!wav_quit) {
+      /* voice commands from the MIDI player can't wait for the mixer */
+      _mixer_set_idle(TRUE);
+      midi = _midi_clock(0);
+      _mixer_set_idle(FALSE);
+
+      _mix_some_samples((uintptr_t) wav_bufdata, 0, (wav_bits == 16));
+
+      if ((!midi) && (!_mixer_voices_active())) {
+	 _unix_rest_usec(1000);
+	 continue;
+      }
+
+#ifdef ALLEGRO_BIG_ENDIAN
+      /* the mixer writes 16 bit values in machine order */
+      if (wav_bits == 16) {
+	 for (i=0, p=wav_bufdata; i<wav_bufsize; i+=2, p+=2) {
+	    c = p[0];
+	    p[0] = p[1];
+	    p[1] = c;
+	 }
+      }
+#endif
+
+      wav_written += fwrite(wav_bufdata, 1, wav_bufsize, wav_file);
+
+      _mixer_set_idle(TRUE);
+      _midi_clock(wav_midi_ticks());
+      _mixer_set_idle(FALSE);
+   }
+
+   return NULL;
+}
+
+
+
+/* wav_detect:
+ *  The file can always be written, so there is nothing to detect.
+ */
+static int wav_detect(int input)
+{
+   if (input) {
+      ustrzcpy(allegro_error, ALLEGRO_ERROR_SIZE, get_config_text("Input is not supported"));
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+
+
+/* wav_init:
+ *  Opens the output file and starts the rendering thread.
+ */
+static int wav_init(int input, int voices)
+{
+   AL_CONST char *name;
+   char tmp1[128], tmp2[128], tmp3[128];
+   char s[1024];
+
+   if (input) {
+      ustrzcpy(allegro_error, ALLEGRO_ERROR_SIZE, get_config_text("Input is not supported"));
+      return -1;
+   }
+
+   name = get_config_string(uconvert_ascii("sound", tmp1),
+			    uconvert_ascii("wav_file", tmp2),
+			    uconvert_ascii("allegro.wav", tmp3));
+
+   wav_raw = (ustricmp(get_extension(name), uconvert_ascii("raw", tmp1)) == 0);
+
+   wav_bits = (_sound_bits == 8) ? 8 : 16;
+   wav_stereo = (_sound_stereo) ? 1 : 0;
+   wav_rate = (_sound_freq > 0) ? _sound_freq : 44100;
+
+   wav_file = fopen(uconvert_tofilename(name, s), "wb");
+   if (!wav_file) {
+      uszprintf(allegro_error, ALLEGRO_ERROR_SIZE, get_config_text("%s: can not open"), name);
+      return -1;
+   }
+
+   wav_written = 0;
+   if (!wav_raw)
+      wav_write_header(0);
+
+   wav_bufsize = WAV_FRAMES * (wav_stereo ? 2 : 1) * wav_bits / 8;
+   wav_bufdata = _AL_MALLOC_ATOMIC(wav_bufsize);
+   if (!wav_bufdata) {
+      ustrzcpy(allegro_error, ALLEGRO_ERROR_SIZE, get_config_text("Can not allocate audio buffer"));
+      fclose(wav_file);
+      return -1;
+   }
+
+   digi_wav.voices = voices;
+
+   if (_mixer_init(wav_bufsize / (wav_bits / 8), wav_rate, wav_stereo,
+		   ((wav_bits == 16) ? 1 : 0), &digi_wav.voices) != 0) {
+      ustrzcpy(allegro_error, ALLEGRO_ERROR_SIZE, get_config_text("Can not init software mixer"));
+      _AL_FREE(wav_bufdata);
+      wav_bufdata = NULL;
+      fclose(wav_file);
+      return -1;
+   }
+
+   /* the MIDI player keeps time with the file from now on */
+   _midi_set_clock(TRUE);
+   wav_midi_rem = 0;
+
+   wav_quit = FALSE;
+   if (pthread_create(&wav_thread, NULL, wav_render, NULL) != 0) {
+      ustrzcpy(allegro_error, ALLEGRO_ERROR_SIZE, get_config_text("Can not create thread"));
+      _midi_set_clock(FALSE);
+      _mixer_exit();
+      _AL_FREE(wav_bufdata);
+      wav_bufdata = NULL;
+      fclose(wav_file);
+      return -1;
+   }
+
+   uszprintf(wav_desc, sizeof(wav_desc), get_config_text("%s: %d bits, %s, %d bps, %s"),
+	     name, wav_bits,
+	     uconvert_ascii((wav_bits == 16 ? "signed" : "unsigned"), tmp1), wav_rate,
+	     uconvert_ascii((wav_stereo ? "stereo" : "mono"), tmp2));
+
+   digi_driver->desc = wav_desc;
+
+   return 0;
+}
+
+
+
+/* wav_exit:
+ *  Stops the rendering thread, and completes the file.
+ */
+static void wav_exit(int input)
+{
+   if (input)
+      return;
+
+   wav_quit = TRUE;
+   pthread_join(wav_thread, NULL);
+
+   _midi_set_clock(FALSE);
+
+   if (!wav_raw)
+      wav_write_header(wav_written);
+
+   fclose(wav_file);
+   wav_file = NULL;
+
+   _AL_FREE(wav_bufdata);
+   wav_bufdata = NULL;
+
+   _mixer_exit();
+}
+
+
+
+/* wav_set_mixer_volume:
+ *  There is no hardware mixer to set.
+ */
+static int wav_set_mixer_volume(int volume)
+{
+   return 0;
+}
+
+
+
+#endif
@@ -56,6 +56,9 @@ static int tim_win32_high_perf_init(void);
 static int tim_win32_low_perf_init(void);
 static void tim_win32_exit(void);
 static void tim_win32_rest(unsigned int time, AL_METHOD(void, callback, (void)));
+static unsigned long tim_win32_high_perf_read_usec(void);
+static unsigned long tim_win32_low_perf_read_usec(void);
+static void tim_win32_rest_usec(unsigned long usecs);
 
 
 static TIMER_DRIVER timer_win32_high_perf =
@@ -67,7 +70,9 @@ static TIMER_DRIVER timer_win32_high_perf =
    tim_win32_high_perf_init,
    tim_win32_exit,
    NULL, NULL, NULL, NULL, NULL, NULL,
-   tim_win32_rest
+   tim_win32_rest,
+   tim_win32_high_perf_read_usec,
+   tim_win32_rest_usec
 };
 
 
@@ -80,7 +85,9 @@ static TIMER_DRIVER timer_win32_low_perf =
    tim_win32_low_perf_init,
    tim_win32_exit,
    NULL, NULL, NULL, NULL, NULL, NULL,
-   tim_win32_rest
+   tim_win32_rest,
+   tim_win32_low_perf_read_usec,
+   tim_win32_rest_usec
 };
 
 
@@ -274,3 +281,42 @@ static void tim_win32_rest(unsigned int time, AL_METHOD(void, callback, (void)))
       Sleep(ms);
    }
 }
+
+
+
+/* tim_win32_high_perf_read_usec:
+ *  Reads the performance counter as a wrapping microsecond count.
+ */
+static unsigned long tim_win32_high_perf_read_usec(void)
+{
+   LARGE_INTEGER counter;
+
+   QueryPerformanceCounter(&counter);
+
+   /* whole seconds first, so that the multiplication can't overflow */
+   return (unsigned long)((counter.QuadPart / counter_freq.QuadPart) * 1000000 +
+			  (counter.QuadPart % counter_freq.QuadPart) * 1000000 / counter_freq.QuadPart);
+}
+
+
+
+/* tim_win32_low_perf_read_usec:
+ *  Reads the multimedia timer as a wrapping microsecond count.
+ */
+static unsigned long tim_win32_low_perf_read_usec(void)
+{
+   return (unsigned long)timeGetTime() * 1000;
+}
+
+
+
+/* tim_win32_rest_usec:
+ *  Sleeps for about the specified number of microseconds, asking for the
+ *  finest scheduler granularity while doing so.
+ */
+static void tim_win32_rest_usec(unsigned long usecs)
+{
+   timeBeginPeriod(1);
+   Sleep(usecs / 1000);
+   timeEndPeriod(1);
+}
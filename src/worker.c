@@ -0,0 +1,241 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Worker thread pool, used to spread CPU heavy drawing work such as
+ *      the binned polygon renderer over several processors.
+ *
+ *      The pool is started the first time it is needed. The number of
+ *      threads defaults to the number of online CPUs, and can be set with
+ *      the worker_threads variable in the [system] section of the config
+ *      file. Platforms without pthreads run every job on the calling
+ *      thread.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+
+#include "allegro.h"
+#include "allegro/internal/aintern.h"
+
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+   #include <pthread.h>
+   #include <unistd.h>
+#endif
+
+
+#define MAX_WORKERS     64
+
+
+static int worker_count = 0;            /* 0 until the pool is set up */
+
+
+
+#ifdef ALLEGRO_HAVE_LIBPTHREAD
+
+static pthread_t worker_thread[MAX_WORKERS];
+static int worker_threads = 0;          /* threads actually started */
+
+static pthread_mutex_t run_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+
+static void (*job_proc)(void *arg, int job, int worker);
+static void *job_arg;
+static int job_count;
+static int job_next;
+static int job_generation = 0;
+static int job_busy = 0;
+static int job_quit = FALSE;
+
+
+
+/* run_jobs:
+ *  Keeps taking jobs off the current batch until there are none left.
+ */
+static void run_jobs(int worker)
+{
+   int job;
+
+   for (;;) {
+      pthread_mutex_lock(&job_mutex);
+      job = job_next++;
+      pthread_mutex_unlock(&job_mutex);
+
+      if (job >= job_count)
+	 break;
+
+      job_proc(job_arg, job, worker);
+   }
+}
+
+
+
+/* worker_proc:
+ *  Thread function: waits for a batch of jobs, helps running it, and
+ *  goes back to sleep.
+ */
+static void *worker_proc(void *arg)
+{
+   int worker = (int)(intptr_t)arg;
+   int seen = 0;
+
+   pthread_mutex_lock(&job_mutex);
+
+   for (;;) {
+      while ((job_generation == seen) && (!job_quit))
+	 pthread_cond_wait(&job_start, &job_mutex);
+
+      if (job_quit)
+	 break;
+
+      seen = job_generation;
+      pthread_mutex_unlock(&job_mutex);
+
+      run_jobs(worker);
+
+      pthread_mutex_lock(&job_mutex);
+      if (--job_busy == 0)
+	 pthread_cond_signal(&job_done);
+   }
+
+   pthread_mutex_unlock(&job_mutex);
+
+   return NULL;
+}
+
+
+
+/* shutdown_workers:
+ *  Stops the worker threads at exit.
+ */
+static void shutdown_workers(void)
+{
+   int i;
+
+   pthread_mutex_lock(&job_mutex);
+   job_quit = TRUE;
+   pthread_cond_broadcast(&job_start);
+   pthread_mutex_unlock(&job_mutex);
+
+   for (i=0; i<worker_threads; i++)
+      pthread_join(worker_thread[i], NULL);
+
+   worker_threads = 0;
+   worker_count = 0;
+   job_generation = 0;
+   job_quit = FALSE;
+
+   _remove_exit_func(shutdown_workers);
+}
+
+#endif
+
+
+
+/* _get_worker_count:
+ *  Returns how many threads _run_worker_jobs() spreads its jobs over,
+ *  including the calling thread. Starts the pool if needed.
+ */
+int _get_worker_count(void)
+{
+   char tmp1[64], tmp2[64];
+   int n;
+
+   if (worker_count)
+      return worker_count;
+
+   n = get_config_int(uconvert_ascii("system", tmp1), uconvert_ascii("worker_threads", tmp2), 0);
+
+   #ifdef ALLEGRO_HAVE_LIBPTHREAD
+
+      if (n <= 0) {
+	 #ifdef _SC_NPROCESSORS_ONLN
+	    n = sysconf(_SC_NPROCESSORS_ONLN);
+	 #else
+	    n = 1;
+	 #endif
+      }
+
+      n = MID(1, n, MAX_WORKERS);
+
+      pthread_mutex_lock(&run_mutex);
+
+      if (!worker_count) {
+	 while (worker_threads < n-1) {
+	    if (pthread_create(&worker_thread[worker_threads], NULL, worker_proc,
+			       (void *)(intptr_t)(worker_threads+1)) != 0)
+	       break;
+	    worker_threads++;
+	 }
+
+	 if (worker_threads > 0)
+	    _add_exit_func(shutdown_workers, "shutdown_workers");
+
+	 worker_count = worker_threads+1;
+      }
+
+      pthread_mutex_unlock(&run_mutex);
+
+   #else
+
+      (void)n;
+      worker_count = 1;
+
+   #endif
+
+   return worker_count;
+}
+
+
+
+/* _run_worker_jobs:
+ *  Calls proc(arg, job, worker) for every job from 0 to count-1, and
+ *  returns once they have all finished. The jobs run in no particular
+ *  order, spread over the worker threads and the calling thread; worker
+ *  is the index of the thread running the job, below _get_worker_count(),
+ *  so it can be used to pick per thread scratch memory. Batches from
+ *  different threads are run one after the other.
+ */
+void _run_worker_jobs(void (*proc)(void *arg, int job, int worker), void *arg, int count)
+{
+   int i;
+
+   if ((_get_worker_count() <= 1) || (count <= 1)) {
+      for (i=0; i<count; i++)
+	 proc(arg, i, 0);
+      return;
+   }
+
+   #ifdef ALLEGRO_HAVE_LIBPTHREAD
+
+      pthread_mutex_lock(&run_mutex);
+
+      pthread_mutex_lock(&job_mutex);
+      job_proc = proc;
+      job_arg = arg;
+      job_count = count;
+      job_next = 0;
+      job_busy = worker_threads;
+      job_generation++;
+      pthread_cond_broadcast(&job_start);
+      pthread_mutex_unlock(&job_mutex);
+
+      run_jobs(0);
+
+      pthread_mutex_lock(&job_mutex);
+      while (job_busy > 0)
+	 pthread_cond_wait(&job_done, &job_mutex);
+      pthread_mutex_unlock(&job_mutex);
+
+      pthread_mutex_unlock(&run_mutex);
+
+   #endif
+}
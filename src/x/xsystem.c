@@ -214,7 +214,8 @@ static int _xwin_sysdrv_init(void)
    /* Open the display, create a window, and background-process 
     * events for it all. */
    if (_xwin_open_display(0) || _xwin_create_window()
-       || _unix_bg_man->register_func(_xwin_bg_handler))
+       || _unix_bg_man->register_func_ex(_xwin_bg_handler, BG_DEFAULT_PERIOD,
+					 ConnectionNumber(_xwin.display), BG_FUNC_READ))
    {
       _xwin_sysdrv_exit();
       return -1;
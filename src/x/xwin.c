@@ -26,6 +26,7 @@
 #include "xwin.h"
 
 #include <string.h>
+#include <sys/time.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/cursorfont.h>
@@ -157,6 +158,28 @@ int _xwin_in_gfx_call = 0;
 
 static COLORCONV_BLITTER_FUNC *blitter_func = NULL;
 static int use_bgr_palette_hack = FALSE; /* use BGR hack for color conversion palette? */
+static int threaded_colorconv = FALSE;   /* split conversions over the worker threads? */
+
+#ifdef ALLEGRO_XWINDOWS_WITH_SHM
+/* Asynchronous present: updates are converted into whichever of two
+ * shared memory XImages the X-server is not reading from, and the
+ * ShmCompletion events tell us when it is done with an image.
+ */
+typedef struct PRESENT_RECT
+{
+   int x1, y1, x2, y2;                  /* empty if x1 >= x2 */
+} PRESENT_RECT;
+
+static int async_present = FALSE;
+static int present_completion = 0;      /* ShmCompletion event type */
+static XImage *present_image[2];
+static unsigned char **present_line[2];
+static XShmSegmentInfo present_shminfo; /* segment of the second image */
+static int present_current = 0;         /* image in _xwin.ximage */
+static int present_busy[2];             /* puts not completed yet */
+static PRESENT_RECT present_stale[2];   /* area an image is missing */
+static PRESENT_RECT present_pending;    /* updates not presented yet */
+#endif
 
 #ifndef ALLEGRO_MULTITHREADED
 int _xwin_missed_input;
@@ -164,6 +187,7 @@ int _xwin_missed_input;
 
 #define X_MAX_EVENTS   5
 #define MOUSE_WARP_DELAY   200
+#define MOUSE_WARP_TICK    10000   /* usecs per unit of MOUSE_WARP_DELAY */
 
 static char _xwin_driver_desc[256] = EMPTY_STRING;
 
@@ -175,6 +199,11 @@ static Atom wm_delete_window;
 #define PREFIX_E                "al-xwin ERROR: "
 
 
+/* Updates smaller than this are converted on the calling thread.  */
+#define COLORCONV_THREAD_MIN_PIXELS   (128 * 128)
+#define COLORCONV_BAND_MIN_LINES      16
+
+
 /* Forward declarations for private functions.  */
 static int _xwin_private_open_display(char *name);
 static int _xwin_private_create_window(void);
@@ -193,6 +222,8 @@ static void _xwin_private_create_mapping(unsigned long *map, int ssize, int dsiz
 static int _xwin_private_display_is_local(void);
 static int _xwin_private_create_ximage(int w, int h);
 static void _xwin_private_destroy_ximage(void);
+static void _xwin_private_setup_async_present(void);
+static void _xwin_private_shutdown_async_present(void);
 static void _xwin_private_prepare_visual(void);
 static int _xwin_private_matching_formats(void);
 static void _xwin_private_hack_shifts(void);
@@ -214,6 +245,7 @@ static void _xwin_private_set_window_name(AL_CONST char *name, AL_CONST char *gr
 static int _xwin_private_get_pointer_mapping(unsigned char map[], int nmap);
 
 static void _xwin_private_fast_colorconv(int sx, int sy, int sw, int sh);
+static void _xwin_private_screen_to_buffer(int sx, int sy, int sw, int sh);
 
 static void _xwin_private_fast_truecolor_8_to_8(int sx, int sy, int sw, int sh);
 static void _xwin_private_fast_truecolor_8_to_16(int sx, int sy, int sw, int sh);
@@ -631,12 +663,25 @@ static _XWIN_SCREEN_TO_BUFFER _xwin_screen_to_buffer_function[5][10] =
  */
 static void _xwin_private_select_screen_to_buffer_function(void)
 {
+   AL_CONST char *tc;
+   char tmp1[64], tmp2[64];
    int i, j;
 
    if (_xwin.matching_formats) {
       _xwin.screen_to_buffer = 0;
    }
    else {
+      /* The fast converters only write to memory, so they can be run in
+       * bands on the worker threads. The slow ones go through XPutPixel.
+       */
+      tc = get_config_string(uconvert_ascii("graphics", tmp1),
+			     uconvert_ascii("threaded_colorconv", tmp2),
+			     NULL);
+      if ((tc) && ((i = ugetc(tc)) != 0) && ((i == 'n') || (i == 'N') || (i == '0')))
+	 threaded_colorconv = FALSE;
+      else
+	 threaded_colorconv = (_xwin.fast_visual_depth != 0);
+
       switch (_xwin.screen_depth) {
 	 case 8: i = 0; break;
 	 case 15: i = 1; break;
@@ -900,6 +945,8 @@ BITMAP *_xwin_create_screen(GFX_DRIVER *drv, int w, int h,
  */
 static void _xwin_private_destroy_screen(void)
 {
+   _xwin_private_shutdown_async_present();
+
    if (_xwin.buffer_line != 0) {
       _AL_FREE(_xwin.buffer_line);
       _xwin.buffer_line = 0;
@@ -1023,6 +1070,9 @@ static BITMAP *_xwin_private_create_screen_bitmap(GFX_DRIVER *drv,
 	 _xwin.buffer_line[line] = _xwin.buffer_line[line - 1] + bytes_per_buffer_line;
    }
 
+   /* Use a second frame buffer for asynchronous updates if requested.  */
+   _xwin_private_setup_async_present();
+
    /* Create bitmap.  */
    bmp = _make_bitmap(_xwin.virtual_width, _xwin.virtual_height,
 		      (uintptr_t) (_xwin.screen_line[0]), drv,
@@ -1146,6 +1196,59 @@ static int _xwin_private_display_is_local(void)
 
 
 
+#ifdef ALLEGRO_XWINDOWS_WITH_SHM
+/* _xwin_create_shm_ximage:
+ *  Create shared memory XImage, attached to the X-server.
+ */
+static XImage *_xwin_private_create_shm_ximage(int w, int h, XShmSegmentInfo *shminfo)
+{
+   XImage *image;
+
+   image = XShmCreateImage(_xwin.display, _xwin.visual, _xwin.window_depth,
+			   ZPixmap, 0, shminfo, w, h);
+   if (image == 0)
+      return 0;
+
+   /* Create shared memory segment.  */
+   shminfo->shmid = shmget(IPC_PRIVATE, image->bytes_per_line * image->height,
+			   IPC_CREAT | 0777);
+   if (shminfo->shmid != -1) {
+      /* Attach shared memory to our address space.  */
+      shminfo->shmaddr = image->data = shmat(shminfo->shmid, 0, 0);
+      if (shminfo->shmaddr != (char*) -1) {
+	 shminfo->readOnly = True;
+
+	 /* Attach shared memory to the X-server address space.  */
+	 if (XShmAttach(_xwin.display, shminfo)) {
+	    XSync(_xwin.display, False);
+	    return image;
+	 }
+
+	 shmdt(shminfo->shmaddr);
+      }
+      shmctl(shminfo->shmid, IPC_RMID, 0);
+   }
+
+   XDestroyImage(image);
+   return 0;
+}
+
+
+
+/* _xwin_destroy_shm_ximage:
+ *  Destroy shared memory XImage.
+ */
+static void _xwin_private_destroy_shm_ximage(XImage *image, XShmSegmentInfo *shminfo)
+{
+   XShmDetach(_xwin.display, shminfo);
+   shmdt(shminfo->shmaddr);
+   shmctl(shminfo->shmid, IPC_RMID, 0);
+   XDestroyImage(image);
+}
+#endif
+
+
+
 /* _xwin_create_ximage:
  *  Create XImage for accessing window.
  */
@@ -1168,34 +1271,9 @@ static int _xwin_private_create_ximage(int w, int h)
 #ifdef ALLEGRO_XWINDOWS_WITH_SHM
    if (_xwin.use_shm) {
       /* Try to create shared memory XImage.  */
-      image = XShmCreateImage(_xwin.display, _xwin.visual, _xwin.window_depth,
-			      ZPixmap, 0, &_xwin.shminfo, w, h);
-      do {
-	 if (image != 0) {
-	    /* Create shared memory segment.  */
-	    _xwin.shminfo.shmid = shmget(IPC_PRIVATE, image->bytes_per_line * image->height,
-					 IPC_CREAT | 0777);
-	    if (_xwin.shminfo.shmid != -1) {
-	       /* Attach shared memory to our address space.  */
-	       _xwin.shminfo.shmaddr = image->data = shmat(_xwin.shminfo.shmid, 0, 0);
-	       if (_xwin.shminfo.shmaddr != (char*) -1) {
-		  _xwin.shminfo.readOnly = True;
-
-		  /* Attach shared memory to the X-server address space.  */
-		  if (XShmAttach(_xwin.display, &_xwin.shminfo)) {
-		     XSync(_xwin.display, False);
-		     break;
-		   }
-
-		  shmdt(_xwin.shminfo.shmaddr);
-	       }
-	       shmctl(_xwin.shminfo.shmid, IPC_RMID, 0);
-	    }
-	    XDestroyImage(image);
-	    image = 0;
-	 }
+      image = _xwin_private_create_shm_ximage(w, h, &_xwin.shminfo);
+      if (image == 0)
 	 _xwin.use_shm = 0;
-      } while (0);
    }
 #endif
 
@@ -1236,19 +1314,204 @@ static void _xwin_private_destroy_ximage(void)
 {
    if (_xwin.ximage != 0) {
 #ifdef ALLEGRO_XWINDOWS_WITH_SHM
-      if (_xwin.use_shm) {
-	 XShmDetach(_xwin.display, &_xwin.shminfo);
-	 shmdt(_xwin.shminfo.shmaddr);
-	 shmctl(_xwin.shminfo.shmid, IPC_RMID, 0);
-      }
+      if (_xwin.use_shm)
+	 _xwin_private_destroy_shm_ximage(_xwin.ximage, &_xwin.shminfo);
+      else
 #endif
-      XDestroyImage(_xwin.ximage);
+	 XDestroyImage(_xwin.ximage);
       _xwin.ximage = 0;
    }
 }
 
 
 
+/* _xwin_setup_async_present:
+ *  Create the second XImage for asynchronous present, if requested in the
+ *  config file. Only used when the screen is converted to the frame buffer,
+ *  since with matching formats the frame buffer is the screen bitmap.
+ */
+static void _xwin_private_setup_async_present(void)
+{
+#ifdef ALLEGRO_XWINDOWS_WITH_SHM
+   AL_CONST char *ap;
+   char tmp1[64], tmp2[64];
+   XImage *image;
+   int line, c;
+
+   async_present = FALSE;
+
+   if ((!_xwin.use_shm) || (_xwin.matching_formats) || (_xwin.ximage == 0))
+      return;
+
+   ap = get_config_string(uconvert_ascii("graphics", tmp1),
+			  uconvert_ascii("async_present", tmp2),
+			  NULL);
+   if ((!ap) || ((c = ugetc(ap)) == 0) || ((c != 'y') && (c != 'Y') && (c != '1')))
+      return;
+
+   image = _xwin_private_create_shm_ximage(_xwin.ximage->width, _xwin.ximage->height,
+					   &present_shminfo);
+   if (image == 0)
+      return;
+
+   /* Line accelerators for the second frame buffer.  */
+   if (_xwin.buffer_line != 0) {
+      present_line[1] = _AL_MALLOC(_xwin.virtual_height * sizeof(unsigned char*));
+      if (present_line[1] == 0) {
+	 _xwin_private_destroy_shm_ximage(image, &present_shminfo);
+	 return;
+      }
+
+      present_line[1][0] = (unsigned char *)image->data + image->xoffset;
+      for (line = 1; line < _xwin.virtual_height; line++)
+	 present_line[1][line] = present_line[1][line - 1] + image->bytes_per_line;
+   }
+   else
+      present_line[1] = 0;
+
+   present_image[0] = _xwin.ximage;
+   present_image[1] = image;
+   present_line[0] = _xwin.buffer_line;
+   present_current = 0;
+   present_busy[0] = present_busy[1] = 0;
+
+   /* The second image has to be converted completely before its first use.  */
+   present_stale[0].x1 = present_stale[0].x2 = 0;
+   present_stale[1].x1 = 0;
+   present_stale[1].y1 = 0;
+   present_stale[1].x2 = _xwin.virtual_width;
+   present_stale[1].y2 = _xwin.virtual_height;
+   present_pending.x1 = present_pending.x2 = 0;
+
+   present_completion = XShmGetEventBase(_xwin.display) + ShmCompletion;
+   async_present = TRUE;
+#endif
+}
+
+
+
+/* _xwin_shutdown_async_present:
+ *  Destroy the second XImage, once the X-server has finished reading it.
+ */
+static void _xwin_private_shutdown_async_present(void)
+{
+#ifdef ALLEGRO_XWINDOWS_WITH_SHM
+   if (!async_present)
+      return;
+
+   XSync(_xwin.display, False);
+
+   _xwin.ximage = present_image[0];
+   _xwin.buffer_line = present_line[0];
+
+   if (present_line[1] != 0) {
+      _AL_FREE(present_line[1]);
+      present_line[1] = 0;
+   }
+
+   _xwin_private_destroy_shm_ximage(present_image[1], &present_shminfo);
+   present_image[1] = 0;
+
+   async_present = FALSE;
+#endif
+}
+
+
+
+#ifdef ALLEGRO_XWINDOWS_WITH_SHM
+/* _xwin_add_present_rect:
+ *  Grow rectangle to include an area.
+ */
+static void _xwin_private_add_present_rect(PRESENT_RECT *r, int x1, int y1, int x2, int y2)
+{
+   if (r->x1 >= r->x2) {
+      r->x1 = x1;
+      r->y1 = y1;
+      r->x2 = x2;
+      r->y2 = y2;
+   }
+   else {
+      r->x1 = MIN(r->x1, x1);
+      r->y1 = MIN(r->y1, y1);
+      r->x2 = MAX(r->x2, x2);
+      r->y2 = MAX(r->y2, y2);
+   }
+}
+
+
+
+/* _xwin_present_completed:
+ *  The X-server has finished reading one of the images.
+ */
+static void _xwin_private_present_completed(XShmCompletionEvent *event)
+{
+   int i;
+
+   if (event->shmseg == _xwin.shminfo.shmseg)
+      i = 0;
+   else if (event->shmseg == present_shminfo.shmseg)
+      i = 1;
+   else
+      return;
+
+   if (present_busy[i] > 0)
+      present_busy[i]--;
+}
+
+
+
+/* _xwin_present_pending:
+ *  Convert pending updates into an image the X-server is not reading from
+ *  and send them to the window. If both images are still busy, the updates
+ *  are left pending until a completion event arrives.
+ */
+static void _xwin_private_present_pending(void)
+{
+   XEvent event;
+   PRESENT_RECT *r;
+   int i, x, y, w, h;
+
+   if (present_pending.x1 >= present_pending.x2)
+      return;
+
+   /* Collect completion events without waiting for more.  */
+   while (XCheckTypedEvent(_xwin.display, present_completion, &event))
+      _xwin_private_present_completed((XShmCompletionEvent *)&event);
+
+   i = present_current;
+   if (present_busy[i]) {
+      i = 1 - i;
+      if (present_busy[i])
+	 return;
+   }
+
+   _xwin.ximage = present_image[i];
+   _xwin.buffer_line = present_line[i];
+   present_current = i;
+
+   /* Catch up with what was presented from the other image.  */
+   r = &present_stale[i];
+   if (r->x1 < r->x2) {
+      _xwin_private_screen_to_buffer(r->x1, r->y1, r->x2 - r->x1, r->y2 - r->y1);
+      r->x1 = r->x2 = 0;
+   }
+
+   r = &present_pending;
+   x = r->x1;
+   y = r->y1;
+   w = r->x2 - r->x1;
+   h = r->y2 - r->y1;
+   r->x1 = r->x2 = 0;
+
+   _xwin_private_screen_to_buffer(x, y, w, h);
+   _xwin_private_add_present_rect(&present_stale[1 - i], x, y, x + w, y + h);
+
+   (*_xwin_window_redrawer)(x - _xwin.scroll_x, y - _xwin.scroll_y, w, h);
+}
+#endif
+
+
+
 /* _xwin_prepare_visual:
  *  Prepare visual for further use.
  */
@@ -2302,6 +2565,14 @@ static void _xwin_private_process_event(XEvent *event)
    static int mouse_warp_now = 0;
    static int mouse_was_warped = 0;
 
+#ifdef ALLEGRO_XWINDOWS_WITH_SHM
+   if ((async_present) && (event->type == present_completion)) {
+      _xwin_private_present_completed((XShmCompletionEvent *)event);
+      _xwin_private_present_pending();
+      return;
+   }
+#endif
+
    switch (event->type) {
       case KeyPress:
          _xwin_keyboard_handler(&event->xkey, FALSE);
@@ -2433,6 +2704,30 @@ static void _xwin_private_process_event(XEvent *event)
 
 
 
+/* _xwin_mouse_warp_tick:
+ *  Returns TRUE once per MOUSE_WARP_TICK. The input handler runs whenever
+ *  the X connection has data, so its calls can't be used as a clock.
+ */
+static int _xwin_mouse_warp_tick(void)
+{
+   static struct timeval last;
+   struct timeval now;
+   long elapsed;
+
+   gettimeofday(&now, NULL);
+
+   if (now.tv_sec - last.tv_sec < 2) {
+      elapsed = (now.tv_sec - last.tv_sec) * 1000000L + (now.tv_usec - last.tv_usec);
+      if ((elapsed >= 0) && (elapsed < MOUSE_WARP_TICK))
+	 return FALSE;
+   }
+
+   last = now;
+   return TRUE;
+}
+
+
+
 /* _xwin_handle_input:
  *  Handle events from the queue.
  */
@@ -2445,7 +2740,8 @@ void _xwin_private_handle_input(void)
       return;
 
    /* Switch mouse to non-warped mode if mickeys were not used recently (~2 seconds).  */
-   if (_xwin.mouse_warped && (_xwin.mouse_warped++ > MOUSE_WARP_DELAY)) {
+   if (_xwin.mouse_warped && _xwin_mouse_warp_tick()
+       && (_xwin.mouse_warped++ > MOUSE_WARP_DELAY)) {
       _xwin.mouse_warped = 0;
       /* Move X-cursor to Allegro cursor.  */
       XWarpPointer(_xwin.display, _xwin.window, _xwin.window,
@@ -2454,11 +2750,23 @@ void _xwin_private_handle_input(void)
 		   _mouse_y - (_xwin_mouse_extended_range ? _xwin.scroll_y : 0));
    }
 
-   /* Flush X-buffers.  */
-   _xwin_private_flush_buffers();
+#ifdef ALLEGRO_XWINDOWS_WITH_SHM
+   if (async_present) {
+      /* Send updates left pending, and read the events without waiting for
+       * the X-server to finish drawing.
+       */
+      _xwin_private_present_pending();
+      events = events_queued = XEventsQueued(_xwin.display, QueuedAfterFlush);
+   }
+   else
+#endif
+   {
+      /* Flush X-buffers.  */
+      _xwin_private_flush_buffers();
 
-   /* How much events are available in the queue.  */
-   events = events_queued = XEventsQueued(_xwin.display, QueuedAlready);
+      /* How much events are available in the queue.  */
+      events = events_queued = XEventsQueued(_xwin.display, QueuedAlready);
+   }
    if (events <= 0)
       return;
 
@@ -2572,7 +2880,13 @@ static void _xwin_private_redraw_window(int x, int y, int w, int h)
       XFillRectangle(_xwin.display, _xwin.window, _xwin.gc, x, y, w, h);
    else {
 #ifdef ALLEGRO_XWINDOWS_WITH_SHM
-      if (_xwin.use_shm)
+      if (async_present) {
+	 /* The completion event tells when the image can be written again.  */
+	 XShmPutImage(_xwin.display, _xwin.window, _xwin.gc, _xwin.ximage,
+		      x + _xwin.scroll_x, y + _xwin.scroll_y, x, y, w, h, True);
+	 present_busy[present_current]++;
+      }
+      else if (_xwin.use_shm)
 	 XShmPutImage(_xwin.display, _xwin.window, _xwin.gc, _xwin.ximage,
 		      x + _xwin.scroll_x, y + _xwin.scroll_y, x, y, w, h, False);
       else
@@ -2627,6 +2941,58 @@ int _xwin_scroll_screen(int x, int y)
 
 
 
+/* Band of lines converted by one worker job.  */
+typedef struct COLORCONV_BANDS
+{
+   int x, y, w, h;
+   int count;
+} COLORCONV_BANDS;
+
+
+
+/* _xwin_private_convert_band:
+ *  Worker job converting one band of the screen to the frame buffer.
+ */
+static void _xwin_private_convert_band(void *arg, int job, int worker)
+{
+   COLORCONV_BANDS *bands = arg;
+   int y1 = bands->y + (bands->h * job) / bands->count;
+   int y2 = bands->y + (bands->h * (job + 1)) / bands->count;
+
+   (*(_xwin.screen_to_buffer))(bands->x, y1, bands->w, y2 - y1);
+}
+
+
+
+/* _xwin_private_screen_to_buffer:
+ *  Converts an area of the screen to the frame buffer, splitting big
+ *  areas into bands of lines handled by the worker threads.
+ */
+static void _xwin_private_screen_to_buffer(int sx, int sy, int sw, int sh)
+{
+   COLORCONV_BANDS bands;
+   int count;
+
+   if ((threaded_colorconv) && (sw * sh >= COLORCONV_THREAD_MIN_PIXELS)
+       && (_get_worker_count() > 1)) {
+      count = MIN(_get_worker_count() * 2, sh / COLORCONV_BAND_MIN_LINES);
+
+      if (count > 1) {
+	 bands.x = sx;
+	 bands.y = sy;
+	 bands.w = sw;
+	 bands.h = sh;
+	 bands.count = count;
+	 _run_worker_jobs(_xwin_private_convert_band, &bands, count);
+	 return;
+      }
+   }
+
+   (*(_xwin.screen_to_buffer))(sx, sy, sw, sh);
+}
+
+
+
 /* _xwin_update_screen:
  *  Update part of the screen.
  */
@@ -2657,7 +3023,15 @@ static void _xwin_private_update_screen(int x, int y, int w, int h)
       if (h <= 0)
 	 return;
 
-      (*(_xwin.screen_to_buffer))(x, y, w, h);
+#ifdef ALLEGRO_XWINDOWS_WITH_SHM
+      if (async_present) {
+	 _xwin_private_add_present_rect(&present_pending, x, y, x + w, y + h);
+	 _xwin_private_present_pending();
+	 return;
+      }
+#endif
+
+      _xwin_private_screen_to_buffer(x, y, w, h);
    }
 
    /* Update window.  */
@@ -2734,6 +3108,30 @@ void xwin_set_window_name(AL_CONST char *name, AL_CONST char *group)
 
 
 
+/* xwin_get_frames_in_flight:
+ *  Returns how many screen updates the X-server has not finished reading
+ *  yet, when asynchronous present is enabled.
+ */
+int xwin_get_frames_in_flight(void)
+{
+   int count = 0;
+#ifdef ALLEGRO_XWINDOWS_WITH_SHM
+   XEvent event;
+
+   XLOCK();
+   if (async_present) {
+      while (XCheckTypedEvent(_xwin.display, present_completion, &event))
+	 _xwin_private_present_completed((XShmCompletionEvent *)&event);
+      count = present_busy[0] + present_busy[1];
+   }
+   XUNLOCK();
+#endif
+
+   return count;
+}
+
+
+
 /* _xwin_get_pointer_mapping:
  *  Wrapper for XGetPointerMapping.
  */
@@ -23,6 +23,36 @@
 
 
 
+/* the 'b' key makes the next MIDI event fire this many voice calls, more
+ * than the mixer can queue up, from wherever the driver runs the player
+ */
+#define BURST_CALLS     4096
+
+SAMPLE *burst_sample = NULL;
+volatile int burst_voice = -1;
+volatile int burst_done = FALSE;
+
+
+
+void burst_callback(int msg, int byte1, int byte2)
+{
+   int voice = burst_voice;
+   int i;
+
+   if (voice < 0)
+      return;
+
+   burst_voice = -1;
+
+   for (i=0; i<BURST_CALLS; i++)
+      voice_set_volume(voice, i & 0xFF);
+
+   deallocate_voice(voice);
+   burst_done = TRUE;
+}
+
+
+
 void format_id(char *buf, int n, int driver_id, AL_CONST char *name)
 {
    char tmp[8];
@@ -227,7 +257,8 @@ int main(int argc, char *argv[])
       i++;
    }
 
-   textprintf_centre_ex(screen, font, SCREEN_W/2, SCREEN_H-48, red, -1, "Press a number 1-9 to trigger a sample or midi file");
+   textprintf_centre_ex(screen, font, SCREEN_W/2, SCREEN_H-60, red, -1, "Press a number 1-9 to trigger a sample or midi file");
+   textprintf_centre_ex(screen, font, SCREEN_W/2, SCREEN_H-48, red, -1, "b fires a burst of voice calls from the MIDI player");
    textprintf_centre_ex(screen, font, SCREEN_W/2, SCREEN_H-36, red, -1, "v/V changes sfx volume, p/P changes sfx pan, and f/F changes sfx frequency");
    textprintf_centre_ex(screen, font, SCREEN_W/2, SCREEN_H-24, red, -1, "space pauses/resumes MIDI playback, and the arrow keys seek through the tune");
    textprintf_centre_ex(screen, font, SCREEN_W/2, SCREEN_H-12, red, -1, "Use the function keys to doodle a tune");
@@ -273,6 +304,19 @@ int main(int argc, char *argv[])
 	    freq += 8;
 	    break;
 
+	 case 'b':
+	    if (!burst_sample) {
+	       burst_sample = create_sample(8, FALSE, 11025, 1024);
+	       if (burst_sample)
+		  memset(burst_sample->data, 0x80, 1024);
+	    }
+	    if ((burst_sample) && (burst_voice < 0)) {
+	       burst_done = FALSE;
+	       burst_voice = allocate_voice(burst_sample);
+	       midi_msg_callback = burst_callback;
+	    }
+	    break;
+
 	 case '0':
 	    play_midi(NULL, FALSE);
 	    paused = FALSE;
@@ -351,6 +395,11 @@ int main(int argc, char *argv[])
       sprintf(buf, "        midi pos: %ld    vol: %d    pan: %d    freq: %d        ", midi_pos, vol, pan, freq);
       textout_centre_ex(screen, font, buf, SCREEN_W/2, SCREEN_H-120, black, white);
 
+      if (burst_done) {
+	 textout_centre_ex(screen, font, "Burst of voice calls done", SCREEN_W/2, SCREEN_H-96, green, white);
+	 burst_done = FALSE;
+      }
+
       do {
       } while ((!keypressed()) && (midi_pos == old_midi_pos));
 
@@ -361,6 +410,10 @@ int main(int argc, char *argv[])
 
    } while ((k & 0xFF) != 27);
 
+   midi_msg_callback = NULL;
+   if (burst_sample)
+      destroy_sample(burst_sample);
+
    for (i=0; i<item_count; i++) {
       if (!item[i])
 	 continue;
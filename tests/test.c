@@ -1833,7 +1833,8 @@ void rotate_test(void)
 
 void stretch_test(void)
 {
-   BITMAP *b;
+   BITMAP *b, *d;
+   int r[4];
    int c;
 
    set_clip_rect(screen, 0, 0, VIRTUAL_W-1, VIRTUAL_H-1);
@@ -1845,9 +1846,6 @@ void stretch_test(void)
    ct = 0;
    c = 1;
 
-   rect(screen, SCREEN_W/2-128, SCREEN_H/2-64, SCREEN_W/2+128, SCREEN_H/2+64, palette_color[15]);
-   set_clip_rect(screen, SCREEN_W/2-127, SCREEN_H/2-63, SCREEN_W/2+127, SCREEN_H/2+63);
-
    solid_mode();
    b = create_bitmap(32, 32);
    clear_to_color(b, palette_color[0]);
@@ -1857,6 +1855,22 @@ void stretch_test(void)
    line(b, 31, 0, 0, 31, palette_color[3]);
    textout_ex(b, font, "Test", 1, 12, palette_color[15], -1);
 
+   /* the source is tracked, to stretch from a dirty rectangle bitmap onto
+    * the screen, and stretching onto a tracked bitmap must mark it
+    */
+   enable_dirty_tracking(b);
+
+   d = create_bitmap(64, 64);
+   enable_dirty_tracking(d);
+   stretch_blit(b, d, 0, 0, 32, 32, 16, 16, 32, 32);
+   if ((get_dirty_rects(d, r, 1) != 1) || (r[0] > 16) || (r[1] > 16) ||
+       (r[0]+r[2] < 48) || (r[1]+r[3] < 48))
+      textout_centre_ex(screen, font, "Dirty rectangle missed by stretch_blit()", SCREEN_W/2, 20, palette_color[15], palette_color[0]);
+   destroy_bitmap(d);
+
+   rect(screen, SCREEN_W/2-128, SCREEN_H/2-64, SCREEN_W/2+128, SCREEN_H/2+64, palette_color[15]);
+   set_clip_rect(screen, SCREEN_W/2-127, SCREEN_H/2-63, SCREEN_W/2+127, SCREEN_H/2+63);
+
    while (!next()) {
       stretch_blit(b, screen, 0, 0, 32, 32, SCREEN_W/2-c, SCREEN_H/2-(256-c), c*2, (256-c)*2);
 
@@ -3951,7 +3965,7 @@ int toggle_sse_proc(void)
 {
    extern MENU mmx_menu[];
 
-   cpu_capabilities ^= CPU_SSE | CPU_SSE2;
+   cpu_capabilities ^= CPU_SSE | CPU_SSE2 | CPU_AVX2;
    cpu_capabilities &= cpu_has_capabilities;
 
    mmx_menu[0].flags = 0;
@@ -4067,7 +4081,7 @@ MENU mmx_menu[] =
    { "&Autodetect",              mmx_auto_proc,    NULL,    D_SELECTED,    NULL  },
    { "&Disable 3DNow!/Enh3DNow!", toggle_3dnow_proc,NULL,    0,             NULL  },
    { "&Disable MMX/MMX+",         toggle_mmx_proc,  NULL,    0,             NULL  },
-   { "&Disable SSE/SSE2",         toggle_sse_proc,  NULL,    0,             NULL  },
+   { "&Disable SSE/SSE2/AVX2",    toggle_sse_proc,  NULL,    0,             NULL  },
    { NULL,                       NULL,             NULL,    0,             NULL  }
 };
 
@@ -4574,6 +4588,9 @@ int main(void)
    if (cpu_capabilities & CPU_SSE3)
       strcat(cpu_specs, " / SSE3");
 
+   if (cpu_capabilities & CPU_AVX2)
+      strcat(cpu_specs, " / AVX2");
+
    if (cpu_capabilities & CPU_MMX)
       strcat(cpu_specs, " / MMX");
 
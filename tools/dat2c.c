@@ -1370,7 +1370,7 @@ static int cvt_SAMPLE(struct dat2c *dat2c, DATAFILE *dat, const char *name)
 	  spl->bits, spl->stereo, spl->freq,
 	  spl->len,
 	  spl->loop_start, spl->loop_end, spl->param,
-	  spl->len * (spl->bits / 8) * (spl->stereo ? 2 : 1), 4,
+	  _sample_data_size(spl->bits, spl->stereo, spl->len), 4,
 	  spl->data);
 
    return 0;
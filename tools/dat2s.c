@@ -172,7 +172,7 @@ static void output_sample(SAMPLE *spl, char *name)
    strcpy(buf, name);
    strcat(buf, "_data");
 
-   output_data(spl->data, spl->len * ((spl->bits==8) ? 1 : sizeof(short)) * ((spl->stereo) ? 2 : 1), buf, "waveform data", FALSE);
+   output_data(spl->data, _sample_data_size(spl->bits, spl->stereo, spl->len), buf, "waveform data", FALSE);
 
    fprintf(outfile, "# sample\n.globl " ALLEGRO_ASM_PREFIX "%s%s\n", prefix, name);
    fprintf(outfile, ".balign 4\n" ALLEGRO_ASM_PREFIX "%s%s:\n", prefix, name);
@@ -19,6 +19,7 @@
 #include <stdio.h>
 
 #include "allegro.h"
+#include "allegro/internal/aintern.h"
 #include "../datedit.h"
 
 
@@ -55,17 +56,23 @@ static void get_sample_desc(AL_CONST DATAFILE *dat, char *s)
    long sec = (sample->len + sample->freq/2) * 10 / MAX(sample->freq, 1);
    char *type = (sample->stereo) ? "stereo" : "mono";
 
-   sprintf(s, "sample (%d bit %s, %d, %ld.%ld sec)", sample->bits, type, sample->freq, sec/10, sec%10);
+   if (sample->bits == 4)
+      sprintf(s, "sample (ADPCM %s, %d, %ld.%ld sec)", type, sample->freq, sec/10, sec%10);
+   else
+      sprintf(s, "sample (%d bit %s, %d, %ld.%ld sec)", sample->bits, type, sample->freq, sec/10, sec%10);
 }
 
 
 
-/* exports a sample into an external file */
+/* exports a sample into an external file, ADPCM ones as 16 bit data */
 static int export_sample(AL_CONST DATAFILE *dat, AL_CONST char *filename)
 {
    SAMPLE *spl = (SAMPLE *)dat->dat;
-   int bps = spl->bits/8 * ((spl->stereo) ? 2 : 1);
+   int bits = (spl->bits == 4) ? 16 : spl->bits;
+   int bps = bits/8 * ((spl->stereo) ? 2 : 1);
    int len = spl->len * bps;
+   int channels = (spl->stereo) ? 2 : 1;
+   signed short pcm[ADPCM_BLOCK_FRAMES*2];
    int i;
    int16_t s;
    PACKFILE *f;
@@ -85,13 +92,22 @@ static int export_sample(AL_CONST DATAFILE *dat, AL_CONST char *filename)
       pack_iputl(spl->freq, f);              /* sample frequency */
       pack_iputl(spl->freq*bps, f);          /* avg. bytes per sec */
       pack_iputw(bps, f);                    /* block alignment */
-      pack_iputw(spl->bits, f);              /* bits per sample */
+      pack_iputw(bits, f);                   /* bits per sample */
       pack_fputs("data", f);                 /* data chunk */
       pack_iputl(len, f);                    /* actual data length */
 
       if (spl->bits == 8) {
 	 pack_fwrite(spl->data, len, f);     /* write the data */
       }
+      else if (spl->bits == 4) {
+	 for (i=0; i < (int)spl->len; i++) {
+	    if ((i & (ADPCM_BLOCK_FRAMES-1)) == 0)
+	       _adpcm_decode_block(pcm, (unsigned char *)spl->data + (i >> ADPCM_BLOCK_SHIFT) * ADPCM_CHANNEL_SIZE * channels, channels);
+	    pack_iputw(pcm[(i & (ADPCM_BLOCK_FRAMES-1)) * channels], f);
+	    if (channels == 2)
+	       pack_iputw(pcm[(i & (ADPCM_BLOCK_FRAMES-1)) * 2 + 1], f);
+	 }
+      }
       else {
 	 for (i=0; i < (int)spl->len * ((spl->stereo) ? 2 : 1); i++) {
 	    s = ((int16_t *)spl->data)[i];
@@ -128,6 +144,9 @@ static int save_sample_in_datafile(DATAFILE *dat, AL_CONST int *fixed_prop, int
    if (spl->bits == 8) {
       pack_fwrite(spl->data, spl->len * ((spl->stereo) ? 2 : 1), f);
    }
+   else if (spl->bits == 4) {
+      pack_fwrite(spl->data, _sample_data_size(4, spl->stereo, spl->len), f);
+   }
    else {
       int i;
 